@@ -0,0 +1,141 @@
+/**
+ * WISE_FWI_Module: fwi_allocation_counter.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Counts the program's heap allocations, for the benchmarks' --check-allocations: replaces the global operator new
+ * (and delete) with versions that count every allocation, in total and per thread, so a steady state can be shown
+ * not to allocate.  Include it in exactly one source file of a program.
+ *
+ * The replacements cover the library too where it shares the program's operator new, as a shared library does on
+ * Linux and macOS; a Windows DLL has its own, so there only the program's allocations are seen.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+
+static std::atomic<std::uint64_t> allocations_total(0);
+static thread_local std::uint64_t allocations_thread = 0;
+
+
+// every allocation made by the program so far
+static inline std::uint64_t allocation_count() {
+	return allocations_total.load(std::memory_order_relaxed);
+}
+
+
+// the calling thread's allocations so far
+static inline std::uint64_t thread_allocation_count() {
+	return allocations_thread;
+}
+
+
+static inline void *counted_allocation(std::size_t bytes, std::size_t alignment) {
+	allocations_total.fetch_add(1, std::memory_order_relaxed);
+	allocations_thread++;
+	if (!bytes)
+		bytes = 1;
+#if defined(_WIN32)
+	return _aligned_malloc(bytes, alignment);
+#else
+	void *p = nullptr;
+	return posix_memalign(&p, (alignment < sizeof(void *)) ? sizeof(void *) : alignment, bytes) ? nullptr : p;
+#endif
+}
+
+
+// kept out of line, so that the compiler doesn't pair a new it can see with this free
+#if defined(_MSC_VER)
+static __declspec(noinline) void counted_free(void *p) {
+#else
+static __attribute__((noinline)) void counted_free(void *p) {
+#endif
+#if defined(_WIN32)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+
+void *operator new(std::size_t bytes) {
+	void *p = counted_allocation(bytes, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+
+void *operator new(std::size_t bytes, std::align_val_t alignment) {
+	void *p = counted_allocation(bytes, (std::size_t)alignment);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+
+void *operator new(std::size_t bytes, const std::nothrow_t &) noexcept {
+	return counted_allocation(bytes, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+
+void *operator new(std::size_t bytes, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+	return counted_allocation(bytes, (std::size_t)alignment);
+}
+
+
+void *operator new[](std::size_t bytes) {
+	return operator new(bytes);
+}
+
+
+void *operator new[](std::size_t bytes, std::align_val_t alignment) {
+	return operator new(bytes, alignment);
+}
+
+
+void *operator new[](std::size_t bytes, const std::nothrow_t &tag) noexcept {
+	return operator new(bytes, tag);
+}
+
+
+void *operator new[](std::size_t bytes, std::align_val_t alignment, const std::nothrow_t &tag) noexcept {
+	return operator new(bytes, alignment, tag);
+}
+
+
+void operator delete(void *p) noexcept						{ counted_free(p); }
+void operator delete(void *p, std::size_t) noexcept				{ counted_free(p); }
+void operator delete(void *p, std::align_val_t) noexcept			{ counted_free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept		{ counted_free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept			{ counted_free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept	{ counted_free(p); }
+void operator delete[](void *p) noexcept					{ counted_free(p); }
+void operator delete[](void *p, std::size_t) noexcept				{ counted_free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept			{ counted_free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept		{ counted_free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept		{ counted_free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept	{ counted_free(p); }
@@ -0,0 +1,688 @@
+/**
+ * WISE_FWI_Module: fwi_grid_runner.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Runs a grid across several worker processes on one machine, each single threaded, with the tiles handed out
+ * dynamically through an FWIShardQueue.  The grid lives in named shared memory (or in files every worker maps), so
+ * each worker writes its tiles' codes straight into the shared outputs and nothing is copied or merged afterwards.
+ *
+ *   fwi_grid_runner [--processes N] [--threads N] [--numa] [--cells N] [--tile-cells N] [--days N] [--seed N]
+ *                   [--regime boreal|prairie|southern] [--hourly] [--season] [--mask PERCENT] [--equilibrium TOLERANCE] [--zones N [--percentiles]] [--classes FILE] [--budget MB] [--factors FILE] [--trace FILE [--trace-counters]] [--reproducible] [--verify] [--check-allocations]
+ *   fwi_grid_runner --files PREFIX --first-day N --days N [--processes N] [--threads N] [--numa] [--hourly] [--season] [--equilibrium TOLERANCE] [--zones N [--percentiles]] [--classes FILE] [--budget MB] [--factors FILE] [--trace FILE [--trace-counters]] [--reproducible]
+ *
+ * The first form generates a synthetic grid (see FWIWeatherGenerator) into shared memory and runs it, reporting
+ * cell-days per second and how many tiles each worker took.  --verify runs the grid again in this process alone and
+ * checks that the outputs are identical.  --season applies the season start and stop rules (see FWISeasonRules) with
+ * every cell starting the run dormant, and --mask leaves that percentage of the cells, picked at random, out of the
+ * run.  --equilibrium lets the hourly FFMC skip cells within that many percent moisture content of equilibrium (see
+ * FWIDownscaler::SetEquilibriumTolerance()).  --zones divides the cells into that many zones and, when the grid is run
+ * in this process, prints each zone's FWI summary for the last day (see FWIZonalSummary).  --classes writes the daily
+ * fire danger classes to FILE, run length encoded (see FWIClassRaster), when the grid is run in this process.
+ * --trace writes where the run spent its time to FILE as a Chrome trace (see FWITrace), or with worker processes each
+ * worker's to FILE.INDEX, and --trace-counters adds the hardware counters to each span where perf allows.
+ * --check-allocations then runs the grid again in this process, for one day and for every day, and fails if the
+ * longer run made more heap allocations: the tiles and threads cost the same in both, so any more were made by the
+ * tile-days themselves.  The zones are left out of it, their sketches grow with the values summarized.
+ * --reproducible selects the reproducible kernel mode (see CCWFGM_FWI::SetKernelMode()) in this process and the
+ * workers, and prints a digest of the exact bits of the state and codes written, cell by cell, which is the same for a
+ * given grid and days whatever the CPU, FWI_ISA, --processes, --threads or --tile-cells.
+ *
+ * The second form runs an existing grid of tiled files PREFIX.location, PREFIX.weather, PREFIX.state, PREFIX.daily
+ * and (with --hourly) PREFIX.hourly, laid out as FWIGridFiles describes.  If PREFIX.mask exists, it masks the cells
+ * run, and if PREFIX.zones exists, --zones gives the number of zones its ids are from.
+ *
+ * --processes 0 runs the grid in this process instead, with --threads compute threads (0 for one per hardware thread),
+ * and reports each NUMA node's share of the tiles and bandwidth.  --numa makes that run NUMA aware (see FWIGridEngine),
+ * or with worker processes, binds each worker to a node in turn.
+ *
+ * The launcher starts each worker as a copy of this program with "--worker INDEX --grid NAME" added to its arguments.
+ */
+
+#include "fwi_allocation_counter.h"
+
+#include "CWFGM_FWI.h"
+#include "FWIClassRaster.h"
+#include "FWIGridEngine.h"
+#include "FWINumaTopology.h"
+#include "FWIRegionalFactors.h"
+#include "FWIShardQueue.h"
+#include "FWITrace.h"
+#include "FWIWeatherGenerator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char **environ;
+#endif
+
+
+enum grid_file { GRID_LOCATION, GRID_WEATHER, GRID_MASK, GRID_ZONES, GRID_STATE, GRID_DAILY, GRID_HOURLY, GRID_COUNT };
+static const char *grid_names[GRID_COUNT] = { "location", "weather", "mask", "zones", "state", "daily", "hourly" };
+
+// exit codes from a worker
+static const int WORKER_OK = 0, WORKER_FAILED = 1, WORKER_CELLS_FAILED = 3;
+
+
+struct options {
+	std::uint32_t processes = 2, threads = 0, cells = 100000, tile_cells = 4096, worker = 0, mask = 0, zones = 0;
+	std::uint16_t days = 0, first_day = 0;
+	std::uint64_t seed = 20230401, budget_mb = 256;
+	double equilibrium = 0.0;
+	FWIClimate climate = FWIClimate::BOREAL;
+	bool hourly = false, season = false, percentiles = false, verify = false, numa = false, is_worker = false, have_first_day = false, trace_counters = false;
+	bool check_allocations = false, reproducible = false;
+	const char *files = nullptr, *grid = nullptr, *factors = nullptr, *classes = nullptr, *trace = nullptr;
+};
+
+
+static int usage(const char *argv0) {
+	fprintf(stderr, "usage: %s [--processes N] [--threads N] [--numa] [--cells N] [--tile-cells N] [--days N] [--seed N] [--regime boreal|prairie|southern] [--hourly] [--season] [--mask PERCENT] [--equilibrium TOLERANCE] [--zones N [--percentiles]] [--classes FILE] [--budget MB] [--factors FILE] [--trace FILE [--trace-counters]] [--reproducible] [--verify] [--check-allocations]\n"
+			"       %s --files PREFIX --first-day N --days N [--processes N] [--threads N] [--numa] [--hourly] [--season] [--equilibrium TOLERANCE] [--zones N [--percentiles]] [--classes FILE] [--budget MB] [--factors FILE] [--trace FILE [--trace-counters]] [--reproducible]\n", argv0, argv0);
+	return 2;
+}
+
+
+static std::string object_name(const char *grid, int file, bool shared) {
+	return std::string(grid) + (shared ? "_" : ".") + grid_names[file];
+}
+
+
+static std::uint32_t state_layers(const options &o) {
+	return o.season ? 7 : 4;
+}
+
+
+// opens (or for the launcher of a synthetic grid, has already created) the grid's files
+static HRESULT open_grid(const options &o, FWITiledFile *f) {
+	const bool shared = !o.files;
+	const char *grid = shared ? o.grid : o.files;
+	for (int i = 0; i < GRID_COUNT; i++) {
+		if (((i == GRID_HOURLY) && (!o.hourly)) || ((i == GRID_MASK) && shared && (!o.mask)) || ((i == GRID_ZONES) && (!o.zones)))
+			continue;
+		const bool writable = (i >= GRID_STATE);
+		const std::string name = object_name(grid, i, shared);
+		HRESULT hr = shared ? f[i].OpenShared(name.c_str(), writable) : f[i].Open(name.c_str(), writable);
+		if (((i == GRID_MASK) || (i == GRID_ZONES)) && (!shared))
+			continue;			// optional
+		if (FAILED(hr)) {
+			fprintf(stderr, "can't open %s\n", name.c_str());
+			return hr;
+		}
+	}
+	return S_OK;
+}
+
+
+static FWIGridFiles grid_files(const options &o, FWITiledFile *f) {
+	FWIGridFiles files = { &f[GRID_LOCATION], &f[GRID_WEATHER], &f[GRID_STATE], &f[GRID_DAILY], o.hourly ? &f[GRID_HOURLY] : nullptr,
+		f[GRID_MASK].IsOpen() ? &f[GRID_MASK] : nullptr, f[GRID_ZONES].IsOpen() ? &f[GRID_ZONES] : nullptr, nullptr };
+	return files;
+}
+
+
+static FWIGridSettings grid_settings(const options &o, std::uint32_t threads) {
+	FWIGridSettings s;
+	s.first_day_of_year = o.first_day;
+	s.days = o.days;
+	s.threads = threads;
+	s.memory_budget = o.budget_mb << 20;
+	s.season.enabled = o.season;
+	s.equilibrium_tolerance = o.equilibrium;
+	s.zonal.zones = o.zones;
+	s.zonal.percentiles = o.percentiles;
+	return s;
+}
+
+
+static bool load_factors(const options &o, FWIRegionalFactors *registry) {
+	if (!o.factors)
+		return true;
+	std::uint32_t line;
+	HRESULT hr = registry->Load(o.factors, &line);
+	if (FAILED(hr)) {
+		if (hr == E_INVALIDARG)
+			fprintf(stderr, "%s:%" PRIu32 ": invalid regional factor configuration\n", o.factors, line);
+		else
+			fprintf(stderr, "cannot read %s\n", o.factors);
+		return false;
+	}
+	return true;
+}
+
+
+static int run_worker(const options &o) {
+	FWIRegionalFactors registry;
+	if (!load_factors(o, &registry))
+		return WORKER_FAILED;
+	FWITiledFile f[GRID_COUNT];
+	if (FAILED(open_grid(o, f)))
+		return WORKER_FAILED;
+	FWIShardQueue queue;
+	const std::string queue_name = std::string(o.grid) + "_queue";
+	if (FAILED(queue.Open(queue_name.c_str(), o.worker))) {
+		fprintf(stderr, "worker %" PRIu32 ": can't open %s\n", o.worker, queue_name.c_str());
+		return WORKER_FAILED;
+	}
+
+	// one compute thread, the processes are the parallelism, dealt out over the nodes
+	if (o.numa)
+		FWINumaTopology::BindThread(o.worker % FWINumaTopology::Nodes());
+	FWIGridEngine engine(grid_settings(o, 1));
+	const std::string trace = o.trace ? (std::string(o.trace) + "." + std::to_string(o.worker)) : std::string();
+	if (o.trace && FAILED(FWITrace::Start(trace.c_str(), o.trace_counters)))
+		return WORKER_FAILED;
+	HRESULT hr = engine.Run(grid_files(o, f), &registry, &queue);
+	if (o.trace && FAILED(FWITrace::Stop()))
+		fprintf(stderr, "worker %" PRIu32 ": can't write %s\n", o.worker, trace.c_str());
+	if (hr == E_INVALIDARG)
+		return WORKER_CELLS_FAILED;
+	if (FAILED(hr)) {
+		fprintf(stderr, "worker %" PRIu32 ": run failed (0x%08lx)\n", o.worker, (unsigned long)hr);
+		return WORKER_FAILED;
+	}
+	return WORKER_OK;
+}
+
+
+// fills a layer of every tile from an array over the whole grid
+static bool put_layer(FWITiledFile &f, std::uint32_t layer, const double *values) {
+	for (std::uint32_t t = 0; t < f.Tiles(); t++)
+		if (FAILED(f.Write(t, layer, values + (std::size_t)t * f.TileCells())))
+			return false;
+	return true;
+}
+
+
+static bool generate_grid(options &o, FWITiledFile *f) {
+	const FWIClimateRegime regime = FWIClimateRegime::Regime(o.climate);
+	if ((!o.days) || (o.days > regime.season_length))
+		o.days = regime.season_length;
+	const std::uint32_t layers[GRID_COUNT] = { 2, o.days * 6u, 1, 1, state_layers(o), o.days * (std::uint32_t)FWI_CODE_COUNT, o.days * 72u };
+	const std::uint32_t sizes[GRID_COUNT] = { sizeof(double), sizeof(double), sizeof(std::uint8_t), sizeof(std::uint32_t), sizeof(double), sizeof(std::uint16_t), sizeof(std::uint16_t) };
+	for (int i = 0; i < GRID_COUNT; i++) {
+		if (((i == GRID_HOURLY) && (!o.hourly)) || ((i == GRID_MASK) && (!o.mask)) || ((i == GRID_ZONES) && (!o.zones)))
+			continue;
+		const std::string name = object_name(o.grid, i, true);
+		if (FAILED(f[i].CreateShared(name.c_str(), o.cells, o.tile_cells, layers[i], sizes[i]))) {
+			fprintf(stderr, "can't create %s\n", name.c_str());
+			return false;
+		}
+	}
+
+	FWIWeatherGenerator weather(o.seed, regime, o.cells);
+	std::vector<double> a(o.cells), b(o.cells);
+	weather.Location(a.data(), b.data());
+	bool ok = put_layer(f[GRID_LOCATION], 0, a.data()) && put_layer(f[GRID_LOCATION], 1, b.data());
+	// with the season rules, every cell starts dormant, with no days counted or winter precipitation
+	const double start[7] = { 85.0, 6.0, 15.0, 85.0, 0.0, 0.0, 0.0 };
+	for (std::uint32_t l = 0; l < state_layers(o); l++) {
+		std::fill(a.begin(), a.end(), start[l]);
+		ok = ok && put_layer(f[GRID_STATE], l, a.data());
+	}
+	if (o.mask) {
+		std::vector<std::uint8_t> mask(o.cells);
+		for (std::uint32_t i = 0; i < o.cells; i++) {
+			std::uint64_t h = (o.seed ^ i) * 0x9e3779b97f4a7c15ull;
+			h ^= h >> 32;
+			mask[i] = ((h % 100) >= o.mask) ? 1 : 0;
+		}
+		for (std::uint32_t t = 0; (t < f[GRID_MASK].Tiles()) && ok; t++)
+			ok = SUCCEEDED(f[GRID_MASK].Write(t, 0, mask.data() + (std::size_t)t * o.tile_cells));
+	}
+	if (o.zones) {
+		// contiguous runs of cells, the generator's cells being scattered at random anyway
+		std::vector<std::uint32_t> zones(o.cells);
+		for (std::uint32_t i = 0; i < o.cells; i++)
+			zones[i] = (std::uint32_t)((std::uint64_t)i * o.zones / o.cells);
+		for (std::uint32_t t = 0; (t < f[GRID_ZONES].Tiles()) && ok; t++)
+			ok = SUCCEEDED(f[GRID_ZONES].Write(t, 0, zones.data() + (std::size_t)t * o.tile_cells));
+	}
+	for (std::uint16_t day = 0; (day < o.days) && ok; day++) {
+		FWIGeneratedDay wx;
+		weather.NextDay(&wx);
+		if (!day)
+			o.first_day = wx.day_of_year;
+		for (std::uint32_t i = 0; i < o.cells; i++) {
+			a[i] = 0.6 * wx.ws[i];
+			b[i] = 1.2 * wx.ws[i];
+		}
+		const std::uint32_t l = day * 6u;
+		ok = put_layer(f[GRID_WEATHER], l, wx.min_temperature) && put_layer(f[GRID_WEATHER], l + 1, wx.max_temperature) && put_layer(f[GRID_WEATHER], l + 2, wx.rh)
+			&& put_layer(f[GRID_WEATHER], l + 3, a.data()) && put_layer(f[GRID_WEATHER], l + 4, b.data()) && put_layer(f[GRID_WEATHER], l + 5, wx.rain);
+	}
+	if (!ok)
+		fprintf(stderr, "can't write the synthetic grid\n");
+	return ok;
+}
+
+
+static void unlink_grid(const options &o) {
+	for (int i = 0; i < GRID_COUNT; i++)
+		FWITiledFile::UnlinkShared(object_name(o.grid, i, true).c_str());
+	FWIShardQueue::Unlink((std::string(o.grid) + "_queue").c_str());
+}
+
+
+#if defined(_WIN32)
+typedef HANDLE worker_process;
+#else
+typedef pid_t worker_process;
+#endif
+
+
+static bool start_worker(int argc, char *argv[], const options &o, std::uint32_t index, worker_process *process) {
+	std::vector<std::string> args(argv, argv + argc);
+	args.push_back("--worker");
+	args.push_back(std::to_string(index));
+	args.push_back("--grid");
+	args.push_back(o.grid);
+	if (!o.files) {
+		// generated by the launcher, so the workers can't know these
+		args.push_back("--days");
+		args.push_back(std::to_string(o.days));
+		args.push_back("--first-day");
+		args.push_back(std::to_string(o.first_day));
+	}
+
+#if defined(_WIN32)
+	char path[MAX_PATH];
+	if (!GetModuleFileNameA(nullptr, path, MAX_PATH))
+		return false;
+	std::string command = std::string("\"") + path + "\"";
+	for (std::size_t i = 1; i < args.size(); i++)
+		command += " \"" + args[i] + "\"";
+	STARTUPINFOA si = { sizeof(si) };
+	PROCESS_INFORMATION pi;
+	if (!CreateProcessA(path, &command[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &si, &pi))
+		return false;
+	CloseHandle(pi.hThread);
+	*process = pi.hProcess;
+	return true;
+#else
+	std::vector<char *> av;
+	for (auto &a : args)
+		av.push_back(&a[0]);
+	av.push_back(nullptr);
+#if defined(__linux__)
+	const char *path = "/proc/self/exe";
+#else
+	const char *path = argv[0];
+#endif
+	return posix_spawn(process, path, nullptr, nullptr, av.data(), environ) == 0;
+#endif
+}
+
+
+static int wait_worker(worker_process process) {
+#if defined(_WIN32)
+	DWORD code = WORKER_FAILED;
+	WaitForSingleObject(process, INFINITE);
+	GetExitCodeProcess(process, &code);
+	CloseHandle(process);
+	return (int)code;
+#else
+	int status;
+	if ((waitpid(process, &status, 0) != process) || (!WIFEXITED(status)))
+		return WORKER_FAILED;
+	return WEXITSTATUS(status);
+#endif
+}
+
+
+// runs the grid again in this process from the starting state, and compares the outputs
+static bool verify_grid(const options &o, FWITiledFile *f, const std::vector<double> &start_state) {
+	options v = o;
+	const std::string grid = std::string(o.grid) + "_verify";
+	v.grid = grid.c_str();
+	FWITiledFile g[GRID_COUNT];
+	bool ok = true;
+	for (int i = GRID_STATE; (i < GRID_COUNT) && ok; i++) {
+		if ((i == GRID_HOURLY) && (!o.hourly))
+			continue;
+		ok = SUCCEEDED(g[i].CreateShared(object_name(v.grid, i, true).c_str(), f[i].Cells(), f[i].TileCells(), f[i].Layers(), f[i].ElementSize()));
+	}
+	for (std::uint32_t l = 0; (l < state_layers(o)) && ok; l++)
+		ok = put_layer(g[GRID_STATE], l, start_state.data() + (std::size_t)l * o.cells);
+
+	FWIRegionalFactors registry;
+	load_factors(o, &registry);
+	FWIGridFiles files = { &f[GRID_LOCATION], &f[GRID_WEATHER], &g[GRID_STATE], &g[GRID_DAILY], o.hourly ? &g[GRID_HOURLY] : nullptr,
+		o.mask ? &f[GRID_MASK] : nullptr, o.zones ? &f[GRID_ZONES] : nullptr, nullptr };
+	if (ok) {
+		// cells failing their range checks fail the same way in both runs
+		const HRESULT hr = FWIGridEngine(grid_settings(o, 1)).Run(files, &registry);
+		ok = SUCCEEDED(hr) || (hr == E_INVALIDARG);
+	}
+
+	std::uint64_t differences = 0;
+	std::vector<std::uint8_t> x((std::size_t)o.tile_cells * sizeof(double)), y(x.size());
+	for (int i = GRID_STATE; (i < GRID_COUNT) && ok; i++) {
+		if ((i == GRID_HOURLY) && (!o.hourly))
+			continue;
+		for (std::uint32_t t = 0; t < f[i].Tiles(); t++)
+			for (std::uint32_t l = 0; l < f[i].Layers(); l++) {
+				f[i].Read(t, l, x.data());
+				g[i].Read(t, l, y.data());
+				if (memcmp(x.data(), y.data(), (std::size_t)f[i].TileCount(t) * f[i].ElementSize()))
+					differences++;
+			}
+	}
+	for (int i = GRID_STATE; i < GRID_COUNT; i++)
+		FWITiledFile::UnlinkShared(object_name(v.grid, i, true).c_str());
+	if (!ok) {
+		printf("verification run failed\n");
+		return false;
+	}
+	printf("verification against a single process run %s", differences ? "FAILED" : "passed");
+	if (differences)
+		printf(", %" PRIu64 " tile layers differ", differences);
+	printf("\n");
+	return !differences;
+}
+
+
+static void print_grid(const options &o, std::uint32_t tiles, double total) {
+	printf("grid              %s\n", o.files ? o.files : "synthetic, in shared memory");
+	printf("cells             %" PRIu32 " in %" PRIu32 " tiles\n", o.cells, tiles);
+	printf("days              %" PRIu16 "%s%s\n", o.days, o.hourly ? " with hourly codes" : "", o.season ? ", season start and stop rules" : "");
+	printf("total time        %.3f s\n", total);
+	printf("cell-days/s       %.0f\n", (double)o.cells * o.days / total);
+}
+
+
+static int run_processes(int argc, char *argv[], const options &o, FWITiledFile *f) {
+	FWIShardQueue queue;
+	const std::string queue_name = std::string(o.grid) + "_queue";
+	if (FAILED(queue.Create(queue_name.c_str(), f[GRID_LOCATION].Tiles(), o.processes))) {
+		fprintf(stderr, "can't create %s\n", queue_name.c_str());
+		return 1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<worker_process> workers;
+	for (std::uint32_t i = 0; i < o.processes; i++) {
+		worker_process p;
+		if (!start_worker(argc, argv, o, i, &p)) {
+			fprintf(stderr, "can't start worker %" PRIu32 "\n", i);
+			break;
+		}
+		workers.push_back(p);
+	}
+	std::uint32_t failed = 0, cells_failed = 0;
+	for (auto &p : workers) {
+		const int code = wait_worker(p);
+		if (code == WORKER_CELLS_FAILED)
+			cells_failed++;
+		else if (code != WORKER_OK)
+			failed++;
+	}
+	const double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	print_grid(o, queue.Tiles(), total);
+	printf("processes         %zu%s\n", workers.size(), o.numa ? ", spread over the NUMA nodes" : "");
+	printf("tiles completed   %" PRIu32 "\n", queue.Completed());
+	for (std::uint32_t i = 0; i < workers.size(); i++)
+		printf("  worker %-4" PRIu32 " %6" PRIu32 " tiles\n", i, queue.Claimed(i));
+	if (cells_failed)
+		printf("%" PRIu32 " workers had cells fail their range checks\n", cells_failed);
+
+	const bool ok = (!failed) && (workers.size() == o.processes) && (queue.Completed() == queue.Tiles());
+	if (!ok)
+		printf("run FAILED\n");
+	queue.Close();
+	FWIShardQueue::Unlink(queue_name.c_str());
+	return ok ? 0 : 1;
+}
+
+
+static void print_zones(const options &o, const FWIZonalSummary &zonal) {
+	if ((!zonal.Zonings()) || (!zonal.Days()))
+		return;
+	const std::uint16_t day = zonal.Days() - 1;
+	printf("FWI by zone, last day\n");
+	printf("  zone       cells   mean    max%s    >=5   >=10   >=20   >=30\n", o.percentiles ? "    p90" : "");
+	for (std::uint32_t z = 0; z < zonal.Zones(); z++) {
+		const FWIZoneStatistics *s = zonal.Statistics(0, z, day, FWICode::FWI);
+		printf("  %-6" PRIu32 " %9" PRIu64 " %6.1f %6.1f", z, s->cells, s->Mean(FWICode::FWI), s->Maximum(FWICode::FWI));
+		double p90 = 0.0;
+		if (o.percentiles)
+			printf(" %6.1f", SUCCEEDED(s->sketch.Quantile(0.9, &p90)) ? p90 : 0.0);
+		for (std::uint8_t t = 0; t < FWI_ZONAL_THRESHOLD_COUNT; t++)
+			printf(" %5.1f%%", s->cells ? 100.0 * s->above[t] / s->cells : 0.0);
+		printf("\n");
+	}
+}
+
+
+static int run_in_process(const options &o, FWITiledFile *f) {
+	FWIRegionalFactors registry;
+	load_factors(o, &registry);
+	FWIGridSettings settings = grid_settings(o, o.threads);
+	settings.numa = o.numa;
+	FWIGridEngine engine(settings);
+
+	FWIGridFiles files = grid_files(o, f);
+	FWIClassRaster classes;
+	if (o.classes) {
+		if (FAILED(classes.Create(o.classes, f[GRID_LOCATION].Cells(), f[GRID_LOCATION].TileCells(), o.days))) {
+			fprintf(stderr, "can't create %s\n", o.classes);
+			return 1;
+		}
+		files.classes = &classes;
+	}
+
+	if (o.trace && FAILED(FWITrace::Start(o.trace, o.trace_counters)))
+		return 1;
+	const bool counters = FWITrace::Counters();
+	const auto start = std::chrono::steady_clock::now();
+	HRESULT hr = engine.Run(files, &registry);
+	const double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (o.trace && FAILED(FWITrace::Stop()))
+		fprintf(stderr, "can't write %s\n", o.trace);
+	const std::uint64_t class_bytes = classes.RunBytes();
+	if (o.classes && FAILED(classes.Close()) && SUCCEEDED(hr))
+		hr = E_FAIL;
+
+	print_grid(o, f[GRID_LOCATION].Tiles(), total);
+	printf("threads           in this process%s\n", o.numa ? ", NUMA aware" : "");
+	std::uint64_t cell_days = 0, active_cell_days = 0, equilibrium_cell_hours = 0;
+	for (const auto &n : engine.Statistics()) {
+		printf("  node %-4" PRIu32 " %3" PRIu32 " threads %6" PRIu32 " tiles %9.1f MB/s\n", n.node, n.threads, n.tiles, n.Bandwidth() / (1024.0 * 1024.0));
+		cell_days += n.cell_days;
+		active_cell_days += n.active_cell_days;
+		equilibrium_cell_hours += n.equilibrium_cell_hours;
+	}
+	if (cell_days)
+		printf("active cell-days  %" PRIu64 " (%.1f%%)\n", active_cell_days, 100.0 * active_cell_days / cell_days);
+	if (o.hourly && active_cell_days)
+		printf("at equilibrium    %" PRIu64 " cell-hours (%.1f%%)\n", equilibrium_cell_hours, 100.0 * equilibrium_cell_hours / (24.0 * active_cell_days));
+	print_zones(o, engine.Zonal());
+	if (o.classes) {
+		const double fwi_bytes = (double)f[GRID_LOCATION].Cells() * o.days * sizeof(std::uint16_t);
+		printf("danger classes    %" PRIu64 " bytes of runs, %.1f%% of the daily FWI's\n", class_bytes, 100.0 * class_bytes / fwi_bytes);
+	}
+	if (o.trace)
+		printf("trace             %s%s\n", o.trace, counters ? ", with hardware counters" : (o.trace_counters ? ", hardware counters unavailable" : ""));
+	if (hr == E_INVALIDARG)
+		printf("cells failed their range checks\n");
+	else if (FAILED(hr)) {
+		printf("run FAILED (0x%08lx)\n", (unsigned long)hr);
+		return 1;
+	}
+	return 0;
+}
+
+
+// FNV-1a over the bytes of the state and outputs, a layer at a time in cell order, so the tiling doesn't show
+static std::uint64_t output_digest(const options &o, FWITiledFile *f) {
+	std::uint64_t hash = 0xcbf29ce484222325ULL;
+	std::vector<std::uint8_t> x;
+	for (int i = GRID_STATE; i < GRID_COUNT; i++) {
+		if ((i == GRID_HOURLY) && (!o.hourly))
+			continue;
+		x.resize((std::size_t)f[i].TileCells() * f[i].ElementSize());
+		for (std::uint32_t l = 0; l < f[i].Layers(); l++)
+			for (std::uint32_t t = 0; t < f[i].Tiles(); t++) {
+				f[i].Read(t, l, x.data());
+				const std::size_t bytes = (std::size_t)f[i].TileCount(t) * f[i].ElementSize();
+				for (std::size_t b = 0; b < bytes; b++) {
+					hash ^= x[b];
+					hash *= 0x100000001b3ULL;
+				}
+			}
+	}
+	return hash;
+}
+
+
+// runs the grid (further) for one day and for every day, on one compute thread and without zones
+static bool check_allocations(const options &o, FWITiledFile *f) {
+	FWIRegionalFactors registry;
+	load_factors(o, &registry);
+	FWIGridFiles files = grid_files(o, f);
+	files.zones = nullptr;
+	const std::uint16_t days[2] = { 1, o.days };
+	std::uint64_t allocations[2];
+	for (int k = 0; k < 2; k++) {
+		FWIGridSettings settings = grid_settings(o, 1);
+		settings.days = days[k];
+		settings.zonal.zones = 0;
+		FWIGridEngine engine(settings);
+		const std::uint64_t before = allocation_count();
+		const HRESULT hr = engine.Run(files, &registry);
+		allocations[k] = allocation_count() - before;
+		if (FAILED(hr) && (hr != E_INVALIDARG)) {
+			printf("allocation check run FAILED (0x%08lx)\n", (unsigned long)hr);
+			return false;
+		}
+	}
+	const std::uint64_t tile_days = (std::uint64_t)f[GRID_LOCATION].Tiles() * (o.days - 1);
+	const std::uint64_t steady = (allocations[1] > allocations[0]) ? (allocations[1] - allocations[0]) : 0;
+	printf("steady state      %" PRIu64 " allocations over %" PRIu64 " tile-days (%" PRIu64 " for a one day run)%s\n", steady, tile_days, allocations[0], steady ? "  FAILED" : "");
+	return !steady;
+}
+
+
+int main(int argc, char *argv[]) {
+	options o;
+	for (int i = 1; i < argc; i++) {
+		const bool has_value = (i + 1 < argc);
+		if (!strcmp(argv[i], "--regime") && has_value) {
+			const char *r = argv[++i];
+			if (!strcmp(r, "boreal"))		o.climate = FWIClimate::BOREAL;
+			else if (!strcmp(r, "prairie"))		o.climate = FWIClimate::PRAIRIE;
+			else if (!strcmp(r, "southern"))	o.climate = FWIClimate::SOUTHERN_HEMISPHERE;
+			else					return usage(argv[0]);
+		}
+		else if (!strcmp(argv[i], "--processes") && has_value)	o.processes = (std::uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--cells") && has_value)	o.cells = (std::uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--tile-cells") && has_value)	o.tile_cells = (std::uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--days") && has_value)	o.days = (std::uint16_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--first-day") && has_value) { o.first_day = (std::uint16_t)strtoul(argv[++i], nullptr, 10); o.have_first_day = true; }
+		else if (!strcmp(argv[i], "--seed") && has_value)	o.seed = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--budget") && has_value)	o.budget_mb = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--factors") && has_value)	o.factors = argv[++i];
+		else if (!strcmp(argv[i], "--files") && has_value)	o.files = argv[++i];
+		else if (!strcmp(argv[i], "--hourly"))			o.hourly = true;
+		else if (!strcmp(argv[i], "--season"))			o.season = true;
+		else if (!strcmp(argv[i], "--equilibrium") && has_value) o.equilibrium = strtod(argv[++i], nullptr);
+		else if (!strcmp(argv[i], "--zones") && has_value)	o.zones = (std::uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--percentiles"))		o.percentiles = true;
+		else if (!strcmp(argv[i], "--classes") && has_value)	o.classes = argv[++i];
+		else if (!strcmp(argv[i], "--trace") && has_value)	o.trace = argv[++i];
+		else if (!strcmp(argv[i], "--trace-counters"))		o.trace_counters = true;
+		else if (!strcmp(argv[i], "--mask") && has_value)	o.mask = (std::uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--reproducible"))		o.reproducible = true;
+		else if (!strcmp(argv[i], "--verify"))			o.verify = true;
+		else if (!strcmp(argv[i], "--check-allocations"))	o.check_allocations = true;
+		else if (!strcmp(argv[i], "--numa"))			o.numa = true;
+		else if (!strcmp(argv[i], "--threads") && has_value)	o.threads = (std::uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--worker") && has_value) { o.worker = (std::uint32_t)strtoul(argv[++i], nullptr, 10); o.is_worker = true; }
+		else if (!strcmp(argv[i], "--grid") && has_value)	o.grid = argv[++i];
+		else							return usage(argv[0]);
+	}
+	if (o.reproducible)
+		CCWFGM_FWI::SetKernelMode(FWIKernelMode::REPRODUCIBLE);
+	if (o.is_worker)
+		return o.grid ? run_worker(o) : usage(argv[0]);
+	if ((!o.cells) || (!o.tile_cells) || (o.mask > 100) || (o.equilibrium < 0.0) || (o.files && ((!o.days) || (!o.have_first_day))) || (o.files && (o.verify || o.mask || o.check_allocations)) || (o.classes && o.processes))
+		return usage(argv[0]);
+
+	FWIRegionalFactors registry;
+	if (!load_factors(o, &registry))
+		return 1;
+
+#if defined(_WIN32)
+	const std::string grid = "Local\\fwi_grid_" + std::to_string(GetCurrentProcessId());
+#else
+	const std::string grid = "/fwi_grid_" + std::to_string(getpid());
+#endif
+	o.grid = grid.c_str();
+
+	FWITiledFile f[GRID_COUNT];
+	std::vector<double> start_state;
+	if (o.files) {
+		if (FAILED(open_grid(o, f)))
+			return 1;
+		o.cells = f[GRID_LOCATION].Cells();
+	}
+	else {
+		if (!generate_grid(o, f)) {
+			unlink_grid(o);
+			return 1;
+		}
+		if (o.verify) {
+			start_state.resize((std::size_t)o.cells * state_layers(o));
+			for (std::uint32_t l = 0; l < state_layers(o); l++)
+				for (std::uint32_t t = 0; t < f[GRID_STATE].Tiles(); t++)
+					f[GRID_STATE].Read(t, l, start_state.data() + (std::size_t)l * o.cells + (std::size_t)t * o.tile_cells);
+		}
+	}
+
+	const std::uint64_t tile_bytes = FWIGridEngine::TileBytes(grid_files(o, f), grid_settings(o, 1));
+	if (tile_bytes > (o.budget_mb << 20)) {
+		fprintf(stderr, "--budget is too small, each worker needs at least %" PRIu64 " MB for a tile\n", (tile_bytes + (1 << 20) - 1) >> 20);
+		if (!o.files)
+			unlink_grid(o);
+		return 1;
+	}
+
+	int rc = o.processes ? run_processes(argc, argv, o, f) : run_in_process(o, f);
+	if ((!rc) && o.reproducible)
+		printf("output digest     %016" PRIx64 "\n", output_digest(o, f));
+	if ((!rc) && o.verify && (!verify_grid(o, f, start_state)))
+		rc = 1;
+	if ((!rc) && o.check_allocations && (!check_allocations(o, f)))
+		rc = 1;
+	if (!o.files)
+		unlink_grid(o);
+	return rc;
+}
@@ -0,0 +1,1156 @@
+/**
+ * WISE_FWI_Module: fwi_season_benchmark.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * End to end throughput benchmark: drives whole fire seasons of daily and hourly codes over many cells with
+ * synthetic weather, and reports cell-days per second, per-stage time and the peak resident set size.  The codes
+ * produced are folded into a checksum (at reporting precision, 0.1) that can be written to a golden file and later
+ * verified, so that an optimization can be timed and validated in the same run.
+ *
+ *   fwi_season_benchmark [--regime boreal|prairie|southern] [--cells N] [--seasons N] [--seed N]
+ *                        [--factors FILE] [--downscale] [--quantized] [--history FILE] [--monte-carlo SAMPLES]
+ *                        [--result-cache] [--aggregator] [--utc] [--replay YEARS] [--check-allocations] [--reproducible] [--golden FILE] [--verify FILE]
+ *
+ * --downscale derives the hourly weather from the generated daily minimum and maximum temperature, noon RH, wind and
+ * rain with FWIDownscaler, streamed into the hourly kernels, instead of using the generator's own hourly weather.
+ *
+ * --quantized also carries the daily codes through the season in FWIQuantized's fixed point forms, and reports (and
+ * fails on) any drift from the double chain beyond half the reporting precision.
+ *
+ * --history writes every cell's daily and hourly (Van Wagner) codes to an FWIStationHistory, a station per cell and a
+ * calendar year per season, then reopens it, checks that everything reads back and times date range queries.
+ *
+ * --monte-carlo also runs a week long forecast (a week from the middle of the first season) for every cell with that
+ * many perturbed samples each (see FWIMonteCarlo), reports its throughput, and checks that the results are the same
+ * with one thread as with several.
+ *
+ * --result-cache calls a small FWIResultCache with several times more distinct inputs than it holds, some of them out of
+ * range and some repeated with noise its key rounding absorbs, and checks every result against CCWFGM_FWI's, and that
+ * a cache given no memory passes the noisy inputs through unrounded.
+ *
+ * --aggregator feeds a month of every cell's hourly weather through FWIDailyAggregator, as stations spread over the time
+ * zones, with hours missing, noon records late or missing and the feeds ending at different times of day, and checks
+ * the days it completes match the noon to noon windows summed and run through the daily codes a station at a time.
+ *
+ * --utc runs a batch of stations spread over every time zone, some with daylight savings, through the hourly UTC batch
+ * forms and FWICalculations in UTC mode at instants across two days, and checks every station against calls for it alone
+ * on its own LST (or local clock, for FWICalculations): bit for bit through the same kernels, and to within rounding
+ * against the per-value methods.
+ *
+ * --replay runs one cell's weather for that many years through FWIHistoryReplay with no tolerance, on several threads
+ * and chunk sizes and with and without restarting each year, and checks the codes match a day by day loop bit for bit.
+ *
+ * --check-allocations counts the heap allocations made by the library's calls (batch, downscaler and a scalar chain
+ * for one cell) after the first day of each season, and fails if there are any: once warmed up, a day shouldn't
+ * allocate.
+ *
+ * --reproducible selects the reproducible kernel mode (see CCWFGM_FWI::SetKernelMode()), and checksums the exact bits
+ * of every value rather than the value rounded, so that golden files written on different CPUs, or with FWI_ISA set to
+ * different variants, can be checked against each other bit for bit.  Timing a run with and without it gives the
+ * mode's cost.
+ */
+
+#include "fwi_allocation_counter.h"
+
+#include "CWFGM_FWI.h"
+#include "FWICalculations.h"
+#include "FWIDailyAggregator.h"
+#include "FWIDownscaler.h"
+#include "FWIHistoryReplay.h"
+#include "FWIMonteCarlo.h"
+#include "FWIQuantized.h"
+#include "FWIRegionalFactors.h"
+#include "FWIResultCache.h"
+#include "FWIStationHistory.h"
+#include "FWIWeatherGenerator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+enum stage { STAGE_WEATHER, STAGE_DAILY, STAGE_DAILY_QUANTIZED, STAGE_HOURLY_VANWAGNER, STAGE_HOURLY_LAWSON, STAGE_HOURLY_ISI_FWI, STAGE_CHECKSUM, STAGE_HISTORY, STAGE_COUNT };
+static const char *stage_names[STAGE_COUNT] = { "weather generation", "daily chain", "daily chain (fixed point)", "hourly FFMC (Van Wagner)", "hourly FFMC (Lawson)", "hourly ISI/FWI", "checksum", "station history" };
+
+enum code { CODE_FFMC, CODE_DMC, CODE_DC, CODE_BUI, CODE_ISI, CODE_FWI, CODE_DSR, CODE_HFFMC_VW, CODE_HFFMC_LAWSON, CODE_HISI, CODE_HFWI, CODE_COUNT };
+static const char *code_names[CODE_COUNT] = { "ffmc", "dmc", "dc", "bui", "isi", "fwi", "dsr", "hffmc_vanwagner", "hffmc_lawson", "hisi", "hfwi" };
+
+
+/*
+ * FNV-1a over the values rounded to one decimal, which is what gets reported, so that the checksum is stable across
+ * kernel variants which differ in the last few bits, or with 'exact' over the bits of the values themselves.  The sum
+ * is kept too so that a mismatch can be sized.
+ */
+struct checksum {
+	std::uint64_t hash = 0xcbf29ce484222325ULL;
+	double sum = 0.0;
+	bool exact = false;
+
+	void add(const double *v, std::size_t n) {
+		for (std::size_t i = 0; i < n; i++) {
+			std::int64_t q;
+			if (exact)
+				memcpy(&q, &v[i], sizeof(q));
+			else
+				q = (std::int64_t)std::llround(v[i] * 10.0);
+			for (int b = 0; b < 8; b++) {
+				hash ^= (std::uint64_t)((q >> (b * 8)) & 0xff);
+				hash *= 0x100000001b3ULL;
+			}
+			sum += v[i];
+		}
+	}
+};
+
+
+/*
+ * An order independent hash of (station, day, slot, value), so that what's appended to a station history can be
+ * compared with what reads back station by station.  Missing values are left out, as the days between seasons read
+ * back as missing.
+ */
+struct history_hash {
+	std::uint64_t hash = 0;
+
+	void add(std::uint32_t station, std::int32_t day, std::uint32_t slot, std::uint16_t value) {
+		if (value == FWIQuantized::MISSING)
+			return;
+		std::uint64_t z = ((std::uint64_t)station << 32) ^ ((std::uint64_t)(std::uint32_t)day << 12) ^ ((std::uint64_t)slot << 16) ^ value;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		hash += z ^ (z >> 31);
+	}
+};
+
+
+// times a stage, and optionally adds up the allocations made in it
+class stage_timer {
+public:
+	stage_timer(double &accumulator, std::uint64_t *allocations = nullptr)
+	    : m_accumulator(accumulator), m_allocations(allocations), m_start_allocations(thread_allocation_count()), m_start(std::chrono::steady_clock::now()) { }
+	~stage_timer() {
+		m_accumulator += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+		if (m_allocations)
+			*m_allocations += thread_allocation_count() - m_start_allocations;
+	}
+
+private:
+	double &m_accumulator;
+	std::uint64_t *m_allocations;
+	std::uint64_t m_start_allocations;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+
+static double peak_rss_mb() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return (double)pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+	return 0.0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0.0;
+#if defined(__APPLE__)
+	return (double)usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+	return (double)usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+
+static int usage(const char *argv0) {
+	fprintf(stderr, "usage: %s [--regime boreal|prairie|southern] [--cells N] [--seasons N] [--seed N] [--factors FILE] [--downscale] [--quantized] [--history FILE] [--monte-carlo SAMPLES] [--result-cache] [--aggregator] [--utc] [--replay YEARS] [--check-allocations] [--reproducible] [--golden FILE] [--verify FILE]\n", argv0);
+	return 2;
+}
+
+
+// runs a week long ensemble forecast from the middle of the first season, with one thread and with several
+static bool run_monte_carlo(const FWIClimateRegime &regime, std::uint32_t cells, std::uint64_t seed, std::uint32_t samples, const FWIRegionalFactors *registry) {
+	const std::uint16_t days = 7;
+	FWIWeatherGenerator weather(seed, regime, cells);
+	std::vector<double> latitude(cells), longitude(cells), temperature((std::size_t)days * cells), rh(temperature.size()), ws(temperature.size()), rain(temperature.size());
+	std::vector<double> in_ffmc(cells, 85.0), in_dmc(cells, 6.0), in_dc(cells, 15.0), codes[FWI_CODE_COUNT];
+	std::uint16_t month[days];
+	weather.Location(latitude.data(), longitude.data());
+
+	// the codes the forecast starts from
+	CCWFGM_FWI fwi;
+	FWICellFactors factors;
+	(registry ? *registry : FWIRegionalFactors()).Resolve(cells, latitude.data(), longitude.data(), &factors);
+	for (auto &c : codes)
+		c.resize(cells);
+	for (std::uint16_t d = 0; d < regime.season_length / 2; d++) {
+		FWIGeneratedDay wx;
+		weather.NextDay(&wx);
+		fwi.DailyCodes_Batch(cells, in_ffmc.data(), in_dmc.data(), in_dc.data(), wx.rain, wx.temperature, wx.rh, wx.ws, factors, 0, wx.month,
+			codes[(int)FWICode::FFMC].data(), codes[(int)FWICode::DMC].data(), codes[(int)FWICode::DC].data(), codes[(int)FWICode::BUI].data(),
+			codes[(int)FWICode::ISI].data(), codes[(int)FWICode::FWI].data(), nullptr);
+		in_ffmc.swap(codes[(int)FWICode::FFMC]);
+		in_dmc.swap(codes[(int)FWICode::DMC]);
+		in_dc.swap(codes[(int)FWICode::DC]);
+	}
+
+	for (std::uint16_t d = 0; d < days; d++) {
+		FWIGeneratedDay wx;
+		weather.NextDay(&wx);
+		month[d] = wx.month;
+		std::copy(wx.temperature, wx.temperature + cells, temperature.begin() + (std::size_t)d * cells);
+		std::copy(wx.rh, wx.rh + cells, rh.begin() + (std::size_t)d * cells);
+		std::copy(wx.ws, wx.ws + cells, ws.begin() + (std::size_t)d * cells);
+		std::copy(wx.rain, wx.rain + cells, rain.begin() + (std::size_t)d * cells);
+	}
+	const FWIForecastWeather forecast = { days, month, temperature.data(), rh.data(), ws.data(), rain.data() };
+
+	FWIMonteCarloSettings settings;
+	settings.samples = samples;
+	settings.seed = seed;
+	settings.threads = 4;
+	FWIMonteCarlo many(settings);
+	const auto start = std::chrono::steady_clock::now();
+	HRESULT hr = many.Run(cells, latitude.data(), longitude.data(), in_ffmc.data(), in_dmc.data(), in_dc.data(), forecast, registry);
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	settings.threads = 1;
+	FWIMonteCarlo one(settings);
+	if (FAILED(hr) || FAILED(one.Run(cells, latitude.data(), longitude.data(), in_ffmc.data(), in_dmc.data(), in_dc.data(), forecast, registry))) {
+		printf("monte carlo       FAILED (0x%08lx)\n", (unsigned long)hr);
+		return false;
+	}
+
+	std::uint64_t differ = 0;
+	for (std::uint32_t i = 0; i < cells; i++)
+		for (std::uint16_t d = 0; d < days; d++)
+			for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++) {
+				const FWIMonteCarloStatistics *a = many.Statistics(i, d, (FWICode)c), *b = one.Statistics(i, d, (FWICode)c);
+				differ += (a->sum != b->sum) || (a->sum_squares != b->sum_squares) || (a->samples != b->samples) || memcmp(a->above, b->above, sizeof(a->above));
+			}
+
+	// the cell with the highest expected FWI on the last day
+	std::uint32_t cell = 0;
+	for (std::uint32_t i = 1; i < cells; i++)
+		if (many.Statistics(i, days - 1, FWICode::FWI)->Mean() > many.Statistics(cell, days - 1, FWICode::FWI)->Mean())
+			cell = i;
+	const FWIMonteCarloStatistics *st = many.Statistics(cell, days - 1, FWICode::FWI);
+	double p10 = 0.0, p50 = 0.0, p90 = 0.0;
+	many.Quantile(cell, days - 1, FWICode::FWI, 0.1, &p10);
+	many.Quantile(cell, days - 1, FWICode::FWI, 0.5, &p50);
+	many.Quantile(cell, days - 1, FWICode::FWI, 0.9, &p90);
+	printf("monte carlo       %" PRIu32 " samples x %" PRIu32 " cells x %" PRIu16 " days, %.0f sample-days/s\n", samples, cells, days, (double)samples * cells * days / seconds);
+	printf("  cell %" PRIu32 " day %u  FWI mean %.1f sd %.1f p10 %.1f p50 %.1f p90 %.1f, P(FWI >= %.0f) %.2f\n", cell, days, st->Mean(), st->StandardDeviation(), p10, p50, p90,
+		settings.thresholds[(int)FWICode::FWI][2], st->Exceedance(2));
+	printf("  one thread      %s\n", differ ? "DIFFERS" : "identical");
+	return !differ;
+}
+
+
+// reopens the history, reads every station back, and times random date range queries
+static bool check_history(FWIStationHistory &history, const char *filename, const history_hash &appended, std::uint64_t seed) {
+	if (FAILED(history.Close()) || FAILED(history.Open(filename))) {
+		printf("station history   can't be written or reopened\n");
+		return false;
+	}
+	const std::uint64_t station_days = history.StationDays();
+	const std::uint64_t bytes = history.BlockBytes();
+	const std::uint32_t stations = history.Stations();
+	const std::size_t values = FWI_CODE_COUNT + FWI_HISTORY_HOURLY_VALUES;
+	printf("station history   %" PRIu64 " station-days, %.2f MB, %.1f bytes per station-day (%.1f%% of the 16 bit values)\n",
+		station_days, bytes / (1024.0 * 1024.0), station_days ? (double)bytes / station_days : 0.0, station_days ? 100.0 * bytes / (station_days * values * sizeof(std::uint16_t)) : 0.0);
+
+	history_hash read;
+	std::vector<std::uint16_t> daily, hourly;
+	for (std::uint32_t s = 0; s < stations; s++) {
+		std::int32_t first, last;
+		if (history.Span(s, &first, &last) != S_OK)
+			continue;
+		const std::size_t days = (std::size_t)(last - first + 1);
+		daily.resize(days * FWI_CODE_COUNT);
+		hourly.resize(days * FWI_HISTORY_HOURLY_VALUES);
+		if (FAILED(history.Read(s, first, last, daily.data(), hourly.data())))
+			break;
+		for (std::size_t d = 0; d < days; d++) {
+			const std::int32_t date = first + (std::int32_t)d;
+			for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+				read.add(s, date, c, daily[d * FWI_CODE_COUNT + c]);
+			for (std::uint8_t v = 0; v < FWI_HISTORY_HOURLY_VALUES; v++)
+				read.add(s, date, FWI_CODE_COUNT + v, hourly[d * FWI_HISTORY_HOURLY_VALUES + v]);
+		}
+	}
+	const bool ok = (read.hash == appended.hash);
+	printf("  read back       %s\n", ok ? "ok" : "MISMATCH");
+
+	// a month of daily codes from a random station and date
+	const std::uint32_t queries = 10000;
+	std::uint64_t rng = seed, decoded = 0;
+	daily.resize(31 * FWI_CODE_COUNT);
+	const auto start = std::chrono::steady_clock::now();
+	for (std::uint32_t q = 0; q < queries; q++) {
+		rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+		const std::uint32_t s = (std::uint32_t)((rng >> 33) % stations);
+		std::int32_t first, last;
+		std::uint32_t days;
+		if (history.Span(s, &first, &last) != S_OK)
+			continue;
+		const std::int32_t from = first + (std::int32_t)((rng >> 11) % (std::uint64_t)(last - first + 1));
+		history.Read(s, from, from + 30, daily.data(), nullptr, &days);
+		decoded += days;
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("  31 day queries  %.1f us each (%" PRIu64 " station-days decoded)\n", 1e6 * seconds / queries, decoded);
+	return ok;
+}
+
+
+// calls a small FWIResultCache with many times more distinct inputs than it holds, some out of range and some
+// repeated with representation noise its rounding should absorb, and checks every result against CCWFGM_FWI's, and
+// that one with no memory leaves the noise alone
+static bool check_result_cache(std::uint64_t seed) {
+	FWIResultCache cache(64 * 1024, 36, 4), disabled(0);
+	CCWFGM_FWI fwi;
+	const std::uint64_t capacity = cache.Statistics().capacity;
+	std::uint64_t rng = seed;
+	auto next = [&rng](std::uint32_t n) {
+		rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+		return (std::uint32_t)((rng >> 33) % n);
+	};
+
+	// inputs on coarse binary steps, which the cache's rounding leaves as they are, so its results can be compared with
+	// calls on the same values; about one in twenty FFMCs are out of range, and those calls fail, and a quarter of the
+	// calls reuse the values before them with another method or time step, which must be kept apart
+	struct call {
+		std::uint8_t method;
+		std::uint32_t seconds;
+		double v[5];
+	};
+	std::vector<call> calls((std::size_t)capacity * 4);
+	for (std::size_t i = 0; i < calls.size(); i++) {
+		call &c = calls[i];
+		c.method = (std::uint8_t)next(4);
+		c.seconds = (next(2) ? 60 : 30) * 60;
+		if (i && (!next(4))) {
+			memcpy(c.v, calls[i - 1].v, sizeof(c.v));
+			if (c.method == calls[i - 1].method)
+				c.seconds = 90 * 60 - calls[i - 1].seconds;
+			continue;
+		}
+		c.v[0] = next(20) ? (next(101 * 32) / 32.0) : 150.0;
+		c.v[1] = (next(10) < 7) ? 0.0 : (next(10 * 64) / 64.0);
+		c.v[2] = -10.0 + next(45 * 8) / 8.0;
+		c.v[3] = next(257) / 256.0;
+		c.v[4] = next(60 * 16) / 16.0;
+		if (c.method == 3) {
+			c.v[0] = next(60 * 64) / 64.0;		// ISI
+			c.v[1] = next(300 * 16) / 16.0;		// BUI
+		}
+	}
+
+	// through the base class, so the cache's overrides are called as a CCWFGM_FWI user would
+	auto calculate = [](CCWFGM_FWI &f, const call &c, const double *v, double *result) {
+		switch (c.method) {
+			case 0:		return f.HourlyFFMC_VanWagner(v[0], v[1], v[2], v[3], v[4], c.seconds, result);
+			case 1:		return f.HourlyFFMC_VanWagner_Previous(v[0], v[1], v[2], v[3], v[4], result);
+			case 2:		return f.DailyFFMC_VanWagner(v[0], v[1], v[2], v[3], v[4], result);
+			default:	return f.FWI(v[0], v[1], result);
+		}
+	};
+
+	std::uint64_t differ = 0, rounded = 0;
+	const std::uint32_t rounds = 20 * (std::uint32_t)calls.size();
+	for (std::uint32_t r = 0; r < rounds; r++) {
+		// a quarter of the calls go to an eighth of the inputs, so some are found while the rest keep evicting
+		const call &c = calls[next(4) ? next((std::uint32_t)calls.size()) : next((std::uint32_t)calls.size() / 8)];
+		double v[5];
+		const double noise = next(2) ? (1.0 + 1.0 / 35184372088832.0) : 1.0;	// 2^-45, well inside the 36 bits kept
+		for (int i = 0; i < 5; i++)
+			v[i] = c.v[i] * noise;
+
+		double cached = -1.0, expected = -1.0;
+		const HRESULT hr_cached = calculate(cache, c, v, &cached), hr_expected = calculate(fwi, c, c.v, &expected);
+		differ += (hr_cached != hr_expected) || (SUCCEEDED(hr_expected) && memcmp(&cached, &expected, sizeof(double)));
+
+		double passed = -1.0, exact = -1.0;
+		const HRESULT hr_passed = calculate(disabled, c, v, &passed), hr_exact = calculate(fwi, c, v, &exact);
+		rounded += (hr_passed != hr_exact) || (SUCCEEDED(hr_exact) && memcmp(&passed, &exact, sizeof(double)));
+	}
+
+	const FWIResultCacheStatistics st = cache.Statistics();
+	printf("result cache      %" PRIu32 " calls, %zu distinct inputs, %" PRIu64 " held, %.1f%% hits, %" PRIu64 " evictions\n", rounds, calls.size(), st.capacity, 100.0 * st.HitRate(), st.evictions);
+	printf("  uncached        %s\n", differ ? "DIFFERS" : "identical");
+	printf("  disabled        %s\n", rounded ? "ROUNDS" : "identical, unrounded");
+	// all of it should have been exercised, finding, evicting and never holding more than it can
+	const bool exercised = st.hits && st.evictions && (st.entries <= st.capacity);
+	if (!exercised)
+		printf("  hits and evictions expected, %" PRIu64 " held\n", st.entries);
+	return (!differ) && (!rounded) && exercised;
+}
+
+
+// a station's standard time offset from UTC, spread over every zone, half and quarter hour ones included
+static std::int32_t zone_offset(std::uint32_t i) {
+	return (std::int32_t)(i % 26) * 60 * 60 - 12 * 60 * 60 + ((i % 7) ? 0 : 30 * 60) - ((i % 11) ? 0 : 15 * 60);
+}
+
+
+// feeds a month of every cell's hourly weather, as stations in every time zone, through FWIDailyAggregator with hours
+// missing, late and missing noon records, and feeds ending at different times of day, and checks the days it
+// completes against the noon to noon windows summed here and run through the daily codes a station at a time
+static bool check_aggregator(const FWIClimateRegime &regime, std::uint32_t stations, std::uint64_t seed, const FWIRegionalFactors *registry) {
+	const std::int64_t DAY = 24 * 60 * 60, NOON = 12 * 60 * 60;
+	const std::int32_t first = FWIStationHistory::DayNumber(2023, 6, 20), july = FWIStationHistory::DayNumber(2023, 7, 1);
+	const std::uint32_t days = 30;
+
+	struct window {
+		std::int32_t day;
+		std::uint16_t hours;
+		bool noon;
+		double rain, temperature, rh, ws;
+	};
+	std::vector<std::vector<window>> expected(stations);
+	std::vector<std::int32_t> utc_offset(stations);
+	std::vector<double> latitude(stations), longitude(stations), temperature(stations), rh(stations), ws(stations), rain(stations);
+	for (std::uint32_t i = 0; i < stations; i++)
+		utc_offset[i] = zone_offset(i);
+
+	FWIWeatherGenerator weather(seed, regime, stations);
+	weather.Location(latitude.data(), longitude.data());
+	FWICellFactors factors;
+	(registry ? *registry : FWIRegionalFactors()).Resolve(stations, latitude.data(), longitude.data(), &factors);
+	FWIDailyAggregator aggregator;
+	if (FAILED(aggregator.Reset(stations, latitude.data(), utc_offset.data(), &factors))) {
+		printf("daily aggregator  FAILED to reset\n");
+		return false;
+	}
+
+	std::uint64_t rng = seed, records = 0;
+	std::vector<FWIHourlyRecord> feed;
+	feed.reserve(stations);
+	for (std::uint32_t c = 0; c < days; c++) {
+		FWIGeneratedDay wx;
+		weather.NextDay(&wx);
+		for (std::uint16_t h = 0; h < 24; h++) {
+			weather.Hourly(h, temperature.data(), rh.data(), ws.data(), rain.data());
+			feed.clear();
+			for (std::uint32_t i = 0; i < stations; i++) {
+				// on the last day, a quarter of the feeds end at 09:00 and a quarter with a late noon record, and
+				// the rest run on into the next day's window, which none of them complete
+				const bool last = (c == days - 1);
+				if (last && ((((i % 4) == 1) && (h > 9)) || (((i % 4) == 2) && (h > 12))))
+					continue;
+
+				rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+				const std::uint32_t draw = (std::uint32_t)((rng >> 33) % 100);
+				std::int64_t lst = (std::int64_t)(first + (std::int32_t)c) * DAY + h * 60 * 60;
+				if (h == 12) {
+					if ((last && ((i % 4) == 2)) || (draw < 10))
+						lst -= 20 * 60;		// late, but after 11:00 so still the noon observation
+					else if (draw < 15)
+						continue;		// missing, leaving 11:00, which is too early
+				}
+				else if (draw < 10)
+					continue;			// a gap
+
+				const FWIHourlyRecord r = { i, lst - utc_offset[i], temperature[i], rh[i], ws[i], rain[i] };
+				feed.push_back(r);
+
+				const std::int32_t day = first + (std::int32_t)c + ((h > 12) ? 1 : 0);
+				std::vector<window> &e = expected[i];
+				if (e.empty() || (e.back().day != day))
+					e.push_back({ day, 0, false, 0.0, 0.0, 0.0, 0.0 });
+				window &w = e.back();
+				w.hours++;
+				w.rain += r.rain;
+				if (lst > (std::int64_t)day * DAY + NOON - 60 * 60) {
+					w.noon = true;
+					w.temperature = r.temperature;
+					w.rh = r.rh;
+					w.ws = r.ws;
+				}
+			}
+			records += feed.size();
+			if (FAILED(aggregator.Add((std::uint32_t)feed.size(), feed.data()))) {
+				printf("daily aggregator  FAILED to add records\n");
+				return false;
+			}
+		}
+	}
+	aggregator.Flush();
+
+	// a window is completed by a later record, or at the end if it has a noon observation
+	CCWFGM_FWI fwi;
+	std::vector<FWIStationDay> want;
+	for (std::uint32_t i = 0; i < stations; i++) {
+		double codes[3] = { 85.0, 6.0, 15.0 };
+		for (std::size_t k = 0; k < expected[i].size(); k++) {
+			const window &w = expected[i][k];
+			if ((k + 1 == expected[i].size()) && (!w.noon))
+				break;
+			FWIStationDay d;
+			d.station = i;
+			d.day = w.day;
+			d.month = (w.day < july) ? 5 : 6;
+			d.hours = w.hours;
+			d.calculated = w.noon;
+			d.noon_temperature = w.temperature;
+			d.noon_rh = w.rh;
+			d.noon_ws = w.ws;
+			d.rain = w.rain;
+			d.ffmc = d.dmc = d.dc = d.bui = d.isi = d.fwi = d.dsr = -98.0;
+			if (w.noon) {
+				fwi.DailyCodes_Batch(1, &codes[0], &codes[1], &codes[2], &w.rain, &w.temperature, &w.rh, &w.ws, factors, i, d.month, &d.ffmc, &d.dmc, &d.dc, &d.bui, &d.isi, &d.fwi, &d.dsr);
+				codes[0] = d.ffmc;
+				codes[1] = d.dmc;
+				codes[2] = d.dc;
+			}
+			want.push_back(d);
+		}
+	}
+
+	std::vector<FWIStationDay> got = aggregator.Days();
+	auto order = [](const FWIStationDay &a, const FWIStationDay &b) {
+		return (a.station < b.station) || ((a.station == b.station) && (a.day < b.day));
+	};
+	std::sort(got.begin(), got.end(), order);
+	std::uint64_t differ = (got.size() != want.size()) ? 1 : 0, calculated = 0;
+	for (std::size_t k = 0; (!differ) && (k < got.size()); k++) {
+		const FWIStationDay &a = got[k], &b = want[k];
+		// the noon observation is only meaningful on a day that had one
+		differ += (a.station != b.station) || (a.day != b.day) || (a.month != b.month) || (a.hours != b.hours) || (a.calculated != b.calculated) ||
+			(b.calculated && ((a.noon_temperature != b.noon_temperature) || (a.noon_rh != b.noon_rh) || (a.noon_ws != b.noon_ws))) ||
+			memcmp(&a.rain, &b.rain, sizeof(double) * 8);
+		calculated += b.calculated;
+	}
+	printf("daily aggregator  %" PRIu64 " hourly records, %zu station-days (%" PRIu64 " calculated)\n", records, want.size(), calculated);
+	printf("  direct          %s\n", differ ? "DIFFERS" : "identical");
+	return !differ;
+}
+
+
+// runs a batch of stations spread over every time zone, with and without daylight savings, through the UTC forms at
+// instants across two days, and checks each station against calls for it alone on its own LST (or local clock)
+static bool check_utc(std::uint64_t seed) {
+	const std::uint32_t count = 2000;
+	std::uint64_t rng = seed;
+	auto uniform = [&rng](double from, double to) {
+		rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+		return from + (to - from) * (double)(rng >> 11) / 9007199254740992.0;
+	};
+
+	std::vector<std::int32_t> utc_offset(count), dst(count);
+	std::vector<double> prev(count), curr(count), rh_0(count), rh(count), rh_1(count), isi(count), prev_bui(count), curr_bui(count), out(count);
+	std::vector<FWIStationInputs> in(count);
+	std::vector<FWIStationOutputs> calculated(count);
+	for (std::uint32_t i = 0; i < count; i++) {
+		utc_offset[i] = zone_offset(i);
+		dst[i] = (i % 3) ? 0 : 60 * 60;
+		prev[i] = uniform(0.0, 101.0);
+		curr[i] = (i % 97) ? uniform(0.0, 101.0) : 120.0;
+		rh_0[i] = uniform(0.0, 1.0);
+		rh[i] = uniform(0.0, 1.0);
+		rh_1[i] = uniform(0.0, 1.0);
+		isi[i] = uniform(0.0, 30.0);
+		prev_bui[i] = uniform(0.0, 100.0);
+		curr_bui[i] = uniform(0.0, 100.0);
+
+		FWIStationInputs &s = in[i];
+		s.yesterday_ffmc = uniform(60.0, 100.0);
+		s.yesterday_dmc = (i % 131) ? uniform(0.0, 50.0) : -5.0;
+		s.yesterday_dc = uniform(0.0, 400.0);
+		s.noon_temperature = uniform(0.0, 30.0);
+		s.noon_rh = uniform(0.0, 1.0);
+		s.noon_rain = (uniform(0.0, 1.0) < 0.2) ? uniform(0.0, 5.0) : 0.0;
+		s.noon_ws = uniform(0.0, 30.0);
+		s.hourly_temperature = uniform(0.0, 30.0);
+		s.hourly_rh = uniform(0.0, 1.0);
+		s.hourly_rain = (uniform(0.0, 1.0) < 0.1) ? uniform(0.0, 1.0) : 0.0;
+		s.hourly_ws = uniform(0.0, 40.0);
+		s.previous_hourly_ffmc = uniform(0.0, 100.0);
+		s.latitude = uniform(0.6, 1.1);
+		s.longitude = uniform(-2.2, -1.0);
+		s.utc_offset = utc_offset[i];
+	}
+
+	CCWFGM_FWI fwi;
+	FWICalculations calculations;
+	const std::int64_t base = 19500LL * 24 * 60 * 60;
+	std::uint64_t compared = 0, differ = 0;
+	auto lst_of = [&](std::int64_t utc, std::uint32_t i) {
+		std::int64_t lst = (utc + utc_offset[i]) % (24 * 60 * 60);
+		return (lst < 0) ? (lst + 24 * 60 * 60) : lst;
+	};
+	auto same = [&](double a, double b) {
+		compared++;
+		differ += (memcmp(&a, &b, sizeof(double)) != 0);
+	};
+	auto close = [&](double a, double b) {
+		compared++;
+		differ += (std::fabs(a - b) > 1e-9 * std::max(1.0, std::fabs(b)));
+	};
+
+	for (std::uint32_t minute = 0; minute < 2 * 24 * 60; minute += 7) {
+		const std::int64_t utc = base + minute * 60 + (minute % 3) * 13;
+
+		// the batch forms, against a station at a time on its LST: the same kernels bit for bit, and the per-value
+		// methods (the reference routines, which the kernels may round differently) to within a rounding error
+		fwi.HourlyFFMC_Lawson_UTC_Batch(count, prev.data(), curr.data(), rh.data(), utc, utc_offset.data(), out.data());
+		for (std::uint32_t i = 0; i < count; i++) {
+			const unsigned long lst = (unsigned long)lst_of(utc, i);
+			double expected, reference;
+			fwi.HourlyFFMC_Lawson_Batch(1, &prev[i], &curr[i], &rh[i], lst, &expected);
+			fwi.HourlyFFMC_Lawson(prev[i], curr[i], 0.0, 0.0, rh[i], 0.0, lst, &reference);
+			same(out[i], expected);
+			close(out[i], reference);
+		}
+		fwi.HourlyFFMC_Lawson_Contiguous_UTC_Batch(count, prev.data(), curr.data(), rh_0.data(), rh.data(), rh_1.data(), utc, utc_offset.data(), out.data());
+		for (std::uint32_t i = 0; i < count; i++) {
+			const unsigned long lst = (unsigned long)lst_of(utc, i);
+			double expected, reference;
+			fwi.HourlyFFMC_Lawson_Contiguous_Batch(1, &prev[i], &curr[i], &rh_0[i], &rh[i], &rh_1[i], lst, &expected);
+			fwi.HourlyFFMC_Lawson_Contiguous(prev[i], curr[i], 0.0, 0.0, rh_0[i], rh[i], rh_1[i], 0.0, lst, &reference);
+			same(out[i], expected);
+			close(out[i], reference);
+		}
+		fwi.HourlyFWI_UTC_Batch(count, isi.data(), prev_bui.data(), curr_bui.data(), utc, utc_offset.data(), out.data());
+		for (std::uint32_t i = 0; i < count; i++) {
+			const double *bui = (lst_of(utc, i) < 12 * 60 * 60) ? &prev_bui[i] : &curr_bui[i];
+			double expected, reference;
+			fwi.FWI_Batch(1, &isi[i], bui, &expected);
+			fwi.FWI(isi[i], *bui, &reference);
+			same(out[i], expected);
+			close(out[i], reference);
+		}
+
+		// and FWICalculations, against a station at a time on its local clock, so the noon switch is 13:00 with daylight savings
+		FWICalculationSettings settings;
+		settings.month = 6;
+		settings.hourly = true;
+		settings.van_wagner = ((minute / 7) % 3) != 0;
+		settings.lawson_previous_hour = ((minute / 7) % 3) == 2;
+		settings.utc = true;
+		settings.hour = (std::uint16_t)((utc / (60 * 60)) % 24);
+		settings.minute = (std::uint16_t)((utc / 60) % 60);
+		settings.second = (std::uint16_t)(utc % 60);
+		calculations.Calculate_Batch(settings, count, in.data(), nullptr, calculated.data());
+		for (std::uint32_t i = 0; i < count; i++) {
+			std::int64_t clock = lst_of(utc, i) + dst[i];
+			FWIStationInputs station = in[i];
+			const bool next_date = (clock >= 24 * 60 * 60);
+			if (next_date) {
+				// the local clock has gone on to the next date, whose yesterday is the LST date's codes, so
+				// only the hourly codes compare
+				clock -= 24 * 60 * 60;
+				station.yesterday_ffmc = calculated[i].ffmc;
+				station.yesterday_dmc = calculated[i].dmc;
+				station.yesterday_dc = calculated[i].dc;
+			}
+			FWICalculationSettings local = settings;
+			local.utc = false;
+			local.dst = dst[i];
+			local.hour = (std::uint16_t)(clock / (60 * 60));
+			local.minute = (std::uint16_t)((clock / 60) % 60);
+			local.second = (std::uint16_t)(clock % 60);
+			FWIStationOutputs expected;
+			calculations.Calculate(local, station, &expected);
+			if (!next_date) {
+				same(calculated[i].ffmc, expected.ffmc);
+				same(calculated[i].dmc, expected.dmc);
+				same(calculated[i].dc, expected.dc);
+				same(calculated[i].bui, expected.bui);
+				same(calculated[i].isi, expected.isi);
+				same(calculated[i].fwi, expected.fwi);
+				same(calculated[i].dsr, expected.dsr);
+			}
+			same(calculated[i].hourly_ffmc, expected.hourly_ffmc);
+			same(calculated[i].hourly_isi, expected.hourly_isi);
+			same(calculated[i].hourly_fwi, expected.hourly_fwi);
+			same(calculated[i].previous_hourly_ffmc, expected.previous_hourly_ffmc);
+		}
+	}
+	printf("UTC batches       %" PRIu32 " stations, %" PRIu64 " values compared with the LST calls\n", count, compared);
+	printf("  one at a time   %s\n", differ ? "DIFFERS" : "identical");
+	return !differ;
+}
+
+
+// replays a station's record of many years on several threads, with no tolerance, and requires the codes to be those of
+// a plain day by day loop bit for bit, carried over the winters and restarted each year
+static bool check_replay(const FWIClimateRegime &regime, std::uint64_t seed, std::uint32_t years, const FWIRegionalFactors *registry) {
+	const std::uint32_t count = years * 365;
+	FWIWeatherGenerator weather(seed, regime, 1);
+	double latitude, longitude;
+	weather.Location(&latitude, &longitude);
+	FWICellFactors factors;
+	(registry ? *registry : FWIRegionalFactors()).Resolve(1, &latitude, &longitude, &factors);
+
+	// the generator carries on past the season, so this is every day of the year; a few days are invalid, to check
+	// the codes restart after them as they would in a loop
+	std::vector<FWIClimatologyDay> days(count);
+	std::uint16_t year = 1990, last_doy = 0;
+	std::uint64_t rng = seed;
+	for (std::uint32_t d = 0; d < count; d++) {
+		FWIGeneratedDay wx;
+		weather.NextDay(&wx);
+		if (d && (wx.day_of_year < last_doy))
+			year++;
+		last_doy = wx.day_of_year;
+		rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+		days[d] = { year, wx.month, wx.temperature[0], wx.rh[0], wx.ws[0], ((rng >> 40) % 500) ? wx.rain[0] : -1.0 };
+	}
+
+	CCWFGM_FWI fwi;
+	bool ok = true;
+	std::vector<double> expected((std::size_t)count * FWI_CODE_COUNT), codes(expected.size());
+	for (int restart = 0; restart < 2; restart++) {
+		FWIReplaySettings settings;
+		settings.restart_each_year = (restart != 0);
+		settings.tolerance = 0.0;
+
+		// the sequential loop, following FWIClimatology: a code that fails restarts from its startup value
+		double ffmc = settings.start_ffmc, dmc = settings.start_dmc, dc = settings.start_dc, out[FWI_CODE_COUNT];
+		for (std::uint32_t d = 0; d < count; d++) {
+			if (settings.restart_each_year && d && (days[d].year != days[d - 1].year)) {
+				ffmc = settings.start_ffmc;
+				dmc = settings.start_dmc;
+				dc = settings.start_dc;
+			}
+			fwi.DailyCodes_Batch(1, &ffmc, &dmc, &dc, &days[d].rain, &days[d].temperature, &days[d].rh, &days[d].ws, factors, 0, days[d].month,
+				&out[(int)FWICode::FFMC], &out[(int)FWICode::DMC], &out[(int)FWICode::DC], &out[(int)FWICode::BUI], &out[(int)FWICode::ISI], &out[(int)FWICode::FWI], &out[(int)FWICode::DSR]);
+			for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+				expected[(std::size_t)c * count + d] = out[c];
+			ffmc = (out[(int)FWICode::FFMC] < 0.0) ? settings.start_ffmc : out[(int)FWICode::FFMC];
+			dmc = (out[(int)FWICode::DMC] < 0.0) ? settings.start_dmc : out[(int)FWICode::DMC];
+			dc = (out[(int)FWICode::DC] < 0.0) ? settings.start_dc : out[(int)FWICode::DC];
+		}
+
+		static const std::uint32_t threads[] = { 1, 2, 4, 7 }, chunk_days[] = { 0, 30, 365, 1000 };
+		std::uint64_t repaired = 0, runs = 0, differ = 0;
+		for (std::uint32_t t : threads)
+			for (std::uint32_t c : chunk_days) {
+				settings.threads = t;
+				settings.chunk_days = c;
+				FWIHistoryReplay replay(settings);
+				std::fill(codes.begin(), codes.end(), 0.0);
+				if (FAILED(replay.Run(count, days.data(), latitude, &factors, 0, codes.data()))) {
+					printf("history replay    FAILED with %" PRIu32 " threads, %" PRIu32 " day chunks\n", t, c);
+					return false;
+				}
+				runs++;
+				repaired += replay.Statistics().repaired_chunks;
+				if (memcmp(codes.data(), expected.data(), codes.size() * sizeof(double))) {
+					printf("  %" PRIu32 " threads, %" PRIu32 " day chunks  DIFFERS\n", t, c);
+					differ++;
+				}
+			}
+		printf("history replay    %" PRIu32 " years, %s, %" PRIu64 " runs (%" PRIu64 " chunks repaired)\n", years, settings.restart_each_year ? "restarted each year" : "carried over the winters", runs, repaired);
+		printf("  sequential      %s\n", differ ? "DIFFERS" : "identical");
+		ok = ok && (!differ);
+	}
+	return ok;
+}
+
+
+int main(int argc, char *argv[]) {
+	FWIClimate climate = FWIClimate::BOREAL;
+	std::string regime_name = "boreal";
+	std::uint32_t cells = 10000, seasons = 1, mc_samples = 0, replay_years = 0;
+	std::uint64_t seed = 20230401;
+	const char *golden = nullptr, *verify = nullptr, *factors_file = nullptr, *history_file = nullptr;
+	bool downscale = false, quantized = false, check_allocations = false, reproducible = false, result_cache = false, aggregator = false, utc = false;
+
+	for (int i = 1; i < argc; i++) {
+		const bool has_value = (i + 1 < argc);
+		if (!strcmp(argv[i], "--regime") && has_value) {
+			regime_name = argv[++i];
+			if (regime_name == "boreal")		climate = FWIClimate::BOREAL;
+			else if (regime_name == "prairie")	climate = FWIClimate::PRAIRIE;
+			else if (regime_name == "southern")	climate = FWIClimate::SOUTHERN_HEMISPHERE;
+			else					return usage(argv[0]);
+		}
+		else if (!strcmp(argv[i], "--cells") && has_value)	cells = (std::uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--seasons") && has_value)	seasons = (std::uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--seed") && has_value)	seed = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--factors") && has_value)	factors_file = argv[++i];
+		else if (!strcmp(argv[i], "--downscale"))		downscale = true;
+		else if (!strcmp(argv[i], "--quantized"))		quantized = true;
+		else if (!strcmp(argv[i], "--history") && has_value)	history_file = argv[++i];
+		else if (!strcmp(argv[i], "--monte-carlo") && has_value) mc_samples = (std::uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--result-cache"))		result_cache = true;
+		else if (!strcmp(argv[i], "--aggregator"))		aggregator = true;
+		else if (!strcmp(argv[i], "--utc"))			utc = true;
+		else if (!strcmp(argv[i], "--replay") && has_value)	replay_years = (std::uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--check-allocations"))	check_allocations = true;
+		else if (!strcmp(argv[i], "--reproducible"))		reproducible = true;
+		else if (!strcmp(argv[i], "--golden") && has_value)	golden = argv[++i];
+		else if (!strcmp(argv[i], "--verify") && has_value)	verify = argv[++i];
+		else							return usage(argv[0]);
+	}
+	if ((!cells) || (!seasons))
+		return usage(argv[0]);
+
+	if (reproducible)
+		CCWFGM_FWI::SetKernelMode(FWIKernelMode::REPRODUCIBLE);
+	CCWFGM_FWI fwi;
+	const char *variant = "?";
+	fwi.KernelVariant(&variant);
+
+	FWIRegionalFactors registry;
+	if (factors_file) {
+		std::uint32_t line;
+		HRESULT hr = registry.Load(factors_file, &line);
+		if (FAILED(hr)) {
+			if (hr == E_INVALIDARG)
+				fprintf(stderr, "%s:%" PRIu32 ": invalid regional factor configuration\n", factors_file, line);
+			else
+				fprintf(stderr, "cannot read %s\n", factors_file);
+			return 1;
+		}
+	}
+
+	const FWIClimateRegime regime = FWIClimateRegime::Regime(climate);
+	double stage_time[STAGE_COUNT] = { 0.0 };
+	checksum sums[CODE_COUNT];
+	for (auto &c : sums)
+		c.exact = reproducible;
+	std::uint64_t cell_days = 0, failures = 0, steady_allocations = 0;
+
+	std::vector<double> latitude(cells), longitude(cells);
+	std::vector<double> ffmc(cells), dmc(cells), dc(cells), bui(cells), isi(cells), fwi_d(cells), dsr(cells);
+	std::vector<double> prev_ffmc(cells), prev_dmc(cells), prev_dc(cells), prev_bui(cells);
+	std::vector<double> h_temp(cells), h_rh(cells), h_ws(cells), h_rain(cells), h_rh_prev(cells), h_rh_next(cells), scratch(cells);
+	std::vector<double> ws_min(cells), ws_max(cells);
+	std::vector<double> hffmc_vw(cells), hffmc_prev(cells), hffmc_lawson(cells), hisi(cells), hfwi(cells);
+
+	// the fixed point chain, indexed by FWICode (the DMC and DC in their 32 bit state form), and the largest difference
+	// of each code from the double chain
+	const std::size_t q_cells = quantized ? cells : 0;
+	std::vector<std::uint16_t> q_prev_ffmc(q_cells), q_codes[FWI_CODE_COUNT];
+	std::vector<std::uint32_t> q_prev_dmc(q_cells), q_prev_dc(q_cells), q_dmc(q_cells), q_dc(q_cells);
+	for (auto &v : q_codes)
+		v.resize(q_cells);
+	double q_drift[FWI_CODE_COUNT] = { 0.0 };
+	std::uint64_t q_missing = 0;
+
+	// a day of every cell's codes as they're appended to the history, the daily codes in FWICode order
+	FWIStationHistory history;
+	history_hash appended;
+	const std::size_t h_cells = history_file ? cells : 0;
+	std::vector<std::uint16_t> h_daily(h_cells * FWI_CODE_COUNT), h_hourly(h_cells * FWI_HISTORY_HOURLY_VALUES);
+	if (history_file && FAILED(history.Create(history_file, cells, true))) {
+		fprintf(stderr, "can't write %s\n", history_file);
+		return 1;
+	}
+	auto history_hour = [&](std::uint16_t hour, const double *h_ffmc) {
+		stage_timer t(stage_time[STAGE_HISTORY]);
+		std::uint16_t *q = h_hourly.data() + (std::size_t)hour * FWI_HISTORY_HOURLY_CODES * cells;
+		FWIQuantized::Quantize(FWICode::FFMC, cells, h_ffmc, q);
+		FWIQuantized::Quantize(FWICode::ISI, cells, hisi.data(), q + cells);
+		FWIQuantized::Quantize(FWICode::FWI, cells, hfwi.data(), q + 2 * cells);
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+	for (std::uint32_t season = 0; season < seasons; season++) {
+		FWIWeatherGenerator weather(seed + season, regime, cells);
+		weather.Location(latitude.data(), longitude.data());
+		FWIDownscaler downscaler(cells, latitude.data());
+		FWICellFactors factors;
+		if (FAILED(registry.Resolve(cells, latitude.data(), longitude.data(), &factors)))
+			failures++;
+
+		// standard start up values
+		std::fill(prev_ffmc.begin(), prev_ffmc.end(), 85.0);
+		std::fill(prev_dmc.begin(), prev_dmc.end(), 6.0);
+		std::fill(prev_dc.begin(), prev_dc.end(), 15.0);
+		std::fill(hffmc_prev.begin(), hffmc_prev.end(), 85.0);
+		fwi.BUI_Batch(cells, prev_dc.data(), prev_dmc.data(), prev_bui.data());
+		std::fill(q_prev_ffmc.begin(), q_prev_ffmc.end(), FWIQuantized::Quantize(FWICode::FFMC, 85.0));
+		std::fill(q_prev_dmc.begin(), q_prev_dmc.end(), FWIQuantized::QuantizeState(FWICode::DMC, 6.0));
+		std::fill(q_prev_dc.begin(), q_prev_dc.end(), FWIQuantized::QuantizeState(FWICode::DC, 15.0));
+
+		for (std::uint32_t day = 0; day < regime.season_length; day++) {
+			// the first day of a season is the warm up
+			std::uint64_t *const steady = (check_allocations && day) ? &steady_allocations : nullptr;
+			FWIGeneratedDay wx;
+			{
+				stage_timer t(stage_time[STAGE_WEATHER]);
+				weather.NextDay(&wx);
+			}
+			if (steady) {
+				// the single value forms, for one cell
+				stage_timer t(stage_time[STAGE_DAILY], steady);
+				double v;
+				fwi.DailyFFMC_VanWagner(prev_ffmc[0], wx.rain[0], wx.temperature[0], wx.rh[0], wx.ws[0], &v);
+				fwi.HourlyFFMC_VanWagner(prev_ffmc[0], wx.rain[0] / 24.0, wx.temperature[0], wx.rh[0], wx.ws[0], 60 * 60, &v);
+				fwi.DMC(prev_dmc[0], wx.rain[0], wx.temperature[0], latitude[0], longitude[0], wx.month, wx.rh[0], &v);
+				fwi.DC(prev_dc[0], wx.rain[0], wx.temperature[0], latitude[0], longitude[0], wx.month, &v);
+				fwi.ISI_FWI(prev_ffmc[0], wx.ws[0], 24 * 60 * 60, &v);
+				fwi.BUI(prev_dc[0], prev_dmc[0], &v);
+				fwi.FWI(v, prev_bui[0], &v);
+				fwi.DSR(v, &v);
+			}
+			{
+				stage_timer t(stage_time[STAGE_DAILY], steady);
+				if (FAILED(fwi.DailyCodes_Batch(cells, prev_ffmc.data(), prev_dmc.data(), prev_dc.data(), wx.rain, wx.temperature, wx.rh, wx.ws,
+				    factors, 0, wx.month, ffmc.data(), dmc.data(), dc.data(), bui.data(), isi.data(), fwi_d.data(), dsr.data())))
+					failures++;
+			}
+			if (quantized) {
+				{
+					stage_timer t(stage_time[STAGE_DAILY_QUANTIZED], steady);
+					if (FAILED(fwi.DailyCodes_Quantized_Batch(cells, q_prev_ffmc.data(), q_prev_dmc.data(), q_prev_dc.data(), wx.rain, wx.temperature, wx.rh, wx.ws, factors, 0, wx.month,
+					    q_codes[(int)FWICode::FFMC].data(), q_dmc.data(), q_dc.data(), q_codes[(int)FWICode::BUI].data(),
+					    q_codes[(int)FWICode::ISI].data(), q_codes[(int)FWICode::FWI].data(), q_codes[(int)FWICode::DSR].data())))
+						failures++;
+				}
+				stage_timer t(stage_time[STAGE_CHECKSUM]);
+				// the DMC and DC as they'd be archived
+				FWIQuantized::NarrowState(FWICode::DMC, cells, q_dmc.data(), q_codes[(int)FWICode::DMC].data());
+				FWIQuantized::NarrowState(FWICode::DC, cells, q_dc.data(), q_codes[(int)FWICode::DC].data());
+				const double *d[FWI_CODE_COUNT] = { ffmc.data(), dmc.data(), dc.data(), isi.data(), bui.data(), fwi_d.data(), dsr.data() };
+				for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+					for (std::uint32_t i = 0; i < cells; i++) {
+						if ((q_codes[c][i] == FWIQuantized::MISSING) != (d[c][i] < 0.0)) {
+							q_missing++;
+							continue;
+						}
+						const double diff = std::fabs(FWIQuantized::Dequantize((FWICode)c, q_codes[c][i]) - d[c][i]);
+						if (diff > q_drift[c])
+							q_drift[c] = diff;
+					}
+				q_prev_ffmc.swap(q_codes[(int)FWICode::FFMC]);
+				q_prev_dmc.swap(q_dmc);
+				q_prev_dc.swap(q_dc);
+			}
+
+			if (downscale) {
+				{
+					stage_timer t(stage_time[STAGE_WEATHER], steady);
+					for (std::uint32_t i = 0; i < cells; i++) {
+						ws_min[i] = 0.6 * wx.ws[i];
+						ws_max[i] = 1.2 * wx.ws[i];
+					}
+					FWIDailyWeather daily = { wx.day_of_year, wx.min_temperature, wx.max_temperature, wx.rh, ws_min.data(), ws_max.data(), wx.rain };
+					if (FAILED(downscaler.SetDay(daily)))
+						failures++;
+				}
+				for (std::uint16_t hour = 0; hour < 24; hour++) {
+					{
+						// the hourly weather is generated inside this stage, a block of cells at a time
+						stage_timer t(stage_time[STAGE_HOURLY_VANWAGNER], steady);
+						if (FAILED(downscaler.HourlyFFMC_VanWagner(hour, hffmc_prev.data(), hisi.data(), (hour < 12) ? prev_bui.data() : bui.data(), hfwi.data())))
+							failures++;
+					}
+					if (history_file)
+						history_hour(hour, hffmc_prev.data());
+					{
+						stage_timer t(stage_time[STAGE_HOURLY_LAWSON], steady);
+						if (FAILED(downscaler.HourlyFFMC_Lawson(hour, prev_ffmc.data(), ffmc.data(), hffmc_lawson.data(), nullptr, nullptr, nullptr)))
+							failures++;
+					}
+					{
+						stage_timer t(stage_time[STAGE_CHECKSUM]);
+						sums[CODE_HFFMC_VW].add(hffmc_prev.data(), cells);
+						sums[CODE_HFFMC_LAWSON].add(hffmc_lawson.data(), cells);
+						sums[CODE_HISI].add(hisi.data(), cells);
+						sums[CODE_HFWI].add(hfwi.data(), cells);
+					}
+				}
+			}
+			else {
+				{
+					stage_timer t(stage_time[STAGE_WEATHER]);
+					weather.Hourly(0, h_temp.data(), h_rh_prev.data(), h_ws.data(), h_rain.data());
+				}
+				for (std::uint16_t hour = 0; hour < 24; hour++) {
+					{
+						stage_timer t(stage_time[STAGE_WEATHER]);
+						weather.Hourly(hour, h_temp.data(), h_rh.data(), h_ws.data(), h_rain.data());
+						if (hour < 23)
+							weather.Hourly(hour + 1, scratch.data(), h_rh_next.data(), scratch.data(), scratch.data());
+						else
+							h_rh_next = h_rh;
+					}
+					{
+						stage_timer t(stage_time[STAGE_HOURLY_VANWAGNER], steady);
+						if (FAILED(fwi.HourlyFFMC_VanWagner_Batch(cells, hffmc_prev.data(), h_rain.data(), h_temp.data(), h_rh.data(), h_ws.data(), 60 * 60, hffmc_vw.data())))
+							failures++;
+					}
+					{
+						stage_timer t(stage_time[STAGE_HOURLY_LAWSON], steady);
+						if (FAILED(fwi.HourlyFFMC_Lawson_Contiguous_Batch(cells, prev_ffmc.data(), ffmc.data(), h_rh_prev.data(), h_rh.data(), h_rh_next.data(), hour * 60 * 60, hffmc_lawson.data())))
+							failures++;
+					}
+					{
+						// before noon LST the hourly FWI uses yesterday's BUI, the same rule as FWICalculations
+						stage_timer t(stage_time[STAGE_HOURLY_ISI_FWI], steady);
+						fwi.ISI_FWI_Batch(cells, hffmc_vw.data(), h_ws.data(), 60 * 60, hisi.data());
+						fwi.FWI_Batch(cells, hisi.data(), (hour < 12) ? prev_bui.data() : bui.data(), hfwi.data());
+					}
+					if (history_file)
+						history_hour(hour, hffmc_vw.data());
+					{
+						stage_timer t(stage_time[STAGE_CHECKSUM]);
+						sums[CODE_HFFMC_VW].add(hffmc_vw.data(), cells);
+						sums[CODE_HFFMC_LAWSON].add(hffmc_lawson.data(), cells);
+						sums[CODE_HISI].add(hisi.data(), cells);
+						sums[CODE_HFWI].add(hfwi.data(), cells);
+					}
+					hffmc_prev.swap(hffmc_vw);
+					h_rh_prev.swap(h_rh);
+				}
+			}
+
+			{
+				stage_timer t(stage_time[STAGE_CHECKSUM]);
+				sums[CODE_FFMC].add(ffmc.data(), cells);
+				sums[CODE_DMC].add(dmc.data(), cells);
+				sums[CODE_DC].add(dc.data(), cells);
+				sums[CODE_BUI].add(bui.data(), cells);
+				sums[CODE_ISI].add(isi.data(), cells);
+				sums[CODE_FWI].add(fwi_d.data(), cells);
+				sums[CODE_DSR].add(dsr.data(), cells);
+			}
+			if (history_file) {
+				const std::int32_t date = FWIStationHistory::DayNumber(2000 + (std::int32_t)season, 1, 1) + regime.season_start + (std::int32_t)day;
+				{
+					stage_timer t(stage_time[STAGE_HISTORY]);
+					const double *d[FWI_CODE_COUNT] = { ffmc.data(), dmc.data(), dc.data(), isi.data(), bui.data(), fwi_d.data(), dsr.data() };
+					for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+						FWIQuantized::Quantize((FWICode)c, cells, d[c], h_daily.data() + (std::size_t)c * cells);
+					if (FAILED(history.Append(date, cells, nullptr, h_daily.data(), h_hourly.data())))
+						failures++;
+				}
+				stage_timer t(stage_time[STAGE_CHECKSUM]);
+				for (std::uint32_t i = 0; i < cells; i++) {
+					for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+						appended.add(i, date, c, h_daily[(std::size_t)c * cells + i]);
+					for (std::uint8_t v = 0; v < FWI_HISTORY_HOURLY_VALUES; v++)
+						appended.add(i, date, FWI_CODE_COUNT + v, h_hourly[(std::size_t)v * cells + i]);
+				}
+			}
+			prev_ffmc.swap(ffmc);
+			prev_dmc.swap(dmc);
+			prev_dc.swap(dc);
+			prev_bui.swap(bui);
+			cell_days += cells;
+		}
+	}
+	const double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const double fwi_time = total - stage_time[STAGE_WEATHER] - stage_time[STAGE_CHECKSUM];
+
+	printf("regime            %s%s\n", regime_name.c_str(), downscale ? " (downscaled hourly weather)" : "");
+	printf("kernel variant    %s\n", variant);
+	printf("cells             %" PRIu32 "\n", cells);
+	printf("seasons           %" PRIu32 " x %" PRIu16 " days\n", seasons, regime.season_length);
+	printf("cell-days         %" PRIu64 "\n", cell_days);
+	printf("failed calls      %" PRIu64 "\n", failures);
+	printf("total time        %.3f s\n", total);
+	printf("cell-days/s       %.0f (FWI stages only: %.0f)\n", (double)cell_days / total, (fwi_time > 0.0) ? (double)cell_days / fwi_time : 0.0);
+	printf("peak RSS          %.1f MB\n", peak_rss_mb());
+	for (int s = 0; s < STAGE_COUNT; s++)
+		printf("  %-26s %9.3f s  %5.1f%%\n", stage_names[s], stage_time[s], 100.0 * stage_time[s] / total);
+
+	int rc = failures ? 1 : 0;
+	if (check_allocations) {
+		printf("steady state allocations %" PRIu64 "%s\n", steady_allocations, steady_allocations ? "  FAILED" : "");
+		if (steady_allocations)
+			rc = 1;
+	}
+	if (quantized) {
+		static const char *q_names[FWI_CODE_COUNT] = { "ffmc", "dmc", "dc", "isi", "bui", "fwi", "dsr" };
+		printf("fixed point drift from the double chain (largest difference)\n");
+		for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++) {
+			printf("  %-16s %.4f%s\n", q_names[c], q_drift[c], (q_drift[c] > 0.05) ? "  EXCEEDS 0.05" : "");
+			if (q_drift[c] > 0.05)
+				rc = 1;
+		}
+		if (q_missing) {
+			printf("  %" PRIu64 " values missing in only one of the chains\n", q_missing);
+			rc = 1;
+		}
+	}
+	if (history_file && (!check_history(history, history_file, appended, seed)))
+		rc = 1;
+	if (mc_samples && (!run_monte_carlo(regime, cells, seed, mc_samples, factors_file ? &registry : nullptr)))
+		rc = 1;
+	if (result_cache && (!check_result_cache(seed)))
+		rc = 1;
+	if (aggregator && (!check_aggregator(regime, cells, seed, factors_file ? &registry : nullptr)))
+		rc = 1;
+	if (utc && (!check_utc(seed)))
+		rc = 1;
+	if (replay_years && (!check_replay(regime, seed, replay_years, factors_file ? &registry : nullptr)))
+		rc = 1;
+	if (golden) {
+		FILE *f = fopen(golden, "w");
+		if (!f) {
+			fprintf(stderr, "can't write %s\n", golden);
+			return 1;
+		}
+		fprintf(f, "# fwi_season_benchmark --regime %s --cells %" PRIu32 " --seasons %" PRIu32 " --seed %" PRIu64 "%s\n", regime_name.c_str(), cells, seasons, seed, downscale ? " --downscale" : "");
+		for (int c = 0; c < CODE_COUNT; c++)
+			fprintf(f, "%s %016" PRIx64 " %.17g\n", code_names[c], sums[c].hash, sums[c].sum);
+		fclose(f);
+		printf("golden checksums written to %s\n", golden);
+	}
+	if (verify) {
+		FILE *f = fopen(verify, "r");
+		if (!f) {
+			fprintf(stderr, "can't read %s\n", verify);
+			return 1;
+		}
+		char line[256], name[64];
+		std::uint64_t hash;
+		double sum;
+		int matched = 0;
+		while (fgets(line, sizeof(line), f)) {
+			if ((line[0] == '#') || (sscanf(line, "%63s %" SCNx64 " %lf", name, &hash, &sum) != 3))
+				continue;
+			for (int c = 0; c < CODE_COUNT; c++) {
+				if (strcmp(name, code_names[c]))
+					continue;
+				matched++;
+				if (hash == sums[c].hash)
+					printf("  %-16s ok\n", name);
+				else {
+					printf("  %-16s MISMATCH, sum %.17g, expected %.17g (relative difference %.3g)\n", name, sums[c].sum, sum,
+						std::fabs(sums[c].sum - sum) / ((std::fabs(sum) > 0.0) ? std::fabs(sum) : 1.0));
+					rc = 1;
+				}
+			}
+		}
+		fclose(f);
+		if (matched != CODE_COUNT) {
+			printf("%s doesn't cover every code\n", verify);
+			rc = 1;
+		}
+		printf("verification against %s %s\n", verify, rc ? "FAILED" : "passed");
+	}
+	return rc;
+}
@@ -19,6 +19,12 @@
 #include "intel_check.h"
 #include "CWFGM_FWI.h"
 #include "fwi.h"
+#include "fwi_kernels.h"
+#include "fwi_shadow.h"
+#include "FWIQuantized.h"
+#include "FWIRegionalFactors.h"
+#include "FWITrace.h"
+#include "FWIWeatherIntermediates.h"
 #include "types.h"
 
 #ifndef TRUE
@@ -276,3 +282,468 @@ HRESULT CCWFGM_FWI::DSR(double fwi, double *dsr) {
 	}
 	return S_OK;
 }
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Batch forms, these hand the arrays straight to the kernel variant chosen for this CPU
+
+static bool any_failed(std::uint32_t count, const double *values) {
+	bool failed = false;
+	for (std::uint32_t i = 0; i < count; i++)
+		failed |= (values[i] < 0.0);
+	return failed;
+}
+
+
+static bool any_failed(std::uint32_t count, const std::uint16_t *values) {
+	bool failed = false;
+	for (std::uint32_t i = 0; i < count; i++)
+		failed |= (values[i] == FWIQuantized::MISSING);
+	return failed;
+}
+
+
+// the UTC forms work through their arrays this many elements at a time, resolving each element's LST into a stack array
+static const std::uint32_t LST_BLOCK = 256;
+
+
+static void lst_seconds(std::uint32_t count, std::int64_t utc, const std::int32_t *utc_offset, std::int32_t *seconds_into_day) {
+	const std::int64_t day = 24 * 60 * 60;
+	for (std::uint32_t i = 0; i < count; i++) {
+		const std::int64_t seconds = (utc + utc_offset[i]) % day;
+		seconds_into_day[i] = (std::int32_t)((seconds < 0) ? (seconds + day) : seconds);
+	}
+}
+
+
+static void shadow_lawson(std::uint32_t count, const double *prev, const double *curr, const double *rh_0, const double *rh_t, const double *rh_1, bool contiguous,
+	std::int64_t seconds_into_day, const std::int32_t *seconds, const double *ffmc) {
+	fwi_shadow(count, [&](std::uint32_t i, fwi_shadow_sample &s) {
+		s.kernel = fwi_shadow_kernel::HOURLY_FFMC_LAWSON;
+		s.flag = contiguous;
+		s.seconds = seconds ? seconds[i] : seconds_into_day;
+		s.in[0] = prev[i];
+		s.in[1] = curr[i];
+		s.in[2] = rh_0[i];
+		s.in[3] = rh_t[i];
+		s.in[4] = rh_1[i];
+		s.in[5] = contiguous ? 1.0 : 0.0;
+		s.out[0] = ffmc[i];
+	});
+}
+
+
+static void shadow_pair(fwi_shadow_kernel kernel, std::uint32_t count, const double *a, const double *b, std::int64_t seconds, const double *out) {
+	fwi_shadow(count, [&](std::uint32_t i, fwi_shadow_sample &s) {
+		s.kernel = kernel;
+		s.seconds = seconds;
+		s.in[0] = a[i];
+		s.in[1] = b[i];
+		s.out[0] = out[i];
+	});
+}
+
+
+HRESULT CCWFGM_FWI::DailyCodes_Batch(std::uint32_t count, const double *in_ffmc, const double *in_dmc, const double *in_dc, const double *rain, const double *temperature, const double *rh, const double *ws,
+	const double *latitude, const double * /*longitude*/, unsigned short month, double *ffmc, double *dmc, double *dc, double *bui, double *isi, double *fwi, double *dsr) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc) || (!in_dmc) || (!in_dc) || (!rain) || (!temperature) || (!rh) || (!ws) || (!latitude) ||
+	    (!ffmc) || (!dmc) || (!dc) || (!bui) || (!isi) || (!fwi))
+		return E_POINTER;
+	if (month > 11)
+		return E_INVALIDARG;
+
+	FWITraceSpan span("DailyCodes_Batch", "count", count);
+
+	// the built-in tables, resolved a block at a time - callers with a fixed set of locations should resolve once with
+	// FWIRegionalFactors and use the other form
+	const std::uint32_t block = 256;
+	double el[block], fl[block];
+	for (std::uint32_t start = 0; start < count; start += block) {
+		const std::uint32_t n = ((count - start) < block) ? (count - start) : block;
+		for (std::uint32_t i = 0; i < n; i++) {
+			el[i] = calc_el_table(latitude[start + i])[month];
+			fl[i] = calc_fl_table(latitude[start + i])[month];
+		}
+		fwi_daily_inputs in = { in_ffmc + start, in_dmc + start, in_dc + start, rain + start, temperature + start, rh + start, ws + start, el, fl };
+		fwi_daily_outputs out = { ffmc + start, dmc + start, dc + start, bui + start, isi + start, fwi + start, dsr ? (dsr + start) : nullptr };
+		fwi_kernels().daily_chain(n, in, out);
+		fwi_shadow_daily(n, in, out);
+	}
+	if (any_failed(count, fwi))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::DailyCodes_Batch(std::uint32_t count, const double *in_ffmc, const double *in_dmc, const double *in_dc, const double *rain, const double *temperature, const double *rh, const double *ws,
+	const FWICellFactors &factors, std::uint32_t first_cell, unsigned short month, double *ffmc, double *dmc, double *dc, double *bui, double *isi, double *fwi, double *dsr) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc) || (!in_dmc) || (!in_dc) || (!rain) || (!temperature) || (!rh) || (!ws) ||
+	    (!ffmc) || (!dmc) || (!dc) || (!bui) || (!isi) || (!fwi))
+		return E_POINTER;
+	if ((month > 11) || (first_cell > factors.Cells()) || (count > (factors.Cells() - first_cell)))
+		return E_INVALIDARG;
+
+	FWITraceSpan span("DailyCodes_Batch", "count", count);
+	fwi_daily_inputs in = { in_ffmc, in_dmc, in_dc, rain, temperature, rh, ws, factors.EL(month) + first_cell, factors.FL(month) + first_cell };
+	fwi_daily_outputs out = { ffmc, dmc, dc, bui, isi, fwi, dsr };
+	fwi_kernels().daily_chain(count, in, out);
+	fwi_shadow_daily(count, in, out);
+	if (any_failed(count, fwi))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::DailyCodes_Quantized_Batch(std::uint32_t count, const std::uint16_t *in_ffmc, const std::uint32_t *in_dmc, const std::uint32_t *in_dc, const double *rain, const double *temperature, const double *rh, const double *ws,
+	const FWICellFactors &factors, std::uint32_t first_cell, unsigned short month, std::uint16_t *ffmc, std::uint32_t *dmc, std::uint32_t *dc, std::uint16_t *bui, std::uint16_t *isi, std::uint16_t *fwi, std::uint16_t *dsr) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc) || (!in_dmc) || (!in_dc) || (!rain) || (!temperature) || (!rh) || (!ws) ||
+	    (!ffmc) || (!dmc) || (!dc) || (!bui) || (!isi) || (!fwi))
+		return E_POINTER;
+	if ((month > 11) || (first_cell > factors.Cells()) || (count > (factors.Cells() - first_cell)))
+		return E_INVALIDARG;
+
+	FWITraceSpan span("DailyCodes_Quantized_Batch", "count", count);
+	fwi_daily_inputs_q16 in = { in_ffmc, in_dmc, in_dc, rain, temperature, rh, ws, factors.EL(month) + first_cell, factors.FL(month) + first_cell };
+	fwi_daily_outputs_q16 out = { ffmc, dmc, dc, bui, isi, fwi, dsr };
+	fwi_kernels().daily_chain_q16(count, in, out);
+	fwi_shadow(count, [&](std::uint32_t i, fwi_shadow_sample &s) {
+		s.kernel = fwi_shadow_kernel::QUANTIZED_DAILY;
+		s.flag = (dsr != nullptr);
+		s.seconds = 24 * 60 * 60;
+		const double in_values[FWIShadowSample::INPUTS] = { FWIQuantized::Dequantize(FWICode::FFMC, in_ffmc[i]), FWIQuantized::DequantizeState(in_dmc[i]), FWIQuantized::DequantizeState(in_dc[i]),
+			rain[i], temperature[i], rh[i], ws[i], in.el[i], in.fl[i] };
+		std::copy(in_values, in_values + FWIShadowSample::INPUTS, s.in);
+		const double out_values[7] = { FWIQuantized::Dequantize(FWICode::FFMC, ffmc[i]), FWIQuantized::DequantizeState(dmc[i]), FWIQuantized::DequantizeState(dc[i]),
+			FWIQuantized::Dequantize(FWICode::BUI, bui[i]), FWIQuantized::Dequantize(FWICode::ISI, isi[i]), FWIQuantized::Dequantize(FWICode::FWI, fwi[i]),
+			dsr ? FWIQuantized::Dequantize(FWICode::DSR, dsr[i]) : 0.0 };
+		std::copy(out_values, out_values + 7, s.out);
+	});
+	if (any_failed(count, fwi))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::HourlyFFMC_VanWagner_Batch(std::uint32_t count, const double *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws,
+	std::uint32_t seconds_since_ffmc, double *ffmc) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc) || (!rain) || (!temperature) || (!rh) || (!ws) || (!ffmc))
+		return E_POINTER;
+	if (seconds_since_ffmc > (2 * 60 * 60))
+		return E_INVALIDARG;
+
+	FWITraceSpan span("HourlyFFMC_VanWagner_Batch", "count", count);
+	fwi_kernels().hourly_ffmc_vanwagner(count, in_ffmc, rain, temperature, rh, ws, seconds_since_ffmc, ffmc);
+	fwi_shadow(count, [&](std::uint32_t i, fwi_shadow_sample &s) {
+		s.kernel = fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER;
+		s.seconds = seconds_since_ffmc;
+		s.in[0] = in_ffmc[i];
+		s.in[1] = rain[i];
+		s.in[2] = temperature[i];
+		s.in[3] = rh[i];
+		s.in[4] = ws[i];
+		s.out[0] = ffmc[i];
+	});
+	if (any_failed(count, ffmc))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::HourlyFFMC_VanWagner_Equilibrium_Batch(std::uint32_t count, const double *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws,
+	std::uint32_t seconds_since_ffmc, double tolerance, double *ffmc, std::uint32_t *converged) const {
+	if (converged)
+		*converged = 0;
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc) || (!rain) || (!temperature) || (!rh) || (!ws) || (!ffmc))
+		return E_POINTER;
+	if ((seconds_since_ffmc > (2 * 60 * 60)) || (!(tolerance >= 0.0)))
+		return E_INVALIDARG;
+
+	FWITraceSpan span("HourlyFFMC_VanWagner_Equilibrium_Batch", "count", count);
+	const std::size_t c = fwi_kernels().hourly_ffmc_vanwagner_equilibrium(count, in_ffmc, rain, temperature, rh, ws, seconds_since_ffmc, tolerance, ffmc);
+	fwi_shadow(count, [&](std::uint32_t i, fwi_shadow_sample &s) {
+		s.kernel = fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER_EQUILIBRIUM;
+		s.seconds = seconds_since_ffmc;
+		s.in[0] = in_ffmc[i];
+		s.in[1] = rain[i];
+		s.in[2] = temperature[i];
+		s.in[3] = rh[i];
+		s.in[4] = ws[i];
+		s.in[5] = tolerance;
+		s.out[0] = ffmc[i];
+	});
+	if (converged)
+		*converged = (std::uint32_t)c;
+	if (any_failed(count, ffmc))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::HourlyFFMC_VanWagner_Quantized_Batch(std::uint32_t count, const std::uint16_t *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws,
+	std::uint32_t seconds_since_ffmc, std::uint16_t *ffmc) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc) || (!rain) || (!temperature) || (!rh) || (!ws) || (!ffmc))
+		return E_POINTER;
+	if (seconds_since_ffmc > (2 * 60 * 60))
+		return E_INVALIDARG;
+
+	FWITraceSpan span("HourlyFFMC_VanWagner_Quantized_Batch", "count", count);
+	fwi_kernels().hourly_ffmc_vanwagner_q16(count, in_ffmc, rain, temperature, rh, ws, seconds_since_ffmc, ffmc);
+	fwi_shadow(count, [&](std::uint32_t i, fwi_shadow_sample &s) {
+		s.kernel = fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER_QUANTIZED;
+		s.seconds = seconds_since_ffmc;
+		s.in[0] = FWIQuantized::Dequantize(FWICode::FFMC, in_ffmc[i]);
+		s.in[1] = rain[i];
+		s.in[2] = temperature[i];
+		s.in[3] = rh[i];
+		s.in[4] = ws[i];
+		s.out[0] = FWIQuantized::Dequantize(FWICode::FFMC, ffmc[i]);
+	});
+	if (any_failed(count, ffmc))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+static fwi_ffmc_weather ffmc_weather(const FWIWeatherIntermediates &wx, std::uint32_t first) {
+	const double *v = wx.EquilibriumDrying() + first;		// the intermediates are stored back to back, see fwi_ffmc_weather
+	const std::size_t c = wx.Count();
+	const fwi_ffmc_weather w = { v, v + c, v + 2 * c, v + 3 * c, v + 4 * c, v + 5 * c };
+	return w;
+}
+
+
+// samples a Van Wagner FFMC calculated from the intermediates, with the weather they were calculated from so the
+// reference starts from the same place
+static void shadow_wx(fwi_shadow_kernel kernel, std::uint32_t count, const double *in_ffmc, const double *rain, const FWIWeatherIntermediates &wx,
+	std::uint32_t first, std::int64_t seconds, const double *ffmc) {
+	fwi_shadow(count, [&](std::uint32_t i, fwi_shadow_sample &s) {
+		s.kernel = kernel;
+		s.seconds = seconds;
+		s.in[0] = in_ffmc[i];
+		s.in[1] = rain[i];
+		s.in[2] = wx.Temperature()[first + i];
+		s.in[3] = wx.RH()[first + i];
+		s.in[4] = wx.WS()[first + i];
+		s.out[0] = ffmc[i];
+	});
+}
+
+
+HRESULT CCWFGM_FWI::HourlyFFMC_VanWagner_Batch(std::uint32_t count, const double *in_ffmc, const double *rain, const FWIWeatherIntermediates &wx, std::uint32_t first_record,
+	std::uint32_t seconds_since_ffmc, double *ffmc) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc) || (!rain) || (!ffmc))
+		return E_POINTER;
+	if ((seconds_since_ffmc > (2 * 60 * 60)) || (first_record > wx.Count()) || (count > (wx.Count() - first_record)))
+		return E_INVALIDARG;
+
+	FWITraceSpan span("HourlyFFMC_VanWagner_Batch", "count", count);
+	fwi_kernels().hourly_ffmc_vanwagner_wx(count, in_ffmc, rain, ffmc_weather(wx, first_record), seconds_since_ffmc, ffmc);
+	shadow_wx(fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER, count, in_ffmc, rain, wx, first_record, seconds_since_ffmc, ffmc);
+	if (any_failed(count, ffmc))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::HourlyFFMC_VanWagner_Previous_Batch(std::uint32_t count, const double *in_ffmc, const double *rain, const FWIWeatherIntermediates &wx, std::uint32_t first_record, double *ffmc) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc) || (!rain) || (!ffmc))
+		return E_POINTER;
+	if ((first_record > wx.Count()) || (count > (wx.Count() - first_record)))
+		return E_INVALIDARG;
+
+	FWITraceSpan span("HourlyFFMC_VanWagner_Previous_Batch", "count", count);
+	fwi_kernels().previous_hourly_ffmc_vanwagner(count, in_ffmc, rain, ffmc_weather(wx, first_record), ffmc);
+	shadow_wx(fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER_PREVIOUS, count, in_ffmc, rain, wx, first_record, 60 * 60, ffmc);
+	if (any_failed(count, ffmc))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::DailyFFMC_VanWagner_Batch(std::uint32_t count, const double *in_ffmc, const double *rain, const FWIWeatherIntermediates &wx, std::uint32_t first_record, double *ffmc) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc) || (!rain) || (!ffmc))
+		return E_POINTER;
+	if ((first_record > wx.Count()) || (count > (wx.Count() - first_record)))
+		return E_INVALIDARG;
+
+	FWITraceSpan span("DailyFFMC_VanWagner_Batch", "count", count);
+	fwi_kernels().daily_ffmc_vanwagner_wx(count, in_ffmc, rain, ffmc_weather(wx, first_record), ffmc);
+	if (any_failed(count, ffmc))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::HourlyFFMC_Lawson_Batch(std::uint32_t count, const double *in_ffmc_prevday, const double *in_ffmc_currday, const double *rh, unsigned long seconds_into_day, double *ffmc) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc_prevday) || (!in_ffmc_currday) || (!rh) || (!ffmc))
+		return E_POINTER;
+
+	FWITraceSpan span("HourlyFFMC_Lawson_Batch", "count", count);
+	fwi_kernels().hourly_ffmc_lawson(count, in_ffmc_prevday, in_ffmc_currday, (std::int64_t)(std::int32_t)seconds_into_day, rh, rh, rh, false, ffmc);
+	shadow_lawson(count, in_ffmc_prevday, in_ffmc_currday, rh, rh, rh, false, (std::int64_t)(std::int32_t)seconds_into_day, nullptr, ffmc);
+	if (any_failed(count, ffmc))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::HourlyFFMC_Lawson_Contiguous_Batch(std::uint32_t count, const double *in_ffmc_prevday, const double *in_ffmc_currday, const double *rh_0, const double *rh_t, const double *rh_1,
+	unsigned long seconds_into_day, double *ffmc) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc_prevday) || (!in_ffmc_currday) || (!rh_0) || (!rh_t) || (!rh_1) || (!ffmc))
+		return E_POINTER;
+
+	FWITraceSpan span("HourlyFFMC_Lawson_Contiguous_Batch", "count", count);
+	fwi_kernels().hourly_ffmc_lawson(count, in_ffmc_prevday, in_ffmc_currday, (std::int64_t)(std::int32_t)seconds_into_day, rh_0, rh_t, rh_1, true, ffmc);
+	shadow_lawson(count, in_ffmc_prevday, in_ffmc_currday, rh_0, rh_t, rh_1, true, (std::int64_t)(std::int32_t)seconds_into_day, nullptr, ffmc);
+	if (any_failed(count, ffmc))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::HourlyFFMC_Lawson_UTC_Batch(std::uint32_t count, const double *in_ffmc_prevday, const double *in_ffmc_currday, const double *rh, std::int64_t utc, const std::int32_t *utc_offset,
+	double *ffmc) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc_prevday) || (!in_ffmc_currday) || (!rh) || (!utc_offset) || (!ffmc))
+		return E_POINTER;
+
+	FWITraceSpan span("HourlyFFMC_Lawson_UTC_Batch", "count", count);
+	const FwiKernelTable &k = fwi_kernels();
+	std::int32_t seconds[LST_BLOCK];
+	for (std::uint32_t first = 0; first < count; first += LST_BLOCK) {
+		const std::uint32_t n = ((count - first) < LST_BLOCK) ? (count - first) : LST_BLOCK;
+		lst_seconds(n, utc, utc_offset + first, seconds);
+		k.hourly_ffmc_lawson_lst(n, in_ffmc_prevday + first, in_ffmc_currday + first, seconds, rh + first, rh + first, rh + first, false, ffmc + first);
+		shadow_lawson(n, in_ffmc_prevday + first, in_ffmc_currday + first, rh + first, rh + first, rh + first, false, 0, seconds, ffmc + first);
+	}
+	if (any_failed(count, ffmc))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::HourlyFFMC_Lawson_Contiguous_UTC_Batch(std::uint32_t count, const double *in_ffmc_prevday, const double *in_ffmc_currday, const double *rh_0, const double *rh_t, const double *rh_1,
+	std::int64_t utc, const std::int32_t *utc_offset, double *ffmc) const {
+	if (!count)
+		return S_OK;
+	if ((!in_ffmc_prevday) || (!in_ffmc_currday) || (!rh_0) || (!rh_t) || (!rh_1) || (!utc_offset) || (!ffmc))
+		return E_POINTER;
+
+	FWITraceSpan span("HourlyFFMC_Lawson_Contiguous_UTC_Batch", "count", count);
+	const FwiKernelTable &k = fwi_kernels();
+	std::int32_t seconds[LST_BLOCK];
+	for (std::uint32_t first = 0; first < count; first += LST_BLOCK) {
+		const std::uint32_t n = ((count - first) < LST_BLOCK) ? (count - first) : LST_BLOCK;
+		lst_seconds(n, utc, utc_offset + first, seconds);
+		k.hourly_ffmc_lawson_lst(n, in_ffmc_prevday + first, in_ffmc_currday + first, seconds, rh_0 + first, rh_t + first, rh_1 + first, true, ffmc + first);
+		shadow_lawson(n, in_ffmc_prevday + first, in_ffmc_currday + first, rh_0 + first, rh_t + first, rh_1 + first, true, 0, seconds, ffmc + first);
+	}
+	if (any_failed(count, ffmc))
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::ISI_FWI_Batch(std::uint32_t count, const double *ffmc, const double *ws, std::uint32_t seconds_since_ffmc, double *isi) const {
+	if (!count)
+		return S_OK;
+	if ((!ffmc) || (!ws) || (!isi))
+		return E_POINTER;
+
+	FWITraceSpan span("ISI_FWI_Batch", "count", count);
+	fwi_kernels().isi(count, ffmc, ws, seconds_since_ffmc, isi);
+	shadow_pair(fwi_shadow_kernel::ISI, count, ffmc, ws, seconds_since_ffmc, isi);
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::BUI_Batch(std::uint32_t count, const double *dc, const double *dmc, double *bui) const {
+	if (!count)
+		return S_OK;
+	if ((!dc) || (!dmc) || (!bui))
+		return E_POINTER;
+
+	FWITraceSpan span("BUI_Batch", "count", count);
+	fwi_kernels().bui(count, dc, dmc, bui);
+	shadow_pair(fwi_shadow_kernel::BUI, count, dc, dmc, 0, bui);
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::FWI_Batch(std::uint32_t count, const double *isi, const double *bui, double *fwi) const {
+	if (!count)
+		return S_OK;
+	if ((!isi) || (!bui) || (!fwi))
+		return E_POINTER;
+
+	FWITraceSpan span("FWI_Batch", "count", count);
+	fwi_kernels().fwi(count, isi, bui, fwi);
+	shadow_pair(fwi_shadow_kernel::FWI, count, isi, bui, 0, fwi);
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::HourlyFWI_UTC_Batch(std::uint32_t count, const double *isi, const double *prev_bui, const double *curr_bui, std::int64_t utc, const std::int32_t *utc_offset, double *fwi) const {
+	if (!count)
+		return S_OK;
+	if ((!isi) || (!prev_bui) || (!curr_bui) || (!utc_offset) || (!fwi))
+		return E_POINTER;
+
+	FWITraceSpan span("HourlyFWI_UTC_Batch", "count", count);
+	const FwiKernelTable &k = fwi_kernels();
+	std::int32_t seconds[LST_BLOCK];
+	double bui[LST_BLOCK];
+	for (std::uint32_t first = 0; first < count; first += LST_BLOCK) {
+		const std::uint32_t n = ((count - first) < LST_BLOCK) ? (count - first) : LST_BLOCK;
+		lst_seconds(n, utc, utc_offset + first, seconds);
+		for (std::uint32_t i = 0; i < n; i++)
+			bui[i] = (seconds[i] < 12 * 60 * 60) ? prev_bui[first + i] : curr_bui[first + i];
+		k.fwi(n, isi + first, bui, fwi + first);
+		shadow_pair(fwi_shadow_kernel::FWI, n, isi + first, bui, 0, fwi + first);
+	}
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::KernelVariant(const char **name) const {
+	if (!name)
+		return E_POINTER;
+	*name = fwi_kernels().name;
+	return S_OK;
+}
+
+
+HRESULT CCWFGM_FWI::SetKernelMode(FWIKernelMode mode) {
+	if ((mode != FWIKernelMode::FASTEST) && (mode != FWIKernelMode::REPRODUCIBLE))
+		return E_INVALIDARG;
+	fwi_set_reproducible(mode == FWIKernelMode::REPRODUCIBLE);
+	return S_OK;
+}
+
+
+FWIKernelMode CCWFGM_FWI::KernelMode() {
+	return fwi_reproducible() ? FWIKernelMode::REPRODUCIBLE : FWIKernelMode::FASTEST;
+}
@@ -0,0 +1,187 @@
+/**
+ * WISE_FWI_Module: FWICalculations.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWICalculations.h"
+#include "FWIRegionalFactors.h"
+#include "fwi.h"
+#include "fwi_kernels.h"
+#include "fwi_shadow.h"
+
+
+// stations are transposed into stack arrays this many at a time for the kernels
+static const std::uint32_t BLOCK = 256;
+
+
+HRESULT FWICalculations::Calculate(const FWICalculationSettings &settings, const FWIStationInputs &in, FWIStationOutputs *out) const {
+	if (!out)
+		return E_POINTER;
+	return Calculate_Batch(settings, 1, &in, nullptr, out);
+}
+
+
+HRESULT FWICalculations::Calculate_Batch(const FWICalculationSettings &settings, std::uint32_t count, const FWIStationInputs *in, const FWICellFactors *factors, FWIStationOutputs *out) const {
+	if (!count)
+		return S_OK;
+	if ((!in) || (!out))
+		return E_POINTER;
+	if ((settings.month > 11) || (settings.hour > 23) || (settings.minute > 59) || (settings.second > 59))
+		return E_INVALIDARG;
+	if (factors && (factors->Cells() < count))
+		return E_INVALIDARG;
+
+	// the Lawson FFMC works in standard time, the choice of BUI for the hourly FWI on the local clock
+	// (just after midnight on daylight savings, that's the last hour of the day before, which the kernels take as negative:
+	// floor division, where the Java reference truncates ts.getHours() toward zero and lands on midnight instead)
+	const std::int64_t clock = (std::int64_t)settings.hour * 60 * 60 + settings.minute * 60 + settings.second - settings.dst;
+	const std::int64_t lawson_seconds = (((clock < 0) ? (clock - (60 * 60 - 1)) : clock) / (60 * 60)) * 60 * 60;
+	const std::int64_t isi_seconds = settings.minute * 60 + settings.second;
+	const bool yesterdays_bui = (settings.hour < ((settings.dst > 0) ? 13 : 12));
+	// or in UTC mode, both from each station's LST, which has no daylight savings to take out
+	const std::int64_t utc_clock = (std::int64_t)settings.hour * 60 * 60 + settings.minute * 60 + settings.second;
+
+	const FwiKernelTable &k = fwi_kernels();
+	double y_ffmc[BLOCK], y_dmc[BLOCK], y_dc[BLOCK], rain[BLOCK], temperature[BLOCK], rh[BLOCK], ws[BLOCK], el[BLOCK], fl[BLOCK];
+	double ffmc[BLOCK], dmc[BLOCK], dc[BLOCK], bui[BLOCK], isi[BLOCK], fwi[BLOCK], dsr[BLOCK];
+	double h_rain[BLOCK], h_temperature[BLOCK], h_rh[BLOCK], h_ws[BLOCK], h_prev[BLOCK], h_lawson_prev[BLOCK], h_ffmc[BLOCK], h_isi[BLOCK], h_fwi[BLOCK], h_bui[BLOCK];
+	double h_isi_part[BLOCK], h_b[BLOCK];
+	std::int32_t h_seconds[BLOCK], h_seconds_prev[BLOCK];
+	bool h_yesterday[BLOCK], h_part[BLOCK];
+	bool failed = false;
+
+	for (std::uint32_t first = 0; first < count; first += BLOCK) {
+		const std::uint32_t n = ((count - first) < BLOCK) ? (count - first) : BLOCK;
+		const FWIStationInputs *s = in + first;
+		for (std::uint32_t i = 0; i < n; i++) {
+			y_ffmc[i] = s[i].yesterday_ffmc;
+			y_dmc[i] = s[i].yesterday_dmc;
+			y_dc[i] = s[i].yesterday_dc;
+			rain[i] = s[i].noon_rain;
+			temperature[i] = s[i].noon_temperature;
+			rh[i] = s[i].noon_rh;
+			ws[i] = s[i].noon_ws;
+			if (factors) {
+				el[i] = factors->EL(settings.month)[first + i];
+				fl[i] = factors->FL(settings.month)[first + i];
+			}
+			else {
+				el[i] = calc_el_table(s[i].latitude)[settings.month];
+				fl[i] = calc_fl_table(s[i].latitude)[settings.month];
+			}
+		}
+
+		const fwi_daily_inputs d_in = { y_ffmc, y_dmc, y_dc, rain, temperature, rh, ws, el, fl };
+		const fwi_daily_outputs d_out = { ffmc, dmc, dc, bui, isi, fwi, dsr };
+		k.daily_chain(n, d_in, d_out);
+		fwi_shadow_daily(n, d_in, d_out);
+
+		if (settings.hourly) {
+			for (std::uint32_t i = 0; i < n; i++) {
+				h_rain[i] = s[i].hourly_rain;
+				h_temperature[i] = s[i].hourly_temperature;
+				h_rh[i] = s[i].hourly_rh;
+				h_ws[i] = s[i].hourly_ws;
+				h_prev[i] = s[i].previous_hourly_ffmc;
+			}
+
+			if (settings.utc) {
+				// each station's LST, truncated to the hour for the Lawson FFMC as above, and whether its ISI time step is a part hour
+				bool any_yesterday = false, any_part = false;
+				for (std::uint32_t i = 0; i < n; i++) {
+					std::int64_t lst = (utc_clock + s[i].utc_offset) % (24 * 60 * 60);
+					if (lst < 0)
+						lst += 24 * 60 * 60;
+					h_seconds[i] = (std::int32_t)(lst - (lst % (60 * 60)));
+					h_seconds_prev[i] = h_seconds[i] - 60 * 60;
+					h_yesterday[i] = (lst < 12 * 60 * 60);
+					h_part[i] = ((lst % (60 * 60)) != 0);
+					any_yesterday |= h_yesterday[i];
+					any_part |= h_part[i];
+				}
+
+				k.hourly_ffmc_lawson_lst(n, y_ffmc, ffmc, h_seconds_prev, h_rh, h_rh, h_rh, false, h_lawson_prev);
+				if (settings.van_wagner)
+					k.hourly_ffmc_vanwagner(n, settings.lawson_previous_hour ? h_lawson_prev : h_prev, h_rain, h_temperature, h_rh, h_ws, 60 * 60, h_ffmc);
+				else
+					k.hourly_ffmc_lawson_lst(n, y_ffmc, ffmc, h_seconds, h_rh, h_rh, h_rh, false, h_ffmc);
+				// f(F) only depends on whether the time step is a whole number of hours
+				k.isi(n, h_ffmc, h_ws, 0, h_isi);
+				if (any_part) {
+					k.isi(n, h_ffmc, h_ws, 30 * 60, h_isi_part);
+					for (std::uint32_t i = 0; i < n; i++)
+						if (h_part[i])
+							h_isi[i] = h_isi_part[i];
+				}
+
+				if (any_yesterday)
+					k.bui(n, y_dc, y_dmc, h_bui);
+				for (std::uint32_t i = 0; i < n; i++)
+					h_b[i] = h_yesterday[i] ? h_bui[i] : bui[i];
+				k.fwi(n, h_isi, h_b, h_fwi);
+				for (std::uint32_t i = 0; i < n; i++) {
+					if (h_ffmc[i] < 0.0)
+						h_isi[i] = h_fwi[i] = -98.0;
+					else if ((h_b[i] < 0.0) || (h_yesterday[i] && ((y_dc[i] < 0.0) || (y_dmc[i] < 0.0))))
+						h_fwi[i] = -98.0;
+				}
+			}
+			else {
+				k.hourly_ffmc_lawson(n, y_ffmc, ffmc, lawson_seconds - 60 * 60, h_rh, h_rh, h_rh, false, h_lawson_prev);
+				if (settings.van_wagner)
+					k.hourly_ffmc_vanwagner(n, settings.lawson_previous_hour ? h_lawson_prev : h_prev, h_rain, h_temperature, h_rh, h_ws, 60 * 60, h_ffmc);
+				else
+					k.hourly_ffmc_lawson(n, y_ffmc, ffmc, lawson_seconds, h_rh, h_rh, h_rh, false, h_ffmc);
+				k.isi(n, h_ffmc, h_ws, isi_seconds, h_isi);
+
+				// yesterday's DMC and DC are only range checked by the daily kernels, so may still be invalid here
+				const double *b = bui;
+				if (yesterdays_bui) {
+					k.bui(n, y_dc, y_dmc, h_bui);
+					b = h_bui;
+				}
+				k.fwi(n, h_isi, b, h_fwi);
+				for (std::uint32_t i = 0; i < n; i++) {
+					if (h_ffmc[i] < 0.0)
+						h_isi[i] = h_fwi[i] = -98.0;
+					else if ((b[i] < 0.0) || (yesterdays_bui && ((y_dc[i] < 0.0) || (y_dmc[i] < 0.0))))
+						h_fwi[i] = -98.0;
+				}
+			}
+		}
+
+		FWIStationOutputs *o = out + first;
+		for (std::uint32_t i = 0; i < n; i++) {
+			o[i].ffmc = ffmc[i];
+			o[i].dmc = dmc[i];
+			o[i].dc = dc[i];
+			o[i].bui = bui[i];
+			o[i].isi = isi[i];
+			o[i].fwi = fwi[i];
+			o[i].dsr = dsr[i];
+			failed |= (fwi[i] < 0.0);
+			if (settings.hourly) {
+				o[i].hourly_ffmc = h_ffmc[i];
+				o[i].hourly_isi = h_isi[i];
+				o[i].hourly_fwi = h_fwi[i];
+				o[i].previous_hourly_ffmc = h_lawson_prev[i];
+				failed |= (h_fwi[i] < 0.0);
+			}
+		}
+	}
+	return failed ? E_INVALIDARG : S_OK;
+}
@@ -0,0 +1,285 @@
+/**
+ * WISE_FWI_Module: FWIClassRaster.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIClassRaster.h"
+#include "FWIQuantized.h"
+
+#include <cstddef>
+#include <cstring>
+
+
+static const char MAGIC[8] = { 'F', 'W', 'I', 'C', 'L', 'A', 'S', '1' };
+static const std::uint32_t VERSION = 1;
+static const std::uint32_t MAX_RUN = 0xffffff;
+
+struct class_header {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t cells;
+	std::uint32_t tile_cells;
+	std::uint32_t days;
+	std::uint64_t index_offset;			// 0 until closed
+};
+
+
+FWIClassRaster::FWIClassRaster() : m_writable(false), m_cells(0), m_tile_cells(0), m_days(0), m_end(0) {
+}
+
+
+FWIClassRaster::~FWIClassRaster() {
+	Close();
+}
+
+
+std::uint32_t FWIClassRaster::TileCount(std::uint32_t tile) const {
+	if (tile >= Tiles())
+		return 0;
+	const std::uint64_t first = (std::uint64_t)tile * m_tile_cells;
+	return ((m_cells - first) < m_tile_cells) ? (std::uint32_t)(m_cells - first) : m_tile_cells;
+}
+
+
+std::uint64_t FWIClassRaster::RunBytes() const {
+	std::lock_guard<std::mutex> l(m_lock);
+	return m_end ? (m_end - sizeof(class_header)) : 0;
+}
+
+
+HRESULT FWIClassRaster::Classify(const FWIDangerClasses &classes, std::uint32_t count, const std::uint16_t *fwi, const std::uint16_t *bui, std::uint8_t *danger_class) {
+	if ((!fwi) || (!danger_class) || (classes.bui_classes && (!bui)))
+		return E_POINTER;
+
+	// compared in fixed point, as the values are stored
+	std::uint16_t f[FWI_DANGER_CLASS_COUNT - 1], b[FWI_DANGER_CLASS_COUNT - 1];
+	for (std::uint8_t k = 0; k < FWI_DANGER_CLASS_COUNT - 1; k++) {
+		f[k] = FWIQuantized::Quantize(FWICode::FWI, classes.fwi[k]);
+		b[k] = FWIQuantized::Quantize(FWICode::BUI, classes.bui[k]);
+	}
+	for (std::uint32_t i = 0; i < count; i++) {
+		const std::uint16_t v = fwi[i];
+		if ((v == FWIQuantized::MISSING) || (classes.bui_classes && (bui[i] == FWIQuantized::MISSING))) {
+			danger_class[i] = NO_DATA;
+			continue;
+		}
+		std::uint8_t c = 0;
+		for (std::uint8_t k = 0; k < FWI_DANGER_CLASS_COUNT - 1; k++)
+			c += (v >= f[k]);
+		if (classes.bui_classes) {
+			std::uint8_t cb = 0;
+			for (std::uint8_t k = 0; k < FWI_DANGER_CLASS_COUNT - 1; k++)
+				cb += (bui[i] >= b[k]);
+			if (cb > c)
+				c = cb;
+		}
+		danger_class[i] = c;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIClassRaster::Create(const char *filename, std::uint32_t cells, std::uint32_t tile_cells, std::uint16_t days) {
+	if (!filename)
+		return E_POINTER;
+	if ((!cells) || (!tile_cells) || (!days) || (tile_cells > MAX_RUN))
+		return E_INVALIDARG;
+	Close();
+
+	m_cells = cells;
+	m_tile_cells = tile_cells;
+	m_days = days;
+	try {
+		m_index.assign((std::size_t)days * Tiles(), index_entry());
+	}
+	catch (...) {
+		m_index.clear();
+		return E_OUTOFMEMORY;
+	}
+	m_file.open(filename, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+	if (!m_file.is_open())
+		return E_FAIL;
+
+	class_header h = {};
+	memcpy(h.magic, MAGIC, sizeof(MAGIC));
+	h.version = VERSION;
+	h.cells = cells;
+	h.tile_cells = tile_cells;
+	h.days = days;
+	if (!m_file.write(reinterpret_cast<const char *>(&h), sizeof(h))) {
+		m_file.close();
+		return E_FAIL;
+	}
+	m_writable = true;
+	m_end = sizeof(h);
+	return S_OK;
+}
+
+
+HRESULT FWIClassRaster::Open(const char *filename) {
+	if (!filename)
+		return E_POINTER;
+	Close();
+
+	m_file.open(filename, std::ios::binary | std::ios::in);
+	if (!m_file.is_open())
+		return E_FAIL;
+	class_header h;
+	if (!m_file.read(reinterpret_cast<char *>(&h), sizeof(h))) {
+		m_file.close();
+		return E_FAIL;
+	}
+	if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) || (h.version != VERSION) || (!h.cells) || (!h.tile_cells) || (!h.days) || (h.days > 0xffff) || (!h.index_offset)) {
+		m_file.close();
+		return E_INVALIDARG;
+	}
+	m_cells = h.cells;
+	m_tile_cells = h.tile_cells;
+	m_days = (std::uint16_t)h.days;
+	m_end = h.index_offset;
+	try {
+		m_index.resize((std::size_t)m_days * Tiles());
+	}
+	catch (...) {
+		m_file.close();
+		return E_OUTOFMEMORY;
+	}
+	if ((!m_file.seekg((std::streamoff)h.index_offset)) || (!m_file.read(reinterpret_cast<char *>(m_index.data()), (std::streamsize)(m_index.size() * sizeof(index_entry))))) {
+		m_file.close();
+		return E_FAIL;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIClassRaster::Close() {
+	if (!m_file.is_open())
+		return S_OK;
+
+	bool ok = true;
+	if (m_writable) {
+		const std::uint64_t index_offset = m_end;
+		ok = m_file.seekp((std::streamoff)index_offset) && m_file.write(reinterpret_cast<const char *>(m_index.data()), (std::streamsize)(m_index.size() * sizeof(index_entry)))
+			&& m_file.seekp((std::streamoff)offsetof(class_header, index_offset)) && m_file.write(reinterpret_cast<const char *>(&index_offset), sizeof(index_offset))
+			&& m_file.flush();
+	}
+	m_file.close();
+	m_writable = false;
+	m_cells = m_tile_cells = 0;
+	m_days = 0;
+	m_end = 0;
+	m_index.clear();
+	return ok ? S_OK : E_FAIL;
+}
+
+
+HRESULT FWIClassRaster::Write(std::uint16_t day, std::uint32_t tile, const std::uint8_t *danger_class, FWIScratchArena *scratch) {
+	if (!danger_class)
+		return E_POINTER;
+	if ((!m_file.is_open()) || (!m_writable))
+		return E_UNEXPECTED;
+	if ((day >= m_days) || (tile >= Tiles()))
+		return E_INVALIDARG;
+
+	// encoded outside the lock, only the append is serialized
+	FWIScratchArena &arena = scratch ? *scratch : FWIScratchArena::ThreadLocal();
+	FWIScratchArena::Frame frame(arena);
+	const std::uint32_t n = TileCount(tile);
+	std::uint32_t *runs = arena.Allocate<std::uint32_t>(n), count = 0;
+	if (!runs)
+		return E_OUTOFMEMORY;
+	for (std::uint32_t i = 0; i < n;) {
+		const std::uint8_t c = danger_class[i];
+		std::uint32_t j = i + 1;
+		while ((j < n) && (danger_class[j] == c))
+			j++;
+		runs[count++] = ((j - i) << 8) | c;
+		i = j;
+	}
+
+	std::lock_guard<std::mutex> l(m_lock);
+	const std::uint64_t offset = m_end;
+	if ((!m_file.seekp((std::streamoff)offset)) || (!m_file.write(reinterpret_cast<const char *>(runs), (std::streamsize)count * sizeof(std::uint32_t))))
+		return E_FAIL;
+	m_end += (std::uint64_t)count * sizeof(std::uint32_t);
+	index_entry &e = m_index[(std::size_t)day * Tiles() + tile];
+	e.offset = offset;
+	e.runs = count;
+	return S_OK;
+}
+
+
+HRESULT FWIClassRaster::Runs(std::uint16_t day, std::uint32_t tile, std::vector<FWIClassRun> *runs) const {
+	if (!runs)
+		return E_POINTER;
+	if (!m_file.is_open())
+		return E_UNEXPECTED;
+	if ((day >= m_days) || (tile >= Tiles()))
+		return E_INVALIDARG;
+
+	std::vector<std::uint32_t> encoded;
+	{
+		std::lock_guard<std::mutex> l(m_lock);
+		const index_entry &e = m_index[(std::size_t)day * Tiles() + tile];
+		try {
+			runs->clear();
+			encoded.resize(e.runs);
+		}
+		catch (...) {
+			return E_OUTOFMEMORY;
+		}
+		if (!e.runs)
+			return S_FALSE;
+		if ((!m_file.seekg((std::streamoff)e.offset)) || (!m_file.read(reinterpret_cast<char *>(encoded.data()), (std::streamsize)(encoded.size() * sizeof(std::uint32_t)))))
+			return E_FAIL;
+	}
+	try {
+		runs->resize(encoded.size());
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	for (std::size_t i = 0; i < encoded.size(); i++) {
+		(*runs)[i].length = encoded[i] >> 8;
+		(*runs)[i].danger_class = (std::uint8_t)encoded[i];
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIClassRaster::Read(std::uint16_t day, std::uint32_t tile, std::uint8_t *danger_class) const {
+	if (!danger_class)
+		return E_POINTER;
+	std::vector<FWIClassRun> runs;
+	HRESULT hr = Runs(day, tile, &runs);
+	if (FAILED(hr))
+		return hr;
+
+	const std::uint32_t n = TileCount(tile);
+	if (hr == S_FALSE) {
+		memset(danger_class, NO_DATA, n);
+		return hr;
+	}
+	std::uint32_t i = 0;
+	for (const auto &r : runs) {
+		if (r.length > n - i)
+			return E_FAIL;
+		memset(danger_class + i, r.danger_class, r.length);
+		i += r.length;
+	}
+	return (i == n) ? S_OK : E_FAIL;
+}
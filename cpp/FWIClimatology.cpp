@@ -0,0 +1,242 @@
+/**
+ * WISE_FWI_Module: FWIClimatology.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIClimatology.h"
+#include "FWINumaTopology.h"
+#include "FWIRegionalFactors.h"
+#include "fwi_kernels.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+
+// days read from the source at a time, per thread
+static const std::uint32_t CHUNK = 1024;
+
+static const char *code_names[FWI_CODE_COUNT] = { "FFMC", "DMC", "DC", "ISI", "BUI", "FWI", "DSR" };
+
+
+FWIClimatology::FWIClimatology(const FWIClimatologySettings &settings)
+    : m_settings(settings),
+      m_stations(0) {
+}
+
+
+HRESULT FWIClimatology::Run(const FWIClimatologySource &source, const FWIRegionalFactors *factors) {
+	const std::uint32_t stations = source.Stations();
+	m_stations = 0;
+	m_sketches.clear();
+
+	FWICellFactors cells;
+	try {
+		std::vector<double> latitude(stations), longitude(stations);
+		for (std::uint32_t i = 0; i < stations; i++) {
+			HRESULT hr = source.Location(i, &latitude[i], &longitude[i]);
+			if (FAILED(hr))
+				return hr;
+		}
+		HRESULT hr;
+		if (factors)
+			hr = factors->Resolve(stations, latitude.data(), longitude.data(), &cells);
+		else
+			hr = FWIRegionalFactors().Resolve(stations, latitude.data(), longitude.data(), &cells);
+		if (FAILED(hr))
+			return hr;
+
+		m_sketches.assign((std::size_t)stations * 12 * FWI_CODE_COUNT, FWIQuantileSketch(m_settings.relative_accuracy));
+	}
+	catch (...) {
+		m_sketches.clear();
+		return E_OUTOFMEMORY;
+	}
+	m_stations = stations;
+
+	std::atomic<std::uint32_t> next(0);
+	std::mutex lock;
+	HRESULT result = S_OK;
+	auto fail = [&](HRESULT hr) {
+		std::lock_guard<std::mutex> l(lock);
+		if (SUCCEEDED(result))
+			result = hr;
+	};
+	auto failed = [&]() {
+		std::lock_guard<std::mutex> l(lock);
+		return FAILED(result);
+	};
+
+	// each station is run start to finish by one thread, in date order, so only ever touches its own sketches
+	auto worker = [&](std::uint32_t thread, bool bind) {
+		// threads are spread evenly over the nodes, so their scratch and the sketches they grow stay local
+		if (bind)
+			FWINumaTopology::BindThread(thread % FWINumaTopology::Nodes());
+		const FwiKernelTable &k = fwi_kernels();
+		std::vector<FWIClimatologyDay> days;
+		try {
+			days.resize(CHUNK);
+		}
+		catch (...) {
+			fail(E_OUTOFMEMORY);
+			return;
+		}
+
+		for (std::uint32_t station = next++; (station < stations) && (!failed()); station = next++) {
+			double ffmc = m_settings.start_ffmc, dmc = m_settings.start_dmc, dc = m_settings.start_dc;
+			std::int32_t year = -1;
+			std::uint64_t first_day = 0;
+			for (;;) {
+				std::uint32_t count = 0;
+				HRESULT hr = source.Read(station, first_day, CHUNK, days.data(), &count);
+				if (FAILED(hr)) {
+					fail(hr);
+					return;
+				}
+				if (!count)
+					break;
+				if (count > CHUNK) {
+					fail(E_UNEXPECTED);
+					return;
+				}
+				first_day += count;
+
+				for (std::uint32_t i = 0; i < count; i++) {
+					const FWIClimatologyDay &d = days[i];
+					if (d.month > 11) {
+						fail(E_INVALIDARG);
+						return;
+					}
+					if (m_settings.restart_each_year && (d.year != year)) {
+						ffmc = m_settings.start_ffmc;
+						dmc = m_settings.start_dmc;
+						dc = m_settings.start_dc;
+					}
+					year = d.year;
+
+					double codes[FWI_CODE_COUNT];
+					const double el = cells.EL(d.month)[station], fl = cells.FL(d.month)[station];
+					const fwi_daily_inputs in = { &ffmc, &dmc, &dc, &d.rain, &d.temperature, &d.rh, &d.ws, &el, &fl };
+					const fwi_daily_outputs out = { &codes[(int)FWICode::FFMC], &codes[(int)FWICode::DMC], &codes[(int)FWICode::DC], &codes[(int)FWICode::BUI],
+						&codes[(int)FWICode::ISI], &codes[(int)FWICode::FWI], &codes[(int)FWICode::DSR] };
+					k.daily_chain(1, in, out);
+
+					// the sketches ignore the -98 error code
+					FWIQuantileSketch *s = &m_sketches[index(station, d.month, FWICode::FFMC)];
+					for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+						s[c].Add(codes[c]);
+
+					ffmc = (codes[(int)FWICode::FFMC] < 0.0) ? m_settings.start_ffmc : codes[(int)FWICode::FFMC];
+					dmc = (codes[(int)FWICode::DMC] < 0.0) ? m_settings.start_dmc : codes[(int)FWICode::DMC];
+					dc = (codes[(int)FWICode::DC] < 0.0) ? m_settings.start_dc : codes[(int)FWICode::DC];
+				}
+			}
+		}
+	};
+
+	std::uint32_t threads = m_settings.threads ? m_settings.threads : std::thread::hardware_concurrency();
+	if (threads > stations)
+		threads = stations;
+	if (threads < 1)
+		threads = 1;
+
+	// the calling thread joins in, unless that would leave it bound to a node
+	std::vector<std::thread> pool;
+	const std::uint32_t first = m_settings.numa ? 0 : 1;
+	try {
+		for (std::uint32_t i = first; i < threads; i++)
+			pool.emplace_back(worker, i, m_settings.numa);
+	}
+	catch (...) {
+		// carry on with however many threads started
+	}
+	if (first || pool.empty())
+		worker(0, false);
+	for (auto &t : pool)
+		t.join();
+
+	if (FAILED(result)) {
+		m_stations = 0;
+		m_sketches.clear();
+	}
+	return result;
+}
+
+
+HRESULT FWIClimatology::Merge(const FWIClimatology &other) {
+	if ((other.m_stations != m_stations) || (other.m_settings.relative_accuracy != m_settings.relative_accuracy))
+		return E_INVALIDARG;
+
+	for (std::size_t i = 0; i < m_sketches.size(); i++) {
+		HRESULT hr = m_sketches[i].Merge(other.m_sketches[i]);
+		if (FAILED(hr))
+			return hr;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIClimatology::Percentile(std::uint32_t station, std::uint16_t month, FWICode code, double q, double *value) const {
+	if (!value)
+		return E_POINTER;
+	if ((station >= m_stations) || (month > 11) || ((std::uint8_t)code >= FWI_CODE_COUNT))
+		return E_INVALIDARG;
+	return Sketch(station, month, code).Quantile(q, value);
+}
+
+
+HRESULT FWIClimatology::WriteTable(const char *filename, std::uint32_t count, const double *q) const {
+	if ((!filename) || (count && (!q)))
+		return E_POINTER;
+	for (std::uint32_t i = 0; i < count; i++)
+		if ((q[i] < 0.0) || (q[i] > 1.0))
+			return E_INVALIDARG;
+
+	try {
+		std::ofstream out(filename);
+		if (!out)
+			return E_FAIL;
+		out.precision(8);
+
+		out << "station,month,code,days";
+		for (std::uint32_t i = 0; i < count; i++)
+			out << ",p" << (q[i] * 100.0);
+		out << "\n";
+
+		for (std::uint32_t station = 0; station < m_stations; station++)
+			for (std::uint16_t month = 0; month < 12; month++)
+				for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++) {
+					const FWIQuantileSketch &s = Sketch(station, month, (FWICode)c);
+					if (!s.Count())
+						continue;
+					out << station << "," << (month + 1) << "," << code_names[c] << "," << s.Count();
+					for (std::uint32_t i = 0; i < count; i++) {
+						double v;
+						s.Quantile(q[i], &v);
+						out << "," << v;
+					}
+					out << "\n";
+				}
+		if (!out)
+			return E_FAIL;
+	}
+	catch (...) {
+		return E_FAIL;
+	}
+	return S_OK;
+}
@@ -0,0 +1,262 @@
+/**
+ * WISE_FWI_Module: FWIDailyAggregator.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIDailyAggregator.h"
+#include "FWIRegionalFactors.h"
+#include "fwi.h"
+#include "fwi_kernels.h"
+
+#include <limits>
+
+
+// completed days are gathered into stack arrays this many at a time for the kernels
+static const std::uint32_t BLOCK = 256;
+
+static const std::int64_t DAY = 24 * 60 * 60;
+static const std::int64_t NOON = 12 * 60 * 60;
+static const std::int32_t MAX_OFFSET = 14 * 60 * 60;
+
+
+static inline std::int64_t floor_div(std::int64_t a, std::int64_t b) {
+	const std::int64_t q = a / b;
+	return ((a % b) && ((a < 0) != (b < 0))) ? (q - 1) : q;
+}
+
+
+// the day whose noon to noon window a record ending at lst falls in: (noon the day before, noon]
+static inline std::int32_t window_of(std::int64_t lst) {
+	return (std::int32_t)floor_div(lst - NOON + DAY - 1, DAY);
+}
+
+
+// the month (origin 0) of a day number, the inverse of FWIStationHistory::DayNumber()
+static std::uint16_t month_of(std::int32_t day) {
+	const std::int32_t z = day + 719468;
+	const std::int32_t era = ((z >= 0) ? z : (z - 146096)) / 146097;
+	const std::uint32_t day_of_era = (std::uint32_t)(z - era * 146097);
+	const std::uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	const std::uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	const std::uint32_t mp = (5 * day_of_year + 2) / 153;
+	return (std::uint16_t)((mp < 10) ? (mp + 2) : (mp - 10));
+}
+
+
+FWIDailyAggregator::FWIDailyAggregator() : m_records(0), m_rejected(0) {
+}
+
+
+HRESULT FWIDailyAggregator::Reset(std::uint32_t stations, const double *latitude, const std::int32_t *utc_offset, const FWICellFactors *factors) {
+	if ((!utc_offset) || ((!latitude) && (!factors)))
+		return E_POINTER;
+	if (factors && (factors->Cells() < stations))
+		return E_INVALIDARG;
+	for (std::uint32_t i = 0; i < stations; i++)
+		if ((utc_offset[i] > MAX_OFFSET) || (utc_offset[i] < -MAX_OFFSET))
+			return E_INVALIDARG;
+
+	try {
+		m_stations.resize(stations);
+		m_el.resize((std::size_t)stations * 12);
+		m_fl.resize((std::size_t)stations * 12);
+		m_pending.clear();
+		m_pending.reserve(stations);
+		m_days.clear();
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+
+	for (std::uint32_t i = 0; i < stations; i++) {
+		station_state &s = m_stations[i];
+		s.last = std::numeric_limits<std::int64_t>::min();
+		s.window = std::numeric_limits<std::int32_t>::min();
+		s.hours = 0;
+		s.open = s.noon = s.pending = false;
+		s.utc_offset = utc_offset[i];
+		s.rain = s.temperature = s.rh = s.ws = 0.0;
+		s.ffmc = 85.0;
+		s.dmc = 6.0;
+		s.dc = 15.0;
+
+		for (std::uint16_t m = 0; m < 12; m++) {
+			m_el[(std::size_t)i * 12 + m] = factors ? factors->EL(m)[i] : calc_el_table(latitude[i])[m];
+			m_fl[(std::size_t)i * 12 + m] = factors ? factors->FL(m)[i] : calc_fl_table(latitude[i])[m];
+		}
+	}
+	m_records = m_rejected = 0;
+	return S_OK;
+}
+
+
+HRESULT FWIDailyAggregator::SetCodes(std::uint32_t station, double ffmc, double dmc, double dc) {
+	if (station >= m_stations.size())
+		return E_INVALIDARG;
+	station_state &s = m_stations[station];
+	s.ffmc = ffmc;
+	s.dmc = dmc;
+	s.dc = dc;
+	return S_OK;
+}
+
+
+bool FWIDailyAggregator::close(std::uint32_t station) {
+	station_state &s = m_stations[station];
+	// a station's next day starts from the codes of this one
+	if (s.pending && (!calculate()))
+		return false;
+
+	FWIStationDay d;
+	d.station = station;
+	d.day = s.window;
+	d.month = month_of(s.window);
+	d.hours = s.hours;
+	d.calculated = s.noon;
+	d.noon_temperature = s.temperature;
+	d.noon_rh = s.rh;
+	d.noon_ws = s.ws;
+	d.rain = s.rain;
+	d.ffmc = d.dmc = d.dc = d.bui = d.isi = d.fwi = d.dsr = -98.0;
+	m_pending.push_back(d);				// within the reserved capacity, one per station
+	s.pending = true;
+	s.open = false;
+	return true;
+}
+
+
+bool FWIDailyAggregator::calculate() {
+	const FwiKernelTable &k = fwi_kernels();
+	double y_ffmc[BLOCK], y_dmc[BLOCK], y_dc[BLOCK], rain[BLOCK], temperature[BLOCK], rh[BLOCK], ws[BLOCK], el[BLOCK], fl[BLOCK];
+	double ffmc[BLOCK], dmc[BLOCK], dc[BLOCK], bui[BLOCK], isi[BLOCK], fwi[BLOCK], dsr[BLOCK];
+	FWIStationDay *day[BLOCK];
+
+	for (std::size_t first = 0; first < m_pending.size(); first += BLOCK) {
+		const std::size_t last = ((m_pending.size() - first) < BLOCK) ? m_pending.size() : (first + BLOCK);
+		std::uint32_t n = 0;
+		for (std::size_t p = first; p < last; p++) {
+			FWIStationDay &d = m_pending[p];
+			station_state &s = m_stations[d.station];
+			s.pending = false;
+			if (!d.calculated)
+				continue;
+			y_ffmc[n] = s.ffmc;
+			y_dmc[n] = s.dmc;
+			y_dc[n] = s.dc;
+			rain[n] = d.rain;
+			temperature[n] = d.noon_temperature;
+			rh[n] = d.noon_rh;
+			ws[n] = d.noon_ws;
+			el[n] = m_el[(std::size_t)d.station * 12 + d.month];
+			fl[n] = m_fl[(std::size_t)d.station * 12 + d.month];
+			day[n++] = &d;
+		}
+		if (!n)
+			continue;
+
+		const fwi_daily_inputs d_in = { y_ffmc, y_dmc, y_dc, rain, temperature, rh, ws, el, fl };
+		const fwi_daily_outputs d_out = { ffmc, dmc, dc, bui, isi, fwi, dsr };
+		k.daily_chain(n, d_in, d_out);
+
+		for (std::uint32_t i = 0; i < n; i++) {
+			FWIStationDay &d = *day[i];
+			d.ffmc = ffmc[i];
+			d.dmc = dmc[i];
+			d.dc = dc[i];
+			d.bui = bui[i];
+			d.isi = isi[i];
+			d.fwi = fwi[i];
+			d.dsr = dsr[i];
+			station_state &s = m_stations[d.station];
+			s.ffmc = ffmc[i];
+			s.dmc = dmc[i];
+			s.dc = dc[i];
+		}
+	}
+
+	try {
+		m_days.insert(m_days.end(), m_pending.begin(), m_pending.end());
+	}
+	catch (...) {
+		m_pending.clear();
+		return false;
+	}
+	m_pending.clear();
+	return true;
+}
+
+
+HRESULT FWIDailyAggregator::Add(std::uint32_t count, const FWIHourlyRecord *records) {
+	if (!count)
+		return S_OK;
+	if (!records)
+		return E_POINTER;
+
+	bool skipped = false;
+	for (std::uint32_t r = 0; r < count; r++) {
+		const FWIHourlyRecord &rec = records[r];
+		if (rec.station >= m_stations.size()) {
+			m_rejected++;
+			skipped = true;
+			continue;
+		}
+		station_state &s = m_stations[rec.station];
+		const std::int64_t lst = rec.utc + s.utc_offset;
+		const std::int32_t window = window_of(lst);
+		// a record can't go back in time, or into a day that's been closed
+		if ((lst <= s.last) || ((!s.open) && (window <= s.window))) {
+			m_rejected++;
+			skipped = true;
+			continue;
+		}
+
+		if (s.open && (window != s.window) && (!close(rec.station)))
+			return E_OUTOFMEMORY;
+		if (!s.open) {
+			s.open = true;
+			s.noon = false;
+			s.window = window;
+			s.hours = 0;
+			s.rain = 0.0;
+		}
+		s.rain += rec.rain;
+		s.hours++;
+		s.last = lst;
+		m_records++;
+
+		const std::int64_t noon = (std::int64_t)window * DAY + NOON;
+		if (lst > noon - 60 * 60) {
+			s.noon = true;
+			s.temperature = rec.temperature;
+			s.rh = rec.rh;
+			s.ws = rec.ws;
+			if ((lst == noon) && (!close(rec.station)))
+				return E_OUTOFMEMORY;
+		}
+	}
+	if (!calculate())
+		return E_OUTOFMEMORY;
+	return skipped ? E_INVALIDARG : S_OK;
+}
+
+
+HRESULT FWIDailyAggregator::Flush() {
+	for (std::uint32_t i = 0; i < m_stations.size(); i++)
+		if (m_stations[i].open && m_stations[i].noon && (!close(i)))
+			return E_OUTOFMEMORY;
+	return calculate() ? S_OK : E_OUTOFMEMORY;
+}
@@ -0,0 +1,211 @@
+/**
+ * WISE_FWI_Module: FWIDownscaler.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIDownscaler.h"
+#include "fwi_kernels.h"
+#include "fwi_math.h"
+
+#include <cmath>
+
+#include "angles.h"
+
+
+static const double PI = 3.14159265358979323846;
+
+// cells are generated into stack buffers this many at a time, then handed to the FFMC/ISI/FWI kernels while still in cache
+static const std::uint32_t BLOCK = 512;
+
+
+FWIDownscaler::FWIDownscaler(std::uint32_t cells, const double *latitude)
+    : m_cells(cells),
+      m_have_day(false),
+      m_equilibrium_tolerance(0.0),
+      m_equilibrium_cell_hours(0),
+      m_tan_latitude(cells, 0.0),
+      m_sunrise(cells), m_day_length(cells), m_sunset_shape(cells), m_min_temp(cells), m_temp_range(cells),
+      m_vapour_pressure(cells), m_min_ws(cells), m_ws_range(cells), m_rain(cells) {
+	if (latitude) {
+		const fwi_math_table &m = fwi_math_functions();
+		for (std::uint32_t i = 0; i < cells; i++)
+			m_tan_latitude[i] = m.tan(latitude[i]);
+	}
+}
+
+
+HRESULT FWIDownscaler::Reset(std::uint32_t cells, const double *latitude) {
+	m_have_day = false;
+	m_equilibrium_tolerance = 0.0;
+	m_equilibrium_cell_hours = 0;
+	try {
+		for (auto *v : { &m_tan_latitude, &m_sunrise, &m_day_length, &m_sunset_shape, &m_min_temp, &m_temp_range, &m_vapour_pressure, &m_min_ws, &m_ws_range, &m_rain })
+			v->resize(cells);
+	}
+	catch (...) {
+		m_cells = 0;
+		return E_OUTOFMEMORY;
+	}
+	m_cells = cells;
+	const fwi_math_table &m = fwi_math_functions();
+	for (std::uint32_t i = 0; i < cells; i++)
+		m_tan_latitude[i] = latitude ? m.tan(latitude[i]) : 0.0;
+	return S_OK;
+}
+
+
+HRESULT FWIDownscaler::SetEquilibriumTolerance(double tolerance) {
+	if (!(tolerance >= 0.0))
+		return E_INVALIDARG;
+	m_equilibrium_tolerance = tolerance;
+	m_equilibrium_cell_hours = 0;
+	return S_OK;
+}
+
+
+HRESULT FWIDownscaler::SetDay(const FWIDailyWeather &day) {
+	if ((!day.min_temperature) || (!day.max_temperature) || (!day.rh) || (!day.min_ws) || (!day.max_ws) || (!day.rain))
+		return E_POINTER;
+	if (day.day_of_year > 365)
+		return E_INVALIDARG;
+	for (std::uint32_t i = 0; i < m_cells; i++)
+		if ((day.min_temperature[i] > day.max_temperature[i]) || (day.min_ws[i] > day.max_ws[i]))
+			return E_INVALIDARG;
+
+	const fwi_math_table &m = fwi_math_functions();
+	const double declination = DEGREE_TO_RADIAN(23.45) * m.sin(2.0 * PI * (284.0 + (double)day.day_of_year + 1.0) / 365.0);
+	const double tan_declination = m.tan(declination);
+
+	for (std::uint32_t i = 0; i < m_cells; i++) {
+		double cos_ha = -m_tan_latitude[i] * tan_declination;
+		if (cos_ha < -1.0)		cos_ha = -1.0;
+		else if (cos_ha > 1.0)		cos_ha = 1.0;
+		double day_length = m.acos(cos_ha) * 24.0 / PI;
+		// keep both halves of the curve defined through polar day and night
+		if (day_length < 1.0)		day_length = 1.0;
+		else if (day_length > 23.0)	day_length = 23.0;
+
+		const double sunrise = 12.0 - 0.5 * day_length;
+		const double range = day.max_temperature[i] - day.min_temperature[i];
+		const double noon = day.min_temperature[i] + range * m.sin(PI * (12.0 - sunrise - fwi_diurnal::C) / (day_length + 2.0 * fwi_diurnal::A));
+		double rh = day.rh[i];
+		if (rh < 0.0)		rh = 0.0;
+		else if (rh > 1.0)	rh = 1.0;
+
+		m_sunrise[i] = sunrise;
+		m_day_length[i] = day_length;
+		m_sunset_shape[i] = m.sin(PI * (day_length - fwi_diurnal::C) / (day_length + 2.0 * fwi_diurnal::A));
+		m_min_temp[i] = day.min_temperature[i];
+		m_temp_range[i] = range;
+		m_vapour_pressure[i] = rh * 6.1078 * m.exp(17.27 * noon / (noon + 237.3));
+		m_min_ws[i] = day.min_ws[i];
+		m_ws_range[i] = day.max_ws[i] - day.min_ws[i];
+		m_rain[i] = day.rain[i] / 24.0;
+	}
+	m_have_day = true;
+	return S_OK;
+}
+
+
+fwi_diurnal_day FWIDownscaler::curves(std::uint32_t first) const {
+	fwi_diurnal_day d = { m_sunrise.data() + first, m_day_length.data() + first, m_sunset_shape.data() + first, m_min_temp.data() + first,
+		m_temp_range.data() + first, m_vapour_pressure.data() + first, m_min_ws.data() + first, m_ws_range.data() + first, m_rain.data() + first };
+	return d;
+}
+
+
+HRESULT FWIDownscaler::Weather(double hour, std::uint32_t first_cell, std::uint32_t count, double *temperature, double *rh, double *ws, double *rain) const {
+	if ((!temperature) || (!rh) || (!ws) || (!rain))
+		return E_POINTER;
+	if ((hour < 0.0) || (hour >= 24.0) || (first_cell > m_cells) || (count > (m_cells - first_cell)))
+		return E_INVALIDARG;
+	if (!m_have_day)
+		return E_UNEXPECTED;
+
+	fwi_kernels().diurnal_weather(count, hour, curves(first_cell), temperature, rh, ws, rain);
+	return S_OK;
+}
+
+
+/*
+ * ISI and FWI for a block, from FFMC values already calculated.  Returns true if any element failed.
+ */
+static bool finish_block(const FwiKernelTable &k, std::uint32_t n, const double *ffmc, const double *ws, double *isi, const double *bui, double *fwi) {
+	double isi_block[BLOCK];
+	double *s = isi ? isi : isi_block;
+	bool failed = false;
+
+	k.isi(n, ffmc, ws, 60 * 60, s);
+	if (fwi)
+		k.fwi(n, s, bui, fwi);
+	for (std::uint32_t i = 0; i < n; i++)
+		if ((ffmc[i] < 0.0) || (fwi && (bui[i] < 0.0))) {
+			s[i] = -98.0;
+			if (fwi)
+				fwi[i] = -98.0;
+			failed = true;
+		}
+	return failed;
+}
+
+
+HRESULT FWIDownscaler::HourlyFFMC_VanWagner(std::uint16_t hour, double *ffmc, double *isi, const double *bui, double *fwi) const {
+	if ((!ffmc) || (fwi && (!bui)))
+		return E_POINTER;
+	if (hour > 23)
+		return E_INVALIDARG;
+	if (!m_have_day)
+		return E_UNEXPECTED;
+
+	const FwiKernelTable &k = fwi_kernels();
+	double temperature[BLOCK], rh[BLOCK], ws[BLOCK], rain[BLOCK];
+	bool failed = false;
+	for (std::uint32_t first = 0; first < m_cells; first += BLOCK) {
+		const std::uint32_t n = ((m_cells - first) < BLOCK) ? (m_cells - first) : BLOCK;
+		k.diurnal_weather(n, (double)hour, curves(first), temperature, rh, ws, rain);
+		if (m_equilibrium_tolerance > 0.0)
+			m_equilibrium_cell_hours += k.hourly_ffmc_vanwagner_equilibrium(n, ffmc + first, rain, temperature, rh, ws, 60 * 60, m_equilibrium_tolerance, ffmc + first);
+		else
+			k.hourly_ffmc_vanwagner(n, ffmc + first, rain, temperature, rh, ws, 60 * 60, ffmc + first);
+		if (finish_block(k, n, ffmc + first, ws, isi ? (isi + first) : nullptr, bui ? (bui + first) : nullptr, fwi ? (fwi + first) : nullptr))
+			failed = true;
+	}
+	return failed ? E_INVALIDARG : S_OK;
+}
+
+
+HRESULT FWIDownscaler::HourlyFFMC_Lawson(std::uint16_t hour, const double *in_ffmc_prevday, const double *in_ffmc_currday, double *ffmc, double *isi, const double *bui, double *fwi) const {
+	if ((!in_ffmc_prevday) || (!in_ffmc_currday) || (!ffmc) || (fwi && (!bui)))
+		return E_POINTER;
+	if (hour > 23)
+		return E_INVALIDARG;
+	if (!m_have_day)
+		return E_UNEXPECTED;
+
+	const FwiKernelTable &k = fwi_kernels();
+	double temperature[BLOCK], rh[BLOCK], ws[BLOCK], rain[BLOCK];
+	bool failed = false;
+	for (std::uint32_t first = 0; first < m_cells; first += BLOCK) {
+		const std::uint32_t n = ((m_cells - first) < BLOCK) ? (m_cells - first) : BLOCK;
+		k.diurnal_weather(n, (double)hour, curves(first), temperature, rh, ws, rain);
+		// on the hour, the contiguous method only uses the RH at that hour
+		k.hourly_ffmc_lawson(n, in_ffmc_prevday + first, in_ffmc_currday + first, (std::int64_t)hour * 60 * 60, rh, rh, rh, true, ffmc + first);
+		if (finish_block(k, n, ffmc + first, ws, isi ? (isi + first) : nullptr, bui ? (bui + first) : nullptr, fwi ? (fwi + first) : nullptr))
+			failed = true;
+	}
+	return failed ? E_INVALIDARG : S_OK;
+}
@@ -0,0 +1,698 @@
+/**
+ * WISE_FWI_Module: FWIGridEngine.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIGridEngine.h"
+#include "FWIDownscaler.h"
+#include "FWINumaTopology.h"
+#include "FWIQuantized.h"
+#include "FWIRegionalFactors.h"
+#include "FWIScratchArena.h"
+#include "FWIShardQueue.h"
+#include "FWITrace.h"
+#include "fwi_mapping.h"
+#include "fwi_math.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+
+static const std::uint32_t WEATHER_LAYERS = 6;
+static const std::uint32_t STATE_LAYERS = 4;
+static const std::uint32_t SEASON_STATE_LAYERS = 7;
+static const std::uint32_t HOURLY_LAYERS = 24 * 3;
+static const std::uint32_t NO_NODE = 0xffffffff;
+
+static const std::uint16_t MONTH_START[13] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365 };
+
+
+struct grid_lane;
+
+
+// one tile's share of every file, mapped
+struct grid_tile {
+	std::uint32_t tile;
+	grid_lane *lane;
+	fwi_mapping location, weather, state, daily, hourly, mask, zones;
+};
+
+
+// the prefetch and compute threads of one NUMA node (or of the whole machine), and the tiles they run
+struct grid_lane {
+	std::uint32_t node = NO_NODE;
+	std::uint32_t first = 0, end = 0;		// the lane's tiles, when there's no queue
+	std::uint32_t threads = 0;
+	std::uint64_t max_mapped = 0, mapped = 0;	// the lane's share of the memory budget, in tiles
+	bool prefetched = false;
+	std::deque<std::unique_ptr<grid_tile>> ready;
+};
+
+
+// the compute threads' working arrays, one tile long, and everything else a tile-day needs, so that once a thread
+// has set up it runs its tiles without allocating
+struct grid_scratch {
+	explicit grid_scratch(std::uint32_t cells) : values((std::size_t)cells * ARRAYS), quantized(cells), classes(cells), downscaler(cells, nullptr) {
+		active.reserve(cells);
+		previous.reserve(cells);
+		if (FAILED(factors.Reserve(cells)) || FAILED(arena.Reserve((std::size_t)cells * sizeof(std::uint32_t))))
+			throw std::bad_alloc();
+	}
+
+	double *array(std::uint32_t index, std::uint32_t cells) { return values.data() + (std::size_t)index * cells; }
+
+	static const std::uint32_t ARRAYS = 26;
+	std::vector<double> values;
+	std::vector<std::uint16_t> quantized;
+	std::vector<std::uint8_t> classes;
+	std::vector<std::uint32_t> active, previous;	// the cells run on the current and previous days
+	FWICellFactors factors;				// of the active cells
+	FWIDownscaler downscaler;			// reset to the active cells
+	FWIScratchArena arena;				// for encoding the danger classes
+};
+
+
+FWIGridEngine::FWIGridEngine(const FWIGridSettings &settings)
+    : m_settings(settings) {
+}
+
+
+static std::uint64_t layer_bytes(const FWITiledFile *file, std::uint32_t layers) {
+	return file ? file->LayerBytes() * layers : 0;
+}
+
+
+static std::uint32_t state_layers(const FWIGridSettings &settings) {
+	return settings.season.enabled ? SEASON_STATE_LAYERS : STATE_LAYERS;
+}
+
+
+std::uint64_t FWIGridEngine::TileBytes(const FWIGridFiles &files, const FWIGridSettings &settings) {
+	const std::uint32_t days = settings.days;
+	return layer_bytes(files.location, 2) + layer_bytes(files.weather, days * WEATHER_LAYERS) + layer_bytes(files.state, state_layers(settings))
+		+ layer_bytes(files.daily, days * FWI_CODE_COUNT) + layer_bytes(files.hourly, days * HOURLY_LAYERS) + layer_bytes(files.mask, 1)
+		+ (files.zones ? layer_bytes(files.zones, files.zones->Layers()) : 0);
+}
+
+
+static bool map_tile(const FWIGridFiles &files, const FWIGridSettings &settings, grid_tile *t) {
+	const std::uint32_t tile = t->tile, days = settings.days;
+	if ((!t->location.map(*files.location, files.location->Offset(tile, 0), (std::size_t)layer_bytes(files.location, 2), false))
+	    || (!t->weather.map(*files.weather, files.weather->Offset(tile, 0), (std::size_t)layer_bytes(files.weather, days * WEATHER_LAYERS), false))
+	    || (!t->state.map(*files.state, files.state->Offset(tile, 0), (std::size_t)layer_bytes(files.state, state_layers(settings)), true))
+	    || (!t->daily.map(*files.daily, files.daily->Offset(tile, 0), (std::size_t)layer_bytes(files.daily, days * FWI_CODE_COUNT), true)))
+		return false;
+	if (files.hourly && (!t->hourly.map(*files.hourly, files.hourly->Offset(tile, 0), (std::size_t)layer_bytes(files.hourly, days * HOURLY_LAYERS), true)))
+		return false;
+	if (files.mask && (!t->mask.map(*files.mask, files.mask->Offset(tile, 0), (std::size_t)layer_bytes(files.mask, 1), false)))
+		return false;
+	if (files.zones && (!t->zones.map(*files.zones, files.zones->Offset(tile, 0), (std::size_t)layer_bytes(files.zones, files.zones->Layers()), false)))
+		return false;
+
+	// the outputs are only written, so aren't worth reading ahead
+	t->location.prefetch();
+	t->weather.prefetch();
+	t->state.prefetch();
+	t->mask.prefetch();
+	t->zones.prefetch();
+	return true;
+}
+
+
+static void restart(std::uint32_t count, const double *code, double start, double *next) {
+	for (std::uint32_t i = 0; i < count; i++)
+		next[i] = (code[i] < 0.0) ? start : code[i];
+}
+
+
+static void gather(const std::vector<std::uint32_t> &cells, const double *from, double *to) {
+	const std::uint32_t *c = cells.data();
+	for (std::size_t i = 0; i < cells.size(); i++)
+		to[i] = from[c[i]];
+}
+
+
+static void scatter(const std::vector<std::uint32_t> &cells, const double *from, double *to) {
+	const std::uint32_t *c = cells.data();
+	for (std::size_t i = 0; i < cells.size(); i++)
+		to[c[i]] = from[i];
+}
+
+
+// quantizes the values of the cells run into a layer of n values, the remainder MISSING
+static void quantize(FWICode code, const std::vector<std::uint32_t> &cells, std::uint32_t n, const double *values, std::uint16_t *scratch, std::uint16_t *out) {
+	const std::uint32_t m = (std::uint32_t)cells.size();
+	if (m == n) {
+		FWIQuantized::Quantize(code, n, values, out);
+		return;
+	}
+	std::fill(out, out + n, FWIQuantized::MISSING);
+	FWIQuantized::Quantize(code, m, values, scratch);
+	const std::uint32_t *c = cells.data();
+	for (std::uint32_t i = 0; i < m; i++)
+		out[c[i]] = scratch[i];
+}
+
+
+static double overwinter_dc(const FWISeasonRules &rules, double fall_dc, double winter_rain, double start_dc) {
+	if (fall_dc < 0.0)
+		return start_dc;
+	const fwi_math_table &m = fwi_math_functions();		// pinned in the reproducible kernel mode
+	const double qs = rules.carry_over * 800.0 * m.exp(-fall_dc / 400.0) + rules.effectiveness * 3.94 * winter_rain;
+	const double dc = 400.0 * m.log(800.0 / qs);
+	return (dc > start_dc) ? dc : start_dc;
+}
+
+
+// the state layers used by the season rules, see FWIGridFiles
+struct season_state {
+	double *ffmc, *dmc, *dc, *hffmc, *active, *count, *winter_rain;
+};
+
+
+// dormant cells count warm days towards the start of their season, and meanwhile collect the winter's precipitation
+static void season_start(const FWIGridSettings &settings, std::uint32_t n, const std::uint8_t *mask, const double *max_temperature, const double *rain, const season_state &s) {
+	const FWISeasonRules &rules = settings.season;
+	for (std::uint32_t i = 0; i < n; i++) {
+		if ((mask && (!mask[i])) || (s.active[i] > 0.0))
+			continue;
+		s.count[i] = (max_temperature[i] >= rules.start_temperature) ? s.count[i] + 1.0 : 0.0;
+		if (s.count[i] >= rules.start_days) {
+			s.ffmc[i] = s.hffmc[i] = settings.start_ffmc;
+			s.dmc[i] = settings.start_dmc;
+			s.dc[i] = rules.overwinter_dc ? overwinter_dc(rules, s.dc[i], s.winter_rain[i], settings.start_dc) : settings.start_dc;
+			s.active[i] = 1.0;
+			s.count[i] = s.winter_rain[i] = 0.0;
+		}
+		else if (rain[i] > 0.0)
+			s.winter_rain[i] += rain[i];
+	}
+}
+
+
+// cells that ran today count cold days towards the end of their season
+static void season_stop(const FWISeasonRules &rules, const std::vector<std::uint32_t> &cells, const double *max_temperature, const season_state &s) {
+	for (std::uint32_t i : cells) {
+		s.count[i] = (max_temperature[i] < rules.stop_temperature) ? s.count[i] + 1.0 : 0.0;
+		if (s.count[i] >= rules.stop_days)
+			s.active[i] = s.count[i] = s.winter_rain[i] = 0.0;
+	}
+}
+
+
+// adds a day of the tile's codes to the thread's zonal summaries, straight from the outputs just written
+static void summarize(const FWIGridFiles &files, const grid_tile &t, std::uint16_t day, const std::uint16_t *out, FWIZonalSummary *zonal) {
+	if (!zonal)
+		return;
+	FWITraceSpan span("zonal summary", "day", day);
+	const std::uint32_t tc = files.location->TileCells();
+	const std::uint32_t n = files.location->TileCount(t.tile);
+	static const FWICode CODES[FWI_ZONAL_CODE_COUNT] = { FWICode::ISI, FWICode::BUI, FWICode::FWI };
+	for (std::uint32_t z = 0; z < zonal->Zonings(); z++) {
+		const std::uint32_t *zones = static_cast<const std::uint32_t *>(t.zones.data()) + (std::size_t)z * tc;
+		for (std::uint8_t c = 0; c < FWI_ZONAL_CODE_COUNT; c++)
+			if (FAILED(zonal->Add(z, day, CODES[c], n, zones, out + (std::size_t)CODES[c] * tc)))
+				throw std::bad_alloc();
+	}
+}
+
+
+// what one tile's run did, added into the node's statistics
+struct grid_counts {
+	std::uint64_t active_cell_days = 0, equilibrium_cell_hours = 0;
+	bool write_failed = false;
+};
+
+
+// classifies a day of the tile's codes into the danger class file
+static void classify(const FWIGridSettings &settings, const FWIGridFiles &files, const grid_tile &t, std::uint16_t day, const std::uint16_t *out, grid_scratch *scratch, grid_counts *counts) {
+	if (!files.classes)
+		return;
+	FWITraceSpan span("danger classes", "day", day);
+	const std::uint32_t tc = files.location->TileCells();
+	const std::uint32_t n = files.location->TileCount(t.tile);
+	FWIClassRaster::Classify(settings.danger, n, out + (std::size_t)FWICode::FWI * tc, out + (std::size_t)FWICode::BUI * tc, scratch->classes.data());
+	if (FAILED(files.classes->Write(day, t.tile, scratch->classes.data(), &scratch->arena)))
+		counts->write_failed = true;
+}
+
+
+// runs every day of one tile, returning false if any cell failed its range checks
+static bool run_tile(const FWIGridSettings &settings, const FWIGridFiles &files, const FWIRegionalFactors &registry, const grid_tile &t, grid_scratch *scratch, grid_counts *counts, FWIZonalSummary *zonal) {
+	CCWFGM_FWI fwi;
+	const std::uint32_t tc = files.location->TileCells();
+	const std::uint32_t n = files.location->TileCount(t.tile);
+	const std::uint8_t *mask = files.mask ? static_cast<const std::uint8_t *>(t.mask.data()) : nullptr;
+	const bool season = settings.season.enabled;
+	bool ok = true;
+
+	const double *location = static_cast<const double *>(t.location.data());
+	double *state = static_cast<double *>(t.state.data());
+	const season_state s = { state, state + tc, state + 2 * tc, state + 3 * tc, state + 4 * tc, state + 5 * tc, state + 6 * tc };
+
+	double *noon_temperature = scratch->array(0, tc), *noon_ws = scratch->array(1, tc), *hour_rh = scratch->array(2, tc), *hour_rain = scratch->array(3, tc);
+	double *d_ffmc = scratch->array(4, tc), *d_dmc = scratch->array(5, tc), *d_dc = scratch->array(6, tc), *d_bui = scratch->array(7, tc);
+	double *d_isi = scratch->array(8, tc), *d_fwi = scratch->array(9, tc), *d_dsr = scratch->array(10, tc), *prev_bui = scratch->array(11, tc);
+	double *h_isi = scratch->array(12, tc), *h_fwi = scratch->array(13, tc);
+	// the active cells' inputs and state, gathered when only some of the cells run
+	double *g_latitude = scratch->array(14, tc), *g_longitude = scratch->array(15, tc);
+	double *g_state[STATE_LAYERS] = { scratch->array(16, tc), scratch->array(17, tc), scratch->array(18, tc), scratch->array(19, tc) };
+	double *g_weather = scratch->array(20, tc);
+
+	std::vector<std::uint32_t> &cells = scratch->active, &previous = scratch->previous;
+	previous.clear();
+	FWICellFactors &factors = scratch->factors;
+	FWIDownscaler *downscaler = nullptr;
+	bool resolved = false;
+
+	for (std::uint16_t day = 0; day < settings.days; day++) {
+		const double *w = static_cast<const double *>(t.weather.data()) + (std::size_t)day * WEATHER_LAYERS * tc;
+		std::uint16_t *out = static_cast<std::uint16_t *>(t.daily.data()) + (std::size_t)day * FWI_CODE_COUNT * tc;
+		std::uint16_t *h_out = files.hourly ? static_cast<std::uint16_t *>(t.hourly.data()) + (std::size_t)day * HOURLY_LAYERS * tc : nullptr;
+		const std::uint16_t doy = (std::uint16_t)((settings.first_day_of_year + day) % 365);
+		std::uint16_t month = 0;
+		while (doy >= MONTH_START[month + 1])
+			month++;
+
+		// a cell starting its season today runs today
+		if (season)
+			season_start(settings, n, mask, w + tc, w + 5 * tc, s);
+		cells.clear();
+		for (std::uint32_t i = 0; i < n; i++)
+			if (((!mask) || mask[i]) && ((!season) || (s.active[i] > 0.0)))
+				cells.push_back(i);
+		const std::uint32_t m = (std::uint32_t)cells.size();
+		const bool dense = (m == n);
+		counts->active_cell_days += m;
+
+		if (!m) {
+			std::fill(out, out + (std::size_t)FWI_CODE_COUNT * tc, FWIQuantized::MISSING);
+			if (h_out)
+				std::fill(h_out, h_out + (std::size_t)HOURLY_LAYERS * tc, FWIQuantized::MISSING);
+			summarize(files, t, day, out, zonal);
+			classify(settings, files, t, day, out, scratch, counts);
+			previous.clear();
+			resolved = false;
+			continue;
+		}
+
+		// the factors and day lengths follow the set of cells, which only changes at the start and end of seasons
+		const bool changed = (!resolved) || (cells != previous);
+		if (changed) {
+			FWITraceSpan span("resolve", "cells", m);
+			const double *latitude = location, *longitude = location + tc;
+			if (!dense) {
+				gather(cells, location, g_latitude);
+				gather(cells, location + tc, g_longitude);
+				latitude = g_latitude;
+				longitude = g_longitude;
+			}
+			HRESULT hr = registry.Resolve(m, latitude, longitude, &factors);
+			if (FAILED(hr)) {
+				if (hr != E_INVALIDARG)
+					return false;
+				ok = false;
+			}
+			if (downscaler)
+				counts->equilibrium_cell_hours += downscaler->EquilibriumCellHours();
+			// never more cells than the tile, so this reuses the scratch's memory
+			downscaler = &scratch->downscaler;
+			if (FAILED(downscaler->Reset(m, latitude)))
+				throw std::bad_alloc();
+			downscaler->SetEquilibriumTolerance(settings.equilibrium_tolerance);
+			resolved = true;
+		}
+		previous = cells;
+
+		double *ffmc = s.ffmc, *dmc = s.dmc, *dc = s.dc, *hffmc = s.hffmc;
+		const double *weather[WEATHER_LAYERS];
+		for (std::uint32_t l = 0; l < WEATHER_LAYERS; l++)
+			weather[l] = w + (std::size_t)l * tc;
+		if (!dense) {
+			FWITraceSpan span("gather", "cells", m);
+			double *g[STATE_LAYERS] = { s.ffmc, s.dmc, s.dc, s.hffmc };
+			for (std::uint32_t l = 0; l < STATE_LAYERS; l++)
+				gather(cells, g[l], g_state[l]);
+			ffmc = g_state[0];
+			dmc = g_state[1];
+			dc = g_state[2];
+			hffmc = g_state[3];
+			for (std::uint32_t l = 0; l < WEATHER_LAYERS; l++) {
+				gather(cells, weather[l], g_weather + (std::size_t)l * tc);
+				weather[l] = g_weather + (std::size_t)l * tc;
+			}
+		}
+
+		// yesterday's BUI carries over while the same cells run, and is recalculated from the state when they change
+		if (changed)
+			fwi.BUI_Batch(m, dc, dmc, prev_bui);
+		const FWIDailyWeather daily = { doy, weather[0], weather[1], weather[2], weather[3], weather[4], weather[5] };
+		{
+			FWITraceSpan span("downscale", "day", day);
+			if (FAILED(downscaler->SetDay(daily)))
+				ok = false;
+			downscaler->Weather(12.0, 0, m, noon_temperature, hour_rh, noon_ws, hour_rain);
+		}
+		if (FAILED(fwi.DailyCodes_Batch(m, ffmc, dmc, dc, daily.rain, noon_temperature, daily.rh, noon_ws, factors, 0, month, d_ffmc, d_dmc, d_dc, d_bui, d_isi, d_fwi, d_dsr)))
+			ok = false;
+
+		{
+			FWITraceSpan span("quantize", "day", day);
+			const double *codes[FWI_CODE_COUNT] = { d_ffmc, d_dmc, d_dc, d_isi, d_bui, d_fwi, d_dsr };
+			for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+				quantize((FWICode)c, cells, n, codes[c], scratch->quantized.data(), out + (std::size_t)c * tc);
+		}
+		summarize(files, t, day, out, zonal);
+		classify(settings, files, t, day, out, scratch, counts);
+
+		if (h_out) {
+			FWITraceSpan span("hourly FFMC", "day", day);
+			for (std::uint16_t hour = 0; hour < 24; hour++) {
+				if (FAILED(downscaler->HourlyFFMC_VanWagner(hour, hffmc, h_isi, (hour < 12) ? prev_bui : d_bui, h_fwi)))
+					ok = false;
+				std::uint16_t *h = h_out + (std::size_t)hour * 3 * tc;
+				quantize(FWICode::FFMC, cells, n, hffmc, scratch->quantized.data(), h);
+				quantize(FWICode::ISI, cells, n, h_isi, scratch->quantized.data(), h + tc);
+				quantize(FWICode::FWI, cells, n, h_fwi, scratch->quantized.data(), h + 2 * tc);
+				restart(m, hffmc, settings.start_ffmc, hffmc);
+			}
+		}
+
+		restart(m, d_ffmc, settings.start_ffmc, ffmc);
+		restart(m, d_dmc, settings.start_dmc, dmc);
+		restart(m, d_dc, settings.start_dc, dc);
+		if (!dense) {
+			FWITraceSpan span("scatter", "cells", m);
+			scatter(cells, ffmc, s.ffmc);
+			scatter(cells, dmc, s.dmc);
+			scatter(cells, dc, s.dc);
+			scatter(cells, hffmc, s.hffmc);
+		}
+		for (std::uint32_t i = 0; i < m; i++)
+			prev_bui[i] = d_bui[i];
+		if (season)
+			season_stop(settings.season, cells, w + tc, s);
+	}
+	if (downscaler)
+		counts->equilibrium_cell_hours += downscaler->EquilibriumCellHours();
+	return ok;
+}
+
+
+static bool check_file(const FWITiledFile *file, const FWITiledFile *location, std::uint32_t layers, std::uint32_t element_size) {
+	return (file->Cells() == location->Cells()) && (file->TileCells() == location->TileCells()) && (file->Layers() >= layers) && (file->ElementSize() == element_size);
+}
+
+
+HRESULT FWIGridEngine::Run(const FWIGridFiles &files, const FWIRegionalFactors *factors) {
+	return Run(files, factors, nullptr);
+}
+
+
+HRESULT FWIGridEngine::Run(const FWIGridFiles &files, const FWIRegionalFactors *factors, FWIShardQueue *queue) {
+	if ((!files.location) || (!files.weather) || (!files.state) || (!files.daily))
+		return E_POINTER;
+	if ((!files.location->IsOpen()) || (!files.weather->IsOpen()) || (!files.state->IsOpen()) || (!files.state->Writable()) || (!files.daily->IsOpen()) || (!files.daily->Writable()))
+		return E_UNEXPECTED;
+	if (files.hourly && ((!files.hourly->IsOpen()) || (!files.hourly->Writable())))
+		return E_UNEXPECTED;
+	if (files.classes && ((!files.classes->IsOpen()) || (!files.classes->Writable())))
+		return E_UNEXPECTED;
+
+	const std::uint16_t days = m_settings.days;
+	if ((!check_file(files.location, files.location, 2, sizeof(double))) || (!check_file(files.weather, files.location, days * WEATHER_LAYERS, sizeof(double)))
+	    || (!check_file(files.state, files.location, state_layers(m_settings), sizeof(double))) || (!check_file(files.daily, files.location, days * FWI_CODE_COUNT, sizeof(std::uint16_t)))
+	    || (files.hourly && (!check_file(files.hourly, files.location, days * HOURLY_LAYERS, sizeof(std::uint16_t))))
+	    || (files.mask && ((!files.mask->IsOpen()) || (!check_file(files.mask, files.location, 1, sizeof(std::uint8_t)))))
+	    || (files.zones && ((!files.zones->IsOpen()) || (!check_file(files.zones, files.location, 1, sizeof(std::uint32_t)))))
+	    || (files.classes && ((files.classes->Cells() != files.location->Cells()) || (files.classes->TileCells() != files.location->TileCells()) || (files.classes->Days() < days) || queue))
+	    || (!(m_settings.equilibrium_tolerance >= 0.0)))
+		return E_INVALIDARG;
+	for (std::uint8_t k = 1; k < FWI_DANGER_CLASS_COUNT - 1; k++)
+		if ((!(m_settings.danger.fwi[k] >= m_settings.danger.fwi[k - 1])) || (!(m_settings.danger.bui[k] >= m_settings.danger.bui[k - 1])))
+			return E_INVALIDARG;
+	if (queue && ((!queue->IsOpen()) || (queue->Tiles() != files.location->Tiles())))
+		return E_INVALIDARG;
+
+	// every tile mapped counts against the budget from when it's prefetched until it's written back
+	const std::uint32_t tiles = files.location->Tiles();
+	const std::uint64_t tile_bytes = TileBytes(files, m_settings);
+	const std::uint64_t max_mapped = m_settings.memory_budget / tile_bytes;
+	if (!max_mapped)
+		return E_INVALIDARG;
+	std::uint32_t threads = m_settings.threads ? m_settings.threads : std::thread::hardware_concurrency();
+	if (threads > max_mapped)
+		threads = (std::uint32_t)max_mapped;
+	if (threads > tiles)
+		threads = tiles;
+	if (threads < 1)
+		threads = 1;
+
+	// one lane per NUMA node in use, each needing at least one thread
+	std::uint32_t lane_count = m_settings.numa ? FWINumaTopology::Nodes() : 1;
+	if (lane_count > threads)
+		lane_count = threads;
+
+	FWIRegionalFactors builtin;
+	const FWIRegionalFactors &registry = factors ? *factors : builtin;
+
+	// each compute thread summarizes into its own copy, merged in thread order at the end
+	const std::uint32_t zonings = (files.zones && m_settings.zonal.zones) ? files.zones->Layers() : 0;
+	HRESULT hr = m_zonal.Initialize(m_settings.zonal, zonings, days);
+	if (FAILED(hr))
+		return hr;
+	std::vector<FWIZonalSummary> partial;
+	if (zonings) {
+		try {
+			partial.resize(threads);
+		}
+		catch (...) {
+			return E_OUTOFMEMORY;
+		}
+		for (auto &z : partial)
+			if (FAILED(hr = z.Initialize(m_settings.zonal, zonings, days)))
+				return hr;
+	}
+
+	std::unique_ptr<grid_lane[]> lanes;
+	try {
+		lanes.reset(new grid_lane[lane_count]);
+		m_statistics.resize(lane_count);
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	for (std::uint32_t i = 0; i < lane_count; i++) {
+		grid_lane &lane = lanes[i];
+		lane.node = (lane_count > 1) ? i : NO_NODE;
+		// a fixed, contiguous block of tiles per node, so repeated runs find a tile's state where they left it
+		lane.first = (std::uint32_t)((std::uint64_t)tiles * i / lane_count);
+		lane.end = (std::uint32_t)((std::uint64_t)tiles * (i + 1) / lane_count);
+		lane.threads = threads / lane_count + ((i < threads % lane_count) ? 1 : 0);
+		lane.max_mapped = max_mapped / lane_count + ((i < max_mapped % lane_count) ? 1 : 0);
+		m_statistics[i] = FWIGridNodeStatistics();
+		m_statistics[i].node = (lane_count > 1) ? i : 0;
+		m_statistics[i].threads = lane.threads;
+	}
+
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<std::unique_ptr<grid_tile>> finished;
+	std::uint32_t computing = 0;
+	bool launched = false, abort = false, cells_failed = false;
+	HRESULT result = S_OK;
+
+	auto fail = [&](HRESULT hr) {
+		std::lock_guard<std::mutex> l(lock);
+		if (SUCCEEDED(result))
+			result = hr;
+		abort = true;
+		changed.notify_all();
+	};
+
+	auto bind = [&](const grid_lane &lane) {
+		if (lane.node != NO_NODE)
+			FWINumaTopology::BindThread(lane.node);
+	};
+
+	// prefetch: maps the lane's tiles, in order or as they're claimed from the queue, ahead of its compute threads.
+	// On its own node so that the pages read in land there.
+	auto prefetch = [&](grid_lane &lane) {
+		bind(lane);
+		FWITrace::NameThread("prefetch");
+		for (std::uint32_t next = lane.first; queue || (next < lane.end); next++) {
+			{
+				std::unique_lock<std::mutex> l(lock);
+				changed.wait(l, [&]() { return abort || (lane.mapped < lane.max_mapped); });
+				if (abort)
+					break;
+				lane.mapped++;
+			}
+			std::uint32_t tile = next;
+			if (queue && (!queue->Claim(&tile))) {
+				std::lock_guard<std::mutex> l(lock);
+				lane.mapped--;
+				break;
+			}
+			std::unique_ptr<grid_tile> t;
+			try {
+				t.reset(new grid_tile);
+			}
+			catch (...) {
+				fail(E_OUTOFMEMORY);
+				break;
+			}
+			t->tile = tile;
+			t->lane = &lane;
+			FWITraceSpan span("map tile", "tile", tile);
+			if (!map_tile(files, m_settings, t.get())) {
+				fail(E_FAIL);
+				break;
+			}
+			std::lock_guard<std::mutex> l(lock);
+			lane.ready.push_back(std::move(t));
+			changed.notify_all();
+		}
+		std::lock_guard<std::mutex> l(lock);
+		lane.prefetched = true;
+		changed.notify_all();
+	};
+
+	auto compute = [&](grid_lane &lane, FWIGridNodeStatistics &stats, FWIZonalSummary *zonal) {
+		bind(lane);
+		FWITrace::NameThread("compute");
+		try {
+			// allocated (so first touched) on the lane's node
+			grid_scratch scratch(files.location->TileCells());
+			for (;;) {
+				std::unique_ptr<grid_tile> t;
+				{
+					std::unique_lock<std::mutex> l(lock);
+					changed.wait(l, [&]() { return abort || (!lane.ready.empty()) || lane.prefetched; });
+					if (abort || lane.ready.empty())
+						break;
+					t = std::move(lane.ready.front());
+					lane.ready.pop_front();
+				}
+				const auto start = std::chrono::steady_clock::now();
+				grid_counts counts;
+				bool ok;
+				{
+					FWITraceSpan span("tile", "tile", t->tile);
+					ok = run_tile(m_settings, files, registry, *t, &scratch, &counts, zonal);
+				}
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				if (counts.write_failed)
+					fail(E_FAIL);
+				std::lock_guard<std::mutex> l(lock);
+				cells_failed |= (!ok);
+				stats.tiles++;
+				stats.cell_days += (std::uint64_t)files.location->TileCount(t->tile) * days;
+				stats.active_cell_days += counts.active_cell_days;
+				stats.equilibrium_cell_hours += counts.equilibrium_cell_hours;
+				stats.bytes += tile_bytes;
+				stats.seconds += seconds;
+				finished.push_back(std::move(t));
+				changed.notify_all();
+			}
+		}
+		catch (...) {
+			fail(E_OUTOFMEMORY);
+		}
+		std::lock_guard<std::mutex> l(lock);
+		computing--;
+		changed.notify_all();
+	};
+
+	// write-back: starts each finished tile on its way to disk and unmaps it, releasing its share of the budget
+	auto write_back = [&]() {
+		FWITrace::NameThread("write back");
+		for (;;) {
+			std::unique_ptr<grid_tile> t;
+			{
+				std::unique_lock<std::mutex> l(lock);
+				changed.wait(l, [&]() { return (!finished.empty()) || (launched && (!computing)); });
+				if (finished.empty())
+					break;
+				t = std::move(finished.front());
+				finished.pop_front();
+			}
+			const std::uint32_t tile = t->tile;
+			grid_lane *lane = t->lane;
+			{
+				FWITraceSpan span("write back", "tile", tile);
+				t->state.flush();
+				t->daily.flush();
+				t->hourly.flush();
+				t.reset();
+			}
+			if (queue)
+				queue->Complete(tile);
+			std::lock_guard<std::mutex> l(lock);
+			lane->mapped--;
+			changed.notify_all();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	std::uint32_t thread = 0;
+	try {
+		pool.emplace_back(write_back);
+		for (std::uint32_t i = 0; i < lane_count; i++) {
+			pool.emplace_back(prefetch, std::ref(lanes[i]));
+			for (std::uint32_t j = 0; j < lanes[i].threads; j++, thread++) {
+				{
+					std::lock_guard<std::mutex> l(lock);
+					computing++;
+				}
+				try {
+					pool.emplace_back(compute, std::ref(lanes[i]), std::ref(m_statistics[i]), zonings ? &partial[thread] : nullptr);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> l(lock);
+					computing--;
+					throw;
+				}
+			}
+		}
+	}
+	catch (...) {
+		fail(E_OUTOFMEMORY);
+		// prefetchers that never started leave their lanes unfinished, which the abort covers
+	}
+	{
+		std::lock_guard<std::mutex> l(lock);
+		launched = true;
+		changed.notify_all();
+	}
+	for (auto &t : pool)
+		t.join();
+
+	for (std::size_t i = 0; (i < partial.size()) && SUCCEEDED(result); i++)
+		result = m_zonal.Merge(partial[i]);
+	if (SUCCEEDED(result) && cells_failed)
+		result = E_INVALIDARG;
+	return result;
+}
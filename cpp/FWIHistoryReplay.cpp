@@ -0,0 +1,274 @@
+/**
+ * WISE_FWI_Module: FWIHistoryReplay.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIHistoryReplay.h"
+#include "FWIRegionalFactors.h"
+#include "fwi.h"
+#include "fwi_kernels.h"
+#include "fwi_math.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+
+namespace {
+	struct replay_chunk {
+		std::uint32_t first, last;		// the days the chunk keeps, [first, last)
+		std::uint32_t spin_first;		// the day its spin-up starts on
+		bool exact;				// the spin-up starts at a restart, so the codes are the sequential run's
+		double ffmc, dmc, dc;			// the codes it arrived at first with
+		double a, b, cap;			// its days take the DC moisture equivalent from q to min(cap, a * q + b)
+	};
+
+	struct replay_state {
+		double ffmc, dmc, dc;
+	};
+
+	class replay_day {
+	public:
+		replay_day(const FWIReplaySettings &settings, const FWIClimatologyDay *days, const double *el, const double *fl)
+		    : m_settings(settings), m_days(days), m_el(el), m_fl(fl), m_kernels(fwi_kernels()) { }
+
+		replay_state start() const { return { m_settings.start_ffmc, m_settings.start_dmc, m_settings.start_dc }; }
+
+		// runs day d from s, which it leaves as the codes the next day starts from
+		void run(std::uint32_t d, replay_state &s, double *codes, std::uint32_t stride) const {
+			const FWIClimatologyDay &day = m_days[d];
+			if (m_settings.restart_each_year && d && (day.year != m_days[d - 1].year))
+				s = start();
+
+			const fwi_daily_inputs in = { &s.ffmc, &s.dmc, &s.dc, &day.rain, &day.temperature, &day.rh, &day.ws, &m_el[day.month], &m_fl[day.month] };
+			const fwi_daily_outputs out = { &codes[(int)FWICode::FFMC * stride], &codes[(int)FWICode::DMC * stride], &codes[(int)FWICode::DC * stride],
+				&codes[(int)FWICode::BUI * stride], &codes[(int)FWICode::ISI * stride], &codes[(int)FWICode::FWI * stride], &codes[(int)FWICode::DSR * stride] };
+			m_kernels.daily_chain(1, in, out);
+			s = next(codes, stride);
+		}
+
+		// the codes the day after one with these results starts from
+		replay_state next(const double *codes, std::uint32_t stride) const {
+			const double ffmc = codes[(int)FWICode::FFMC * stride], dmc = codes[(int)FWICode::DMC * stride], dc = codes[(int)FWICode::DC * stride];
+			return { (ffmc < 0.0) ? m_settings.start_ffmc : ffmc, (dmc < 0.0) ? m_settings.start_dmc : dmc, (dc < 0.0) ? m_settings.start_dc : dc };
+		}
+
+	private:
+		const FWIReplaySettings &m_settings;
+		const FWIClimatologyDay *m_days;
+		const double *m_el, *m_fl;
+		const FwiKernelTable &m_kernels;
+	};
+}
+
+
+// the DC's moisture equivalent, which its rain and drying steps scale and shift (see calc_dc_fl())
+static inline double dc_moisture(const fwi_math_table &fm, double dc) {
+	return 800.0 * fm.exp(-dc / 400.0);
+}
+
+
+/*
+ * In terms of its moisture equivalent q, a day's DC is min(800, m * min(800, q + r)), for the day's effective rain r
+ * and drying factor m, so a run of days composes to min(cap, a * q + b) however long it is.  This follows calc_dc_fl()
+ * for each day, and the kernels closely enough to predict where a chunk's DC starts from, which its spin-up (with DC
+ * forgetting so slowly) can't.
+ */
+static void dc_transfer(const FWIReplaySettings &settings, const FWIClimatologyDay *days, const double *fl, replay_chunk &c) {
+	const fwi_math_table &fm = fwi_math_functions();		// pinned in the reproducible kernel mode
+	c.a = 1.0;
+	c.b = 0.0;
+	c.cap = 800.0;
+	for (std::uint32_t d = c.first; d < c.last; d++) {
+		const FWIClimatologyDay &day = days[d];
+		if (settings.restart_each_year && d && (day.year != days[d - 1].year)) {
+			c.a = 0.0;
+			c.b = c.cap = dc_moisture(fm, settings.start_dc);
+		}
+		if ((day.rain < 0.0) || (day.rain > 600.0)) {
+			// fails, and the next day starts over
+			c.a = 0.0;
+			c.b = c.cap = dc_moisture(fm, settings.start_dc);
+			continue;
+		}
+
+		const double temperature = std::max(std::min(day.temperature, 60.0), -2.8);
+		const double pe = (0.36 * (temperature + 2.8) + fl[day.month]) / 2.0;
+		const double r = (day.rain > 2.8) ? (3.937 * (0.83 * day.rain - 1.27)) : 0.0;
+		const double m = fm.exp(-pe / 400.0);
+		c.cap = std::min(800.0, m * std::min(800.0, c.cap + r));
+		c.a *= m;
+		c.b = m * (c.b + r);
+	}
+}
+
+
+// runs fn on every chunk, spread over the threads
+template <typename F>
+static void for_each_chunk(std::vector<replay_chunk> &chunks, std::uint32_t threads, F fn) {
+	std::atomic<std::uint32_t> next(0);
+	auto worker = [&]() {
+		for (std::uint32_t i = next++; i < chunks.size(); i = next++)
+			fn(chunks[i]);
+	};
+
+	if (threads > chunks.size())
+		threads = (std::uint32_t)chunks.size();
+	std::vector<std::thread> pool;
+	try {
+		for (std::uint32_t i = 1; i < threads; i++)
+			pool.emplace_back(worker);
+	}
+	catch (...) {
+		// carry on with however many threads started
+	}
+	worker();
+	for (auto &t : pool)
+		t.join();
+}
+
+
+static double difference(const replay_state &a, const replay_state &b) {
+	return std::max(std::fabs(a.ffmc - b.ffmc), std::max(std::fabs(a.dmc - b.dmc), std::fabs(a.dc - b.dc)));
+}
+
+
+FWIHistoryReplay::FWIHistoryReplay(const FWIReplaySettings &settings)
+    : m_settings(settings) {
+}
+
+
+HRESULT FWIHistoryReplay::Run(std::uint32_t count, const FWIClimatologyDay *days, double latitude, const FWICellFactors *factors, std::uint32_t cell, double *codes) {
+	m_statistics = FWIReplayStatistics();
+	if (!count)
+		return S_OK;
+	if ((!days) || (!codes))
+		return E_POINTER;
+	if (factors && (cell >= factors->Cells()))
+		return E_INVALIDARG;
+	for (std::uint32_t d = 0; d < count; d++)
+		if (days[d].month > 11)
+			return E_INVALIDARG;
+
+	double el[12], fl[12];
+	for (std::uint16_t m = 0; m < 12; m++) {
+		el[m] = factors ? factors->EL(m)[cell] : calc_el_table(latitude)[m];
+		fl[m] = factors ? factors->FL(m)[cell] : calc_fl_table(latitude)[m];
+	}
+	const replay_day day(m_settings, days, el, fl);
+
+	std::uint32_t threads = m_settings.threads ? m_settings.threads : std::thread::hardware_concurrency();
+	if (threads < 1)
+		threads = 1;
+	const std::uint32_t chunk_days = m_settings.chunk_days ? m_settings.chunk_days : (std::uint32_t)(((std::uint64_t)count + threads - 1) / threads);
+
+	// a day the codes restart on, so that nothing before it matters
+	auto restart = [&](std::uint32_t d) {
+		return (!d) || (m_settings.restart_each_year && (days[d].year != days[d - 1].year));
+	};
+
+	std::vector<replay_chunk> chunks;
+	try {
+		chunks.reserve((std::size_t)(((std::uint64_t)count + chunk_days - 1) / chunk_days));
+		for (std::uint64_t nominal = 0; nominal < count; nominal += chunk_days) {
+			// a chunk that can start on a restart doesn't need any spin-up, so look ahead for one
+			std::uint32_t first = (std::uint32_t)nominal;
+			const std::uint32_t end = (std::uint32_t)std::min<std::uint64_t>(nominal + chunk_days, count);
+			if (m_settings.restart_each_year)
+				for (std::uint32_t d = first; d < end; d++)
+					if (restart(d)) {
+						first = d;
+						break;
+					}
+
+			replay_chunk c;
+			c.first = first;
+			c.last = count;
+			c.spin_first = (first > m_settings.spin_up_days) ? (first - m_settings.spin_up_days) : 0;
+			c.exact = false;
+			for (std::uint32_t d = first + 1; d-- > c.spin_first; )
+				if (restart(d)) {
+					c.spin_first = d;
+					c.exact = true;
+					break;
+				}
+			if (!chunks.empty())
+				chunks.back().last = first;
+			chunks.push_back(c);
+		}
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+
+	// each chunk's DC starts from what its predecessors' transfers give, so the spin-up only has to settle FFMC and
+	// DMC (which don't depend on DC) and those forget their start within weeks
+	for_each_chunk(chunks, threads, [&](replay_chunk &c) {
+		dc_transfer(m_settings, days, fl, c);
+	});
+	const fwi_math_table &fm = fwi_math_functions();
+	double q = dc_moisture(fm, m_settings.start_dc);
+	for (replay_chunk &c : chunks) {
+		c.dc = -400.0 * fm.log(q / 800.0);
+		q = std::min(c.cap, c.a * q + c.b);
+	}
+
+	for_each_chunk(chunks, threads, [&](replay_chunk &c) {
+		double discard[FWI_CODE_COUNT];
+		replay_state s = day.start();
+		for (std::uint32_t d = c.spin_first; d < c.first; d++)
+			day.run(d, s, discard, 1);
+		c.ffmc = s.ffmc;
+		c.dmc = s.dmc;
+		if (!c.exact)
+			s.dc = c.dc;
+		c.dc = s.dc;
+		for (std::uint32_t d = c.first; d < c.last; d++)
+			day.run(d, s, codes + d, count);
+	});
+
+	// the hand overs, in order, so each chunk is checked against its predecessor as it was finally left
+	m_statistics.chunks = (std::uint32_t)chunks.size();
+	for (const replay_chunk &c : chunks) {
+		m_statistics.spin_up_days += c.first - c.spin_first;
+		if (c.exact) {
+			m_statistics.exact_chunks++;
+			continue;
+		}
+
+		replay_state s = day.next(codes + c.first - 1, count);
+		const double diff = difference(s, { c.ffmc, c.dmc, c.dc });
+		if (diff <= m_settings.tolerance) {
+			m_statistics.max_difference = std::max(m_statistics.max_difference, diff);
+			continue;
+		}
+
+		m_statistics.repaired_chunks++;
+		for (std::uint32_t d = c.first; d < c.last; d++) {
+			const replay_state was = day.next(codes + d, count);
+			day.run(d, s, codes + d, count);
+			m_statistics.repaired_days++;
+			const double now = difference(s, was);
+			if (now <= m_settings.tolerance) {
+				m_statistics.max_difference = std::max(m_statistics.max_difference, now);
+				break;
+			}
+		}
+	}
+	return S_OK;
+}
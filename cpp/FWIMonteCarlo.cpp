@@ -0,0 +1,230 @@
+/**
+ * WISE_FWI_Module: FWIMonteCarlo.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIMonteCarlo.h"
+#include "FWIRegionalFactors.h"
+#include "fwi_kernels.h"
+#include "fwi_math.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <thread>
+
+
+// the weather variables perturbed, each with its own stream of deviates
+enum perturbation { PERTURB_TEMPERATURE, PERTURB_RH, PERTURB_WS, PERTURB_RAIN, PERTURB_COUNT };
+
+
+static inline std::uint64_t mix(std::uint64_t x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+
+// the key of the deviates for one station, day and variable; the sample is the counter
+static inline std::uint64_t stream_key(std::uint64_t seed, std::uint32_t station, std::uint16_t day, std::uint8_t variable) {
+	return mix(mix(mix(seed) ^ station) ^ (((std::uint64_t)day << 8) | variable));
+}
+
+
+double FWIMonteCarloStatistics::StandardDeviation() const {
+	if (samples < 2)
+		return 0.0;
+	const double mean = sum / samples;
+	const double variance = (sum_squares - mean * sum) / (samples - 1);
+	return (variance > 0.0) ? std::sqrt(variance) : 0.0;
+}
+
+
+FWIMonteCarlo::FWIMonteCarlo(const FWIMonteCarloSettings &settings)
+    : m_settings(settings),
+      m_stations(0),
+      m_days(0) {
+}
+
+
+HRESULT FWIMonteCarlo::Run(std::uint32_t stations, const double *latitude, const double *longitude, const double *in_ffmc, const double *in_dmc, const double *in_dc,
+    const FWIForecastWeather &forecast, const FWIRegionalFactors *factors) {
+	if ((!latitude) || (!longitude) || (!in_ffmc) || (!in_dmc) || (!in_dc) || (!forecast.month) || (!forecast.temperature) || (!forecast.rh) || (!forecast.ws) || (!forecast.rain))
+		return E_POINTER;
+	const FWIMonteCarloSettings &s = m_settings;
+	if ((!s.samples) || (!(s.temperature_sd >= 0.0)) || (!(s.rh_sd >= 0.0)) || (!(s.ws_sd >= 0.0)) || (!(s.rain_sd >= 0.0)))
+		return E_INVALIDARG;
+	for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+		for (std::uint8_t t = 1; t < FWI_MONTE_CARLO_THRESHOLD_COUNT; t++)
+			if (!(s.thresholds[c][t] >= s.thresholds[c][t - 1]))
+				return E_INVALIDARG;
+	for (std::uint16_t d = 0; d < forecast.days; d++)
+		if (forecast.month[d] > 11)
+			return E_INVALIDARG;
+
+	m_stations = 0;
+	m_days = 0;
+	m_statistics.clear();
+
+	FWICellFactors cells;
+	try {
+		HRESULT hr;
+		if (factors)
+			hr = factors->Resolve(stations, latitude, longitude, &cells);
+		else
+			hr = FWIRegionalFactors().Resolve(stations, latitude, longitude, &cells);
+		if (FAILED(hr))
+			return hr;
+
+		m_statistics.assign((std::size_t)stations * forecast.days * FWI_CODE_COUNT, FWIMonteCarloStatistics(s.relative_accuracy));
+	}
+	catch (...) {
+		m_statistics.clear();
+		return E_OUTOFMEMORY;
+	}
+	m_stations = stations;
+	m_days = forecast.days;
+
+	std::atomic<std::uint32_t> next(0);
+	std::mutex lock;
+	HRESULT result = S_OK;
+	auto fail = [&](HRESULT hr) {
+		std::lock_guard<std::mutex> l(lock);
+		if (SUCCEEDED(result))
+			result = hr;
+	};
+	auto failed = [&]() {
+		std::lock_guard<std::mutex> l(lock);
+		return FAILED(result);
+	};
+
+	// each station's samples are one batch, run by one thread day by day, so only ever touch its own statistics
+	auto worker = [&]() {
+		const FwiKernelTable &k = fwi_kernels();
+		const fwi_math_table &m = fwi_math_functions();
+		const std::size_t n = s.samples;
+		std::vector<double> scratch;
+		try {
+			scratch.resize(n * (10 + FWI_CODE_COUNT));
+		}
+		catch (...) {
+			fail(E_OUTOFMEMORY);
+			return;
+		}
+		double *z = scratch.data(), *temperature = z + n, *rh = temperature + n, *ws = rh + n, *rain = ws + n, *el = rain + n, *fl = el + n;
+		double *state[3] = { fl + n, fl + 2 * n, fl + 3 * n }, *codes[FWI_CODE_COUNT];
+		for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+			codes[c] = fl + (4 + c) * n;
+		const double ws_bias = 0.5 * s.ws_sd * s.ws_sd, rain_bias = 0.5 * s.rain_sd * s.rain_sd;
+
+		for (std::uint32_t station = next++; (station < stations) && (!failed()); station = next++) {
+			std::fill(state[0], state[0] + n, in_ffmc[station]);
+			std::fill(state[1], state[1] + n, in_dmc[station]);
+			std::fill(state[2], state[2] + n, in_dc[station]);
+
+			for (std::uint16_t day = 0; day < forecast.days; day++) {
+				const std::size_t at = (std::size_t)day * stations + station;
+				k.normal_deviates(n, stream_key(s.seed, station, day, PERTURB_TEMPERATURE), 0, z);
+				for (std::size_t i = 0; i < n; i++)
+					temperature[i] = forecast.temperature[at] + s.temperature_sd * z[i];
+				k.normal_deviates(n, stream_key(s.seed, station, day, PERTURB_RH), 0, z);
+				for (std::size_t i = 0; i < n; i++) {
+					const double r = forecast.rh[at] + s.rh_sd * z[i];
+					rh[i] = (r < 0.0) ? 0.0 : ((r > 1.0) ? 1.0 : r);
+				}
+				k.normal_deviates(n, stream_key(s.seed, station, day, PERTURB_WS), 0, z);
+				for (std::size_t i = 0; i < n; i++)
+					ws[i] = forecast.ws[at] * m.exp(s.ws_sd * z[i] - ws_bias);
+				k.normal_deviates(n, stream_key(s.seed, station, day, PERTURB_RAIN), 0, z);
+				for (std::size_t i = 0; i < n; i++)
+					rain[i] = forecast.rain[at] * m.exp(s.rain_sd * z[i] - rain_bias);
+				std::fill(el, el + n, cells.EL(forecast.month[day])[station]);
+				std::fill(fl, fl + n, cells.FL(forecast.month[day])[station]);
+
+				const fwi_daily_inputs in = { state[0], state[1], state[2], rain, temperature, rh, ws, el, fl };
+				const fwi_daily_outputs out = { codes[(int)FWICode::FFMC], codes[(int)FWICode::DMC], codes[(int)FWICode::DC], codes[(int)FWICode::BUI],
+					codes[(int)FWICode::ISI], codes[(int)FWICode::FWI], codes[(int)FWICode::DSR] };
+				k.daily_chain(n, in, out);
+
+				for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++) {
+					FWIMonteCarloStatistics &st = m_statistics[index(station, day, (FWICode)c)];
+					const double *v = codes[c], *threshold = s.thresholds[c];
+					for (std::size_t i = 0; i < n; i++) {
+						if (v[i] < 0.0) {
+							st.missing++;
+							continue;
+						}
+						st.samples++;
+						st.sum += v[i];
+						st.sum_squares += v[i] * v[i];
+						for (std::uint8_t t = 0; t < FWI_MONTE_CARLO_THRESHOLD_COUNT; t++)
+							st.above[t] += (v[i] >= threshold[t]);
+						st.sketch.Add(v[i]);
+					}
+				}
+				std::copy(codes[(int)FWICode::FFMC], codes[(int)FWICode::FFMC] + n, state[0]);
+				std::copy(codes[(int)FWICode::DMC], codes[(int)FWICode::DMC] + n, state[1]);
+				std::copy(codes[(int)FWICode::DC], codes[(int)FWICode::DC] + n, state[2]);
+			}
+		}
+	};
+
+	std::uint32_t threads = s.threads ? s.threads : std::thread::hardware_concurrency();
+	if (threads > stations)
+		threads = stations;
+	if (threads < 1)
+		threads = 1;
+
+	// the calling thread joins in
+	std::vector<std::thread> pool;
+	try {
+		for (std::uint32_t i = 1; i < threads; i++)
+			pool.emplace_back(worker);
+	}
+	catch (...) {
+		// carry on with however many threads started
+	}
+	worker();
+	for (auto &t : pool)
+		t.join();
+
+	if (FAILED(result)) {
+		m_stations = 0;
+		m_days = 0;
+		m_statistics.clear();
+	}
+	return result;
+}
+
+
+const FWIMonteCarloStatistics *FWIMonteCarlo::Statistics(std::uint32_t station, std::uint16_t day, FWICode code) const {
+	if ((station >= m_stations) || (day >= m_days) || ((std::uint8_t)code >= FWI_CODE_COUNT))
+		return nullptr;
+	return &m_statistics[index(station, day, code)];
+}
+
+
+HRESULT FWIMonteCarlo::Quantile(std::uint32_t station, std::uint16_t day, FWICode code, double q, double *value) const {
+	if (!value)
+		return E_POINTER;
+	const FWIMonteCarloStatistics *st = Statistics(station, day, code);
+	if (!st)
+		return E_INVALIDARG;
+	return st->sketch.Quantile(q, value);
+}
@@ -0,0 +1,164 @@
+/**
+ * WISE_FWI_Module: FWINumaTopology.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWINumaTopology.h"
+
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fstream>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+#ifdef _WIN32
+
+struct numa_node {
+	GROUP_AFFINITY affinity;
+};
+
+
+static std::vector<numa_node> read_topology() {
+	std::vector<numa_node> nodes;
+	ULONG highest;
+	if (!GetNumaHighestNodeNumber(&highest))
+		return nodes;
+	for (USHORT n = 0; n <= highest; n++) {
+		numa_node node = {};
+		if (GetNumaNodeProcessorMaskEx(n, &node.affinity) && node.affinity.Mask)
+			nodes.push_back(node);
+	}
+	return nodes;
+}
+
+
+static std::uint32_t processor_count(const numa_node &node) {
+	std::uint32_t count = 0;
+	for (KAFFINITY m = node.affinity.Mask; m; m &= m - 1)
+		count++;
+	return count;
+}
+
+
+static bool bind(const numa_node &node) {
+	return SetThreadGroupAffinity(GetCurrentThread(), &node.affinity, nullptr) != 0;
+}
+
+#else
+
+struct numa_node {
+	std::vector<int> cpus;
+};
+
+
+// parses a kernel CPU list, e.g. "0-3,8-11"
+static std::vector<int> parse_cpulist(const std::string &list) {
+	std::vector<int> cpus;
+	std::size_t pos = 0;
+	while (pos < list.size()) {
+		std::size_t end = list.find(',', pos);
+		if (end == std::string::npos)
+			end = list.size();
+		const std::string range = list.substr(pos, end - pos);
+		const std::size_t dash = range.find('-');
+		try {
+			const int first = std::stoi(range.substr(0, dash));
+			const int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+			for (int c = first; c <= last; c++)
+				cpus.push_back(c);
+		}
+		catch (...) {
+		}
+		pos = end + 1;
+	}
+	return cpus;
+}
+
+
+static std::vector<numa_node> read_topology() {
+	std::vector<numa_node> nodes;
+	// node numbers can have gaps, so look a little past the last one found
+	for (int n = 0, missing = 0; missing < 64; n++) {
+		std::ifstream f("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+		if (!f) {
+			missing++;
+			continue;
+		}
+		missing = 0;
+		std::string list;
+		std::getline(f, list);
+		numa_node node;
+		node.cpus = parse_cpulist(list);
+		if (!node.cpus.empty())
+			nodes.push_back(node);
+	}
+	return nodes;
+}
+
+
+static std::uint32_t processor_count(const numa_node &node) {
+	return (std::uint32_t)node.cpus.size();
+}
+
+
+static bool bind(const numa_node &node) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int c : node.cpus)
+		if (c < CPU_SETSIZE)
+			CPU_SET(c, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#endif
+
+
+static const std::vector<numa_node> &topology() {
+	static const std::vector<numa_node> nodes = read_topology();
+	return nodes;
+}
+
+
+std::uint32_t FWINumaTopology::Nodes() {
+	const std::size_t n = topology().size();
+	return n ? (std::uint32_t)n : 1;
+}
+
+
+std::uint32_t FWINumaTopology::Processors(std::uint32_t node) {
+	const auto &nodes = topology();
+	if (nodes.empty())
+		return node ? 0 : std::thread::hardware_concurrency();
+	return (node < nodes.size()) ? processor_count(nodes[node]) : 0;
+}
+
+
+HRESULT FWINumaTopology::BindThread(std::uint32_t node) {
+	if (node >= Nodes())
+		return E_INVALIDARG;
+	const auto &nodes = topology();
+	if (nodes.size() < 2)
+		return S_FALSE;
+	return bind(nodes[node]) ? S_OK : E_FAIL;
+}
@@ -0,0 +1,139 @@
+/**
+ * WISE_FWI_Module: FWIQuantileSketch.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIQuantileSketch.h"
+#include "fwi_math.h"
+
+#include <cmath>
+
+
+// values smaller than this are counted as zero, rather than spreading buckets down towards 0
+static const double MIN_VALUE = 0.001;
+
+
+FWIQuantileSketch::FWIQuantileSketch(double relative_accuracy) {
+	if ((relative_accuracy <= 0.0) || (relative_accuracy >= 1.0))
+		relative_accuracy = 0.005;
+	m_accuracy = relative_accuracy;
+	m_gamma = (1.0 + relative_accuracy) / (1.0 - relative_accuracy);
+	m_inv_log_gamma = 1.0 / fwi_math_functions().log(m_gamma);
+	m_offset = 0;
+	Clear();
+}
+
+
+void FWIQuantileSketch::Clear() {
+	m_count = m_zero = 0;
+	m_min = m_max = 0.0;
+	m_buckets.clear();
+}
+
+
+void FWIQuantileSketch::grow(std::int32_t index) {
+	if (m_buckets.empty()) {
+		m_offset = index;
+		m_buckets.assign(1, 0);
+	}
+	else if (index < m_offset) {
+		m_buckets.insert(m_buckets.begin(), (std::size_t)(m_offset - index), 0);
+		m_offset = index;
+	}
+	else if (index >= m_offset + (std::int32_t)m_buckets.size())
+		m_buckets.resize((std::size_t)(index - m_offset) + 1, 0);
+}
+
+
+void FWIQuantileSketch::Add(double value) {
+	if (!(value >= 0.0))
+		return;
+
+	if (!m_count)
+		m_min = m_max = value;
+	else if (value < m_min)
+		m_min = value;
+	else if (value > m_max)
+		m_max = value;
+	m_count++;
+
+	if (value < MIN_VALUE) {
+		m_zero++;
+		return;
+	}
+	const std::int32_t index = (std::int32_t)std::ceil(fwi_math_functions().log(value) * m_inv_log_gamma);
+	grow(index);
+	m_buckets[index - m_offset]++;
+}
+
+
+HRESULT FWIQuantileSketch::Merge(const FWIQuantileSketch &other) {
+	if (other.m_accuracy != m_accuracy)
+		return E_INVALIDARG;
+	if (!other.m_count)
+		return S_OK;
+
+	try {
+		if (!other.m_buckets.empty()) {
+			grow(other.m_offset);
+			grow(other.m_offset + (std::int32_t)other.m_buckets.size() - 1);
+		}
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	for (std::size_t i = 0; i < other.m_buckets.size(); i++)
+		m_buckets[other.m_offset - m_offset + i] += other.m_buckets[i];
+
+	if ((!m_count) || (other.m_min < m_min))
+		m_min = other.m_min;
+	if ((!m_count) || (other.m_max > m_max))
+		m_max = other.m_max;
+	m_count += other.m_count;
+	m_zero += other.m_zero;
+	return S_OK;
+}
+
+
+HRESULT FWIQuantileSketch::Quantile(double q, double *value) const {
+	if (!value)
+		return E_POINTER;
+	if ((q < 0.0) || (q > 1.0))
+		return E_INVALIDARG;
+	if (!m_count)
+		return E_UNEXPECTED;
+
+	// lower rank, so the 0th and 100th percentiles are the smallest and largest values
+	const std::uint64_t rank = (std::uint64_t)std::floor(q * (double)(m_count - 1));
+	double v;
+	if (rank < m_zero)
+		v = 0.0;
+	else {
+		std::uint64_t seen = m_zero;
+		std::size_t i = 0;
+		while ((i + 1 < m_buckets.size()) && ((seen + m_buckets[i]) <= rank))
+			seen += m_buckets[i++];
+		// the midpoint of the bucket (in relative terms), within relative_accuracy of every value in it
+		v = 2.0 * fwi_math_functions().pow(m_gamma, (double)(m_offset + (std::int32_t)i)) / (m_gamma + 1.0);
+	}
+	if (v < m_min)
+		v = m_min;
+	else if (v > m_max)
+		v = m_max;
+	*value = v;
+	return S_OK;
+}
@@ -0,0 +1,65 @@
+/**
+ * WISE_FWI_Module: FWIQuantized.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIQuantized.h"
+
+
+HRESULT FWIQuantized::Quantize(FWICode code, std::uint32_t count, const double *values, std::uint16_t *q) {
+	if (count && ((!values) || (!q)))
+		return E_POINTER;
+	for (std::uint32_t i = 0; i < count; i++)
+		q[i] = Quantize(code, values[i]);
+	return S_OK;
+}
+
+
+HRESULT FWIQuantized::Dequantize(FWICode code, std::uint32_t count, const std::uint16_t *q, double *values) {
+	if (count && ((!values) || (!q)))
+		return E_POINTER;
+	for (std::uint32_t i = 0; i < count; i++)
+		values[i] = Dequantize(code, q[i]);
+	return S_OK;
+}
+
+
+HRESULT FWIQuantized::QuantizeState(FWICode code, std::uint32_t count, const double *values, std::uint32_t *q) {
+	if (count && ((!values) || (!q)))
+		return E_POINTER;
+	for (std::uint32_t i = 0; i < count; i++)
+		q[i] = QuantizeState(code, values[i]);
+	return S_OK;
+}
+
+
+HRESULT FWIQuantized::DequantizeState(std::uint32_t count, const std::uint32_t *q, double *values) {
+	if (count && ((!values) || (!q)))
+		return E_POINTER;
+	for (std::uint32_t i = 0; i < count; i++)
+		values[i] = DequantizeState(q[i]);
+	return S_OK;
+}
+
+
+HRESULT FWIQuantized::NarrowState(FWICode code, std::uint32_t count, const std::uint32_t *state, std::uint16_t *q) {
+	if (count && ((!state) || (!q)))
+		return E_POINTER;
+	for (std::uint32_t i = 0; i < count; i++)
+		q[i] = Quantize(code, DequantizeState(state[i]));
+	return S_OK;
+}
@@ -0,0 +1,253 @@
+/**
+ * WISE_FWI_Module: FWIRegionalFactors.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIRegionalFactors.h"
+#include "fwi_tables.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "angles.h"
+
+using namespace fwi_tables;
+
+
+static FWIRegion builtin(const char *name, double lat_min, double lat_max, const double *el, const double *fl) {
+	FWIRegion r;
+	r.name = name;
+	r.latitude_min = lat_min;
+	r.latitude_max = lat_max;
+	r.longitude_min = -180.0;
+	r.longitude_max = 180.0;
+	for (int i = 0; i < 12; i++) {
+		r.el[i] = el[i];
+		r.fl[i] = fl[i];
+	}
+	return r;
+}
+
+
+FWIRegionalFactors::FWIRegionalFactors() {
+	// nested so that, with later regions taking precedence, the bands and their (inclusive) edges match calc_el_table()
+	// and calc_fl_table()
+	Add(builtin("equatorial", -90.0, 90.0, EL_EQ, FL_EQ));
+	Add(builtin("southern 10-30", -90.0, -10.0, EL_S20, FL_NZ));
+	Add(builtin("northern 10-30", 10.0, 90.0, EL_N20, FL));
+	Add(builtin("southern", -90.0, -30.0, EL_NZ, FL_NZ));
+	Add(builtin("northern", 30.0, 90.0, EL, FL));
+}
+
+
+HRESULT FWIRegionalFactors::Add(const FWIRegion &region) {
+	if ((region.latitude_min < -90.0) || (region.latitude_max > 90.0) || (region.latitude_min > region.latitude_max) ||
+	    (region.longitude_min < -180.0) || (region.longitude_min > 180.0) || (region.longitude_max < -180.0) || (region.longitude_max > 180.0))
+		return E_INVALIDARG;
+
+	try {
+		entry e;
+		e.region = region;
+		e.lat_min = DEGREE_TO_RADIAN(region.latitude_min);
+		e.lat_max = DEGREE_TO_RADIAN(region.latitude_max);
+		e.lon_min = DEGREE_TO_RADIAN(region.longitude_min);
+		e.lon_max = DEGREE_TO_RADIAN(region.longitude_max);
+		e.all_longitudes = (region.longitude_min == -180.0) && (region.longitude_max == 180.0);
+		m_regions.push_back(e);
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIRegionalFactors::Load(const char *filename, std::uint32_t *error_line) {
+	if (!filename)
+		return E_POINTER;
+	if (error_line)
+		*error_line = 0;
+
+	std::string text;
+	try {
+		std::ifstream in(filename);
+		if (!in)
+			return E_FAIL;
+		std::ostringstream ss;
+		ss << in.rdbuf();
+		text = ss.str();
+	}
+	catch (...) {
+		return E_FAIL;
+	}
+	return Parse(text.c_str(), error_line);
+}
+
+
+HRESULT FWIRegionalFactors::Parse(const char *text, std::uint32_t *error_line) {
+	if (!text)
+		return E_POINTER;
+	if (error_line)
+		*error_line = 0;
+
+	try {
+		FWIRegionalFactors parsed(*this);
+		FWIRegion region;
+		std::uint32_t line_no = 0, have = 0;			// have: bit 0 region line, bit 1 el, bit 2 fl
+		std::istringstream in(text);
+		std::string line;
+
+		auto fail = [&]() {
+			if (error_line)
+				*error_line = line_no;
+			return E_INVALIDARG;
+		};
+
+		while (std::getline(in, line)) {
+			line_no++;
+			std::string::size_type hash = line.find('#');
+			if (hash != std::string::npos)
+				line.erase(hash);
+
+			std::istringstream words(line);
+			std::string keyword;
+			if (!(words >> keyword))
+				continue;
+
+			if (keyword == "clear") {
+				if (have)
+					return fail();
+				parsed.Clear();
+			}
+			else if (keyword == "region") {
+				if (have)
+					return fail();
+				if (!(words >> region.name >> region.latitude_min >> region.latitude_max >> region.longitude_min >> region.longitude_max))
+					return fail();
+				have = 1;
+			}
+			else if ((keyword == "el") || (keyword == "fl")) {
+				const std::uint32_t bit = (keyword == "el") ? 2 : 4;
+				if ((!(have & 1)) || (have & bit))
+					return fail();
+				std::array<double, 12> &v = (keyword == "el") ? region.el : region.fl;
+				for (int i = 0; i < 12; i++)
+					if (!(words >> v[i]))
+						return fail();
+				have |= bit;
+			}
+			else
+				return fail();
+
+			std::string extra;
+			if (words >> extra)
+				return fail();
+
+			if (have == 7) {
+				if (FAILED(parsed.Add(region)))
+					return fail();
+				have = 0;
+			}
+		}
+		if (have) {
+			line_no++;
+			return fail();
+		}
+		m_regions.swap(parsed.m_regions);
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
+}
+
+
+const FWIRegionalFactors::entry *FWIRegionalFactors::find(double latitude, const double *longitude) const {
+	for (auto e = m_regions.rbegin(); e != m_regions.rend(); ++e) {
+		if ((latitude < e->lat_min) || (latitude > e->lat_max))
+			continue;
+		if (e->all_longitudes)
+			return &*e;
+		if (!longitude)
+			continue;
+		if (e->lon_min <= e->lon_max) {
+			if ((*longitude >= e->lon_min) && (*longitude <= e->lon_max))
+				return &*e;
+		}
+		else if ((*longitude >= e->lon_min) || (*longitude <= e->lon_max))
+			return &*e;
+	}
+	return nullptr;
+}
+
+
+HRESULT FWICellFactors::Reserve(std::uint32_t cells) {
+	try {
+		m_el.reserve((std::size_t)cells * 12);
+		m_fl.reserve((std::size_t)cells * 12);
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIRegionalFactors::Resolve(double latitude, double longitude, double *el, double *fl) const {
+	if ((!el) || (!fl))
+		return E_POINTER;
+	const entry *e = find(latitude, &longitude);
+	if (!e)
+		return E_INVALIDARG;
+	for (int i = 0; i < 12; i++) {
+		el[i] = e->region.el[i];
+		fl[i] = e->region.fl[i];
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIRegionalFactors::Resolve(std::uint32_t count, const double *latitude, const double *longitude, FWICellFactors *factors) const {
+	if ((!latitude) || (!factors))
+		return E_POINTER;
+
+	try {
+		factors->m_el.assign((std::size_t)count * 12, 0.0);
+		factors->m_fl.assign((std::size_t)count * 12, 0.0);
+	}
+	catch (...) {
+		factors->m_el.clear();
+		factors->m_fl.clear();
+		factors->m_cells = 0;
+		return E_OUTOFMEMORY;
+	}
+	factors->m_cells = count;
+
+	HRESULT hr = S_OK;
+	for (std::uint32_t i = 0; i < count; i++) {
+		const entry *e = find(latitude[i], longitude ? (longitude + i) : nullptr);
+		if (!e) {
+			hr = E_INVALIDARG;
+			continue;
+		}
+		for (std::size_t m = 0; m < 12; m++) {
+			factors->m_el[m * count + i] = e->region.el[m];
+			factors->m_fl[m * count + i] = e->region.fl[m];
+		}
+	}
+	return hr;
+}
@@ -0,0 +1,347 @@
+/**
+ * WISE_FWI_Module: FWIResultCache.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIResultCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+static const std::uint32_t NONE = 0xffffffff;
+static const std::uint32_t MAX_SHARDS = 1024;
+static const std::uint32_t KEY_WORDS = 6;
+static const std::uint64_t HASH_MULTIPLIERS[KEY_WORDS - 1] = { 0xbf58476d1ce4e5b9ULL, 0x94d049bb133111ebULL, 0xd6e8feb86659fd93ULL,
+	0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL };
+
+// which calculation an entry holds, the low byte of its first key word
+enum cache_op : std::uint8_t {
+	OP_HOURLY_FFMC = 1,
+	OP_HOURLY_FFMC_PREVIOUS,
+	OP_DAILY_FFMC,
+	OP_FWI
+};
+
+
+/*
+ * The inputs of one call: the operation and its duration in seconds, if it has one, in the first word, then the bits
+ * of up to 5 floating point inputs.  Unused words stay 0.
+ */
+struct fwi_cache_key {
+	std::uint64_t word[KEY_WORDS];
+	std::uint64_t hash;
+
+	fwi_cache_key(cache_op op, std::uint32_t integer, std::initializer_list<double> values) {
+		word[0] = (std::uint64_t)op | ((std::uint64_t)integer << 8);
+		std::uint32_t i = 1;
+		for (double v : values)
+			std::memcpy(&word[i++], &v, sizeof(double));
+		for (; i < KEY_WORDS; i++)
+			word[i] = 0;
+
+		// the words are multiplied independently and summed, rather than chained, to keep the hash off the hit path's
+		// critical path
+		std::uint64_t h = word[0] * 0x9e3779b97f4a7c15ULL;
+		for (i = 1; i < KEY_WORDS; i++)
+			h += (word[i] ^ (word[i] >> 29)) * HASH_MULTIPLIERS[i - 1];
+		h ^= h >> 32;
+		h *= 0xd6e8feb86659fd93ULL;
+		hash = h ^ (h >> 32);
+	}
+
+	double value(std::uint32_t i) const {
+		double v;
+		std::memcpy(&v, &word[i + 1], sizeof(double));
+		return v;
+	}
+
+	bool operator==(const fwi_cache_key &k) const {
+		return (hash == k.hash) && (!std::memcmp(word, k.word, sizeof(word)));
+	}
+};
+
+
+struct cache_entry {
+	fwi_cache_key key;
+	double value;
+	std::uint32_t prev, next;			// towards the most and least recently used
+};
+
+
+/*
+ * A shard is a fixed pool of entries on a doubly linked list in order of use, and an open addressed index into them
+ * (linear probing, twice as many slots as entries, deletion by shifting back).
+ */
+struct alignas(64) fwi_cache_shard {
+	std::mutex lock;
+	std::vector<cache_entry> entries;		// reserved up front, never reallocated
+	std::vector<std::uint32_t> slots;
+	std::uint32_t slot_mask = 0;
+	std::uint32_t head = NONE, tail = NONE;	// most and least recently used
+	std::uint64_t hits = 0, misses = 0, evictions = 0;
+
+	std::uint32_t capacity() const { return (std::uint32_t)entries.capacity(); }
+
+	std::uint32_t find_slot(const fwi_cache_key &key) const {
+		for (std::uint32_t s = (std::uint32_t)key.hash & slot_mask; ; s = (s + 1) & slot_mask)
+			if ((slots[s] == NONE) || (entries[slots[s]].key == key))
+				return s;
+	}
+
+	void unlink(std::uint32_t e) {
+		cache_entry &c = entries[e];
+		if (c.prev != NONE)	entries[c.prev].next = c.next;
+		else			head = c.next;
+		if (c.next != NONE)	entries[c.next].prev = c.prev;
+		else			tail = c.prev;
+	}
+
+	void push_front(std::uint32_t e) {
+		cache_entry &c = entries[e];
+		c.prev = NONE;
+		c.next = head;
+		if (head != NONE)
+			entries[head].prev = e;
+		head = e;
+		if (tail == NONE)
+			tail = e;
+	}
+
+	void erase_slot(std::uint32_t s) {
+		slots[s] = NONE;
+		// close the gap, so that every entry stays reachable from its home slot
+		for (std::uint32_t n = (s + 1) & slot_mask; slots[n] != NONE; n = (n + 1) & slot_mask) {
+			const std::uint32_t home = (std::uint32_t)entries[slots[n]].key.hash & slot_mask;
+			if (((n - home) & slot_mask) >= ((n - s) & slot_mask)) {
+				slots[s] = slots[n];
+				slots[n] = NONE;
+				s = n;
+			}
+		}
+	}
+
+	void clear() {
+		entries.clear();
+		std::fill(slots.begin(), slots.end(), NONE);
+		head = tail = NONE;
+		hits = misses = evictions = 0;
+	}
+};
+
+
+FWIResultCache::FWIResultCache(std::size_t bytes, std::uint32_t mantissa_bits, std::uint32_t shards) {
+	if ((!mantissa_bits) || (mantissa_bits > EXACT))
+		mantissa_bits = EXACT;
+	m_mantissa_bits = mantissa_bits;
+	const std::uint32_t drop = EXACT - mantissa_bits;
+	m_drop_mask = drop ? ((1ULL << drop) - 1) : 0;
+	m_drop_half = drop ? (1ULL << (drop - 1)) : 0;
+
+	if (!shards) {
+		const std::uint32_t threads = std::thread::hardware_concurrency();
+		shards = 4 * (threads ? threads : 1);
+	}
+	if (shards > MAX_SHARDS)
+		shards = MAX_SHARDS;
+	std::uint32_t n = 1;
+	while (n < shards)
+		n <<= 1;
+
+	// each entry costs its own size and two index slots, and each shard gets at least a few entries
+	const std::size_t entry_bytes = sizeof(cache_entry) + 2 * sizeof(std::uint32_t);
+	while ((n > 1) && (bytes / n < 64 * entry_bytes))
+		n >>= 1;
+	const std::size_t per_shard = bytes / n / entry_bytes;
+
+	m_shard_mask = n - 1;
+	if (per_shard)
+		try {
+			m_shards.reset(new fwi_cache_shard[n]);
+			for (std::uint32_t i = 0; i < n; i++) {
+				fwi_cache_shard &s = m_shards[i];
+				std::uint32_t slots = 1;
+				while (slots < 2 * per_shard)
+					slots <<= 1;
+				s.entries.reserve(per_shard);
+				s.slots.assign(slots, NONE);
+				s.slot_mask = slots - 1;
+			}
+		}
+		catch (...) {
+			m_shards.reset();
+		}
+
+	if (!m_shards) {
+		// a cache that holds nothing, so every call is calculated, and from the inputs as given: with nothing to
+		// share there's no reason to round them
+		m_shard_mask = 0;
+		m_mantissa_bits = EXACT;
+		m_drop_mask = m_drop_half = 0;
+	}
+}
+
+
+FWIResultCache::~FWIResultCache() {
+}
+
+
+double FWIResultCache::quantize(double value) const {
+	if ((!m_drop_mask) || (value == 0.0))
+		return value;
+	std::uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(double));
+	if ((bits & 0x7ff0000000000000ULL) == 0x7ff0000000000000ULL)
+		return value;				// infinity or NaN
+	bits = (bits + m_drop_half) & ~m_drop_mask;	// a carry out of the mantissa correctly bumps the exponent
+	std::memcpy(&value, &bits, sizeof(double));
+	return value;
+}
+
+
+fwi_cache_shard &FWIResultCache::shard(const fwi_cache_key &key) const {
+	// the high bits pick the shard, the low bits the slot within it
+	return m_shards[(std::uint32_t)(key.hash >> 40) & m_shard_mask];
+}
+
+
+bool FWIResultCache::find(const fwi_cache_key &key, double *value) const {
+	fwi_cache_shard &s = shard(key);
+	std::lock_guard<std::mutex> l(s.lock);
+	if (s.capacity()) {
+		const std::uint32_t e = s.slots[s.find_slot(key)];
+		if (e != NONE) {
+			if (s.head != e) {
+				s.unlink(e);
+				s.push_front(e);
+			}
+			*value = s.entries[e].value;
+			s.hits++;
+			return true;
+		}
+	}
+	s.misses++;
+	return false;
+}
+
+
+void FWIResultCache::insert(const fwi_cache_key &key, double value) const {
+	fwi_cache_shard &s = shard(key);
+	std::lock_guard<std::mutex> l(s.lock);
+	if (!s.capacity())
+		return;
+	std::uint32_t slot = s.find_slot(key);
+	if (s.slots[slot] != NONE)
+		return;					// another thread calculated the same result first
+
+	std::uint32_t e;
+	if (s.entries.size() < s.capacity()) {
+		e = (std::uint32_t)s.entries.size();
+		s.entries.push_back(cache_entry{ key, value, NONE, NONE });	// within the reserved capacity
+	}
+	else {
+		e = s.tail;
+		s.unlink(e);
+		s.erase_slot(s.find_slot(s.entries[e].key));
+		s.evictions++;
+		s.entries[e].key = key;
+		s.entries[e].value = value;
+		slot = s.find_slot(key);		// the eviction may have shifted the probe sequence
+	}
+	s.slots[slot] = e;
+	s.push_front(e);
+}
+
+
+template <typename F>
+HRESULT FWIResultCache::cached(const fwi_cache_key &key, double *result, F calculate) const {
+	if (!result)
+		return E_POINTER;
+	if (!m_shards)
+		return calculate(result);
+	if (find(key, result))
+		return S_OK;
+	const HRESULT hr = calculate(result);
+	if (SUCCEEDED(hr))
+		insert(key, *result);
+	return hr;
+}
+
+
+void FWIResultCache::Clear() {
+	if (m_shards)
+		for (std::uint32_t i = 0; i <= m_shard_mask; i++) {
+			std::lock_guard<std::mutex> l(m_shards[i].lock);
+			m_shards[i].clear();
+		}
+}
+
+
+FWIResultCacheStatistics FWIResultCache::Statistics() const {
+	FWIResultCacheStatistics stats;
+	if (m_shards)
+		for (std::uint32_t i = 0; i <= m_shard_mask; i++) {
+			fwi_cache_shard &s = m_shards[i];
+			std::lock_guard<std::mutex> l(s.lock);
+			stats.hits += s.hits;
+			stats.misses += s.misses;
+			stats.evictions += s.evictions;
+			stats.entries += s.entries.size();
+			stats.capacity += s.capacity();
+			stats.bytes += s.capacity() * sizeof(cache_entry) + s.slots.size() * sizeof(std::uint32_t);
+		}
+	return stats;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// The cached methods, each calculating from the rounded inputs it's keyed on
+
+HRESULT FWIResultCache::HourlyFFMC_VanWagner(double in_ffmc, double rain, double temperature, double rh, double ws, std::uint32_t seconds_since_ffmc, double *ffmc) {
+	const fwi_cache_key key(OP_HOURLY_FFMC, seconds_since_ffmc, { quantize(in_ffmc), quantize(rain), quantize(temperature), quantize(rh), quantize(ws) });
+	return cached(key, ffmc, [&](double *r) {
+		return CCWFGM_FWI::HourlyFFMC_VanWagner(key.value(0), key.value(1), key.value(2), key.value(3), key.value(4), seconds_since_ffmc, r);
+	});
+}
+
+
+HRESULT FWIResultCache::HourlyFFMC_VanWagner_Previous(double current_ffmc, double rain, double temperature, double rh, double ws, double *prev_ffmc) {
+	const fwi_cache_key key(OP_HOURLY_FFMC_PREVIOUS, 0, { quantize(current_ffmc), quantize(rain), quantize(temperature), quantize(rh), quantize(ws) });
+	return cached(key, prev_ffmc, [&](double *r) {
+		return CCWFGM_FWI::HourlyFFMC_VanWagner_Previous(key.value(0), key.value(1), key.value(2), key.value(3), key.value(4), r);
+	});
+}
+
+
+HRESULT FWIResultCache::DailyFFMC_VanWagner(double in_ffmc, double rain, double temperature, double rh, double ws, double *ffmc) {
+	const fwi_cache_key key(OP_DAILY_FFMC, 0, { quantize(in_ffmc), quantize(rain), quantize(temperature), quantize(rh), quantize(ws) });
+	return cached(key, ffmc, [&](double *r) {
+		return CCWFGM_FWI::DailyFFMC_VanWagner(key.value(0), key.value(1), key.value(2), key.value(3), key.value(4), r);
+	});
+}
+
+
+HRESULT FWIResultCache::FWI(double isi, double bui, double *fwi) const {
+	const fwi_cache_key key(OP_FWI, 0, { quantize(isi), quantize(bui) });
+	return cached(key, fwi, [&](double *r) {
+		return CCWFGM_FWI::FWI(key.value(0), key.value(1), r);
+	});
+}
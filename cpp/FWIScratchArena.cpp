@@ -0,0 +1,189 @@
+/**
+ * WISE_FWI_Module: FWIScratchArena.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIScratchArena.h"
+
+#include <new>
+
+
+// the smallest chunk an owning arena allocates
+static const std::size_t MIN_CHUNK = 16384;
+
+
+static inline std::size_t round_up(std::size_t bytes) {
+	return (bytes + FWIScratchArena::ALIGNMENT - 1) & ~(FWIScratchArena::ALIGNMENT - 1);
+}
+
+
+static std::uint8_t *new_chunk(std::size_t bytes) {
+	return static_cast<std::uint8_t *>(::operator new(bytes, std::align_val_t(FWIScratchArena::ALIGNMENT), std::nothrow));
+}
+
+
+FWIScratchArena::FWIScratchArena()
+    : m_owning(true),
+      m_chunk(0),
+      m_offset(0),
+      m_used(0),
+      m_high_water(0),
+      m_frames(0),
+      m_growths(0) {
+}
+
+
+FWIScratchArena::FWIScratchArena(void *buffer, std::size_t bytes)
+    : m_owning(false),
+      m_chunk(0),
+      m_offset(0),
+      m_used(0),
+      m_high_water(0),
+      m_frames(0),
+      m_growths(0) {
+	if (!buffer)
+		return;
+	const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(buffer), aligned = round_up(start);
+	const std::size_t skip = (std::size_t)(aligned - start);
+	if (bytes <= skip)
+		return;
+	try {
+		m_chunks.push_back(chunk{ reinterpret_cast<std::uint8_t *>(aligned), bytes - skip });
+	}
+	catch (...) {
+		// an arena that hands out nothing
+	}
+}
+
+
+FWIScratchArena::~FWIScratchArena() {
+	free_chunks();
+}
+
+
+FWIScratchArena &FWIScratchArena::ThreadLocal() {
+	thread_local FWIScratchArena arena;
+	return arena;
+}
+
+
+std::size_t FWIScratchArena::Capacity() const {
+	std::size_t bytes = 0;
+	for (const auto &c : m_chunks)
+		bytes += c.bytes;
+	return bytes;
+}
+
+
+void FWIScratchArena::free_chunks() {
+	if (m_owning)
+		for (const auto &c : m_chunks)
+			::operator delete(c.memory, std::align_val_t(ALIGNMENT));
+	m_chunks.clear();
+	m_chunk = m_offset = 0;
+}
+
+
+HRESULT FWIScratchArena::Reserve(std::size_t bytes) {
+	if (m_used)
+		return E_UNEXPECTED;
+	if ((!bytes) || ((m_chunks.size() == 1) && (m_chunks[0].bytes >= bytes)))
+		return S_FALSE;
+	if (!m_owning)
+		return E_OUTOFMEMORY;
+
+	free_chunks();
+	bytes = round_up(bytes);
+	try {
+		m_chunks.reserve(4);
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	std::uint8_t *memory = new_chunk(bytes);
+	if (!memory)
+		return E_OUTOFMEMORY;
+	m_chunks.push_back(chunk{ memory, bytes });
+	m_growths++;
+	return S_OK;
+}
+
+
+void *FWIScratchArena::allocate(std::size_t bytes) {
+	const std::size_t size = round_up(bytes ? bytes : 1);
+	while (m_chunk < m_chunks.size()) {
+		const chunk &c = m_chunks[m_chunk];
+		if (c.bytes - m_offset >= size) {
+			void *p = c.memory + m_offset;
+			m_offset += size;
+			if ((m_used += size) > m_high_water)
+				m_high_water = m_used;
+			return p;
+		}
+		if (m_chunk + 1 == m_chunks.size())
+			break;
+		// the rest of this chunk is skipped until the frame ends
+		m_chunk++;
+		m_offset = 0;
+	}
+	if (!m_owning)
+		return nullptr;
+
+	// what's handed out stays where it is, so carry on in a new chunk at least as large as all the others together
+	std::size_t capacity = Capacity();
+	if (capacity < MIN_CHUNK)
+		capacity = MIN_CHUNK;
+	const std::size_t chunk_bytes = (size > capacity) ? size : capacity;
+	try {
+		m_chunks.reserve(m_chunks.size() + 4);
+	}
+	catch (...) {
+		return nullptr;
+	}
+	std::uint8_t *memory = new_chunk(chunk_bytes);
+	if (!memory)
+		return nullptr;
+	m_chunks.push_back(chunk{ memory, chunk_bytes });
+	m_growths++;
+	m_chunk = m_chunks.size() - 1;
+	m_offset = size;
+	if ((m_used += size) > m_high_water)
+		m_high_water = m_used;
+	return memory;
+}
+
+
+void FWIScratchArena::release(std::size_t chunk_index, std::size_t offset, std::size_t used) {
+	m_chunk = chunk_index;
+	m_offset = offset;
+	m_used = used;
+	m_frames--;
+
+	// once nothing is handed out, an arena that had to grow part way through a call is remade as one chunk large
+	// enough for all of it, so the next call of the same size fits without allocating
+	if ((!m_frames) && (!m_used) && m_owning && (m_chunks.size() > 1)) {
+		std::size_t bytes = Capacity();
+		if (bytes < m_high_water)
+			bytes = m_high_water;
+		free_chunks();
+		std::uint8_t *memory = new_chunk(bytes);
+		if (memory) {
+			m_chunks.push_back(chunk{ memory, bytes });	// capacity is left over from the chunks freed
+			m_growths++;
+		}
+	}
+}
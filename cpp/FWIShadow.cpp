@@ -0,0 +1,557 @@
+/**
+ * WISE_FWI_Module: FWIShadow.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIShadow.h"
+#include "FWITrace.h"
+#include "fwi.h"
+#include "fwi_shadow.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+
+static const std::uint32_t CHANNELS = (std::uint32_t)FWIShadowChannel::COUNT;
+static const char *const CHANNEL_NAMES[CHANNELS] = {
+	"hourly_ffmc_vanwagner", "hourly_ffmc_vanwagner_equilibrium", "hourly_ffmc_vanwagner_quantized", "hourly_ffmc_vanwagner_previous",
+	"hourly_ffmc_lawson",
+	"isi", "bui", "fwi",
+	"daily_ffmc", "daily_dmc", "daily_dc", "daily_bui", "daily_isi", "daily_fwi", "daily_dsr",
+	"quantized_daily_ffmc", "quantized_daily_dmc", "quantized_daily_dc", "quantized_daily_bui", "quantized_daily_isi", "quantized_daily_fwi", "quantized_daily_dsr"
+};
+
+// the upper bounds of histogram buckets 1..15
+static const double BUCKET_LIMITS[FWIShadowStatistics::BUCKETS - 2] = {
+	1e-14, 1e-13, 1e-12, 1e-11, 1e-10, 1e-9, 1e-8, 1e-7, 1e-6, 1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 1.0
+};
+
+
+struct shadow_channel {
+	std::uint64_t samples, exceeded, failures;
+	double max_difference, sum_difference;
+	std::uint64_t histogram[FWIShadowStatistics::BUCKETS];
+	std::vector<FWIShadowSample> worst;		// unordered, at most g_worst
+};
+
+
+// true until the environment has been looked at, so the first batch does, then only while a session is running
+std::atomic<bool> fwi_shadow_active(true);
+
+static std::mutex g_lock;				// guards starting and stopping
+static std::atomic<std::uint32_t> g_session(0);	// 0 while stopped
+static std::uint32_t g_sessions = 0;
+static std::atomic<double> g_log_keep(0.0);		// log(1 - rate)
+static std::atomic<std::uint64_t> g_seed(0);
+static double g_tolerance = 0.0;
+static std::uint32_t g_worst = 0;
+static std::thread g_worker;
+
+static std::mutex g_queue_lock;				// guards the queue and the counts
+static std::condition_variable g_queued, g_drained;
+static std::vector<fwi_shadow_sample> g_queue;		// reserved at Start(), never grows
+static std::size_t g_capacity = 0;
+static bool g_running = false;
+static std::uint64_t g_accepted = 0, g_processed = 0;
+static std::atomic<std::uint64_t> g_dropped(0);
+
+static std::mutex g_stats_lock;				// guards the channels
+static shadow_channel g_channels[CHANNELS];
+
+
+struct shadow_thread {
+	std::uint32_t session;
+	std::uint64_t state;
+	std::uint64_t pending;
+	double log_keep;
+};
+
+static thread_local shadow_thread t_shadow = { 0, 0, 0, 0.0 };
+
+
+static inline std::uint64_t next_random(std::uint64_t &state) {
+	std::uint64_t x = (state += 0x9e3779b97f4a7c15ULL);
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+
+// geometric, so that each element is sampled independently with probability rate
+static std::uint64_t draw_skip(shadow_thread &t) {
+	if (t.log_keep == 0.0)				// every element
+		return 0;
+	const double u = ((double)(next_random(t.state) >> 11) + 1.0) * (1.0 / 9007199254740992.0);	// (0..1]
+	const double skip = std::floor(std::log(u) / t.log_keep);
+	return (skip < 4.0e18) ? (std::uint64_t)skip : (std::uint64_t)4.0e18;
+}
+
+
+static shadow_thread &current_thread() {
+	shadow_thread &t = t_shadow;
+	const std::uint32_t session = g_session.load();
+	if (session && (t.session != session)) {
+		t.session = session;
+		t.state = g_seed.fetch_add(1) * 0xd1b54a32d192ed03ULL + session;
+		t.log_keep = g_log_keep.load();
+		t.pending = draw_skip(t);
+	}
+	return t;
+}
+
+
+std::uint64_t fwi_shadow_skip() {
+	shadow_thread &t = current_thread();
+	if (t.session != g_session.load())
+		return UINT64_MAX;
+	return draw_skip(t);
+}
+
+
+std::uint64_t &fwi_shadow_pending() {
+	return current_thread().pending;
+}
+
+
+void fwi_shadow_submit(const fwi_shadow_sample *samples, std::uint32_t count) {
+	const std::uint32_t session = t_shadow.session;
+	std::lock_guard<std::mutex> l(g_queue_lock);
+	// a batch that began before a Stop() can't add to the session Start()ed after it
+	if ((!g_running) || (session != g_session.load()))
+		return;
+	const std::size_t room = g_capacity - g_queue.size();
+	const std::size_t n = (count < room) ? count : room;
+	g_queue.insert(g_queue.end(), samples, samples + n);	// within the reserved capacity
+	g_accepted += n;
+	if (n < count)
+		g_dropped += count - n;
+	if (n)
+		g_queued.notify_one();
+}
+
+
+static void record(FWIShadowChannel channel, const fwi_shadow_sample &s, std::uint32_t inputs, double output, double reference) {
+	shadow_channel &c = g_channels[(std::uint32_t)channel];
+	const bool output_failed = !(output >= 0.0), reference_failed = !(reference >= 0.0);
+	double difference;
+	if (output_failed || reference_failed) {
+		if (output_failed == reference_failed) {
+			c.samples++;
+			c.histogram[0]++;
+			return;
+		}
+		difference = std::numeric_limits<double>::infinity();
+		c.failures++;
+		c.exceeded++;
+	}
+	else {
+		difference = std::fabs(output - reference);
+		std::uint32_t b = 0;
+		if (difference > 0.0) {
+			b = 1;
+			while ((b < FWIShadowStatistics::BUCKETS - 1) && (difference >= BUCKET_LIMITS[b - 1]))
+				b++;
+		}
+		c.histogram[b]++;
+		c.sum_difference += difference;
+		if (difference > c.max_difference)
+			c.max_difference = difference;
+		if (difference > g_tolerance)
+			c.exceeded++;
+	}
+	c.samples++;
+
+	if ((!g_worst) || (difference == 0.0))
+		return;
+	std::size_t slot = c.worst.size();
+	if (c.worst.size() == g_worst) {
+		slot = 0;
+		for (std::size_t i = 1; i < c.worst.size(); i++)
+			if (c.worst[i].difference < c.worst[slot].difference)
+				slot = i;
+		if (c.worst[slot].difference >= difference)
+			return;
+	}
+	else
+		c.worst.emplace_back();				// within the reserved capacity
+	FWIShadowSample &w = c.worst[slot];
+	w.channel = channel;
+	w.seconds = s.seconds;
+	w.inputs_count = inputs;
+	std::copy(s.in, s.in + inputs, w.inputs);
+	std::fill(w.inputs + inputs, w.inputs + FWIShadowSample::INPUTS, 0.0);
+	w.output = output;
+	w.reference = reference;
+	w.difference = difference;
+}
+
+
+static double reference_or_failure(double (*f)(const fwi_shadow_sample &), const fwi_shadow_sample &s) {
+	try {
+		return f(s);
+	}
+	catch (...) {
+		return -97.0;
+	}
+}
+
+
+static void reference_daily(const fwi_shadow_sample &s, FWIShadowChannel first) {
+	const double *in = s.in;
+	double r[7];
+	try {
+		r[0] = calc_daily_ffmc_vanwagner(in[0], in[3], in[4], in[5], in[6]);
+		r[1] = calc_dmc_el(in[1], in[3], in[4], in[7], in[5]);
+		r[2] = calc_dc_fl(in[2], in[3], in[4], in[8]);
+		if ((r[0] < 0.0) || (r[1] < 0.0) || (r[2] < 0.0))
+			r[3] = r[4] = r[5] = r[6] = -98.0;
+		else {
+			double sf;
+			r[3] = calc_bui(r[2], r[1]);
+			r[4] = calc_isi(WTimeSpan(24 * 60 * 60), r[0], in[6], &sf);
+			r[5] = calc_fwi(r[4], r[3]);
+			r[6] = calc_dsr(r[5]);
+		}
+	}
+	catch (...) {
+		std::fill(r, r + 7, -97.0);
+	}
+	const std::uint32_t outputs = s.flag ? 7 : 6;
+	for (std::uint32_t i = 0; i < outputs; i++)
+		record((FWIShadowChannel)((std::uint32_t)first + i), s, 9, s.out[i], r[i]);
+}
+
+
+static void recompute(const fwi_shadow_sample &s) {
+	switch (s.kernel) {
+		case fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER:
+		case fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER_EQUILIBRIUM:
+		case fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER_QUANTIZED: {
+				const double r = reference_or_failure([](const fwi_shadow_sample &x) {
+					return calc_subdaily_ffmc_vanwagner(WTimeSpan(x.seconds), x.in[0], x.in[1], x.in[2], x.in[3], x.in[4]);
+				}, s);
+				if (s.kernel == fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER)
+					record(FWIShadowChannel::HOURLY_FFMC_VANWAGNER, s, 5, s.out[0], r);
+				else if (s.kernel == fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER_EQUILIBRIUM)
+					record(FWIShadowChannel::HOURLY_FFMC_VANWAGNER_EQUILIBRIUM, s, 6, s.out[0], r);
+				else
+					record(FWIShadowChannel::HOURLY_FFMC_VANWAGNER_QUANTIZED, s, 5, s.out[0], r);
+			}
+			break;
+
+		case fwi_shadow_kernel::HOURLY_FFMC_VANWAGNER_PREVIOUS:
+			record(FWIShadowChannel::HOURLY_FFMC_VANWAGNER_PREVIOUS, s, 5, s.out[0], reference_or_failure([](const fwi_shadow_sample &x) {
+				return calc_previous_hourly_ffmc_vanwagner(x.in[0], x.in[1], x.in[2], x.in[3], x.in[4]);
+			}, s));
+			break;
+
+		case fwi_shadow_kernel::HOURLY_FFMC_LAWSON:
+			record(FWIShadowChannel::HOURLY_FFMC_LAWSON, s, 6, s.out[0], reference_or_failure([](const fwi_shadow_sample &x) {
+				return calc_hourly_ffmc_lawson_contiguous(x.in[0], x.in[1], WTimeSpan(x.seconds), x.in[2] * 100.0, x.in[3] * 100.0, x.in[4] * 100.0, x.flag);
+			}, s));
+			break;
+
+		case fwi_shadow_kernel::ISI:
+			record(FWIShadowChannel::ISI, s, 2, s.out[0], reference_or_failure([](const fwi_shadow_sample &x) {
+				double sf;
+				return calc_isi(WTimeSpan(x.seconds), x.in[0], x.in[1], &sf);
+			}, s));
+			break;
+
+		case fwi_shadow_kernel::BUI:
+			record(FWIShadowChannel::BUI, s, 2, s.out[0], reference_or_failure([](const fwi_shadow_sample &x) { return calc_bui(x.in[0], x.in[1]); }, s));
+			break;
+
+		case fwi_shadow_kernel::FWI:
+			record(FWIShadowChannel::FWI, s, 2, s.out[0], reference_or_failure([](const fwi_shadow_sample &x) { return calc_fwi(x.in[0], x.in[1]); }, s));
+			break;
+
+		case fwi_shadow_kernel::DAILY:
+			reference_daily(s, FWIShadowChannel::DAILY_FFMC);
+			break;
+
+		case fwi_shadow_kernel::QUANTIZED_DAILY:
+			reference_daily(s, FWIShadowChannel::QUANTIZED_DAILY_FFMC);
+			break;
+	}
+}
+
+
+static void worker(std::vector<fwi_shadow_sample> *buffer) {
+	FWITrace::NameThread("FWI shadow");
+	std::unique_lock<std::mutex> l(g_queue_lock);
+	for (;;) {
+		g_queued.wait(l, [] { return (!g_queue.empty()) || (!g_running); });
+		if (g_queue.empty())
+			break;
+		buffer->swap(g_queue);
+		l.unlock();
+
+		{
+			FWITraceSpan span("FWIShadow", "samples", (std::int64_t)buffer->size());
+			std::lock_guard<std::mutex> sl(g_stats_lock);
+			for (const auto &s : *buffer)
+				recompute(s);
+		}
+
+		l.lock();
+		g_processed += buffer->size();
+		buffer->clear();
+		g_drained.notify_all();
+	}
+}
+
+
+static HRESULT start(double rate, double tolerance, std::uint32_t worst, std::uint32_t queue) {
+	if ((!(rate > 0.0)) || (rate > 1.0) || (!(tolerance >= 0.0)) || (!queue))
+		return E_INVALIDARG;
+	std::lock_guard<std::mutex> l(g_lock);
+	if (g_session.load())
+		return E_UNEXPECTED;
+
+	static std::vector<fwi_shadow_sample> buffer;		// the worker's side of the queue
+	try {
+		{
+			// batches from before the last Stop() may still be submitting
+			std::lock_guard<std::mutex> ql(g_queue_lock);
+			std::vector<fwi_shadow_sample>().swap(g_queue);
+			g_queue.reserve(queue);
+			g_capacity = queue;
+			g_accepted = g_processed = 0;
+		}
+		std::vector<fwi_shadow_sample>().swap(buffer);
+		buffer.reserve(queue);
+		std::lock_guard<std::mutex> sl(g_stats_lock);
+		for (auto &c : g_channels) {
+			c.samples = c.exceeded = c.failures = 0;
+			c.max_difference = c.sum_difference = 0.0;
+			std::fill(c.histogram, c.histogram + FWIShadowStatistics::BUCKETS, 0);
+			c.worst.clear();
+			c.worst.reserve(worst);
+		}
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+
+	g_tolerance = tolerance;
+	g_worst = worst;
+	g_dropped = 0;
+	g_log_keep = (rate >= 1.0) ? 0.0 : std::log1p(-rate);
+	{
+		std::lock_guard<std::mutex> ql(g_queue_lock);
+		g_running = true;
+	}
+	try {
+		g_worker = std::thread(worker, &buffer);
+	}
+	catch (...) {
+		std::lock_guard<std::mutex> ql(g_queue_lock);
+		g_running = false;
+		return E_OUTOFMEMORY;
+	}
+
+	// only now can batches see the session
+	if (!++g_sessions)
+		g_sessions++;
+	g_session = g_sessions;
+	fwi_shadow_active = true;
+	return S_OK;
+}
+
+
+static HRESULT stop() {
+	std::lock_guard<std::mutex> l(g_lock);
+	if (!g_session.load())
+		return S_FALSE;
+	fwi_shadow_active = false;
+	g_session = 0;
+	{
+		std::lock_guard<std::mutex> ql(g_queue_lock);
+		g_running = false;
+		g_queued.notify_one();
+	}
+	// the worker finishes what's queued before it exits
+	g_worker.join();
+	return S_OK;
+}
+
+
+/*
+ * Looks at FWI_SHADOW the first time shadowing is touched (a batch, Start() or Enabled()) rather than as the library
+ * loads, when the other translation units' statics the worker uses (FWITrace's) may not be constructed yet.  Being
+ * constructed after them, it's destroyed before them, and stops any session still running so the worker has exited.
+ */
+struct shadow_lifetime {
+	bool report;					// FWI_SHADOW started the session, so FWI_SHADOW_REPORT applies
+
+	shadow_lifetime() : report(false) {
+		const char *rate = getenv("FWI_SHADOW");
+		if (rate && *rate) {
+			const char *tolerance = getenv("FWI_SHADOW_TOLERANCE");
+			report = SUCCEEDED(start(atof(rate), (tolerance && *tolerance) ? atof(tolerance) : 1e-6, 16, 65536));
+		}
+		if (!report)
+			fwi_shadow_active = false;
+	}
+
+	~shadow_lifetime() {
+		stop();
+		const char *filename = getenv("FWI_SHADOW_REPORT");
+		if (report && filename && *filename)
+			FWIShadow::Write(filename);
+	}
+};
+
+
+static shadow_lifetime &lifetime() {
+	static shadow_lifetime l;
+	return l;
+}
+
+
+bool fwi_shadow_begin() {
+	lifetime();
+	return g_session.load() != 0;
+}
+
+
+bool FWIShadow::Enabled() {
+	return fwi_shadow_begin();
+}
+
+
+HRESULT FWIShadow::Start(double rate, double tolerance, std::uint32_t worst, std::uint32_t queue) {
+	lifetime();
+	return start(rate, tolerance, worst, queue);
+}
+
+
+HRESULT FWIShadow::Stop() {
+	return stop();
+}
+
+
+void FWIShadow::Drain() {
+	std::unique_lock<std::mutex> l(g_queue_lock);
+	g_drained.wait(l, [] { return g_processed == g_accepted; });
+}
+
+
+HRESULT FWIShadow::Statistics(FWIShadowChannel channel, FWIShadowStatistics *stats) {
+	if (!stats)
+		return E_POINTER;
+	if ((std::uint32_t)channel >= CHANNELS)
+		return E_INVALIDARG;
+
+	std::lock_guard<std::mutex> l(g_stats_lock);
+	const shadow_channel &c = g_channels[(std::uint32_t)channel];
+	try {
+		stats->worst = c.worst;
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	std::sort(stats->worst.begin(), stats->worst.end(), [](const FWIShadowSample &a, const FWIShadowSample &b) { return a.difference > b.difference; });
+	stats->samples = c.samples;
+	stats->exceeded = c.exceeded;
+	stats->failures = c.failures;
+	stats->max_difference = c.max_difference;
+	stats->mean_difference = (c.samples > c.failures) ? (c.sum_difference / (double)(c.samples - c.failures)) : 0.0;
+	std::copy(c.histogram, c.histogram + FWIShadowStatistics::BUCKETS, stats->histogram);
+	return S_OK;
+}
+
+
+std::uint64_t FWIShadow::Dropped() {
+	return g_dropped.load();
+}
+
+
+const char *FWIShadow::ChannelName(FWIShadowChannel channel) {
+	return ((std::uint32_t)channel < CHANNELS) ? CHANNEL_NAMES[(std::uint32_t)channel] : nullptr;
+}
+
+
+// JSON has no infinity, failures are written as null
+static void write_number(FILE *f, double v) {
+	if (std::isfinite(v))
+		fprintf(f, "%.17g", v);
+	else
+		fputs("null", f);
+}
+
+
+HRESULT FWIShadow::Write(const char *filename) {
+	if (!filename)
+		return E_POINTER;
+
+	FWIShadowStatistics stats[CHANNELS];
+	for (std::uint32_t i = 0; i < CHANNELS; i++) {
+		const HRESULT hr = Statistics((FWIShadowChannel)i, &stats[i]);
+		if (FAILED(hr))
+			return hr;
+	}
+
+	FILE *f = fopen(filename, "w");
+	if (!f)
+		return E_FAIL;
+	fprintf(f, "{\"dropped\":%" PRIu64 ",\"channels\":{", Dropped());
+	bool first = true;
+	for (std::uint32_t i = 0; i < CHANNELS; i++) {
+		const FWIShadowStatistics &s = stats[i];
+		if (!s.samples)
+			continue;
+		fprintf(f, "%s\n\"%s\":{\"samples\":%" PRIu64 ",\"exceeded\":%" PRIu64 ",\"failures\":%" PRIu64 ",\"max_difference\":", first ? "" : ",",
+			CHANNEL_NAMES[i], s.samples, s.exceeded, s.failures);
+		write_number(f, s.max_difference);
+		fputs(",\"mean_difference\":", f);
+		write_number(f, s.mean_difference);
+		fputs(",\"histogram\":[", f);
+		for (std::uint32_t b = 0; b < FWIShadowStatistics::BUCKETS; b++)
+			fprintf(f, "%s%" PRIu64, b ? "," : "", s.histogram[b]);
+		fputs("],\"worst\":[", f);
+		for (std::size_t w = 0; w < s.worst.size(); w++) {
+			const FWIShadowSample &x = s.worst[w];
+			fprintf(f, "%s\n{\"seconds\":%" PRId64 ",\"inputs\":[", w ? "," : "", x.seconds);
+			for (std::uint32_t k = 0; k < x.inputs_count; k++) {
+				if (k)
+					fputc(',', f);
+				write_number(f, x.inputs[k]);
+			}
+			fputs("],\"output\":", f);
+			write_number(f, x.output);
+			fputs(",\"reference\":", f);
+			write_number(f, x.reference);
+			fputs(",\"difference\":", f);
+			write_number(f, x.difference);
+			fputc('}', f);
+		}
+		fputs("]}", f);
+		first = false;
+	}
+	fputs("\n}}\n", f);
+	const bool ok = (!ferror(f));
+	return (fclose(f) || (!ok)) ? E_FAIL : S_OK;
+}
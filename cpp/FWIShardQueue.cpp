@@ -0,0 +1,171 @@
+/**
+ * WISE_FWI_Module: FWIShardQueue.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIShardQueue.h"
+#include "fwi_mapping.h"
+
+#include <atomic>
+#include <cstring>
+#include <new>
+
+
+// the counters are shared between processes, which only works if they're implemented without a lock
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "cross process counters need lock free atomics");
+
+static const char MAGIC[8] = { 'F', 'W', 'I', 'S', 'H', 'R', 'D', '1' };
+static const std::uint32_t NO_WORKER = 0xffffffff;
+
+
+// the shared memory, followed by each worker's claimed count
+struct fwi_shard_control {
+	char magic[8];
+	std::uint32_t tiles;
+	std::uint32_t workers;
+	std::atomic<std::uint32_t> next;		// next tile to hand out
+	std::atomic<std::uint32_t> completed;
+
+	std::atomic<std::uint32_t> *claimed() { return reinterpret_cast<std::atomic<std::uint32_t> *>(this + 1); }
+};
+
+
+FWIShardQueue::FWIShardQueue()
+    : m_control(nullptr),
+      m_worker(NO_WORKER) {
+}
+
+
+FWIShardQueue::~FWIShardQueue() {
+	Close();
+}
+
+
+HRESULT FWIShardQueue::Create(const char *name, std::uint32_t tiles, std::uint32_t workers) {
+	if (!name)
+		return E_POINTER;
+	if ((!tiles) || (!workers))
+		return E_INVALIDARG;
+	Close();
+
+	try {
+		m_region.reset(new fwi_shared_region);
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	if (!m_region->create(name, sizeof(fwi_shard_control) + (std::size_t)workers * sizeof(std::atomic<std::uint32_t>))) {
+		Close();
+		return E_FAIL;
+	}
+
+	fwi_shard_control *c = new (m_region->data()) fwi_shard_control;
+	memcpy(c->magic, MAGIC, sizeof(MAGIC));
+	c->tiles = tiles;
+	c->workers = workers;
+	c->next = 0;
+	c->completed = 0;
+	for (std::uint32_t i = 0; i < workers; i++)
+		new (c->claimed() + i) std::atomic<std::uint32_t>(0);
+	m_control = c;
+	return S_OK;
+}
+
+
+HRESULT FWIShardQueue::Open(const char *name, std::uint32_t worker) {
+	if (!name)
+		return E_POINTER;
+	Close();
+
+	try {
+		m_region.reset(new fwi_shared_region);
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	if (!m_region->open(name)) {
+		Close();
+		return E_FAIL;
+	}
+
+	fwi_shard_control *c = static_cast<fwi_shard_control *>(m_region->data());
+	if ((m_region->bytes() < sizeof(fwi_shard_control)) || memcmp(c->magic, MAGIC, sizeof(MAGIC))
+	    || (m_region->bytes() < sizeof(fwi_shard_control) + (std::size_t)c->workers * sizeof(std::atomic<std::uint32_t>)) || (worker >= c->workers)) {
+		Close();
+		return E_INVALIDARG;
+	}
+	m_control = c;
+	m_worker = worker;
+	return S_OK;
+}
+
+
+void FWIShardQueue::Close() {
+	m_control = nullptr;
+	m_worker = NO_WORKER;
+	m_region.reset();
+}
+
+
+HRESULT FWIShardQueue::Unlink(const char *name) {
+	if (!name)
+		return E_POINTER;
+	return fwi_shared_region::unlink(name) ? S_OK : E_FAIL;
+}
+
+
+std::uint32_t FWIShardQueue::Tiles() const {
+	return m_control ? m_control->tiles : 0;
+}
+
+
+std::uint32_t FWIShardQueue::Workers() const {
+	return m_control ? m_control->workers : 0;
+}
+
+
+bool FWIShardQueue::Claim(std::uint32_t *tile) {
+	if ((!m_control) || (!tile))
+		return false;
+	// once every tile is handed out the counter stops moving, so it can't wrap however often it's asked
+	std::uint32_t next = m_control->next.load();
+	do {
+		if (next >= m_control->tiles)
+			return false;
+	} while (!m_control->next.compare_exchange_weak(next, next + 1));
+
+	*tile = next;
+	if (m_worker != NO_WORKER)
+		m_control->claimed()[m_worker]++;
+	return true;
+}
+
+
+void FWIShardQueue::Complete(std::uint32_t tile) {
+	if (m_control && (tile < m_control->tiles))
+		m_control->completed++;
+}
+
+
+std::uint32_t FWIShardQueue::Completed() const {
+	return m_control ? m_control->completed.load() : 0;
+}
+
+
+std::uint32_t FWIShardQueue::Claimed(std::uint32_t worker) const {
+	return (m_control && (worker < m_control->workers)) ? m_control->claimed()[worker].load() : 0;
+}
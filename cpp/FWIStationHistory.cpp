@@ -0,0 +1,427 @@
+/**
+ * WISE_FWI_Module: FWIStationHistory.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIStationHistory.h"
+#include "FWIQuantized.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+
+
+static const char MAGIC[8] = { 'F', 'W', 'I', 'H', 'I', 'S', 'T', '1' };
+static const std::uint32_t VERSION = 1;
+static const std::uint8_t PREVIOUS = FWI_CODE_COUNT + FWI_HISTORY_HOURLY_CODES;	// values a day is encoded against
+
+struct history_header {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t stations;
+	std::uint32_t hourly;
+	std::uint32_t block_bytes;
+	std::uint64_t station_days;
+	std::uint64_t index_offset;			// 0 until closed
+};
+
+
+static inline void put_varint(std::vector<std::uint8_t> &bytes, std::uint32_t v) {
+	while (v >= 0x80) {
+		bytes.push_back((std::uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	bytes.push_back((std::uint8_t)v);
+}
+
+
+static inline void put_delta(std::vector<std::uint8_t> &bytes, std::uint16_t *previous, std::uint16_t value) {
+	const std::int32_t delta = (std::int32_t)value - (std::int32_t)*previous;
+	put_varint(bytes, ((std::uint32_t)delta << 1) ^ (std::uint32_t)(delta >> 31));
+	*previous = value;
+}
+
+
+static inline bool get_delta(const std::uint8_t *&p, const std::uint8_t *end, std::uint16_t *previous, std::uint16_t *value) {
+	std::uint32_t v = 0;
+	for (int shift = 0; ; shift += 7) {
+		if ((p == end) || (shift > 14))
+			return false;
+		const std::uint8_t b = *p++;
+		v |= (std::uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			break;
+	}
+	*previous = (std::uint16_t)((std::int32_t)*previous + (std::int32_t)((v >> 1) ^ (0 - (v & 1))));
+	if (value)
+		*value = *previous;
+	return true;
+}
+
+
+FWIStationHistory::FWIStationHistory() : m_writable(false), m_hourly(false), m_stations(0), m_block_bytes(0), m_end(0), m_station_days(0), m_appends(0) {
+}
+
+
+FWIStationHistory::~FWIStationHistory() {
+	Close();
+}
+
+
+std::int32_t FWIStationHistory::DayNumber(std::int32_t year, std::uint32_t month, std::uint32_t day) {
+	year -= (month <= 2);
+	const std::int32_t era = ((year >= 0) ? year : (year - 399)) / 400;
+	const std::uint32_t year_of_era = (std::uint32_t)(year - era * 400);
+	const std::uint32_t day_of_year = (153 * ((month > 2) ? (month - 3) : (month + 9)) + 2) / 5 + day - 1;
+	const std::uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	return era * 146097 + (std::int32_t)day_of_era - 719468;
+}
+
+
+std::uint64_t FWIStationHistory::BlockBytes() const {
+	std::lock_guard<std::mutex> l(m_lock);
+	return m_end ? (m_end - sizeof(history_header)) : 0;
+}
+
+
+std::uint64_t FWIStationHistory::StationDays() const {
+	std::lock_guard<std::mutex> l(m_lock);
+	return m_station_days;
+}
+
+
+HRESULT FWIStationHistory::Span(std::uint32_t station, std::int32_t *first_day, std::int32_t *last_day) const {
+	if ((!first_day) || (!last_day))
+		return E_POINTER;
+	if (!m_file.is_open())
+		return E_UNEXPECTED;
+	if (station >= m_stations)
+		return E_INVALIDARG;
+
+	std::lock_guard<std::mutex> l(m_lock);
+	const std::vector<block_entry> &blocks = m_index[station];
+	if (blocks.empty())
+		return S_FALSE;
+	*first_day = blocks.front().first_day;
+	*last_day = blocks.back().first_day + (std::int32_t)blocks.back().days - 1;
+	return S_OK;
+}
+
+
+HRESULT FWIStationHistory::Create(const char *filename, std::uint32_t stations, bool hourly, std::uint32_t block_bytes) {
+	if (!filename)
+		return E_POINTER;
+	if ((!stations) || (!block_bytes))
+		return E_INVALIDARG;
+	Close();
+
+	try {
+		m_index.resize(stations);
+		m_pending.resize(stations);
+		for (auto &p : m_pending) {
+			p.first_day = INT_MIN;
+			p.days = 0;
+			p.append = 0;
+		}
+		m_appends = 0;
+		m_previous.assign((std::size_t)stations * PREVIOUS, 0);
+	}
+	catch (...) {
+		m_index.clear();
+		m_pending.clear();
+		m_previous.clear();
+		return E_OUTOFMEMORY;
+	}
+	m_file.open(filename, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+	if (!m_file.is_open())
+		return E_FAIL;
+
+	history_header h = {};
+	memcpy(h.magic, MAGIC, sizeof(MAGIC));
+	h.version = VERSION;
+	h.stations = stations;
+	h.hourly = hourly ? 1 : 0;
+	h.block_bytes = block_bytes;
+	if (!m_file.write(reinterpret_cast<const char *>(&h), sizeof(h))) {
+		m_file.close();
+		return E_FAIL;
+	}
+	m_writable = true;
+	m_hourly = hourly;
+	m_stations = stations;
+	m_block_bytes = block_bytes;
+	m_end = sizeof(h);
+	m_station_days = 0;
+	return S_OK;
+}
+
+
+HRESULT FWIStationHistory::Open(const char *filename) {
+	if (!filename)
+		return E_POINTER;
+	Close();
+
+	m_file.open(filename, std::ios::binary | std::ios::in);
+	if (!m_file.is_open())
+		return E_FAIL;
+	history_header h;
+	if (!m_file.read(reinterpret_cast<char *>(&h), sizeof(h))) {
+		m_file.close();
+		return E_FAIL;
+	}
+	if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) || (h.version != VERSION) || (!h.stations) || (!h.block_bytes) || (!h.index_offset)) {
+		m_file.close();
+		return E_INVALIDARG;
+	}
+
+	std::vector<std::uint32_t> counts;
+	try {
+		counts.resize(h.stations);
+		m_index.resize(h.stations);
+	}
+	catch (...) {
+		m_index.clear();
+		m_file.close();
+		return E_OUTOFMEMORY;
+	}
+	bool ok = m_file.seekg((std::streamoff)h.index_offset) && m_file.read(reinterpret_cast<char *>(counts.data()), (std::streamsize)(counts.size() * sizeof(std::uint32_t)));
+	try {
+		for (std::uint32_t s = 0; ok && (s < h.stations); s++) {
+			m_index[s].resize(counts[s]);
+			ok = !!m_file.read(reinterpret_cast<char *>(m_index[s].data()), (std::streamsize)(counts[s] * sizeof(block_entry)));
+		}
+	}
+	catch (...) {
+		m_index.clear();
+		m_file.close();
+		return E_OUTOFMEMORY;
+	}
+	if (!ok) {
+		m_index.clear();
+		m_file.close();
+		return E_FAIL;
+	}
+	m_hourly = (h.hourly != 0);
+	m_stations = h.stations;
+	m_block_bytes = h.block_bytes;
+	m_end = h.index_offset;
+	m_station_days = h.station_days;
+	return S_OK;
+}
+
+
+HRESULT FWIStationHistory::Close() {
+	if (!m_file.is_open())
+		return S_OK;
+
+	bool ok = true;
+	if (m_writable) {
+		ok = SUCCEEDED(Flush());
+		const std::uint64_t index_offset = m_end;
+		if (ok && m_file.seekp((std::streamoff)index_offset)) {
+			for (const auto &blocks : m_index) {
+				const std::uint32_t count = (std::uint32_t)blocks.size();
+				ok &= !!m_file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+			}
+			for (const auto &blocks : m_index)
+				ok &= !!m_file.write(reinterpret_cast<const char *>(blocks.data()), (std::streamsize)(blocks.size() * sizeof(block_entry)));
+			ok = ok && m_file.seekp((std::streamoff)offsetof(history_header, station_days))
+				&& m_file.write(reinterpret_cast<const char *>(&m_station_days), sizeof(m_station_days))
+				&& m_file.write(reinterpret_cast<const char *>(&index_offset), sizeof(index_offset))
+				&& m_file.flush();
+		}
+		else
+			ok = false;
+	}
+	m_file.close();
+	m_writable = m_hourly = false;
+	m_stations = m_block_bytes = 0;
+	m_end = m_station_days = 0;
+	m_index.clear();
+	m_pending.clear();
+	m_previous.clear();
+	return ok ? S_OK : E_FAIL;
+}
+
+
+bool FWIStationHistory::write_block(std::uint32_t station) {
+	station_block &p = m_pending[station];
+	if (!p.days)
+		return true;
+
+	std::lock_guard<std::mutex> l(m_lock);
+	if ((!m_file.seekp((std::streamoff)m_end)) || (!m_file.write(reinterpret_cast<const char *>(p.bytes.data()), (std::streamsize)p.bytes.size())))
+		return false;
+	block_entry e = { p.first_day, p.days, m_end, (std::uint32_t)p.bytes.size(), 0 };
+	m_index[station].push_back(e);		// capacity is reserved by Append()
+	m_end += p.bytes.size();
+	m_station_days += p.days;
+	p.first_day += (std::int32_t)p.days;
+	p.days = 0;
+	p.bytes.clear();
+	return true;
+}
+
+
+HRESULT FWIStationHistory::Append(std::int32_t day, std::uint32_t count, const std::uint32_t *stations, const std::uint16_t *daily, const std::uint16_t *hourly) {
+	if ((!daily) || (m_hourly && (!hourly)))
+		return E_POINTER;
+	if ((!m_file.is_open()) || (!m_writable))
+		return E_UNEXPECTED;
+
+	// everything is checked before anything is appended, so that a call that's rejected changes nothing
+	if (stations && (++m_appends == 0)) {
+		for (auto &p : m_pending)
+			p.append = 0;
+		m_appends = 1;
+	}
+	for (std::uint32_t i = 0; i < count; i++) {
+		const std::uint32_t s = stations ? stations[i] : i;
+		if (s >= m_stations)
+			return E_INVALIDARG;
+		station_block &p = m_pending[s];
+		if ((p.first_day != INT_MIN) && (day < p.first_day + (std::int32_t)p.days))
+			return E_INVALIDARG;
+		if (stations) {
+			if (p.append == m_appends)
+				return E_INVALIDARG;		// the station is in stations twice
+			p.append = m_appends;
+		}
+	}
+
+	try {
+		for (std::uint32_t i = 0; i < count; i++) {
+			const std::uint32_t s = stations ? stations[i] : i;
+			station_block &p = m_pending[s];
+			if (p.days && (day != p.first_day + (std::int32_t)p.days) && (!write_block(s)))
+				return E_FAIL;
+
+			// a block decodes on its own, so its first day is encoded against zeros
+			std::uint16_t *previous = m_previous.data() + (std::size_t)s * PREVIOUS;
+			if (!p.days) {
+				p.first_day = day;
+				std::fill(previous, previous + PREVIOUS, (std::uint16_t)0);
+				// Read() may be going through the index on another thread
+				if (m_index[s].size() == m_index[s].capacity()) {
+					std::lock_guard<std::mutex> l(m_lock);
+					m_index[s].reserve(m_index[s].size() * 2 + 4);
+				}
+			}
+			for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+				put_delta(p.bytes, previous + c, daily[(std::size_t)c * count + i]);
+			if (m_hourly)
+				for (std::uint8_t v = 0; v < FWI_HISTORY_HOURLY_VALUES; v++)
+					put_delta(p.bytes, previous + FWI_CODE_COUNT + v % FWI_HISTORY_HOURLY_CODES, hourly[(std::size_t)v * count + i]);
+			p.days++;
+			if ((p.bytes.size() >= m_block_bytes) && (!write_block(s)))
+				return E_FAIL;
+		}
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIStationHistory::Flush() {
+	if ((!m_file.is_open()) || (!m_writable))
+		return E_UNEXPECTED;
+	for (std::uint32_t s = 0; s < m_stations; s++)
+		if (!write_block(s))
+			return E_FAIL;
+	return m_file.flush() ? S_OK : E_FAIL;
+}
+
+
+HRESULT FWIStationHistory::Read(std::uint32_t station, std::int32_t first_day, std::int32_t last_day, std::uint16_t *daily, std::uint16_t *hourly, std::uint32_t *days) const {
+	if (days)
+		*days = 0;
+	if (!m_file.is_open())
+		return E_UNEXPECTED;
+	if ((station >= m_stations) || (last_day < first_day) || (hourly && (!m_hourly)))
+		return E_INVALIDARG;
+
+	const std::size_t range = (std::size_t)((std::int64_t)last_day - first_day + 1);
+	if (daily)
+		std::fill(daily, daily + range * FWI_CODE_COUNT, FWIQuantized::MISSING);
+	if (hourly)
+		std::fill(hourly, hourly + range * FWI_HISTORY_HOURLY_VALUES, FWIQuantized::MISSING);
+
+	// the blocks overlapping the range, read in one go
+	std::vector<block_entry> blocks;
+	std::vector<std::uint8_t> bytes;
+	{
+		std::lock_guard<std::mutex> l(m_lock);
+		const std::vector<block_entry> &index = m_index[station];
+		auto b = std::upper_bound(index.begin(), index.end(), first_day, [](std::int32_t d, const block_entry &e) { return d < e.first_day; });
+		if (b != index.begin())
+			b--;
+		auto e = b;
+		while ((e != index.end()) && (e->first_day <= last_day))
+			e++;
+		while ((b != e) && (b->first_day + (std::int32_t)b->days <= first_day))
+			b++;
+		if (b == e)
+			return S_FALSE;
+		try {
+			blocks.assign(b, e);
+			std::size_t total = 0;
+			for (const auto &k : blocks)
+				total += k.bytes;
+			bytes.resize(total);
+		}
+		catch (...) {
+			return E_OUTOFMEMORY;
+		}
+		std::size_t at = 0;
+		for (const auto &k : blocks) {
+			if ((!m_file.seekg((std::streamoff)k.offset)) || (!m_file.read(reinterpret_cast<char *>(bytes.data() + at), (std::streamsize)k.bytes)))
+				return E_FAIL;
+			at += k.bytes;
+		}
+	}
+
+	std::uint32_t stored = 0;
+	const std::uint8_t *p = bytes.data();
+	for (const auto &k : blocks) {
+		const std::uint8_t *end = p + k.bytes;
+		std::uint16_t previous[PREVIOUS] = { 0 };
+		for (std::uint32_t d = 0; d < k.days; d++) {
+			const std::int64_t at = (std::int64_t)k.first_day + d - first_day;
+			const bool wanted = (at >= 0) && (at < (std::int64_t)range);
+			if (at >= (std::int64_t)range)
+				break;
+			std::uint16_t *dv = (wanted && daily) ? (daily + (std::size_t)at * FWI_CODE_COUNT) : nullptr;
+			for (std::uint8_t c = 0; c < FWI_CODE_COUNT; c++)
+				if (!get_delta(p, end, previous + c, dv ? (dv + c) : nullptr))
+					return E_FAIL;
+			if (m_hourly) {
+				std::uint16_t *hv = (wanted && hourly) ? (hourly + (std::size_t)at * FWI_HISTORY_HOURLY_VALUES) : nullptr;
+				for (std::uint8_t v = 0; v < FWI_HISTORY_HOURLY_VALUES; v++)
+					if (!get_delta(p, end, previous + FWI_CODE_COUNT + v % FWI_HISTORY_HOURLY_CODES, hv ? (hv + v) : nullptr))
+						return E_FAIL;
+			}
+			stored += wanted;
+		}
+		p = end;
+	}
+	if (days)
+		*days = stored;
+	return stored ? S_OK : S_FALSE;
+}
@@ -0,0 +1,586 @@
+/**
+ * WISE_FWI_Module: FWITiledFile.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWITiledFile.h"
+#include "fwi_mapping.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// the header occupies the first page so that tile data stays page aligned whenever a tile's size is
+static const std::uint64_t HEADER_BYTES = 4096;
+static const char MAGIC[8] = { 'F', 'W', 'I', 'T', 'I', 'L', 'E', '1' };
+static const std::uint32_t VERSION = 1;
+static const std::intptr_t NO_FILE = -1;
+
+struct tiled_header {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t cells;
+	std::uint32_t tile_cells;
+	std::uint32_t layers;
+	std::uint32_t element_size;
+};
+
+
+#ifdef _WIN32
+
+static HANDLE handle(std::intptr_t h) { return reinterpret_cast<HANDLE>(h); }
+
+
+static std::uint64_t map_alignment() {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+}
+
+
+// ReadFile() and WriteFile() are limited to 4GB at a time
+static const std::size_t IO_CHUNK = 0x40000000;
+
+
+static bool read_at(HANDLE file, std::uint64_t offset, void *buffer, std::size_t bytes) {
+	std::uint8_t *b = static_cast<std::uint8_t *>(buffer);
+	while (bytes) {
+		OVERLAPPED o = {};
+		o.Offset = (DWORD)offset;
+		o.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD done;
+		if ((!ReadFile(file, b, (DWORD)((bytes > IO_CHUNK) ? IO_CHUNK : bytes), &done, &o)) || (!done))
+			return false;
+		b += done;
+		offset += done;
+		bytes -= done;
+	}
+	return true;
+}
+
+
+static bool write_at(HANDLE file, std::uint64_t offset, const void *buffer, std::size_t bytes) {
+	const std::uint8_t *b = static_cast<const std::uint8_t *>(buffer);
+	while (bytes) {
+		OVERLAPPED o = {};
+		o.Offset = (DWORD)offset;
+		o.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD done;
+		if ((!WriteFile(file, b, (DWORD)((bytes > IO_CHUNK) ? IO_CHUNK : bytes), &done, &o)) || (!done))
+			return false;
+		b += done;
+		offset += done;
+		bytes -= done;
+	}
+	return true;
+}
+
+
+// shared memory has no file handle, so is read and written through a temporary view
+static bool copy_view(HANDLE mapping, std::uint64_t offset, void *buffer, std::size_t bytes, bool write) {
+	static const std::uint64_t alignment = map_alignment();
+	const std::uint64_t start = offset - (offset % alignment);
+	std::uint8_t *view = static_cast<std::uint8_t *>(MapViewOfFile(mapping, write ? FILE_MAP_WRITE : FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, (SIZE_T)(offset - start + bytes)));
+	if (!view)
+		return false;
+	if (write)
+		memcpy(view + (offset - start), buffer, bytes);
+	else
+		memcpy(buffer, view + (offset - start), bytes);
+	UnmapViewOfFile(view);
+	return true;
+}
+
+
+bool FWITiledFile::read_bytes(std::uint64_t offset, void *buffer, std::size_t bytes) const {
+	if (m_file == NO_FILE)
+		return copy_view(handle(m_mapping), offset, buffer, bytes, false);
+	return read_at(handle(m_file), offset, buffer, bytes);
+}
+
+
+bool FWITiledFile::write_bytes(std::uint64_t offset, const void *buffer, std::size_t bytes) {
+	if (m_file == NO_FILE)
+		return copy_view(handle(m_mapping), offset, const_cast<void *>(buffer), bytes, true);
+	return write_at(handle(m_file), offset, buffer, bytes);
+}
+
+#else
+
+static std::uint64_t map_alignment() {
+	return (std::uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+
+bool FWITiledFile::read_bytes(std::uint64_t offset, void *buffer, std::size_t bytes) const {
+	std::uint8_t *b = static_cast<std::uint8_t *>(buffer);
+	while (bytes) {
+		const ssize_t done = pread((int)m_file, b, bytes, (off_t)offset);
+		if (done <= 0)
+			return false;
+		b += done;
+		offset += done;
+		bytes -= done;
+	}
+	return true;
+}
+
+
+bool FWITiledFile::write_bytes(std::uint64_t offset, const void *buffer, std::size_t bytes) {
+	const std::uint8_t *b = static_cast<const std::uint8_t *>(buffer);
+	while (bytes) {
+		const ssize_t done = pwrite((int)m_file, b, bytes, (off_t)offset);
+		if (done <= 0)
+			return false;
+		b += done;
+		offset += done;
+		bytes -= done;
+	}
+	return true;
+}
+
+#endif
+
+
+FWITiledFile::FWITiledFile()
+    : m_file(NO_FILE),
+      m_mapping(NO_FILE),
+      m_writable(false),
+      m_cells(0),
+      m_tile_cells(0),
+      m_layers(0),
+      m_element_size(0) {
+}
+
+
+FWITiledFile::~FWITiledFile() {
+	Close();
+}
+
+
+bool FWITiledFile::IsOpen() const {
+	return (m_file != NO_FILE) || (m_mapping != NO_FILE);
+}
+
+
+std::uint32_t FWITiledFile::TileCount(std::uint32_t tile) const {
+	const std::uint64_t first = (std::uint64_t)tile * m_tile_cells;
+	if (first >= m_cells)
+		return 0;
+	return ((m_cells - first) < m_tile_cells) ? (std::uint32_t)(m_cells - first) : m_tile_cells;
+}
+
+
+std::uint64_t FWITiledFile::Offset(std::uint32_t tile, std::uint32_t layer) const {
+	return HEADER_BYTES + ((std::uint64_t)tile * m_layers + layer) * LayerBytes();
+}
+
+
+HRESULT FWITiledFile::Create(const char *filename, std::uint32_t cells, std::uint32_t tile_cells, std::uint32_t layers, std::uint32_t element_size) {
+	if (!filename)
+		return E_POINTER;
+	if ((!cells) || (!tile_cells) || (!layers) || (!element_size))
+		return E_INVALIDARG;
+	Close();
+
+#ifdef _WIN32
+	HANDLE f = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (f == INVALID_HANDLE_VALUE)
+		return E_FAIL;
+	m_file = reinterpret_cast<std::intptr_t>(f);
+#else
+	const int f = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (f < 0)
+		return E_FAIL;
+	m_file = f;
+#endif
+	return create(cells, tile_cells, layers, element_size);
+}
+
+
+HRESULT FWITiledFile::CreateShared(const char *name, std::uint32_t cells, std::uint32_t tile_cells, std::uint32_t layers, std::uint32_t element_size) {
+	if (!name)
+		return E_POINTER;
+	if ((!cells) || (!tile_cells) || (!layers) || (!element_size))
+		return E_INVALIDARG;
+	Close();
+
+#ifdef _WIN32
+	// the mapping object is the memory, so is sized on creation
+	const std::uint64_t tiles = ((std::uint64_t)cells + tile_cells - 1) / tile_cells;
+	const std::uint64_t size = HEADER_BYTES + tiles * layers * tile_cells * element_size;
+	HANDLE m = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, name);
+	if (!m)
+		return E_FAIL;
+	m_mapping = reinterpret_cast<std::intptr_t>(m);
+#else
+	const int f = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (f < 0)
+		return E_FAIL;
+	m_file = f;
+#endif
+	return create(cells, tile_cells, layers, element_size);
+}
+
+
+// sizes a newly created file (zero filled) and writes its header
+HRESULT FWITiledFile::create(std::uint32_t cells, std::uint32_t tile_cells, std::uint32_t layers, std::uint32_t element_size) {
+	m_cells = cells;
+	m_tile_cells = tile_cells;
+	m_layers = layers;
+	m_element_size = element_size;
+	m_writable = true;
+	const std::uint64_t size = Offset(Tiles(), 0);
+
+	bool ok = true;
+#ifdef _WIN32
+	if (m_file != NO_FILE) {
+		LARGE_INTEGER end;
+		end.QuadPart = (LONGLONG)size;
+		ok = SetFilePointerEx(handle(m_file), end, nullptr, FILE_BEGIN) && SetEndOfFile(handle(m_file));
+		if (ok) {
+			HANDLE m = CreateFileMappingA(handle(m_file), nullptr, PAGE_READWRITE, 0, 0, nullptr);
+			if (m)
+				m_mapping = reinterpret_cast<std::intptr_t>(m);
+			else
+				ok = false;
+		}
+	}
+#else
+	ok = (ftruncate((int)m_file, (off_t)size) == 0);
+#endif
+
+	tiled_header header = {};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.cells = cells;
+	header.tile_cells = tile_cells;
+	header.layers = layers;
+	header.element_size = element_size;
+	if ((!ok) || (!write_bytes(0, &header, sizeof(header)))) {
+		Close();
+		return E_FAIL;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWITiledFile::Open(const char *filename, bool writable) {
+	if (!filename)
+		return E_POINTER;
+	Close();
+
+#ifdef _WIN32
+	HANDLE f = CreateFileA(filename, writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (f == INVALID_HANDLE_VALUE)
+		return E_FAIL;
+	m_file = reinterpret_cast<std::intptr_t>(f);
+	HANDLE m = CreateFileMappingA(f, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+	if (!m) {
+		Close();
+		return E_FAIL;
+	}
+	m_mapping = reinterpret_cast<std::intptr_t>(m);
+#else
+	const int f = open(filename, writable ? O_RDWR : O_RDONLY);
+	if (f < 0)
+		return E_FAIL;
+	m_file = f;
+#endif
+	m_writable = writable;
+
+	if (!read_header()) {
+		Close();
+		return E_INVALIDARG;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWITiledFile::OpenShared(const char *name, bool writable) {
+	if (!name)
+		return E_POINTER;
+	Close();
+
+#ifdef _WIN32
+	HANDLE m = OpenFileMappingA(writable ? FILE_MAP_WRITE : FILE_MAP_READ, FALSE, name);
+	if (!m)
+		return E_FAIL;
+	m_mapping = reinterpret_cast<std::intptr_t>(m);
+#else
+	const int f = shm_open(name, writable ? O_RDWR : O_RDONLY, 0);
+	if (f < 0)
+		return E_FAIL;
+	m_file = f;
+#endif
+	m_writable = writable;
+
+	if (!read_header()) {
+		Close();
+		return E_INVALIDARG;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWITiledFile::UnlinkShared(const char *name) {
+	if (!name)
+		return E_POINTER;
+#ifdef _WIN32
+	// named mappings go away with their last handle
+	return S_OK;
+#else
+	return (shm_unlink(name) == 0) ? S_OK : E_FAIL;
+#endif
+}
+
+
+bool FWITiledFile::read_header() {
+	tiled_header header;
+	if (!read_bytes(0, &header, sizeof(header)))
+		return false;
+	if ((memcmp(header.magic, MAGIC, sizeof(MAGIC))) || (header.version != VERSION))
+		return false;
+	if ((!header.cells) || (!header.tile_cells) || (!header.layers) || (!header.element_size))
+		return false;
+
+	m_cells = header.cells;
+	m_tile_cells = header.tile_cells;
+	m_layers = header.layers;
+	m_element_size = header.element_size;
+
+	// check for truncation
+#ifdef _WIN32
+	if (m_file == NO_FILE)
+		return true;				// shared memory is sized on creation
+	LARGE_INTEGER size;
+	return GetFileSizeEx(handle(m_file), &size) && ((std::uint64_t)size.QuadPart >= Offset(Tiles(), 0));
+#else
+	struct stat st;
+	return (fstat((int)m_file, &st) == 0) && ((std::uint64_t)st.st_size >= Offset(Tiles(), 0));
+#endif
+}
+
+
+void FWITiledFile::Close() {
+#ifdef _WIN32
+	if (m_mapping != NO_FILE)
+		CloseHandle(handle(m_mapping));
+	if (m_file != NO_FILE)
+		CloseHandle(handle(m_file));
+#else
+	if (m_file != NO_FILE)
+		close((int)m_file);
+#endif
+	m_file = m_mapping = NO_FILE;
+	m_writable = false;
+	m_cells = m_tile_cells = m_layers = m_element_size = 0;
+}
+
+
+HRESULT FWITiledFile::Read(std::uint32_t tile, std::uint32_t layer, void *values) const {
+	if (!values)
+		return E_POINTER;
+	if (!IsOpen())
+		return E_UNEXPECTED;
+	if ((tile >= Tiles()) || (layer >= m_layers))
+		return E_INVALIDARG;
+	return read_bytes(Offset(tile, layer), values, (std::size_t)TileCount(tile) * m_element_size) ? S_OK : E_FAIL;
+}
+
+
+HRESULT FWITiledFile::Write(std::uint32_t tile, std::uint32_t layer, const void *values) {
+	if (!values)
+		return E_POINTER;
+	if ((!IsOpen()) || (!m_writable))
+		return E_UNEXPECTED;
+	if ((tile >= Tiles()) || (layer >= m_layers))
+		return E_INVALIDARG;
+	return write_bytes(Offset(tile, layer), values, (std::size_t)TileCount(tile) * m_element_size) ? S_OK : E_FAIL;
+}
+
+
+// source is the mapping object on Windows, the file descriptor elsewhere
+static void *map_range(std::intptr_t source, std::uint64_t start, std::size_t length, bool writable) {
+#ifdef _WIN32
+	return MapViewOfFile(handle(source), writable ? FILE_MAP_WRITE : FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, length);
+#else
+	void *base = mmap(nullptr, length, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, (int)source, (off_t)start);
+	return (base == MAP_FAILED) ? nullptr : base;
+#endif
+}
+
+
+static void unmap_range(void *base, std::size_t length) {
+#ifdef _WIN32
+	UnmapViewOfFile(base);
+#else
+	munmap(base, length);
+#endif
+}
+
+
+bool fwi_mapping::map(const FWITiledFile &file, std::uint64_t offset, std::size_t bytes, bool writable) {
+	unmap();
+	if ((!file.IsOpen()) || (writable && (!file.m_writable)) || (!bytes))
+		return false;
+
+	static const std::uint64_t alignment = map_alignment();
+	const std::uint64_t start = offset - (offset % alignment);
+	const std::size_t length = (std::size_t)(offset - start) + bytes;
+#ifdef _WIN32
+	void *base = map_range(file.m_mapping, start, length, writable);
+#else
+	void *base = map_range(file.m_file, start, length, writable);
+#endif
+	if (!base)
+		return false;
+	m_base = base;
+	m_data = static_cast<std::uint8_t *>(base) + (offset - start);
+	m_bytes = length;
+	m_writable = writable;
+	return true;
+}
+
+
+void fwi_mapping::unmap() {
+	if (!m_base)
+		return;
+	unmap_range(m_base, m_bytes);
+	m_base = m_data = nullptr;
+	m_bytes = 0;
+	m_writable = false;
+}
+
+
+void fwi_mapping::prefetch() {
+	if (!m_base)
+		return;
+#ifdef _WIN32
+	WIN32_MEMORY_RANGE_ENTRY range = { m_base, m_bytes };
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	madvise(m_base, m_bytes, MADV_WILLNEED);
+#endif
+}
+
+
+void fwi_mapping::flush() {
+	if ((!m_base) || (!m_writable))
+		return;
+#ifdef _WIN32
+	// starts the writes without waiting for them to reach the disk
+	FlushViewOfFile(m_base, m_bytes);
+#else
+	msync(m_base, m_bytes, MS_ASYNC);
+#endif
+}
+
+
+bool fwi_shared_region::create(const char *name, std::size_t bytes) {
+	close();
+#ifdef _WIN32
+	HANDLE m = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((std::uint64_t)bytes >> 32), (DWORD)bytes, name);
+	if (!m)
+		return false;
+	m_handle = reinterpret_cast<std::intptr_t>(m);
+#else
+	const int f = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (f < 0)
+		return false;
+	m_handle = f;
+	if (ftruncate(f, (off_t)bytes) != 0) {
+		close();
+		return false;
+	}
+#endif
+	m_data = map_range(m_handle, 0, bytes, true);
+	if (!m_data) {
+		close();
+		return false;
+	}
+	m_bytes = bytes;
+	return true;
+}
+
+
+bool fwi_shared_region::open(const char *name) {
+	close();
+#ifdef _WIN32
+	HANDLE m = OpenFileMappingA(FILE_MAP_WRITE, FALSE, name);
+	if (!m)
+		return false;
+	m_handle = reinterpret_cast<std::intptr_t>(m);
+	m_data = MapViewOfFile(m, FILE_MAP_WRITE, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION info;
+	if ((!m_data) || (!VirtualQuery(m_data, &info, sizeof(info)))) {
+		close();
+		return false;
+	}
+	m_bytes = info.RegionSize;
+#else
+	const int f = shm_open(name, O_RDWR, 0);
+	if (f < 0)
+		return false;
+	m_handle = f;
+	struct stat st;
+	if ((fstat(f, &st) != 0) || (!st.st_size)) {
+		close();
+		return false;
+	}
+	m_data = map_range(m_handle, 0, (std::size_t)st.st_size, true);
+	if (!m_data) {
+		close();
+		return false;
+	}
+	m_bytes = (std::size_t)st.st_size;
+#endif
+	return true;
+}
+
+
+void fwi_shared_region::close() {
+	if (m_data)
+		unmap_range(m_data, m_bytes);
+#ifdef _WIN32
+	if (m_handle != NO_FILE)
+		CloseHandle(handle(m_handle));
+#else
+	if (m_handle != NO_FILE)
+		::close((int)m_handle);
+#endif
+	m_handle = NO_FILE;
+	m_data = nullptr;
+	m_bytes = 0;
+}
+
+
+bool fwi_shared_region::unlink(const char *name) {
+#ifdef _WIN32
+	return true;
+#else
+	return shm_unlink(name) == 0;
+#endif
+}
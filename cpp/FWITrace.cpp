@@ -0,0 +1,399 @@
+/**
+ * WISE_FWI_Module: FWITrace.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWITrace.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+
+static const std::uint32_t COUNTERS = 3;
+static const char *const COUNTER_NAMES[COUNTERS] = { "cycles", "instructions", "llc_misses" };
+
+
+struct trace_event {
+	const char *name;
+	const char *arg_name;
+	std::int64_t arg;
+	std::uint64_t start, duration;			// steady clock, ns
+	std::uint64_t counters[COUNTERS];
+	bool has_counters;
+};
+
+
+// a thread's spans.  Only the owning thread touches the counters, so they're never closed under it.
+struct trace_thread {
+	std::mutex lock;				// guards the rest
+	std::uint32_t tid;
+	bool in_use;
+	const char *name;
+	std::vector<trace_event> events;
+
+	std::uint32_t session;				// the session the counters were set up for
+	int counters[COUNTERS];				// group leader first, -1 if not open
+
+	explicit trace_thread(std::uint32_t id) : tid(id), in_use(true), name(nullptr), session(0), counters{ -1, -1, -1 } { }
+};
+
+
+std::atomic<bool> FWITrace::s_enabled(false);
+
+static std::mutex g_lock;				// guards the thread list and the session's settings
+static std::vector<std::unique_ptr<trace_thread>> g_threads;
+static std::atomic<std::uint32_t> g_session(0);	// 0 while stopped
+static std::uint32_t g_sessions = 0;
+static std::atomic<bool> g_counters(false);
+static std::string g_filename;
+static std::uint64_t g_epoch = 0;
+
+
+static inline std::uint64_t now() {
+	return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+#ifdef __linux__
+
+static int open_counter(std::uint64_t config, int group) {
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+
+static void close_counters(trace_thread *t) {
+	for (std::uint32_t i = 0; i < COUNTERS; i++)
+		if (t->counters[i] >= 0) {
+			close(t->counters[i]);
+			t->counters[i] = -1;
+		}
+}
+
+
+// for the calling thread, all or nothing
+static void open_counters(trace_thread *t) {
+	static const std::uint64_t config[COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+	for (std::uint32_t i = 0; i < COUNTERS; i++)
+		if ((t->counters[i] = open_counter(config[i], (i == 0) ? -1 : t->counters[0])) < 0) {
+			close_counters(t);
+			return;
+		}
+}
+
+
+static bool read_counters(const trace_thread *t, std::uint64_t *values) {
+	if (t->counters[0] < 0)
+		return false;
+	struct {
+		std::uint64_t nr;
+		std::uint64_t values[COUNTERS];
+	} group;
+	if ((read(t->counters[0], &group, sizeof(group)) != (ssize_t)sizeof(group)) || (group.nr != COUNTERS))
+		return false;
+	memcpy(values, group.values, sizeof(group.values));
+	return true;
+}
+
+#else
+
+static void close_counters(trace_thread *) {
+}
+
+
+static void open_counters(trace_thread *) {
+}
+
+
+static bool read_counters(const trace_thread *, std::uint64_t *) {
+	return false;
+}
+
+#endif
+
+
+// releases the thread's buffer when it exits, for a later thread to take over once its spans are written
+struct trace_slot {
+	trace_thread *thread = nullptr;
+
+	~trace_slot() {
+		if (thread) {
+			close_counters(thread);
+			std::lock_guard<std::mutex> l(thread->lock);
+			thread->in_use = false;
+		}
+	}
+};
+
+
+// the calling thread's buffer, set up for the session, or NULL
+static trace_thread *current_thread(std::uint32_t session) {
+	thread_local trace_slot slot;
+	trace_thread *t = slot.thread;
+	if (!t) {
+		std::lock_guard<std::mutex> l(g_lock);
+		for (auto &b : g_threads) {
+			std::lock_guard<std::mutex> bl(b->lock);
+			if ((!b->in_use) && b->events.empty()) {
+				b->in_use = true;
+				b->name = nullptr;
+				b->session = 0;
+				t = b.get();
+				break;
+			}
+		}
+		if (!t) {
+			try {
+				g_threads.emplace_back(new trace_thread((std::uint32_t)g_threads.size() + 1));
+			}
+			catch (...) {
+				return nullptr;
+			}
+			t = g_threads.back().get();
+		}
+		slot.thread = t;
+	}
+	if (t->session != session) {
+		close_counters(t);
+		if (g_counters.load(std::memory_order_relaxed))
+			open_counters(t);
+		t->session = session;
+	}
+	return t;
+}
+
+
+bool FWITrace::Counters() {
+	const std::uint32_t session = g_session.load();
+	if ((!Enabled()) || (!session))
+		return false;
+	const trace_thread *t = current_thread(session);
+	return t && (t->counters[0] >= 0);
+}
+
+
+HRESULT FWITrace::Start(const char *filename, bool counters) {
+	if (!filename)
+		return E_POINTER;
+	std::lock_guard<std::mutex> l(g_lock);
+	if (g_session.load())
+		return E_UNEXPECTED;
+	try {
+		g_filename = filename;
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	for (auto &b : g_threads) {
+		std::lock_guard<std::mutex> bl(b->lock);
+		b->events.clear();
+	}
+	g_counters = counters;
+	g_epoch = now();
+	if (!++g_sessions)
+		g_sessions++;
+	g_session = g_sessions;
+	s_enabled = true;
+	return S_OK;
+}
+
+
+void FWITrace::NameThread(const char *name) {
+	const std::uint32_t session = g_session.load();
+	if ((!Enabled()) || (!session))
+		return;
+	trace_thread *t = current_thread(session);
+	if (t) {
+		std::lock_guard<std::mutex> l(t->lock);
+		t->name = name;
+	}
+}
+
+
+static void write_string(FILE *f, const char *s) {
+	fputc('"', f);
+	for (; *s; s++) {
+		if ((*s == '"') || (*s == '\\'))
+			fputc('\\', f);
+		if ((unsigned char)*s >= 0x20)
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+
+HRESULT FWITrace::Stop() {
+	std::lock_guard<std::mutex> l(g_lock);
+	if (!g_session.load())
+		return S_FALSE;
+	// spans ending from here on find the session gone and drop themselves
+	s_enabled = false;
+	g_session = 0;
+
+	struct trace_buffer {
+		std::uint32_t tid;
+		const char *name;
+		std::vector<trace_event> events;
+	};
+	std::vector<trace_buffer> buffers;
+	try {
+		buffers.resize(g_threads.size());
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	for (std::size_t i = 0; i < g_threads.size(); i++) {
+		trace_thread &t = *g_threads[i];
+		std::lock_guard<std::mutex> bl(t.lock);
+		buffers[i].tid = t.tid;
+		buffers[i].name = t.name;
+		buffers[i].events.swap(t.events);
+	}
+
+#ifdef _WIN32
+	const unsigned long pid = GetCurrentProcessId();
+#else
+	const unsigned long pid = (unsigned long)getpid();
+#endif
+	FILE *f = fopen(g_filename.c_str(), "w");
+	if (!f)
+		return E_FAIL;
+	fputs("{\"traceEvents\":[", f);
+	bool first = true;
+	for (const auto &b : buffers) {
+		if (b.name) {
+			fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%" PRIu32 ",\"args\":{\"name\":", first ? "" : ",", pid, b.tid);
+			write_string(f, b.name);
+			fputs("}}", f);
+			first = false;
+		}
+		for (const auto &e : b.events) {
+			fprintf(f, "%s\n{\"name\":", first ? "" : ",");
+			write_string(f, e.name);
+			fprintf(f, ",\"ph\":\"X\",\"pid\":%lu,\"tid\":%" PRIu32 ",\"ts\":%.3f,\"dur\":%.3f", pid, b.tid,
+				(double)(e.start - g_epoch) / 1000.0, (double)e.duration / 1000.0);
+			if (e.arg_name || e.has_counters) {
+				fputs(",\"args\":{", f);
+				bool first_arg = true;
+				if (e.arg_name) {
+					write_string(f, e.arg_name);
+					fprintf(f, ":%" PRId64, e.arg);
+					first_arg = false;
+				}
+				if (e.has_counters)
+					for (std::uint32_t c = 0; c < COUNTERS; c++) {
+						fprintf(f, "%s\"%s\":%" PRIu64, first_arg ? "" : ",", COUNTER_NAMES[c], e.counters[c]);
+						first_arg = false;
+					}
+				fputc('}', f);
+			}
+			fputc('}', f);
+			first = false;
+		}
+	}
+	fputs("\n],\"displayTimeUnit\":\"ms\"}\n", f);
+	const bool ok = (!ferror(f));
+	return (fclose(f) || (!ok)) ? E_FAIL : S_OK;
+}
+
+
+void FWITraceSpan::begin(const char *name, const char *arg_name, std::int64_t arg) {
+	const std::uint32_t session = g_session.load();
+	if (!session)
+		return;
+	trace_thread *t = current_thread(session);
+	if (!t)
+		return;
+	m_thread = t;
+	m_arg_name = arg_name;
+	m_arg = arg;
+	m_session = session;
+	if (!read_counters(t, m_counters))
+		m_counters[0] = UINT64_MAX;
+	// last, to leave the setup out of the span
+	m_start = now();
+	m_name = name;
+}
+
+
+void FWITraceSpan::end() {
+	const std::uint64_t finish = now();
+	trace_thread *t = m_thread;
+	trace_event e;
+	e.name = m_name;
+	e.arg_name = m_arg_name;
+	e.arg = m_arg;
+	e.start = m_start;
+	e.duration = finish - m_start;
+	e.has_counters = (m_counters[0] != UINT64_MAX) && read_counters(t, e.counters);
+	if (e.has_counters)
+		for (std::uint32_t c = 0; c < COUNTERS; c++)
+			e.counters[c] -= m_counters[c];
+
+	std::lock_guard<std::mutex> l(t->lock);
+	// checked under the lock, so Stop() either collects the span or it's dropped
+	if (g_session.load() != m_session)
+		return;
+	try {
+		t->events.push_back(e);
+	}
+	catch (...) {
+	}
+}
+
+
+// FWI_TRACE=file traces the whole life of the library
+static struct trace_environment {
+	bool started;
+
+	trace_environment() : started(false) {
+		const char *filename = getenv("FWI_TRACE");
+		if (filename && *filename) {
+			const char *counters = getenv("FWI_TRACE_COUNTERS");
+			started = SUCCEEDED(FWITrace::Start(filename, counters && (*counters == '1')));
+		}
+	}
+
+	~trace_environment() {
+		if (started)
+			FWITrace::Stop();
+	}
+} s_environment;
@@ -0,0 +1,250 @@
+/**
+ * WISE_FWI_Module: FWIWeatherGenerator.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIWeatherGenerator.h"
+#include "fwi_math.h"
+
+#include <cmath>
+
+#include "angles.h"
+
+
+static const double PI = 3.14159265358979323846;
+static const std::uint16_t MONTH_START[13] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365 };
+
+
+/*
+ * splitmix64, small, fast, and fully specified so the weather is the same everywhere
+ */
+static inline std::uint64_t next_u64(std::uint64_t &state) {
+	std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+
+static inline double uniform(std::uint64_t &state) {		// (0..1)
+	return ((double)(next_u64(state) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+
+/*
+ * The elementary functions come from fwi_math_functions(), so that the weather is the same bits on every CPU when the
+ * reproducible kernel mode is selected (sqrt is correctly rounded everywhere, so needs no such care).
+ */
+static inline double normal(const fwi_math_table &m, std::uint64_t &state) {
+	const double u1 = uniform(state), u2 = uniform(state);
+	return std::sqrt(-2.0 * m.log(u1)) * m.cos(2.0 * PI * u2);
+}
+
+
+static inline double saturation_vp(const fwi_math_table &m, double t) {	// hPa
+	return 6.112 * m.exp(17.67 * t / (t + 243.5));
+}
+
+
+static inline double diurnal(const fwi_math_table &m, std::uint16_t hour) {	// -1 at 03:00, +1 at 15:00 LST
+	return m.cos(2.0 * PI * ((double)hour - 15.0) / 24.0);
+}
+
+
+FWIClimateRegime FWIClimateRegime::Regime(FWIClimate climate) {
+	FWIClimateRegime r;
+	switch (climate) {
+	case FWIClimate::PRAIRIE:
+		r.latitude_min = 49.0;		r.latitude_max = 54.0;
+		r.longitude_min = -115.0;	r.longitude_max = -100.0;
+		r.season_start = 79;		r.season_length = 225;
+		r.temp_mean = 9.0;		r.temp_amplitude = 15.0;	r.temp_peak = 200;
+		r.temp_sd = 4.0;		r.temp_persistence = 0.7;
+		r.diurnal_range = 14.0;
+		r.dewpoint_depression = 14.0;	r.dewpoint_sd = 4.0;
+		r.wind_mean = 20.0;		r.wind_sd = 8.0;
+		r.p_wet_after_dry = 0.18;	r.p_wet_after_wet = 0.45;
+		r.rain_mean = 6.0;
+		break;
+
+	case FWIClimate::SOUTHERN_HEMISPHERE:
+		r.latitude_min = -45.0;		r.latitude_max = -35.0;
+		r.longitude_min = 166.0;	r.longitude_max = 178.0;
+		r.season_start = 273;		r.season_length = 212;
+		r.temp_mean = 12.0;		r.temp_amplitude = 6.0;		r.temp_peak = 25;
+		r.temp_sd = 2.5;		r.temp_persistence = 0.6;
+		r.diurnal_range = 10.0;
+		r.dewpoint_depression = 8.0;	r.dewpoint_sd = 3.0;
+		r.wind_mean = 18.0;		r.wind_sd = 7.0;
+		r.p_wet_after_dry = 0.25;	r.p_wet_after_wet = 0.6;
+		r.rain_mean = 7.0;
+		break;
+
+	case FWIClimate::BOREAL:
+	default:
+		r.latitude_min = 54.0;		r.latitude_max = 62.0;
+		r.longitude_min = -125.0;	r.longitude_max = -95.0;
+		r.season_start = 105;		r.season_length = 185;
+		r.temp_mean = 6.0;		r.temp_amplitude = 14.0;	r.temp_peak = 198;
+		r.temp_sd = 3.5;		r.temp_persistence = 0.65;
+		r.diurnal_range = 12.0;
+		r.dewpoint_depression = 10.0;	r.dewpoint_sd = 3.5;
+		r.wind_mean = 12.0;		r.wind_sd = 5.0;
+		r.p_wet_after_dry = 0.28;	r.p_wet_after_wet = 0.55;
+		r.rain_mean = 5.0;
+		break;
+	}
+	return r;
+}
+
+
+FWIWeatherGenerator::FWIWeatherGenerator(std::uint64_t seed, const FWIClimateRegime &regime, std::uint32_t cells)
+    : m_regime(regime),
+      m_cells(cells),
+      m_day(-1),
+      m_rng(cells),
+      m_latitude(cells), m_longitude(cells),
+      m_temp_anomaly(cells, 0.0),
+      m_wet(cells, 0),
+      m_mean_temp(cells), m_dewpoint(cells), m_wind(cells),
+      m_rain_start(cells, 0), m_rain_hours(cells, 0),
+      m_rain_rate(cells, 0.0), m_carry_rain(cells, 0.0),
+      m_noon_temp(cells), m_noon_rh(cells), m_noon_ws(cells), m_noon_rain(cells), m_min_temp(cells), m_max_temp(cells) {
+	const fwi_math_table &m = fwi_math_functions();
+	for (std::uint32_t i = 0; i < cells; i++) {
+		std::uint64_t s = seed ^ (0xd1b54a32d192ed03ULL * ((std::uint64_t)i + 1));
+		next_u64(s);
+		m_rng[i] = s;
+		m_latitude[i] = DEGREE_TO_RADIAN(regime.latitude_min + (regime.latitude_max - regime.latitude_min) * uniform(m_rng[i]));
+		m_longitude[i] = DEGREE_TO_RADIAN(regime.longitude_min + (regime.longitude_max - regime.longitude_min) * uniform(m_rng[i]));
+		m_temp_anomaly[i] = regime.temp_sd * normal(m, m_rng[i]);
+	}
+}
+
+
+HRESULT FWIWeatherGenerator::Location(double *latitude, double *longitude) const {
+	if (!latitude)
+		return E_POINTER;
+	for (std::uint32_t i = 0; i < m_cells; i++) {
+		latitude[i] = m_latitude[i];
+		if (longitude)
+			longitude[i] = m_longitude[i];
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIWeatherGenerator::NextDay(FWIGeneratedDay *day) {
+	if (!day)
+		return E_POINTER;
+
+	const fwi_math_table &m = fwi_math_functions();
+	m_day++;
+	const std::uint16_t doy = (std::uint16_t)((m_regime.season_start + m_day) % 365);
+	std::uint16_t month = 0;
+	while (doy >= MONTH_START[month + 1])
+		month++;
+
+	const double seasonal = m_regime.temp_mean + m_regime.temp_amplitude * m.cos(2.0 * PI * ((double)doy - (double)m_regime.temp_peak) / 365.0);
+	const double innovation = std::sqrt(1.0 - m_regime.temp_persistence * m_regime.temp_persistence) * m_regime.temp_sd;
+
+	for (std::uint32_t i = 0; i < m_cells; i++) {
+		std::uint64_t &rng = m_rng[i];
+
+		const bool wet = uniform(rng) < (m_wet[i] ? m_regime.p_wet_after_wet : m_regime.p_wet_after_dry);
+		m_wet[i] = wet ? 1 : 0;
+
+		m_temp_anomaly[i] = m_regime.temp_persistence * m_temp_anomaly[i] + innovation * normal(m, rng);
+		double range = m_regime.diurnal_range * (0.8 + 0.4 * uniform(rng));
+		double depression = m_regime.dewpoint_depression + m_regime.dewpoint_sd * normal(m, rng);
+		double wind = m_regime.wind_mean + m_regime.wind_sd * normal(m, rng);
+		double mean_temp = seasonal + m_temp_anomaly[i];
+
+		double rain = 0.0;
+		std::uint8_t hours = 0, start = 0;
+		if (wet) {
+			rain = -m_regime.rain_mean * m.log(uniform(rng));
+			hours = (std::uint8_t)(1 + (next_u64(rng) % 6));
+			start = (std::uint8_t)(next_u64(rng) % (24 - hours));		// so the event ends by 23:00
+			range *= 0.6;				// cloud cover
+			depression *= 0.35;
+			mean_temp -= 2.0;
+		}
+		if (depression < 0.5)
+			depression = 0.5;
+		if (wind < 0.0)
+			wind = 0.0;
+
+		m_mean_temp[i] = mean_temp;
+		m_min_temp[i] = mean_temp - 0.5 * range;
+		m_max_temp[i] = mean_temp + 0.5 * range;
+		m_dewpoint[i] = m_max_temp[i] - depression;
+		m_wind[i] = wind;
+		m_rain_start[i] = start;
+		m_rain_hours[i] = hours;
+		m_rain_rate[i] = hours ? (rain / (double)hours) : 0.0;
+
+		// the hours ending 1..12 fall in today's noon to noon period, the remainder carry into tomorrow's
+		double before_noon = 0.0, after_noon = 0.0;
+		for (std::uint8_t h = start + 1; h <= start + hours; h++) {
+			if (h <= 12)
+				before_noon += m_rain_rate[i];
+			else
+				after_noon += m_rain_rate[i];
+		}
+		m_noon_rain[i] = m_carry_rain[i] + before_noon;
+		m_carry_rain[i] = after_noon;
+
+		m_noon_temp[i] = mean_temp + 0.5 * range * diurnal(m, 12);
+		double rh = saturation_vp(m, m_dewpoint[i]) / saturation_vp(m, m_noon_temp[i]);
+		m_noon_rh[i] = (rh > 1.0) ? 1.0 : rh;
+		m_noon_ws[i] = wind;
+	}
+
+	day->day_of_year = doy;
+	day->month = month;
+	day->temperature = m_noon_temp.data();
+	day->rh = m_noon_rh.data();
+	day->ws = m_noon_ws.data();
+	day->rain = m_noon_rain.data();
+	day->min_temperature = m_min_temp.data();
+	day->max_temperature = m_max_temp.data();
+	return (m_day < (std::int32_t)m_regime.season_length) ? S_OK : S_FALSE;
+}
+
+
+HRESULT FWIWeatherGenerator::Hourly(std::uint16_t hour, double *temperature, double *rh, double *ws, double *rain) const {
+	if ((!temperature) || (!rh) || (!ws) || (!rain))
+		return E_POINTER;
+	if (hour > 23)
+		return E_INVALIDARG;
+	if (m_day < 0)
+		return E_UNEXPECTED;
+
+	const fwi_math_table &m = fwi_math_functions();
+	const double shape = diurnal(m, hour);
+	const double wind_shape = 1.0 + 0.35 * (shape - diurnal(m, 12));		// equal to the noon wind at noon
+	for (std::uint32_t i = 0; i < m_cells; i++) {
+		const double t = m_mean_temp[i] + 0.5 * (m_max_temp[i] - m_min_temp[i]) * shape;
+		const double r = saturation_vp(m, m_dewpoint[i]) / saturation_vp(m, t);
+		temperature[i] = t;
+		rh[i] = (r > 1.0) ? 1.0 : r;
+		ws[i] = m_wind[i] * ((wind_shape < 0.0) ? 0.0 : wind_shape);
+		rain[i] = ((hour > m_rain_start[i]) && (hour <= m_rain_start[i] + m_rain_hours[i])) ? m_rain_rate[i] : 0.0;
+	}
+	return S_OK;
+}
@@ -0,0 +1,47 @@
+/**
+ * WISE_FWI_Module: FWIWeatherIntermediates.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIWeatherIntermediates.h"
+#include "fwi_kernels.h"
+
+#include <algorithm>
+
+
+HRESULT FWIWeatherIntermediates::Calculate(std::uint32_t count, const double *temperature, const double *rh, const double *ws) {
+	if (count && ((!temperature) || (!rh) || (!ws)))
+		return E_POINTER;
+
+	try {
+		m_values.resize((std::size_t)count * 9);
+	}
+	catch (...) {
+		m_values.clear();
+		m_count = 0;
+		return E_OUTOFMEMORY;
+	}
+	m_count = count;
+
+	double *v = m_values.data();
+	const std::size_t c = count;
+	fwi_kernels().ffmc_weather(count, temperature, rh, ws, v, v + c, v + 2 * c, v + 3 * c, v + 4 * c, v + 5 * c);
+	std::copy(temperature, temperature + c, v + 6 * c);
+	std::copy(rh, rh + c, v + 7 * c);
+	std::copy(ws, ws + c, v + 8 * c);
+	return S_OK;
+}
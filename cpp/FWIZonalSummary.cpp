@@ -0,0 +1,126 @@
+/**
+ * WISE_FWI_Module: FWIZonalSummary.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "intel_check.h"
+#include "FWIZonalSummary.h"
+
+
+static const FWICode CODES[FWI_ZONAL_CODE_COUNT] = { FWICode::ISI, FWICode::BUI, FWICode::FWI };
+
+
+HRESULT FWIZonalSummary::Initialize(const FWIZonalSettings &settings, std::uint32_t zonings, std::uint16_t days) {
+	for (std::uint8_t c = 0; c < FWI_ZONAL_CODE_COUNT; c++)
+		for (std::uint8_t t = 1; t < FWI_ZONAL_THRESHOLD_COUNT; t++)
+			if (!(settings.thresholds[c][t] >= settings.thresholds[c][t - 1]))
+				return E_INVALIDARG;
+
+	m_statistics.clear();
+	m_settings = settings;
+	m_zonings = zonings;
+	m_days = days;
+	// compared in fixed point, so that a value lands on the same side of a threshold however it's accumulated
+	for (std::uint8_t c = 0; c < FWI_ZONAL_CODE_COUNT; c++)
+		for (std::uint8_t t = 0; t < FWI_ZONAL_THRESHOLD_COUNT; t++) {
+			const std::uint16_t q = FWIQuantized::Quantize(CODES[c], settings.thresholds[c][t]);
+			m_thresholds[c][t] = (q == FWIQuantized::MISSING) ? 0 : q;
+		}
+	try {
+		m_statistics.assign((std::size_t)zonings * days * settings.zones * FWI_ZONAL_CODE_COUNT, FWIZoneStatistics(settings.relative_accuracy));
+	}
+	catch (...) {
+		m_zonings = m_days = 0;
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIZonalSummary::Add(std::uint32_t zoning, std::uint16_t day, FWICode code, std::uint32_t count, const std::uint32_t *zones, const std::uint16_t *values) {
+	const int c = CodeIndex(code);
+	if ((zoning >= m_zonings) || (day >= m_days) || (c < 0))
+		return E_INVALIDARG;
+	if (!count)
+		return S_OK;
+	if ((!zones) || (!values))
+		return E_POINTER;
+
+	const std::uint16_t *thresholds = m_thresholds[c];
+	FWIZoneStatistics *s = m_statistics.data() + index(zoning, 0, day, c);
+	try {
+		for (std::uint32_t i = 0; i < count; i++) {
+			const std::uint32_t z = zones[i];
+			if (z >= m_settings.zones)
+				continue;
+			FWIZoneStatistics &zs = s[(std::size_t)z * FWI_ZONAL_CODE_COUNT];
+			const std::uint16_t v = values[i];
+			if (v == FWIQuantized::MISSING) {
+				zs.missing++;
+				continue;
+			}
+			zs.cells++;
+			zs.sum += v;
+			if (v > zs.maximum)
+				zs.maximum = v;
+			for (std::uint8_t t = 0; t < FWI_ZONAL_THRESHOLD_COUNT; t++)
+				zs.above[t] += (v >= thresholds[t]);
+			if (m_settings.percentiles)
+				zs.sketch.Add(FWIQuantized::Dequantize(code, v));
+		}
+	}
+	catch (...) {
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
+}
+
+
+HRESULT FWIZonalSummary::Merge(const FWIZonalSummary &other) {
+	if ((other.m_zonings != m_zonings) || (other.m_days != m_days) || (other.m_settings.zones != m_settings.zones) || (other.m_settings.percentiles != m_settings.percentiles)
+	    || (other.m_settings.relative_accuracy != m_settings.relative_accuracy))
+		return E_INVALIDARG;
+	for (std::uint8_t c = 0; c < FWI_ZONAL_CODE_COUNT; c++)
+		for (std::uint8_t t = 0; t < FWI_ZONAL_THRESHOLD_COUNT; t++)
+			if (other.m_thresholds[c][t] != m_thresholds[c][t])
+				return E_INVALIDARG;
+
+	for (std::size_t i = 0; i < m_statistics.size(); i++) {
+		FWIZoneStatistics &s = m_statistics[i];
+		const FWIZoneStatistics &o = other.m_statistics[i];
+		s.cells += o.cells;
+		s.missing += o.missing;
+		s.sum += o.sum;
+		if (o.maximum > s.maximum)
+			s.maximum = o.maximum;
+		for (std::uint8_t t = 0; t < FWI_ZONAL_THRESHOLD_COUNT; t++)
+			s.above[t] += o.above[t];
+		if (m_settings.percentiles) {
+			HRESULT hr = s.sketch.Merge(o.sketch);
+			if (FAILED(hr))
+				return hr;
+		}
+	}
+	return S_OK;
+}
+
+
+const FWIZoneStatistics *FWIZonalSummary::Statistics(std::uint32_t zoning, std::uint32_t zone, std::uint16_t day, FWICode code) const {
+	const int c = CodeIndex(code);
+	if ((zoning >= m_zonings) || (zone >= m_settings.zones) || (day >= m_days) || (c < 0))
+		return nullptr;
+	return &m_statistics[index(zoning, zone, day, c)];
+}
@@ -24,10 +24,13 @@
 #endif
 
 #include "fwi.h"
+#include "fwi_tables.h"
 
 #include <cassert>
 #include "angles.h"
 
+using namespace fwi_tables;
+
 
 // tolerance for convergance of previous ffmc calculations
 #define TOLERANCE 0.0000001
@@ -119,6 +122,76 @@ double calc_subdaily_ffmc_vanwagner(const WTimeSpan &ts, const double in_ffmc, c
 	return c_f;
 }
 
+void calc_ffmc_weather(double temperature, double rh, double ws, ffmc_weather *wx) {
+	if (temperature < -50.0)
+		temperature = -50.0;
+	else if (temperature > 60.0)
+		temperature = 60.0;
+
+	if (rh < 0.0)
+		rh = 0.0;
+	else if (rh > 1.0)
+		rh = 1.0;
+
+	if (ws > 200.0)
+		ws = 200.0;
+	else if (ws < 0.0)
+		ws = 0.0;
+
+	// the same expressions as calc_subdaily_ffmc_vanwagner() and calc_daily_ffmc_vanwagner(), so the results are identical
+	const double rhp = rh * 100.0;
+	const double e1 = exp((rhp - 100.0) / 10.0);
+	const double e2 = 0.18 * (21.1 - temperature) * (1.0 - exp(-0.115 * rhp));
+	const double sws = sqrt(ws);
+	wx->ed = 0.942 * pow(rhp, 0.679) + (11.0 * e1) + e2;				// equation 8a
+	wx->ew = 0.618 * pow(rhp, 0.753) + (10.0 * e1) + e2;				// equation 8b
+	wx->k_dry = 0.424 * (1.0 - pow(rh, 1.7)) + 0.0694 * sws * (1.0 - pow(rh, 8.0));	// equation 4 / 6a
+	wx->k_wet = 0.424 * (1.0 - pow(1.0 - rh, 1.7)) + 0.0694 * sws * (1.0 - pow(1.0 - rh, 8.0));
+	wx->k_wet_daily = 0.424 * (1.0 - pow((100.0 - rhp) / 100.0, 1.7)) + 0.0694 * sws * (1.0 - pow(1.0 - rh, 8.0));	// eqn 7a
+	wx->temp_factor = exp(0.0365 * temperature);
+}
+
+
+double calc_subdaily_ffmc_vanwagner_wx(const WTimeSpan &ts, const double in_ffmc, const double rain, const ffmc_weather &wx) {
+	if ((in_ffmc < 0.0) || (in_ffmc > 101.0) ||
+	    (rain < 0.0) || (rain > 300.0))
+		return -98;
+
+	double factor, hour_frac = (double)ts.GetTotalSeconds() / 60.0 / 60.0;
+	double hour_frac2 = hour_frac - floor(hour_frac);
+	if (hour_frac2 > 1e-4)
+		factor = 147.27723;
+	else
+		factor = 147.2;
+
+	double mo = factor * (101.0 - in_ffmc) / (59.5 + in_ffmc);
+	if (rain != 0)
+		mo += rain * 42.5 * exp(-100.0 / (251.0 - mo)) * (1.0 - exp(-6.93 / rain));
+	if (mo > 250.0)
+		mo = 250.0;
+
+	const double moed = mo - wx.ed, moew = mo - wx.ew;
+	double xm;
+	if (moed == 0.0 || (moew >= 0.0 && moed < 0.0))
+		xm = mo;
+	else {
+		double xkd;
+		if (moed > 0.0)
+			xkd = wx.k_dry * 0.0579 * wx.temp_factor;
+		else
+			xkd = wx.k_wet * 0.0579 * wx.temp_factor;
+		xm = ((moed > 0.0) ? wx.ed : wx.ew) + ((moed > 0.0) ? moed : moew) * pow(10.0, -xkd * hour_frac);
+	}
+
+	double c_f = 59.5 * (250.0 - xm) / (factor + xm);
+	if (c_f > 101.0)
+		c_f = 101.0;
+	else if (c_f < 0.0)
+		c_f = 0.0;
+	return c_f;
+}
+
+
 /////////////////////////////////////////////////////////////////////
 //                                                                 //
 //  This routine calculates ffmc backwards through time based on   //
@@ -152,10 +225,13 @@ double calc_previous_hourly_ffmc_vanwagner(const double current_ffmc,
 		ws = 0.0;
 
 	double out_ffmc, out_ffmc_prior, in_ffmc, diff_mc;
+	const WTimeSpan one_hour(0, 1, 0, 0);
+	ffmc_weather wx;
+	calc_ffmc_weather(temperature, rh, ws, &wx);		// the weather doesn't change between iterations
 
 	in_ffmc = current_ffmc;
 
-	out_ffmc = calc_subdaily_ffmc_vanwagner(WTimeSpan(0, 1, 0, 0), in_ffmc, rain, temperature, rh, ws);
+	out_ffmc = calc_subdaily_ffmc_vanwagner_wx(one_hour, in_ffmc, rain, wx);
 
 	diff_mc = fabs(out_ffmc - current_ffmc);
 	while (diff_mc > TOLERANCE ) {
@@ -167,7 +243,7 @@ double calc_previous_hourly_ffmc_vanwagner(const double current_ffmc,
 		}
 
 		out_ffmc_prior = out_ffmc;	
-		out_ffmc = calc_subdaily_ffmc_vanwagner(WTimeSpan(0, 1, 0, 0), in_ffmc, rain, temperature, rh, ws);
+		out_ffmc = calc_subdaily_ffmc_vanwagner_wx(one_hour, in_ffmc, rain, wx);
 		
 		diff_mc = fabs(out_ffmc - current_ffmc);
 		// check for error conditions
@@ -267,92 +343,6 @@ double calc_daily_ffmc_vanwagner(const double in_ffmc, const double rain, double
  * originated from Mike Wotton's source file called diurffmc.c
  */
 
-/*
- * Supporting tables for various routines  
- * moved out of the routines by Mac on 2001/12/13
- * to support backwards hourly calculations
- */
-
-
-/* Morning Hours Tables
- * One for each of three RH levels
- */
-
-// Low rh
-static const double L[9][39] = {
-		{9999, 17.5, 30.0, 40.0, 50.0, 55.0, 60.0, 65.0, 70.0, 72.0, 74.0, 75.0, 76.0, 77.0, 78.0, 79.0, 80.0, 81.0, 82.0, 83.0, 84.0, 85.0, 86.0, 87.0, 88.0, 89.0, 90.0, 91.0, 92.0, 93.0, 94.0, 95.0, 96.0, 97.0, 98.0, 99.0,100.0,100.9,101.0 },
-		{600 , 48.3, 49.4, 51.1, 53.5, 55.1, 56.9, 59.1, 61.7, 62.9, 64.1, 64.8, 65.5, 66.2, 66.9, 67.7, 68.5, 69.4, 70.2, 71.1, 72.1, 73.1, 74.1, 75.2, 76.3, 77.5, 78.7, 80.0, 81.3, 82.7, 84.1, 85.7, 87.2, 88.8, 90.4, 91.9, 93.2, 93.8, 93.8 },
-		{700 , 50.7, 52.1, 53.9, 56.3, 57.9, 59.7, 61.8, 64.3, 65.4, 66.6, 67.2, 67.9, 68.6, 69.3, 70.0, 70.7, 71.5, 72.3, 73.2, 74.0, 75.0, 75.9, 76.9, 77.9, 79.0, 80.2, 81.4, 82.6, 83.9, 85.2, 86.6, 88.1, 89.6, 91.1, 92.6, 93.9, 94.5, 94.5 },
-		{800 , 53.3, 54.9, 56.8, 59.3, 60.9, 62.6, 64.7, 67.0, 68.1, 69.2, 69.8, 70.4, 71.0, 71.6, 72.3, 73.0, 73.7, 74.5, 75.3, 76.1, 76.9, 77.8, 78.7, 79.7, 80.6, 81.7, 82.8, 83.9, 85.1, 86.3, 87.7, 89.0, 90.4, 91.9, 93.3, 94.6, 95.3, 95.3 },
-		{900 , 59.6, 60.7, 62.2, 64.4, 65.7, 67.3, 69.1, 71.2, 72.1, 73.2, 73.7, 74.2, 74.8, 75.4, 76.0, 76.7, 77.3, 78.0, 78.7, 79.5, 80.3, 81.1, 81.9, 82.8, 83.7, 84.7, 85.7, 86.7, 87.8, 89.0, 90.1, 91.4, 92.6, 93.9, 95.2, 96.3, 96.8, 96.8 },
-		{1000, 66.8, 67.2, 68.2, 69.9, 70.9, 72.2, 73.8, 75.6, 76.5, 77.4, 77.9, 78.4, 78.9, 79.4, 80.0, 80.5, 81.1, 81.8, 82.4, 83.1, 83.8, 84.5, 85.3, 86.1, 86.9, 87.8, 88.7, 89.7, 90.6, 91.7, 92.7, 93.8, 94.9, 96.0, 97.1, 97.9, 98.4, 98.4 },
-		{1100, 74.5, 74.5, 74.9, 75.9, 76.6, 77.6, 78.8, 80.3, 81.0, 81.9, 82.4, 83.0, 83.6, 84.1, 84.7, 85.2, 85.8, 86.3, 86.9, 87.4, 88.0, 88.5, 89.0, 89.6, 90.1, 90.6, 91.1, 91.6, 92.1, 92.6, 93.1, 93.8, 94.9, 96.0, 97.1, 97.9, 98.4, 98.4 },
-		{1159, 83.0, 82.5, 82.3, 82.4, 82.7, 83.2, 84.1, 85.2, 85.8, 86.5, 86.8, 87.2, 87.6, 87.9, 88.2, 88.6, 88.9, 89.2, 89.6, 89.9, 90.2, 90.5, 90.9, 91.2, 91.5, 91.8, 92.1, 92.4, 92.7, 93.0, 93.3, 93.8, 94.9, 96.0, 97.1, 97.9, 98.4, 98.4 },
-		{1200, 83.0, 82.5, 82.3, 82.4, 82.7, 83.2, 84.1, 85.2, 85.8, 86.5, 86.8, 87.2, 87.6, 87.9, 88.2, 88.6, 88.9, 89.2, 89.6, 89.9, 90.2, 90.5, 90.9, 91.2, 91.5, 91.8, 92.1, 92.4, 92.7, 93.0, 93.3, 93.8, 94.9, 96.0, 97.1, 97.9, 98.4, 98.4 }
-	};
-
-// Medium rh
-static const double M[9][39] = {
-		{9999, 17.5, 30.0, 40.0, 50.0, 55.0, 60.0, 65.0, 70.0, 72.0, 74.0, 75.0, 76.0, 77.0, 78.0, 79.0, 80.0, 81.0, 82.0, 83.0, 84.0, 85.0, 86.0, 87.0, 88.0, 89.0, 90.0, 91.0, 92.0, 93.0, 94.0, 95.0, 96.0, 97.0, 98.0, 99.0,100.0,100.9,101.0 },
-		{600 , 34.8, 39.2, 43.2, 47.6, 50.0, 52.6, 55.4, 58.4, 59.7, 61.1, 61.8, 62.5, 63.3, 64.0, 64.8, 65.6, 66.4, 67.2, 68.1, 68.9, 69.8, 70.8, 71.7, 72.7, 73.8, 74.8, 75.9, 77.1, 78.3, 79.5, 80.8, 82.2, 83.6, 85.0, 86.5, 88.0, 89.1, 89.1 },
-		{700 , 36.3, 40.5, 44.3, 48.7, 51.2, 53.8, 56.7, 59.9, 61.3, 62.7, 63.4, 64.2, 64.9, 65.7, 66.5, 67.4, 68.2, 69.1, 70.0, 70.9, 71.9, 72.8, 73.9, 74.9, 75.9, 77.0, 78.2, 79.3, 80.5, 81.8, 83.1, 84.4, 85.7, 87.0, 88.3, 89.5, 90.2, 90.2 },
-		{800 , 37.8, 41.7, 45.5, 49.8, 52.3, 55.1, 58.1, 61.4, 62.8, 64.3, 65.1, 65.9, 66.7, 67.5, 68.4, 69.3, 70.1, 71.1, 72.0, 73.0, 74.0, 75.0, 76.0, 77.1, 78.2, 79.3, 80.5, 81.7, 82.9, 84.1, 85.4, 86.6, 87.9, 89.1, 90.2, 91.2, 91.6, 91.6 },
-		{900 , 44.6, 48.2, 51.6, 55.6, 57.8, 60.3, 63.0, 66.0, 67.3, 68.6, 69.3, 70.1, 70.8, 71.6, 72.3, 73.1, 73.9, 74.8, 75.6, 76.5, 77.4, 78.3, 79.3, 80.3, 81.3, 82.3, 83.4, 84.5, 85.7, 86.8, 88.0, 89.2, 90.5, 91.7, 92.8, 93.8, 94.4, 94.4 },
-		{1000, 52.5, 55.5, 58.5, 61.9, 63.9, 66.0, 68.4, 71.0, 72.1, 73.3, 73.9, 74.5, 75.2, 75.9, 76.5, 77.2, 77.9, 78.7, 79.4, 80.2, 81.0, 81.9, 82.7, 83.6, 84.5, 85.5, 86.5, 87.5, 88.5, 89.6, 90.8, 91.9, 93.1, 94.3, 95.5, 96.7, 97.3, 97.3 },
-		{1100, 61.6, 64.0, 66.3, 69.0, 70.6, 72.3, 74.2, 76.4, 77.3, 78.3, 79.0, 79.6, 80.3, 80.9, 81.5, 82.2, 82.8, 83.4, 84.0, 84.6, 85.3, 85.9, 86.5, 87.1, 87.7, 88.3, 88.9, 89.4, 90.0, 90.6, 91.2, 91.9, 93.1, 94.3, 95.5, 96.7, 97.3, 97.3 },
-		{1159, 72.1, 73.5, 75.0, 76.9, 77.9, 79.2, 80.6, 82.2, 82.9, 83.6, 84.0, 84.4, 84.8, 85.2, 85.6, 86.0, 86.4, 86.7, 87.1, 87.5, 87.9, 88.2, 88.6, 88.9, 89.3, 89.7, 90.0, 90.3, 90.7, 91.0, 91.4, 91.9, 93.1, 94.3, 95.5, 96.7, 97.3, 97.3 },
-		{1200, 72.1, 73.5, 75.0, 76.9, 77.9, 79.2, 80.6, 82.2, 82.9, 83.6, 84.0, 84.4, 84.8, 85.2, 85.6, 86.0, 86.4, 86.7, 87.1, 87.5, 87.9, 88.2, 88.6, 88.9, 89.3, 89.7, 90.0, 90.3, 90.7, 91.0, 91.4, 91.9, 93.1, 94.3, 95.5, 96.7, 97.3, 97.3 }
-	};
-
-// High rh
-static const double H[9][39] = {
-		{9999, 17.5, 30.0, 40.0, 50.0, 55.0, 60.0, 65.0, 70.0, 72.0, 74.0, 75.0, 76.0, 77.0, 78.0, 79.0, 80.0, 81.0, 82.0, 83.0, 84.0, 85.0, 86.0, 87.0, 88.0, 89.0, 90.0, 91.0, 92.0, 93.0, 94.0, 95.0, 96.0, 97.0, 98.0, 99.0,100.0,100.9,101.0 },
-		{600,  28.2, 33.4, 37.9, 42.9, 45.6, 48.5, 51.7, 55.1, 56.5, 58.0, 58.8, 59.5, 60.3, 61.2, 62.0, 62.9, 63.7, 64.6, 65.5, 66.5, 67.4, 68.4, 69.4, 70.5, 71.6, 72.7, 73.8, 75.0, 76.2, 77.4, 78.7, 80.0, 81.4, 82.7, 84.1, 85.4, 86.3, 86.3 },
-		{700,  30.0, 34.8, 39.0, 43.8, 46.5, 49.4, 52.5, 55.9, 57.3, 58.8, 59.6, 60.4, 61.2, 62.1, 62.9, 63.8, 64.7, 65.7, 66.6, 67.6, 68.6, 69.6, 70.7, 71.8, 72.9, 74.1, 75.3, 76.5, 77.8, 79.1, 80.5, 81.9, 83.3, 84.8, 86.2, 87.6, 88.4, 88.4 },
-		{800,  31.9, 36.2, 40.2, 44.8, 47.4, 50.2, 53.3, 56.7, 58.2, 59.7, 60.5, 61.3, 62.2, 63.0, 63.9, 64.8, 65.7, 66.7, 67.7, 68.7, 69.8, 70.8, 71.9, 73.1, 74.3, 75.5, 76.8, 78.1, 79.4, 80.8, 82.3, 83.8, 85.3, 86.9, 88.4, 89.8, 90.6, 90.6 },
-		{900,  37.7, 42.1, 46.1, 50.5, 52.9, 55.5, 58.4, 61.5, 62.8, 64.2, 64.9, 65.6, 66.4, 67.1, 67.9, 68.7, 69.5, 70.4, 71.3, 72.1, 73.1, 74.0, 75.0, 76.0, 77.0, 78.1, 79.2, 80.3, 81.5, 82.7, 84.0, 85.3, 86.7, 88.1, 89.5, 90.8, 91.7, 91.7 },
-		{1000, 44.4, 48.9, 52.7, 56.8, 59.1, 61.4, 63.9, 66.7, 67.8, 69.0, 69.6, 70.2, 70.9, 71.5, 72.2, 72.9, 73.6, 74.3, 75.0, 75.8, 76.6, 77.3, 78.2, 79.0, 79.9, 80.8, 81.7, 82.6, 83.6, 84.7, 85.8, 86.9, 88.0, 89.3, 90.5, 91.8, 92.8, 92.8 },
-		{1100, 52.1, 56.5, 60.2, 63.9, 65.9, 67.9, 70.1, 72.3, 73.3, 74.3, 74.9, 75.5, 76.1, 76.6, 77.2, 77.8, 78.4, 79.0, 79.5, 80.1, 80.7, 81.2, 81.8, 82.4, 82.9, 83.5, 84.0, 84.6, 85.1, 85.6, 86.2, 86.9, 88.0, 89.3, 90.5, 91.8, 92.8, 92.8 },
-		{1159, 60.9, 65.2, 68.6, 71.8, 73.5, 75.1, 76.7, 78.4, 79.1, 79.8, 80.2, 80.5, 80.8, 81.2, 81.5, 81.8, 82.1, 82.5, 82.8, 83.1, 83.4, 83.7, 84.0, 84.3, 84.6, 84.9, 85.2, 85.5, 85.8, 86.1, 86.4, 86.9, 88.0, 89.3, 90.5, 91.8, 92.8, 92.8 },
-		{1200, 60.9, 65.2, 68.6, 71.8, 73.5, 75.1, 76.7, 78.4, 79.1, 79.8, 80.2, 80.5, 80.8, 81.2, 81.5, 81.8, 82.1, 82.5, 82.8, 83.1, 83.4, 83.7, 84.0, 84.3, 84.6, 84.9, 85.2, 85.5, 85.8, 86.1, 86.4, 86.9, 88.0, 89.3, 90.5, 91.8, 92.8, 92.8 }
-	};
-
-
-/*
- * main table for the remainder of hours for all of the rh ranges
- */
-static const double MAIN[22][39] = {
-		{9999, 17.5, 30.0, 40.0, 50.0, 55.0, 60.0, 65.0, 70.0, 72.0, 74.0, 75.0, 76.0, 77.0, 78.0, 79.0, 80.0, 81.0, 82.0, 83.0, 84.0, 85.0, 86.0, 87.0, 88.0, 89.0, 90.0, 91.0, 92.0, 93.0, 94.0, 95.0, 96.0, 97.0, 98.0, 99.0,100.0,100.9,101.0 },
-		{100 , 23.4, 32.9, 40.5, 47.8, 51.4, 54.9, 58.3, 61.8, 63.3, 64.8, 65.5, 66.3, 67.1, 67.9, 68.8, 69.6, 70.5, 71.4, 72.3, 73.2, 74.1, 75.1, 76.1, 77.1, 78.1, 79.1, 80.2, 81.3, 82.4, 83.5, 84.7, 85.9, 87.1, 88.3, 89.5, 90.7, 91.6, 91.6 },
-		{200 , 24.3, 33.0, 39.9, 46.8, 50.2, 53.6, 56.9, 60.4, 61.8, 63.4, 64.1, 64.9, 65.7, 66.5, 67.4, 68.2, 69.1, 70.0, 70.9, 71.8, 72.7, 73.7, 74.7, 75.7, 76.7, 77.8, 78.9, 80.0, 81.1, 82.3, 83.4, 84.7, 85.9, 87.2, 88.4, 89.6, 90.5, 90.5 },
-		{300 , 25.2, 33.1, 39.4, 45.8, 49.0, 52.3, 55.6, 59.0, 60.5, 62.0, 62.7, 63.5, 64.3, 65.1, 66.0, 66.8, 67.7, 68.6, 69.5, 70.4, 71.4, 72.3, 73.3, 74.4, 75.4, 76.5, 77.6, 78.7, 79.8, 81.0, 82.2, 83.5, 84.7, 86.0, 87.3, 88.5, 89.4, 89.4 },
-		{400 , 26.2, 33.2, 38.9, 44.8, 47.9, 51.0, 54.3, 57.7, 59.1, 60.6, 61.4, 62.2, 63.0, 63.8, 64.6, 65.5, 66.3, 67.2, 68.1, 69.1, 70.0, 71.0, 72.0, 73.0, 74.1, 75.2, 76.3, 77.4, 78.6, 79.8, 81.0, 82.3, 83.6, 84.9, 86.2, 87.5, 88.4, 88.4 },
-		{500 , 27.2, 33.3, 38.4, 43.9, 46.7, 49.8, 52.9, 56.4, 57.8, 59.3, 60.1, 60.8, 61.6, 62.5, 63.3, 64.2, 65.0, 65.9, 66.8, 67.8, 68.7, 69.7, 70.7, 71.7, 72.8, 73.9, 75.0, 76.2, 77.4, 78.6, 79.8, 81.1, 82.5, 83.8, 85.2, 86.4, 87.3, 87.3 },
-		{559 , 28.2, 33.4, 37.9, 42.9, 45.7, 48.6, 51.7, 55.1, 56.5, 58.0, 58.8, 59.6, 60.4, 61.2, 62.0, 62.9, 63.8, 64.6, 65.6, 66.5, 67.5, 68.4, 69.5, 70.5, 71.6, 72.7, 73.8, 75.0, 76.2, 77.4, 78.7, 80.0, 81.4, 82.7, 84.1, 85.4, 86.3, 86.3 },
-		{600 , 28.2, 33.4, 37.9, 42.9, 45.7, 48.6, 51.7, 55.1, 56.5, 58.0, 58.8, 59.6, 60.4, 61.2, 62.0, 62.9, 63.8, 64.6, 65.6, 66.5, 67.5, 68.4, 69.5, 70.5, 71.6, 72.7, 73.8, 75.0, 76.2, 77.4, 78.7, 80.0, 81.4, 82.7, 84.1, 85.4, 86.3, 86.3 },
-		{1200, 17.5, 27.7, 34.4, 40.9, 44.5, 48.2, 52.5, 57.3, 59.4, 61.7, 62.9, 64.2, 65.5, 66.9, 68.5, 70.5, 73.8, 76.4, 78.4, 80.0, 81.5, 82.8, 84.0, 85.2, 86.3, 87.5, 88.6, 89.7, 90.8, 91.9, 92.9, 94.0, 95.0, 96.0, 97.0, 97.9, 98.7, 98.7 },
-		{1300, 17.5, 28.3, 35.8, 43.2, 47.2, 51.5, 56.0, 61.0, 63.2, 65.5, 66.7, 67.9, 69.3, 70.7, 72.2, 73.9, 76.3, 78.2, 79.8, 81.1, 82.4, 83.7, 84.8, 86.0, 87.1, 88.2, 89.3, 90.4, 91.4, 92.5, 93.5, 94.6, 95.6, 96.6, 97.6, 98.5, 99.3, 99.3 },
-		{1400, 17.5, 29.0, 37.2, 45.6, 50.1, 54.8, 59.8, 65.1, 67.3, 69.6, 70.8, 72.0, 73.3, 74.6, 76.1, 77.4, 78.7, 79.9, 81.1, 82.3, 83.4, 84.6, 85.7, 86.8, 87.9, 88.9, 90.0, 91.0, 92.1, 93.1, 94.1, 95.1, 96.1, 97.1, 98.1, 99.1,100.0,100.0 },
-		{1500, 17.5, 29.5, 38.6, 47.8, 52.5, 57.4, 62.4, 67.5, 69.6, 71.8, 72.9, 74.0, 75.1, 76.3, 77.5, 78.7, 79.9, 81.0, 82.1, 83.2, 84.2, 85.3, 86.4, 87.4, 88.5, 89.5, 90.5, 91.5, 92.6, 93.6, 94.6, 95.6, 96.6, 97.6, 98.6, 99.6,100.4,100.4 },
-		{1600, 17.5, 30.0, 40.0, 50.0, 55.0, 60.0, 65.0, 70.0, 72.0, 74.0, 75.0, 76.0, 77.0, 78.0, 79.0, 80.0, 81.0, 82.0, 83.0, 84.0, 85.0, 86.0, 87.0, 88.0, 89.0, 90.0, 91.0, 92.1, 93.1, 94.1, 95.1, 96.1, 97.1, 98.1, 99.1,100.1,101.0,101.0 },
-		{1700, 17.8, 30.6, 40.8, 51.0, 56.1, 61.0, 65.8, 70.4, 72.2, 74.0, 75.0, 75.9, 76.8, 77.8, 78.7, 79.7, 80.6, 81.6, 82.6, 83.5, 84.5, 85.5, 86.5, 87.5, 88.5, 89.5, 90.5, 91.5, 92.5, 93.5, 94.5, 95.5, 96.5, 97.6, 98.6, 99.6,100.4,100.4 },
-		{1800, 18.0, 31.1, 41.6, 52.0, 57.1, 62.0, 66.6, 70.7, 72.3, 74.0, 74.9, 75.7, 76.6, 77.5, 78.4, 79.3, 80.2, 81.2, 82.1, 83.0, 84.0, 84.9, 85.9, 86.9, 87.9, 88.9, 89.9, 90.9, 91.9, 92.9, 93.9, 95.0, 96.0, 97.1, 98.1, 99.1, 99.9, 99.9 },
-		{1900, 18.5, 31.8, 42.4, 52.6, 57.5, 62.0, 66.2, 70.0, 71.6, 73.2, 74.0, 74.8, 75.7, 76.5, 77.4, 78.2, 79.1, 80.0, 80.9, 81.8, 82.8, 83.7, 84.6, 85.6, 86.6, 87.5, 88.5, 89.5, 90.5, 91.5, 92.6, 93.6, 94.6, 95.7, 96.7, 97.8, 98.6, 98.6 },
-		{2000, 19.1, 32.5, 43.2, 53.3, 57.9, 62.0, 65.9, 69.4, 70.9, 72.4, 73.1, 73.9, 74.7, 75.5, 76.3, 77.2, 78.0, 78.9, 79.8, 80.6, 81.5, 82.5, 83.4, 84.3, 85.3, 86.2, 87.2, 88.2, 89.2, 90.2, 91.2, 92.3, 93.3, 94.3, 95.4, 96.4, 97.4, 97.4 },
-		{2100, 19.9, 32.5, 42.6, 52.1, 56.5, 60.5, 64.3, 67.8, 69.3, 70.8, 71.5, 72.3, 73.1, 73.9, 74.8, 75.6, 76.5, 77.3, 78.2, 79.1, 80.0, 80.9, 81.9, 82.8, 83.8, 84.8, 85.8, 86.8, 87.8, 88.8, 89.9, 90.9, 92.0, 93.1, 94.2, 95.2, 96.2, 96.2 },
-		{2200, 20.7, 32.6, 42.1, 51.0, 55.2, 59.1, 62.7, 66.2, 67.7, 69.2, 70.0, 70.8, 71.6, 72.4, 73.2, 74.1, 74.9, 75.8, 76.7, 77.6, 78.5, 79.4, 80.4, 81.3, 82.3, 83.3, 84.3, 85.4, 86.4, 87.5, 88.6, 89.6, 90.8, 91.9, 93.0, 94.1, 95.0, 95.0 },
-		{2300, 21.6, 32.7, 41.5, 50.0, 53.9, 57.6, 61.2, 64.7, 66.2, 67.7, 68.5, 69.3, 70.1, 70.9, 71.7, 72.5, 73.4, 74.3, 75.2, 76.1, 77.0, 77.9, 78.9, 79.9, 80.9, 81.9, 82.9, 84.0, 85.0, 86.1, 87.2, 88.4, 89.5, 90.7, 91.8, 92.9, 93.9, 93.9 },
-		{2400, 22.5, 32.8, 41.0, 48.9, 52.7, 56.3, 59.8, 63.3, 64.7, 66.2, 67.0, 67.8, 68.6, 69.4, 70.2, 71.1, 71.9, 72.8, 73.7, 74.6, 75.5, 76.5, 77.5, 78.5, 79.5, 80.5, 81.5, 82.6, 83.7, 84.8, 86.0, 87.1, 88.3, 89.5, 90.7, 91.8, 92.7, 92.7 },
-		{2500, 23.4, 32.9, 40.5, 47.8, 51.4, 54.9, 58.3, 61.8, 63.3, 64.8, 65.5, 66.3, 67.1, 67.9, 68.8, 69.6, 70.5, 71.4, 72.3, 73.2, 74.1, 75.1, 76.1, 77.1, 78.1, 79.1, 80.2, 81.3, 82.4, 83.5, 84.7, 85.9, 87.1, 88.3, 89.5, 90.7, 91.6, 91.6 }
-	};
-
-static const double RHCLASS[4][8][2] = {
-		{{600, 630}, {700, 730}, {800, 830}, {900, 930}, {1000, 1030}, {1100, 1130}, {1159, 1200}, {1200, 1200}},
-		{{87, 3}   , {77, 3}   , {67, 3}   , {62, 3}   , {57, 3}     , {54.5, 3}   , {52, 3}     , {52, 3}     },
-		{{87, 2}   , {77, 2}   , {67, 2}   , {62, 2}   , {57, 2}     , {54.5, 2}   , {52, 2}     , {52, 2}     },
-		{{68, 1}   , {58, 1}   , {48, 1}   , {43, 1}   , {38, 1}     , {35.5, 1}   , {33, 1}     , {33, 1}     }
-	};
-
 /*--------------------------------------------------------------------------*/
 static double intrp(const double I1, const double I2, const double I3, const double I4, const double fraction, const WTimeSpan &ts) {
 					/*--------------------------------------------------------------------------*
@@ -583,7 +573,36 @@ double calc_hourly_ffmc_lawson_contiguous(double ff_ffmc_prev, double ff_ffmc_cu
 }
 
 
+const double *calc_el_table(const double latitude) {
+									// from Cordy 060203 over the phone - slight change from the stuff in the paper from NZ but provided by Marty
+									// Alexander
+	if (latitude >= DEGREE_TO_RADIAN(30.0))
+		return EL;
+	else if (latitude <= DEGREE_TO_RADIAN(-30.0))
+		return EL_NZ;
+	else if (latitude >= DEGREE_TO_RADIAN(10.0))
+		return EL_N20;
+	else if (latitude <= DEGREE_TO_RADIAN(-10.0))
+		return EL_S20;
+	return EL_EQ;
+}
+
+
+const double *calc_fl_table(const double latitude) {
+	if (latitude >= DEGREE_TO_RADIAN(10.0))
+		return FL;
+	else if (latitude <= DEGREE_TO_RADIAN(-10.0))
+		return FL_NZ;
+	return FL_EQ;
+}
+
+
 double calc_dmc(const double in_dmc, const double rain, double temperature, const double latitude, const double /*longitude*/, const std::uint16_t mm, double rh) {
+	return calc_dmc_el(in_dmc, rain, temperature, calc_el_table(latitude)[mm], rh);
+}
+
+
+double calc_dmc_el(const double in_dmc, const double rain, double temperature, const double el, double rh) {
 	if ((in_dmc < 0.0) || (temperature > 60.0) ||
 	    (rain < 0.0) || (rain > 600.0))
 		return -98;
@@ -594,27 +613,6 @@ double calc_dmc(const double in_dmc, const double rain, double temperature, cons
 	if (rh < 0.0)		rh = 0.0;
 	else if (rh > 1.0)	rh = 1.0;
 
-	static const double EL[12] =    { 6.5, 7.5, 9.0, 12.8, 13.9, 13.9, 12.4, 10.9, 9.4, 8.0, 7.0, 6.0 };
-	static const double EL_N20[12]= { 7.9, 8.4, 8.9, 9.5, 9.9, 10.2, 10.1, 9.7, 9.1, 8.6, 8.1, 7.8 };
-	static const double EL_EQ[12] = { 9.0, 9.0, 9.0, 9.0, 9.0, 9.0, 9.0, 9.0, 9.0, 9.0, 9.0, 9.0 };
-	static const double EL_S20[12]= { 10.1, 9.6, 9.1, 8.5, 8.1, 7.8, 7.9, 8.3, 8.9, 9.4, 9.9, 10.2 };
-	static const double EL_NZ[12] = { 11.5, 10.5, 9.2, 7.9, 6.8, 6.2, 6.5, 7.4, 8.7, 10.0, 11.2, 11.8 };
-
-	const double *el;
-									// from Cordy 060203 over the phone - slight change from the stuff in the paper from NZ but provided by Marty
-									// Alexander
-
-	if (latitude >= DEGREE_TO_RADIAN(30.0))
-		el = EL;
-	else if (latitude <= DEGREE_TO_RADIAN(-30.0))
-		el = EL_NZ;	
-	else if (latitude >= DEGREE_TO_RADIAN(10.0))
-		el = EL_N20;
-	else if (latitude <= DEGREE_TO_RADIAN(-10.0))
-		el = EL_S20;
-	else
-		el = EL_EQ;
-		
 	double po, rk, wmi, rw, b, wmr, pr ;
 	double c_d ;
 
@@ -623,7 +621,7 @@ double calc_dmc(const double in_dmc, const double rain, double temperature, cons
 	if (temperature < -1.1)
 		rk = 0.0;
 	else
-		rk = 1.894 * (temperature + 1.1) * (1.0 - rh) * el[mm] * 0.01;
+		rk = 1.894 * (temperature + 1.1) * (1.0 - rh) * el * 0.01;
 	if (rain > 1.5) {
 		rw = 0.92 * rain - 1.27;				// eqn 11
 		wmi = 20.0 + (exp(5.6348 - (po / 43.43)));		// eqn 12
@@ -650,6 +648,11 @@ double calc_dmc(const double in_dmc, const double rain, double temperature, cons
 
 //*********************** Drought Code *****************************************}
 double calc_dc(const double in_dc, double rain, double temperature, const double latitude, const double /*longitude*/, const std::uint16_t mm/* 0..11 */){
+	return calc_dc_fl(in_dc, rain, temperature, calc_fl_table(latitude)[mm]);
+}
+
+
+double calc_dc_fl(const double in_dc, double rain, double temperature, const double fl) {
 	if ((in_dc < 0.0) ||
 	    (rain < 0.0) || (rain > 600.0))
 		return -98;
@@ -659,24 +662,12 @@ double calc_dc(const double in_dc, double rain, double temperature, const double
 	else if (temperature > 60.0)
 		temperature = 60.0;
 
-	static const double FL[12]	= { -1.6, -1.6, -1.6, 0.9, 3.8, 5.8, 6.4, 5.0, 2.4, 0.4, -1.6, -1.6 };
-	static const double FL_EQ[12]	= { 1.4, 1.4, 1.4, 1.4, 1.4, 1.4, 1.4, 1.4, 1.4, 1.4, 1.4, 1.4 };
-	static const double FL_NZ[12]	= { 6.4, 5.0, 2.4, 0.4, -1.6, -1.6, -1.6, -1.6, -1.6, 0.9, 3.8, 5.8 };
-	const double *fl;
-
-	if (latitude >= DEGREE_TO_RADIAN(10.0))
-		fl = FL;
-	else if (latitude <= DEGREE_TO_RADIAN(-10.0))
-		fl = FL_NZ;
-	else
-		fl = FL_EQ;
-
 	double pe,dr,smi,c_d ;
 
 	if (temperature < -2.8)
 		temperature = -2.8;
 
-	pe = (0.36 * (temperature + 2.8) + fl[mm]) / 2.0;
+	pe = (0.36 * (temperature + 2.8) + fl) / 2.0;
 	if (rain <= 2.8) 
 		dr = in_dc;
 	else {
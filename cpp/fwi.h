@@ -30,11 +30,24 @@ double calc_previous_hourly_ffmc_vanwagner(const double current_ffmc,
 					   double ws);
 double calc_daily_ffmc_vanwagner(const double in_ffmc, const double rain, double temperature, const double rh, double ws);
 
+// the parts of the Van Wagner FFMC that depend only on the weather, see FWIWeatherIntermediates
+struct ffmc_weather {
+	double ed, ew;						// drying and wetting equilibrium moisture content
+	double k_dry, k_wet, k_wet_daily;			// log drying/wetting rates, before the temperature term
+	double temp_factor;					// exp(0.0365 * temperature)
+};
+void calc_ffmc_weather(double temperature, double rh, double ws, ffmc_weather *wx);
+double calc_subdaily_ffmc_vanwagner_wx(const WTimeSpan &ts, const double in_ffmc, const double rain, const ffmc_weather &wx);
+
 double calc_hourly_ffmc_lawson(double ff_ffmc, WTimeSpan ts, double rh);
 double calc_hourly_ffmc_lawson_contiguous(double ff_ffmc_prev, double ff_ffmc_curr, const WTimeSpan &ts, double rh_0, double rh_t, double rh_1, bool contiguous);
 
 double calc_dmc (const double in_dmc, const double rain, double temperature, const double latitude, const double longitude, const std::uint16_t mm, const double rh);// duff moisture code
 double calc_dc  (const double in_dc, double rain, double temperature, const double latitude, const double longitude, const std::uint16_t mm);		// drought code
+double calc_dmc_el(const double in_dmc, const double rain, double temperature, const double el, const double rh);	// as calc_dmc, with the month's day length factor already resolved
+double calc_dc_fl (const double in_dc, double rain, double temperature, const double fl);			// as calc_dc, with the month's day length factor already resolved
+const double *calc_el_table(const double latitude);							// built-in DMC day length factors (12 months) for a latitude
+const double *calc_fl_table(const double latitude);							// built-in DC day length factors (12 months) for a latitude
 
 double calc_ff  (const WTimeSpan &ts, const double ffmc);							// the ffmc func. from the ISI eq.
 double calc_isi (const WTimeSpan &ts, const double ffmc, const double ws, double *sf);			// initial spread index
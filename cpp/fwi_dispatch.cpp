@@ -0,0 +1,139 @@
+/**
+ * WISE_FWI_Module: fwi_dispatch.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fwi_kernels.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+
+namespace {
+
+enum class isa_level { generic = 0, sse42, avx2, avx512 };
+
+
+/*
+ * What the running CPU (and the OS, for the wider register files) supports.
+ */
+isa_level cpu_isa_level() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl") &&
+	    __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return isa_level::avx512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return isa_level::avx2;
+	if (__builtin_cpu_supports("sse4.2"))
+		return isa_level::sse42;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int r[4];
+	__cpuid(r, 0);
+	const int max_leaf = r[0];
+	__cpuid(r, 1);
+	const bool sse42 = (r[2] & (1 << 20)) != 0;
+	const bool fma = (r[2] & (1 << 12)) != 0;
+	const bool osxsave = (r[2] & (1 << 27)) != 0;
+	if (max_leaf >= 7 && osxsave) {
+		const unsigned long long xcr0 = _xgetbv(0);
+		__cpuidex(r, 7, 0);
+		const bool avx2 = (r[1] & (1 << 5)) != 0;
+		const bool avx512 = ((r[1] & (1 << 16)) != 0) && ((r[1] & (1 << 17)) != 0) &&		// F, DQ
+				    ((r[1] & (1 << 30)) != 0) && ((r[1] & (1u << 31)) != 0);		// BW, VL
+		if (avx512 && avx2 && fma && ((xcr0 & 0xe6) == 0xe6))
+			return isa_level::avx512;
+		if (avx2 && fma && ((xcr0 & 0x6) == 0x6))
+			return isa_level::avx2;
+	}
+	if (sse42)
+		return isa_level::sse42;
+#endif
+	return isa_level::generic;
+}
+
+
+const FwiKernelTable *table_for(isa_level level) {
+	switch (level) {
+#ifdef FWI_HAVE_ISA_AVX512
+	case isa_level::avx512:	return &fwi_kernels_avx512::table;
+#endif
+#ifdef FWI_HAVE_ISA_AVX2
+	case isa_level::avx2:	return &fwi_kernels_avx2::table;
+#endif
+#ifdef FWI_HAVE_ISA_SSE42
+	case isa_level::sse42:	return &fwi_kernels_sse42::table;
+#endif
+	default:		return nullptr;
+	}
+}
+
+
+const FwiKernelTable *select_kernels() {
+	isa_level level = cpu_isa_level();
+
+	const char *forced = std::getenv("FWI_ISA");
+	if (forced && *forced) {
+		isa_level requested = level;
+		if (!std::strcmp(forced, "generic"))		requested = isa_level::generic;
+		else if (!std::strcmp(forced, "sse4.2"))	requested = isa_level::sse42;
+		else if (!std::strcmp(forced, "avx2"))		requested = isa_level::avx2;
+		else if (!std::strcmp(forced, "avx512"))	requested = isa_level::avx512;
+		if (requested < level)
+			level = requested;
+	}
+
+	// walk down from the best the CPU can run until we find a variant that was built
+	for (int l = (int)level; l > (int)isa_level::generic; l--)
+		if (const FwiKernelTable *t = table_for((isa_level)l))
+			return t;
+	return &fwi_kernels_generic::table;
+}
+
+
+std::atomic<bool> &reproducible_mode() {
+	static std::atomic<bool> mode([] {
+		const char *requested = std::getenv("FWI_REPRODUCIBLE");
+		return requested && (!std::strcmp(requested, "1"));
+	}());
+	return mode;
+}
+
+}
+
+
+const FwiKernelTable &fwi_kernels() {
+	static const FwiKernelTable *kernels = select_kernels();
+	if (reproducible_mode().load(std::memory_order_relaxed))
+		return fwi_kernels_reproducible::table;
+	return *kernels;
+}
+
+
+bool fwi_reproducible() {
+	return reproducible_mode().load(std::memory_order_relaxed);
+}
+
+
+void fwi_set_reproducible(bool reproducible) {
+	reproducible_mode().store(reproducible);
+}
@@ -0,0 +1,862 @@
+/**
+ * WISE_FWI_Module: fwi_kernels.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This file is compiled once per instruction set (see CMakeLists.txt), with FWI_KERNEL_NS and FWI_KERNEL_NAME
+ * naming the variant, and once more for the reproducible mode, with FWI_KERNEL_REPRODUCIBLE defined, no instruction
+ * set flags and no floating point contraction.  Everything in it must stay in that namespace or have internal linkage, otherwise the
+ * linker is free to pick e.g. the AVX-512 copy of a helper for use by the generic code.
+ *
+ * The math follows the reference routines in fwi.cpp line for line - any change there needs to be made here too.
+ */
+
+#include <cmath>
+
+#include "fwi_kernels.h"
+#include "fwi_math.h"
+#include "fwi_tables.h"
+#include "FWIQuantized.h"
+
+#ifndef FWI_KERNEL_NS
+#define FWI_KERNEL_NS	fwi_kernels_generic
+#define FWI_KERNEL_NAME	"generic"
+#endif
+
+
+namespace FWI_KERNEL_NS {
+
+using namespace fwi_tables;
+
+// the reproducible copy takes its elementary functions from fwi_math rather than whichever the C library picks
+#ifdef FWI_KERNEL_REPRODUCIBLE
+namespace kmath = fwi_math;
+#else
+namespace kmath {
+	using std::exp;
+	using std::log;
+	using std::pow;
+	using std::sin;
+	using std::cos;
+}
+#endif
+
+namespace {
+
+inline double clamp(double v, double lo, double hi) {
+	return (v < lo) ? lo : ((v > hi) ? hi : v);
+}
+
+
+inline double ffmc_factor(std::int64_t seconds, double *hour_frac) {
+	double hf = (double)seconds / 60.0 / 60.0;
+	if (hour_frac)
+		*hour_frac = hf;
+	return ((hf - std::floor(hf)) > 1e-4) ? 147.27723 : 147.2;
+}
+
+
+inline double subdaily_ffmc(double in_ffmc, double rain, double temperature, double rh, double ws, double hour_frac, double factor) {
+	if ((in_ffmc < 0.0) || (in_ffmc > 101.0) || (rain < 0.0) || (rain > 300.0))
+		return -98.0;
+
+	temperature = clamp(temperature, -50.0, 60.0);
+	rh = clamp(rh, 0.0, 1.0);
+	ws = clamp(ws, 0.0, 200.0);
+
+	const double rhp = rh * 100.0;
+	double mo = factor * (101.0 - in_ffmc) / (59.5 + in_ffmc);
+	if (rain != 0)
+		mo += rain * 42.5 * kmath::exp(-100.0 / (251.0 - mo)) * (1.0 - kmath::exp(-6.93 / rain));
+	if (mo > 250.0)
+		mo = 250.0;
+
+	const double ed = 0.942 * kmath::pow(rhp, 0.679) + (11.0 * kmath::exp((rhp - 100.0) / 10.0)) + 0.18 * (21.1 - temperature) * (1.0 - kmath::exp(-0.115 * rhp));
+	const double moed = mo - ed;
+	const double ew = 0.618 * kmath::pow(rhp, 0.753) + (10.0 * kmath::exp((rhp - 100.0) / 10.0)) + 0.18 * (21.1 - temperature) * (1.0 - kmath::exp(-0.115 * rhp));
+	const double moew = mo - ew;
+
+	double xm;
+	if (moed == 0.0 || (moew >= 0.0 && moed < 0.0))
+		xm = mo;
+	else {
+		double a1, e, moe;
+		if (moed > 0.0) {
+			a1 = rh;
+			e = ed;
+			moe = moed;
+		}
+		else {
+			a1 = 1.0 - rh;
+			e = ew;
+			moe = moew;
+		}
+		double xkd = (0.424 * (1.0 - kmath::pow(a1, 1.7)) + (0.0694 * std::sqrt(ws) * (1.0 - kmath::pow(a1, 8.0))));
+		xkd = xkd * 0.0579 * kmath::exp(0.0365 * temperature);
+		xm = e + moe * kmath::pow(10.0, -xkd * hour_frac);
+	}
+
+	return clamp(59.5 * (250.0 - xm) / (factor + xm), 0.0, 101.0);
+}
+
+
+// subdaily_ffmc(), except that a cell without rain whose moisture content is already within 'tolerance' of the
+// equilibrium it would move towards keeps its moisture content, skipping the rate and the decay.  The full model
+// moves the moisture content from mo towards that equilibrium without passing it, so the fast path is never more
+// than 'tolerance' away in moisture content, or 59.5 * (250 + 147.27723) / 147.2^2 (< 1.091) times that in FFMC.
+inline double subdaily_ffmc_equilibrium(double in_ffmc, double rain, double temperature, double rh, double ws, double hour_frac, double factor, double tolerance, bool *converged) {
+	*converged = false;
+	if ((in_ffmc < 0.0) || (in_ffmc > 101.0) || (rain < 0.0) || (rain > 300.0))
+		return -98.0;
+
+	temperature = clamp(temperature, -50.0, 60.0);
+	rh = clamp(rh, 0.0, 1.0);
+	ws = clamp(ws, 0.0, 200.0);
+
+	const double rhp = rh * 100.0;
+	double mo = factor * (101.0 - in_ffmc) / (59.5 + in_ffmc);
+	if (rain != 0)
+		mo += rain * 42.5 * kmath::exp(-100.0 / (251.0 - mo)) * (1.0 - kmath::exp(-6.93 / rain));
+	if (mo > 250.0)
+		mo = 250.0;
+
+	// a drying cell never needs the wetting equilibrium
+	const double ed = 0.942 * kmath::pow(rhp, 0.679) + (11.0 * kmath::exp((rhp - 100.0) / 10.0)) + 0.18 * (21.1 - temperature) * (1.0 - kmath::exp(-0.115 * rhp));
+	const double moed = mo - ed;
+	double xm = mo;
+	if ((rain == 0) && (moed > 0.0) && (moed <= tolerance))
+		*converged = true;
+	else {
+		const double ew = 0.618 * kmath::pow(rhp, 0.753) + (10.0 * kmath::exp((rhp - 100.0) / 10.0)) + 0.18 * (21.1 - temperature) * (1.0 - kmath::exp(-0.115 * rhp));
+		const double moew = mo - ew;
+		if ((rain == 0) && (moew < 0.0) && (moew >= -tolerance) && (moed < 0.0))
+			*converged = true;
+		else if (!(moed == 0.0 || (moew >= 0.0 && moed < 0.0))) {
+			double a1, e, moe;
+			if (moed > 0.0) {
+				a1 = rh;
+				e = ed;
+				moe = moed;
+			}
+			else {
+				a1 = 1.0 - rh;
+				e = ew;
+				moe = moew;
+			}
+			double xkd = (0.424 * (1.0 - kmath::pow(a1, 1.7)) + (0.0694 * std::sqrt(ws) * (1.0 - kmath::pow(a1, 8.0))));
+			xkd = xkd * 0.0579 * kmath::exp(0.0365 * temperature);
+			xm = e + moe * kmath::pow(10.0, -xkd * hour_frac);
+		}
+	}
+
+	return clamp(59.5 * (250.0 - xm) / (factor + xm), 0.0, 101.0);
+}
+
+
+inline double daily_ffmc(double in_ffmc, double rain, double temperature, double rh, double ws) {
+	if ((in_ffmc < 0.0) || (in_ffmc > 101.0) || (rain < 0.0) || (rain > 600.0))
+		return -98.0;
+
+	temperature = clamp(temperature, -50.0, 60.0);
+	rh = clamp(rh, 0.0, 1.0);
+	ws = clamp(ws, 0.0, 200.0);
+
+	const double rhp = rh * 100.0;
+	double wmo = (147.2 * (101.0 - in_ffmc)) / (59.5 + in_ffmc);
+	if (rain > 0.5) {
+		const double rf = rain - 0.5;
+		if (wmo > 150.0) {
+			double tmp = (wmo - 150.0);
+			tmp = tmp * tmp;
+			wmo = wmo + 42.5 * rf * (kmath::exp(-100.0 / (251.0 - wmo))) * (1.0 - kmath::exp(-6.93 / rf)) + 0.0015 * tmp * std::sqrt(rf);
+		}
+		else	wmo = wmo + 42.5 * rf * (kmath::exp(-100.0 / (251.0 - wmo))) * (1.0 - kmath::exp(-6.93 / rf));
+	}
+	if (wmo > 250.0)
+		wmo = 250.0;
+
+	const double ed = 0.942 * kmath::pow(rhp, 0.679) + (11.0 * kmath::exp((rhp - 100.0) / 10.0)) + 0.18 * (21.1 - temperature) * (1.0 - kmath::exp(-0.115 * rhp));
+	const double ew = 0.618 * kmath::pow(rhp, 0.753) + (10.0 * kmath::exp((rhp - 100.0) / 10.0)) + 0.18 * (21.1 - temperature) * (1.0 - kmath::exp(-0.115 * rhp));
+
+	double wm;
+	if ((wmo < ed) && (wmo < ew)) {
+		const double k1 = 0.424 * (1.0 - kmath::pow((100.0 - rhp) / 100.0, 1.7)) + 0.0694 * std::sqrt(ws) * (1.0 - kmath::pow(1.0 - rh, 8.0));
+		const double kw = k1 * 0.581 * kmath::exp(0.0365 * temperature);
+		wm = ew - (ew - wmo) / kmath::pow(10.0, kw);
+	}
+	else if (wmo > ed) {
+		const double ko = 0.424 * (1.0 - kmath::pow(rh, 1.7)) + 0.0694 * std::sqrt(ws) * (1.0 - kmath::pow(rh, 8.0));
+		const double kd = ko * 0.581 * kmath::exp(0.0365 * temperature);
+		wm = ed + (wmo - ed) / kmath::pow(10.0, kd);
+	}
+	else
+		wm = wmo;
+
+	return clamp(59.5 * (250.0 - wm) / (147.2 + wm), 0.0, 101.0);
+}
+
+
+struct weather_terms {
+	double ed, ew, k_dry, k_wet, k_wet_daily, temp_factor;
+};
+
+
+inline weather_terms ffmc_weather(double temperature, double rh, double ws) {
+	temperature = clamp(temperature, -50.0, 60.0);
+	rh = clamp(rh, 0.0, 1.0);
+	ws = clamp(ws, 0.0, 200.0);
+
+	const double rhp = rh * 100.0;
+	const double e1 = kmath::exp((rhp - 100.0) / 10.0);
+	const double e2 = 0.18 * (21.1 - temperature) * (1.0 - kmath::exp(-0.115 * rhp));
+	const double sws = std::sqrt(ws);
+	weather_terms w;
+	w.ed = 0.942 * kmath::pow(rhp, 0.679) + (11.0 * e1) + e2;
+	w.ew = 0.618 * kmath::pow(rhp, 0.753) + (10.0 * e1) + e2;
+	w.k_dry = 0.424 * (1.0 - kmath::pow(rh, 1.7)) + 0.0694 * sws * (1.0 - kmath::pow(rh, 8.0));
+	w.k_wet = 0.424 * (1.0 - kmath::pow(1.0 - rh, 1.7)) + 0.0694 * sws * (1.0 - kmath::pow(1.0 - rh, 8.0));
+	w.k_wet_daily = 0.424 * (1.0 - kmath::pow((100.0 - rhp) / 100.0, 1.7)) + 0.0694 * sws * (1.0 - kmath::pow(1.0 - rh, 8.0));
+	w.temp_factor = kmath::exp(0.0365 * temperature);
+	return w;
+}
+
+
+inline weather_terms load_terms(const fwi_ffmc_weather &wx, std::size_t i) {
+	const weather_terms w = { wx.ed[i], wx.ew[i], wx.k_dry[i], wx.k_wet[i], wx.k_wet_daily[i], wx.temp_factor[i] };
+	return w;
+}
+
+
+// subdaily_ffmc() from precalculated weather terms
+inline double subdaily_ffmc_wx(double in_ffmc, double rain, const weather_terms &w, double hour_frac, double factor) {
+	if ((in_ffmc < 0.0) || (in_ffmc > 101.0) || (rain < 0.0) || (rain > 300.0))
+		return -98.0;
+
+	double mo = factor * (101.0 - in_ffmc) / (59.5 + in_ffmc);
+	if (rain != 0)
+		mo += rain * 42.5 * kmath::exp(-100.0 / (251.0 - mo)) * (1.0 - kmath::exp(-6.93 / rain));
+	if (mo > 250.0)
+		mo = 250.0;
+
+	const double moed = mo - w.ed, moew = mo - w.ew;
+	double xm;
+	if (moed == 0.0 || (moew >= 0.0 && moed < 0.0))
+		xm = mo;
+	else if (moed > 0.0)
+		xm = w.ed + moed * kmath::pow(10.0, -(w.k_dry * 0.0579 * w.temp_factor) * hour_frac);
+	else
+		xm = w.ew + moew * kmath::pow(10.0, -(w.k_wet * 0.0579 * w.temp_factor) * hour_frac);
+
+	return clamp(59.5 * (250.0 - xm) / (factor + xm), 0.0, 101.0);
+}
+
+
+// daily_ffmc() from precalculated weather terms
+inline double daily_ffmc_wx(double in_ffmc, double rain, const weather_terms &w) {
+	if ((in_ffmc < 0.0) || (in_ffmc > 101.0) || (rain < 0.0) || (rain > 600.0))
+		return -98.0;
+
+	double wmo = (147.2 * (101.0 - in_ffmc)) / (59.5 + in_ffmc);
+	if (rain > 0.5) {
+		const double rf = rain - 0.5;
+		if (wmo > 150.0) {
+			double tmp = (wmo - 150.0);
+			tmp = tmp * tmp;
+			wmo = wmo + 42.5 * rf * (kmath::exp(-100.0 / (251.0 - wmo))) * (1.0 - kmath::exp(-6.93 / rf)) + 0.0015 * tmp * std::sqrt(rf);
+		}
+		else	wmo = wmo + 42.5 * rf * (kmath::exp(-100.0 / (251.0 - wmo))) * (1.0 - kmath::exp(-6.93 / rf));
+	}
+	if (wmo > 250.0)
+		wmo = 250.0;
+
+	double wm;
+	if ((wmo < w.ed) && (wmo < w.ew))
+		wm = w.ew - (w.ew - wmo) / kmath::pow(10.0, w.k_wet_daily * 0.581 * w.temp_factor);
+	else if (wmo > w.ed)
+		wm = w.ed + (wmo - w.ed) / kmath::pow(10.0, w.k_dry * 0.581 * w.temp_factor);
+	else
+		wm = wmo;
+
+	return clamp(59.5 * (250.0 - wm) / (147.2 + wm), 0.0, 101.0);
+}
+
+
+// calc_previous_hourly_ffmc_vanwagner(), bisecting on the input FFMC with the weather terms held fixed
+inline double previous_hourly_ffmc(double current_ffmc, double rain, const weather_terms &w) {
+	const double tolerance = 0.0000001;
+	if ((current_ffmc < 0.0) || (current_ffmc > 101.0) || (rain < 0.0) || (rain > 300.0))
+		return -98.0;
+
+	double in_ffmc = current_ffmc;
+	double out_ffmc = subdaily_ffmc_wx(in_ffmc, rain, w, 1.0, 147.2);
+	double diff_mc = std::fabs(out_ffmc - current_ffmc);
+	while (diff_mc > tolerance) {
+		if (out_ffmc > current_ffmc)
+			in_ffmc -= diff_mc / 2;
+		else
+			in_ffmc += diff_mc / 2;
+
+		const double out_ffmc_prior = out_ffmc;
+		out_ffmc = subdaily_ffmc_wx(in_ffmc, rain, w, 1.0, 147.2);
+		diff_mc = std::fabs(out_ffmc - current_ffmc);
+		if ((out_ffmc < 0.0) || (out_ffmc > 101.0))
+			return current_ffmc;
+		if (std::fabs(out_ffmc - out_ffmc_prior) < tolerance)
+			break;
+	}
+	return in_ffmc;
+}
+
+
+inline double dmc(double in_dmc, double rain, double temperature, double el, double rh) {
+	if ((in_dmc < 0.0) || (temperature > 60.0) || (rain < 0.0) || (rain > 600.0))
+		return -98.0;
+
+	temperature = clamp(temperature, -50.0, 60.0);
+	rh = clamp(rh, 0.0, 1.0);
+
+	double rk, pr;
+	if (temperature < -1.1)
+		rk = 0.0;
+	else
+		rk = 1.894 * (temperature + 1.1) * (1.0 - rh) * el * 0.01;
+	if (rain > 1.5) {
+		const double rw = 0.92 * rain - 1.27;
+		const double wmi = 20.0 + (kmath::exp(5.6348 - (in_dmc / 43.43)));
+		double b;
+		if (in_dmc <= 33.0)
+			b = 100.0 / (0.5 + (0.3 * in_dmc));
+		else if (in_dmc > 65.0)
+			b = 6.2 * kmath::log(in_dmc) - 17.2;
+		else
+			b = 14.0 - 1.3 * kmath::log(in_dmc);
+		const double wmr = wmi + (1000.0 * rw) / (48.77 + b * rw);
+		pr = 43.43 * (5.6348 - kmath::log(wmr - 20.0));
+	}
+	else
+		pr = in_dmc;
+
+	if (pr < 0.0)
+		pr = 0.0;
+	const double c_d = pr + rk;
+	return (c_d < 0.0) ? 0.0 : c_d;
+}
+
+
+inline double dc(double in_dc, double rain, double temperature, double fl) {
+	if ((in_dc < 0.0) || (rain < 0.0) || (rain > 600.0))
+		return -98.0;
+
+	temperature = clamp(temperature, -2.8, 60.0);
+
+	const double pe = (0.36 * (temperature + 2.8) + fl) / 2.0;
+	double dr;
+	if (rain <= 2.8)
+		dr = in_dc;
+	else {
+		const double rw = 0.83 * rain - 1.27;
+		const double smi = 800.0 * kmath::exp(-in_dc / 400.0);
+		dr = in_dc - 400.0 * kmath::log(1.0 + ((3.937 * rw) / smi));
+		if (dr < 0.0)
+			dr = 0.0;
+	}
+	const double c_d = dr + pe;
+	return (c_d < 0.0) ? 0.0 : c_d;
+}
+
+
+inline double isi(double ffmc, double ws, double factor) {
+	const double fm = factor * (101.0 - ffmc) / (59.5 + ffmc);
+	const double sf = 91.9 * kmath::exp(fm * (-0.1386)) * (1.0 + kmath::pow(fm, 5.31) / 49300000.0);
+	return 0.208 * sf * kmath::exp(0.05039 * ws);
+}
+
+
+inline double bui(double dc, double dmc) {
+	double b;
+	if ((dmc == 0.0) || (dc == 0.0))
+		b = 0.0;
+	else	b = (0.8 * dc * dmc) / (dmc + 0.4 * dc);
+
+	if (b < dmc) {
+		const double p = (dmc - b) / dmc;
+		const double cc = 0.92 + kmath::pow(0.0114 * dmc, 1.7);
+		b = dmc - cc * p;
+		if (b < 0.0)
+			b = 0.0;
+	}
+	return b;
+}
+
+
+inline double fwi(double isi, double bui) {
+	double bb;
+	if (bui > 80.0)
+		bb = 0.1 * isi * (1000.0 / (25.0 + 108.64 / kmath::exp(0.023 * bui)));
+	else	bb = 0.1 * isi * (0.626 * kmath::pow(bui, 0.809) + 2.0);
+
+	if (bb <= 1.0)
+		return bb;
+	return kmath::exp(2.72 * kmath::pow(0.434 * kmath::log(bb), 0.647));
+}
+
+
+inline double dsr(double fwi) {
+	return 0.0272 * kmath::pow(fwi, 1.77);
+}
+
+
+/*
+ * Everything calc_hourly_ffmc_lawson() derives from the time of day, so that it's resolved once per batch rather
+ * than once per element.
+ */
+struct lawson_time {
+	bool morning;
+	int tindex;
+	double minutes;
+	double divisor;
+	double rh_high, rh_low;		// morning RH class thresholds
+};
+
+
+lawson_time lawson_resolve(std::int64_t seconds) {
+	lawson_time t;
+	while (seconds < 0)
+		seconds += 24 * 60 * 60;
+	const int hour = (int)((seconds / (60 * 60)) % 24);
+	const int minutes = (int)((seconds / 60) % 60);
+
+	t.minutes = minutes;
+	t.divisor = (hour == 11) ? 59.0 : 60.0;
+	t.morning = (hour >= 6) && (hour <= 11);
+	t.rh_high = t.rh_low = 0.0;
+	if (t.morning) {
+		int i = 0;
+		while ((100.0 * hour) >= RHCLASS[0][i][0])
+			i++;
+		t.tindex = i;
+		const int c = (minutes <= 30) ? (i - 1) : i;
+		t.rh_high = RHCLASS[1][c][0];
+		t.rh_low = RHCLASS[3][c][0];
+	}
+	else {
+		int hhmm = hour * 100 + minutes;
+		if (hhmm < 100)
+			hhmm += 2400;
+		int i = 1;
+		while (hhmm >= MAIN[i][0])
+			i++;
+		t.tindex = i - 1;
+	}
+	return t;
+}
+
+
+inline double lawson(const lawson_time &t, double ff_ffmc, double rh) {
+	if ((ff_ffmc < 0.0) || (ff_ffmc > 101.0))
+		return -98.0;
+	if (ff_ffmc < 17.5)
+		ff_ffmc = 17.5;
+
+	rh = clamp(rh, 0.0, 100.0);
+	rh = std::floor(rh * 100.0 + 0.5) * 0.01;
+	if (rh < 1.0)
+		rh = 95;
+
+	// all of the tables share the same FFMC header row, find the last column <= ff_ffmc
+	const double *hdr = MAIN[0];
+	int i = 1;
+	for (int step = 32; step; step >>= 1)
+		if ((i + step <= 38) && (hdr[i + step] <= ff_ffmc))
+			i += step;
+
+	const double (*tbl)[39];
+	if (t.morning) {
+		if (rh > t.rh_high)		tbl = H;
+		else if (rh < t.rh_low)		tbl = L;
+		else				tbl = M;
+	}
+	else					tbl = MAIN;
+
+	const double *r0 = tbl[t.tindex], *r1 = tbl[t.tindex + 1];
+	double i12, i34;
+	if (i == 38) {				// ff_ffmc == 101.0, where the reference routine's column search runs off the end of the row
+		i12 = r0[38];
+		i34 = r1[38];
+	}
+	else {
+		const double fraction = (ff_ffmc - hdr[i]) / (hdr[i + 1] - hdr[i]);
+		i12 = r0[i] + ((r0[i + 1] - r0[i]) * fraction);
+		i34 = r1[i] + ((r1[i + 1] - r1[i]) * fraction);
+	}
+	const double adjffmc = i12 + ((i34 - i12) / t.divisor) * t.minutes;
+	if (t.morning)
+		return adjffmc;
+	return clamp(adjffmc, 0.0, 101.0);
+}
+
+}
+
+
+static void daily_ffmc_vanwagner(std::size_t n, const double *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, double *ffmc) {
+	for (std::size_t i = 0; i < n; i++)
+		ffmc[i] = daily_ffmc(in_ffmc[i], rain[i], temperature[i], rh[i], ws[i]);
+}
+
+
+static void dmc_batch(std::size_t n, const double *in_dmc, const double *rain, const double *temperature, const double *el, const double *rh, double *out) {
+	for (std::size_t i = 0; i < n; i++)
+		out[i] = dmc(in_dmc[i], rain[i], temperature[i], el[i], rh[i]);
+}
+
+
+static void dc_batch(std::size_t n, const double *in_dc, const double *rain, const double *temperature, const double *fl, double *out) {
+	for (std::size_t i = 0; i < n; i++)
+		out[i] = dc(in_dc[i], rain[i], temperature[i], fl[i]);
+}
+
+
+/*
+ * One element of the daily chain.  If any of the FFMC, DMC or DC fail their range checks, the codes that depend on
+ * them are set to -98.
+ */
+static inline void daily_element(double in_ffmc, double in_dmc, double in_dc, double rain, double temperature, double rh, double ws, double el, double fl,
+    double isi_factor, double &f, double &p, double &d, double &b, double &s, double &w) {
+	f = daily_ffmc(in_ffmc, rain, temperature, rh, ws);
+	p = dmc(in_dmc, rain, temperature, el, rh);
+	d = dc(in_dc, rain, temperature, fl);
+	if ((f < 0.0) || (p < 0.0) || (d < 0.0)) {
+		b = s = w = -98.0;
+		return;
+	}
+	b = bui(d, p);
+	s = isi(f, ws, isi_factor);
+	w = fwi(s, b);
+}
+
+
+static void daily_chain(std::size_t n, const fwi_daily_inputs &in, const fwi_daily_outputs &out) {
+	const double isi_factor = ffmc_factor(24 * 60 * 60, nullptr);
+	for (std::size_t i = 0; i < n; i++) {
+		double f, p, d, b, s, w;
+		daily_element(in.in_ffmc[i], in.in_dmc[i], in.in_dc[i], in.rain[i], in.temperature[i], in.rh[i], in.ws[i], in.el[i], in.fl[i], isi_factor, f, p, d, b, s, w);
+		out.ffmc[i] = f;
+		out.dmc[i] = p;
+		out.dc[i] = d;
+		out.bui[i] = b;
+		out.isi[i] = s;
+		out.fwi[i] = w;
+		if (out.dsr)
+			out.dsr[i] = (w < 0.0) ? -98.0 : dsr(w);
+	}
+}
+
+
+static void daily_chain_q16(std::size_t n, const fwi_daily_inputs_q16 &in, const fwi_daily_outputs_q16 &out) {
+	const double isi_factor = ffmc_factor(24 * 60 * 60, nullptr);
+	for (std::size_t i = 0; i < n; i++) {
+		double f, p, d, b, s, w;
+		daily_element(FWIQuantized::Dequantize(FWICode::FFMC, in.in_ffmc[i]), FWIQuantized::DequantizeState(in.in_dmc[i]), FWIQuantized::DequantizeState(in.in_dc[i]),
+			in.rain[i], in.temperature[i], in.rh[i], in.ws[i], in.el[i], in.fl[i], isi_factor, f, p, d, b, s, w);
+		out.ffmc[i] = FWIQuantized::Quantize(FWICode::FFMC, f);
+		out.dmc[i] = FWIQuantized::QuantizeState(FWICode::DMC, p);
+		out.dc[i] = FWIQuantized::QuantizeState(FWICode::DC, d);
+		out.bui[i] = FWIQuantized::Quantize(FWICode::BUI, b);
+		out.isi[i] = FWIQuantized::Quantize(FWICode::ISI, s);
+		out.fwi[i] = FWIQuantized::Quantize(FWICode::FWI, w);
+		if (out.dsr)
+			out.dsr[i] = (w < 0.0) ? FWIQuantized::MISSING : FWIQuantized::Quantize(FWICode::DSR, dsr(w));
+	}
+}
+
+
+static void hourly_ffmc_vanwagner(std::size_t n, const double *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, std::int64_t seconds, double *ffmc) {
+	double hour_frac;
+	const double factor = ffmc_factor(seconds, &hour_frac);
+	for (std::size_t i = 0; i < n; i++)
+		ffmc[i] = subdaily_ffmc(in_ffmc[i], rain[i], temperature[i], rh[i], ws[i], hour_frac, factor);
+}
+
+
+static void hourly_ffmc_vanwagner_q16(std::size_t n, const std::uint16_t *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, std::int64_t seconds, std::uint16_t *ffmc) {
+	double hour_frac;
+	const double factor = ffmc_factor(seconds, &hour_frac);
+	for (std::size_t i = 0; i < n; i++)
+		ffmc[i] = FWIQuantized::Quantize(FWICode::FFMC, subdaily_ffmc(FWIQuantized::Dequantize(FWICode::FFMC, in_ffmc[i]), rain[i], temperature[i], rh[i], ws[i], hour_frac, factor));
+}
+
+
+static std::size_t hourly_ffmc_vanwagner_equilibrium(std::size_t n, const double *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, std::int64_t seconds, double tolerance, double *ffmc) {
+	// the compiler may contract the two copies of the model differently, so without a fast path the results come from the original
+	if (tolerance <= 0.0) {
+		hourly_ffmc_vanwagner(n, in_ffmc, rain, temperature, rh, ws, seconds, ffmc);
+		return 0;
+	}
+
+	double hour_frac;
+	const double factor = ffmc_factor(seconds, &hour_frac);
+	std::size_t converged = 0;
+	for (std::size_t i = 0; i < n; i++) {
+		bool c;
+		ffmc[i] = subdaily_ffmc_equilibrium(in_ffmc[i], rain[i], temperature[i], rh[i], ws[i], hour_frac, factor, tolerance, &c);
+		converged += c;
+	}
+	return converged;
+}
+
+
+static void hourly_ffmc_lawson(std::size_t n, const double *prev_ffmc, const double *curr_ffmc, std::int64_t seconds_into_day, const double *rh_0, const double *rh_t, const double *rh_1, bool contiguous, double *ffmc) {
+	const std::int64_t hour = 60 * 60;
+	if ((seconds_into_day < -12 * hour) || (seconds_into_day >= 35 * hour)) {
+		for (std::size_t i = 0; i < n; i++)
+			ffmc[i] = -98.0;
+		return;
+	}
+
+	// the same decisions as calc_hourly_ffmc_lawson_contiguous(), made once for the whole batch
+	if ((seconds_into_day >= 12 * hour) || (seconds_into_day <= 5 * hour) || (!contiguous) || (!(seconds_into_day % hour))) {
+		const lawson_time t = lawson_resolve(seconds_into_day);
+		const bool use_curr = (seconds_into_day >= 12 * hour);
+		const bool use_rh_0 = (!use_curr) && (seconds_into_day > 5 * hour) && contiguous;
+		const double *src = use_curr ? curr_ffmc : prev_ffmc;
+		const double *rh = use_rh_0 ? rh_0 : rh_t;
+		for (std::size_t i = 0; i < n; i++) {
+			if ((prev_ffmc[i] < 0.0) || (prev_ffmc[i] > 101.0) || (curr_ffmc[i] < 0.0) || (curr_ffmc[i] > 101.0))
+				ffmc[i] = -98.0;
+			else
+				ffmc[i] = lawson(t, src[i], rh[i] * 100.0);
+		}
+		return;
+	}
+
+	const std::int64_t h0 = seconds_into_day - (seconds_into_day % hour), h1 = h0 + hour;
+	const lawson_time t0 = lawson_resolve(h0), t1 = lawson_resolve(h1);
+	const double *src1 = (h1 == 12 * hour) ? curr_ffmc : prev_ffmc;
+	const double sec = (double)(seconds_into_day % hour);
+	for (std::size_t i = 0; i < n; i++) {
+		if ((prev_ffmc[i] < 0.0) || (prev_ffmc[i] > 101.0) || (curr_ffmc[i] < 0.0) || (curr_ffmc[i] > 101.0)) {
+			ffmc[i] = -98.0;
+			continue;
+		}
+		const double ffmc1 = lawson(t0, prev_ffmc[i], rh_0[i] * 100.0);
+		const double ffmc2 = lawson(t1, src1[i], rh_1[i] * 100.0);
+		ffmc[i] = ((ffmc2 * sec) + (ffmc1 * (60.0 * 60.0 - sec))) / (60.0 * 60.0);
+	}
+}
+
+
+/*
+ * lawson_resolve() for every minute of the day, which is all it depends on, packed small enough to stay in cache
+ * when every element of a batch has its own time of day.
+ */
+struct lawson_minute {
+	std::int8_t tindex;
+	std::int8_t rh_class;			// the RHCLASS column of the morning thresholds
+	bool morning;
+};
+
+
+static const lawson_minute *lawson_minutes() {
+	static const struct minutes_table {
+		lawson_minute m[24 * 60];
+
+		minutes_table() {
+			for (int i = 0; i < 24 * 60; i++) {
+				const lawson_time t = lawson_resolve((std::int64_t)i * 60);
+				m[i].tindex = (std::int8_t)t.tindex;
+				m[i].rh_class = (std::int8_t)((t.morning && ((i % 60) > 30)) ? t.tindex : (t.tindex - 1));
+				m[i].morning = t.morning;
+			}
+		}
+	} table;
+	return table.m;
+}
+
+
+// the same lawson_time as lawson_resolve(seconds)
+static inline lawson_time lawson_lookup(const lawson_minute *minutes, std::int64_t seconds) {
+	if (seconds < 0)
+		seconds += ((-seconds) / (24 * 60 * 60) + 1) * 24 * 60 * 60;
+	const int minute = (int)((seconds / 60) % (24 * 60));
+	const lawson_minute &m = minutes[minute];
+	lawson_time t;
+	t.morning = m.morning;
+	t.tindex = m.tindex;
+	t.minutes = minute % 60;
+	t.divisor = ((minute / 60) == 11) ? 59.0 : 60.0;
+	t.rh_high = m.morning ? RHCLASS[1][m.rh_class][0] : 0.0;
+	t.rh_low = m.morning ? RHCLASS[3][m.rh_class][0] : 0.0;
+	return t;
+}
+
+
+/*
+ * hourly_ffmc_lawson() with the time of day per element, for batches spanning time zones: each element makes the
+ * decisions the batch kernel makes once, picking its table row, its side of the noon switch and whether to
+ * interpolate from its own LST.
+ */
+static void hourly_ffmc_lawson_lst(std::size_t n, const double *prev_ffmc, const double *curr_ffmc, const std::int32_t *seconds_into_day, const double *rh_0, const double *rh_t, const double *rh_1, bool contiguous, double *ffmc) {
+	const std::int64_t hour = 60 * 60;
+	const lawson_minute *minutes = lawson_minutes();
+	for (std::size_t i = 0; i < n; i++) {
+		const std::int64_t seconds = seconds_into_day[i];
+		if ((seconds < -12 * hour) || (seconds >= 35 * hour) ||
+		    (prev_ffmc[i] < 0.0) || (prev_ffmc[i] > 101.0) || (curr_ffmc[i] < 0.0) || (curr_ffmc[i] > 101.0)) {
+			ffmc[i] = -98.0;
+			continue;
+		}
+
+		if ((seconds >= 12 * hour) || (seconds <= 5 * hour) || (!contiguous) || (!(seconds % hour))) {
+			const bool use_curr = (seconds >= 12 * hour);
+			const bool use_rh_0 = (!use_curr) && (seconds > 5 * hour) && contiguous;
+			ffmc[i] = lawson(lawson_lookup(minutes, seconds), use_curr ? curr_ffmc[i] : prev_ffmc[i], (use_rh_0 ? rh_0[i] : rh_t[i]) * 100.0);
+			continue;
+		}
+
+		const std::int64_t h0 = seconds - (seconds % hour), h1 = h0 + hour;
+		const double sec = (double)(seconds % hour);
+		const double ffmc1 = lawson(lawson_lookup(minutes, h0), prev_ffmc[i], rh_0[i] * 100.0);
+		const double ffmc2 = lawson(lawson_lookup(minutes, h1), (h1 == 12 * hour) ? curr_ffmc[i] : prev_ffmc[i], rh_1[i] * 100.0);
+		ffmc[i] = ((ffmc2 * sec) + (ffmc1 * (60.0 * 60.0 - sec))) / (60.0 * 60.0);
+	}
+}
+
+
+static void isi_batch(std::size_t n, const double *ffmc, const double *ws, std::int64_t seconds, double *out) {
+	const double factor = ffmc_factor(seconds, nullptr);
+	for (std::size_t i = 0; i < n; i++)
+		out[i] = isi(ffmc[i], ws[i], factor);
+}
+
+
+static void bui_batch(std::size_t n, const double *dc, const double *dmc, double *out) {
+	for (std::size_t i = 0; i < n; i++)
+		out[i] = bui(dc[i], dmc[i]);
+}
+
+
+static void fwi_batch(std::size_t n, const double *isi, const double *bui, double *out) {
+	for (std::size_t i = 0; i < n; i++)
+		out[i] = fwi(isi[i], bui[i]);
+}
+
+
+static void dsr_batch(std::size_t n, const double *fwi, double *out) {
+	for (std::size_t i = 0; i < n; i++)
+		out[i] = dsr(fwi[i]);
+}
+
+
+static void ffmc_weather_batch(std::size_t n, const double *temperature, const double *rh, const double *ws, double *ed, double *ew, double *k_dry, double *k_wet, double *k_wet_daily, double *temp_factor) {
+	for (std::size_t i = 0; i < n; i++) {
+		const weather_terms w = ffmc_weather(temperature[i], rh[i], ws[i]);
+		ed[i] = w.ed;
+		ew[i] = w.ew;
+		k_dry[i] = w.k_dry;
+		k_wet[i] = w.k_wet;
+		k_wet_daily[i] = w.k_wet_daily;
+		temp_factor[i] = w.temp_factor;
+	}
+}
+
+
+static void hourly_ffmc_vanwagner_wx(std::size_t n, const double *in_ffmc, const double *rain, const fwi_ffmc_weather &wx, std::int64_t seconds, double *ffmc) {
+	double hour_frac;
+	const double factor = ffmc_factor(seconds, &hour_frac);
+	for (std::size_t i = 0; i < n; i++)
+		ffmc[i] = subdaily_ffmc_wx(in_ffmc[i], rain[i], load_terms(wx, i), hour_frac, factor);
+}
+
+
+static void daily_ffmc_vanwagner_wx(std::size_t n, const double *in_ffmc, const double *rain, const fwi_ffmc_weather &wx, double *ffmc) {
+	for (std::size_t i = 0; i < n; i++)
+		ffmc[i] = daily_ffmc_wx(in_ffmc[i], rain[i], load_terms(wx, i));
+}
+
+
+static void previous_hourly_ffmc_vanwagner(std::size_t n, const double *current_ffmc, const double *rain, const fwi_ffmc_weather &wx, double *ffmc) {
+	for (std::size_t i = 0; i < n; i++)
+		ffmc[i] = previous_hourly_ffmc(current_ffmc[i], rain[i], load_terms(wx, i));
+}
+
+
+static void diurnal_weather(std::size_t n, double hour, const fwi_diurnal_day &day, double *temperature, double *rh, double *ws, double *rain) {
+	const double pi = 3.14159265358979323846;
+	for (std::size_t i = 0; i < n; i++) {
+		const double sunrise = day.sunrise[i], sunset = sunrise + day.day_length[i];
+		double shape;
+		if ((hour >= sunrise + fwi_diurnal::C) && (hour <= sunset))
+			shape = kmath::sin(pi * (hour - sunrise - fwi_diurnal::C) / (day.day_length[i] + 2.0 * fwi_diurnal::A));
+		else {
+			const double since_sunset = (hour > sunset) ? (hour - sunset) : (hour + 24.0 - sunset);
+			shape = day.sunset_shape[i] * kmath::exp(-fwi_diurnal::B * since_sunset / (24.0 - day.day_length[i]));
+		}
+
+		const double t = day.min_temperature[i] + day.temperature_range[i] * shape;
+		const double r = day.vapour_pressure[i] / (6.1078 * kmath::exp(17.27 * t / (t + 237.3)));
+		temperature[i] = t;
+		rh[i] = (r > 1.0) ? 1.0 : r;
+		ws[i] = day.min_ws[i] + day.ws_range[i] * shape;
+		rain[i] = day.rain[i];
+	}
+}
+
+
+/*
+ * Standard normal deviates from a counter based generator: each is Box-Muller applied to the two halves of the
+ * splitmix64 finalizer of (key, counter), so there's no state carried from one element to the next and any element
+ * can be generated on its own, in any order.
+ */
+static void normal_deviates(std::size_t n, std::uint64_t key, std::uint64_t first, double *z) {
+	const double two_pi = 6.28318530717958647692;
+	for (std::size_t i = 0; i < n; i++) {
+		std::uint64_t x = key + (first + i) * 0x9e3779b97f4a7c15ULL;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		x ^= x >> 31;
+		const double u1 = ((double)(std::uint32_t)(x >> 32) + 0.5) * (1.0 / 4294967296.0);	// (0..1)
+		const double u2 = (double)(std::uint32_t)x * (1.0 / 4294967296.0);
+		z[i] = std::sqrt(-2.0 * kmath::log(u1)) * kmath::cos(two_pi * u2);
+	}
+}
+
+
+extern const FwiKernelTable table = {
+	FWI_KERNEL_NAME,
+	daily_chain,
+	daily_chain_q16,
+	daily_ffmc_vanwagner,
+	dmc_batch,
+	dc_batch,
+	hourly_ffmc_vanwagner,
+	hourly_ffmc_vanwagner_q16,
+	hourly_ffmc_vanwagner_equilibrium,
+	hourly_ffmc_lawson,
+	hourly_ffmc_lawson_lst,
+	isi_batch,
+	bui_batch,
+	fwi_batch,
+	dsr_batch,
+	ffmc_weather_batch,
+	hourly_ffmc_vanwagner_wx,
+	daily_ffmc_vanwagner_wx,
+	previous_hourly_ffmc_vanwagner,
+	diurnal_weather,
+	normal_deviates
+};
+
+}
@@ -0,0 +1,183 @@
+/**
+ * WISE_FWI_Module: fwi_kernels.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+/*
+ * Batch (structure of arrays) versions of the routines in fwi.h.  Each kernel processes 'n' independent elements
+ * and writes the same values (including the -98 error code for out of range inputs) that the scalar routine
+ * would for each element, with one exception: the Lawson FFMC at ff_ffmc == 101, where the reference routine's
+ * column search runs off the end of its table row and reads past it, takes the row's last column instead, so its
+ * value is defined and needn't match the scalar routine's.
+ *
+ * fwi_kernels.cpp is compiled once per supported instruction set, each copy in its own namespace, and fwi_kernels()
+ * hands back the table for the best variant that the running CPU supports.  The variants are the same scalar loops
+ * built with different -m flags, so for now this is the scaffolding for dispatch rather than a speedup: the table
+ * lookups, branches and elementary functions keep the compiler from vectorizing much, and the generic variant runs
+ * within a few percent of the AVX-512 one.
+ */
+
+struct fwi_daily_inputs {
+	const double *in_ffmc;
+	const double *in_dmc;
+	const double *in_dc;
+	const double *rain;			// noon to noon, mm
+	const double *temperature;		// noon LST, Celsius
+	const double *rh;			// noon LST, [0..1]
+	const double *ws;			// noon LST, kph
+	const double *el;			// the month's DMC day length factors, see FWIRegionalFactors
+	const double *fl;			// the month's DC day length factors
+};
+
+struct fwi_daily_outputs {
+	double *ffmc;
+	double *dmc;
+	double *dc;
+	double *bui;
+	double *isi;
+	double *fwi;
+	double *dsr;				// may be NULL
+};
+
+/*
+ * As fwi_daily_inputs and fwi_daily_outputs, with the codes in FWIQuantized's fixed point forms: the FFMC and the
+ * reported codes in 16 bits, the DMC and DC state in 32.
+ */
+struct fwi_daily_inputs_q16 {
+	const std::uint16_t *in_ffmc;
+	const std::uint32_t *in_dmc;
+	const std::uint32_t *in_dc;
+	const double *rain;
+	const double *temperature;
+	const double *rh;
+	const double *ws;
+	const double *el;
+	const double *fl;
+};
+
+struct fwi_daily_outputs_q16 {
+	std::uint16_t *ffmc;
+	std::uint32_t *dmc;
+	std::uint32_t *dc;
+	std::uint16_t *bui;
+	std::uint16_t *isi;
+	std::uint16_t *fwi;
+	std::uint16_t *dsr;			// may be NULL
+};
+
+/*
+ * The parts of the Van Wagner FFMC that depend only on the (clamped) weather, calculated once per weather record by
+ * FwiKernelTable::ffmc_weather() and shared by the hourly, daily and back-cast FFMC kernels.  The rates are before
+ * the temperature term, which is kept separately so the hourly (0.0579) and daily (0.581) constants can be applied
+ * in the same order as the reference routines.  See FWIWeatherIntermediates.
+ */
+struct fwi_ffmc_weather {
+	const double *ed;				// drying equilibrium moisture content
+	const double *ew;				// wetting equilibrium moisture content
+	const double *k_dry;				// log drying rate
+	const double *k_wet;				// log wetting rate, hourly
+	const double *k_wet_daily;			// log wetting rate, daily (the daily FFMC rounds (1 - rh) differently)
+	const double *temp_factor;			// exp(0.0365 * temperature)
+};
+
+/*
+ * Per-cell parameters of one day's diurnal weather curves, set up by FWIDownscaler::SetDay().  Temperature follows
+ * Parton and Logan (1981): a sine from just before sunrise to sunset, then an exponential decay through the night.
+ * The 'shape' of that curve (0 at the daily minimum, 1 at the maximum) also drives the wind speed, and RH follows
+ * from holding the day's vapour pressure constant.
+ */
+namespace fwi_diurnal {
+	const double A = 1.86;			// lag of the maximum temperature after solar noon, hours
+	const double B = 2.20;			// night time decay coefficient
+	const double C = -0.17;			// lag of the minimum temperature after sunrise, hours
+}
+
+struct fwi_diurnal_day {
+	const double *sunrise;			// hours LST
+	const double *day_length;		// hours, (0..24)
+	const double *sunset_shape;		// value of the day time curve at sunset
+	const double *min_temperature;		// Celsius
+	const double *temperature_range;	// Celsius
+	const double *vapour_pressure;		// hPa
+	const double *min_ws;			// kph
+	const double *ws_range;			// kph
+	const double *rain;			// mm per hour
+};
+
+struct FwiKernelTable {
+	const char *name;
+
+	void (*daily_chain)(std::size_t n, const fwi_daily_inputs &in, const fwi_daily_outputs &out);
+	void (*daily_chain_q16)(std::size_t n, const fwi_daily_inputs_q16 &in, const fwi_daily_outputs_q16 &out);
+	void (*daily_ffmc_vanwagner)(std::size_t n, const double *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, double *ffmc);
+	void (*dmc)(std::size_t n, const double *in_dmc, const double *rain, const double *temperature, const double *el, const double *rh, double *dmc);
+	void (*dc)(std::size_t n, const double *in_dc, const double *rain, const double *temperature, const double *fl, double *dc);
+
+	void (*hourly_ffmc_vanwagner)(std::size_t n, const double *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, std::int64_t seconds, double *ffmc);
+	void (*hourly_ffmc_vanwagner_q16)(std::size_t n, const std::uint16_t *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, std::int64_t seconds, std::uint16_t *ffmc);
+	std::size_t (*hourly_ffmc_vanwagner_equilibrium)(std::size_t n, const double *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, std::int64_t seconds, double tolerance, double *ffmc);	// returns the number of elements that took the fast path
+	void (*hourly_ffmc_lawson)(std::size_t n, const double *prev_ffmc, const double *curr_ffmc, std::int64_t seconds_into_day, const double *rh_0, const double *rh_t, const double *rh_1, bool contiguous, double *ffmc);	// rh's are fractions ([0..1])
+	void (*hourly_ffmc_lawson_lst)(std::size_t n, const double *prev_ffmc, const double *curr_ffmc, const std::int32_t *seconds_into_day, const double *rh_0, const double *rh_t, const double *rh_1, bool contiguous, double *ffmc);	// as hourly_ffmc_lawson, with each element's own LST
+
+	void (*isi)(std::size_t n, const double *ffmc, const double *ws, std::int64_t seconds, double *isi);
+	void (*bui)(std::size_t n, const double *dc, const double *dmc, double *bui);
+	void (*fwi)(std::size_t n, const double *isi, const double *bui, double *fwi);
+	void (*dsr)(std::size_t n, const double *fwi, double *dsr);
+
+	void (*ffmc_weather)(std::size_t n, const double *temperature, const double *rh, const double *ws, double *ed, double *ew, double *k_dry, double *k_wet, double *k_wet_daily, double *temp_factor);
+	void (*hourly_ffmc_vanwagner_wx)(std::size_t n, const double *in_ffmc, const double *rain, const fwi_ffmc_weather &wx, std::int64_t seconds, double *ffmc);
+	void (*daily_ffmc_vanwagner_wx)(std::size_t n, const double *in_ffmc, const double *rain, const fwi_ffmc_weather &wx, double *ffmc);
+	void (*previous_hourly_ffmc_vanwagner)(std::size_t n, const double *current_ffmc, const double *rain, const fwi_ffmc_weather &wx, double *ffmc);
+
+	void (*diurnal_weather)(std::size_t n, double hour, const fwi_diurnal_day &day, double *temperature, double *rh, double *ws, double *rain);	// hour is LST, rh is a fraction
+
+	void (*normal_deviates)(std::size_t n, std::uint64_t key, std::uint64_t first, double *z);	// z[i] is a function of (key, first + i) alone
+};
+
+namespace fwi_kernels_generic { extern const FwiKernelTable table; }
+#ifdef FWI_HAVE_ISA_SSE42
+namespace fwi_kernels_sse42 { extern const FwiKernelTable table; }
+#endif
+#ifdef FWI_HAVE_ISA_AVX2
+namespace fwi_kernels_avx2 { extern const FwiKernelTable table; }
+#endif
+#ifdef FWI_HAVE_ISA_AVX512
+namespace fwi_kernels_avx512 { extern const FwiKernelTable table; }
+#endif
+// the generic kernels built without contraction and on fwi_math, always built (see fwi_reproducible())
+namespace fwi_kernels_reproducible { extern const FwiKernelTable table; }
+
+/*
+ * Returns the kernel table selected for this process.  The selection is made once, on first use, from the CPU's
+ * capabilities.  The FWI_ISA environment variable ("generic", "sse4.2", "avx2", "avx512") can be used to force a
+ * lower variant for testing; requests for a variant that wasn't built or that the CPU can't run are ignored.  While
+ * the reproducible mode is selected, the reproducible table is returned whatever the CPU.
+ */
+const FwiKernelTable &fwi_kernels();
+
+/*
+ * Whether fwi_kernels() hands back the reproducible table instead, and the code around the kernels uses fwi_math
+ * rather than the system's libm (see CCWFGM_FWI::SetKernelMode()).  It starts out set if the FWI_REPRODUCIBLE
+ * environment variable is "1".
+ */
+bool fwi_reproducible();
+void fwi_set_reproducible(bool reproducible);
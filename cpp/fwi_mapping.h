@@ -0,0 +1,81 @@
+/**
+ * WISE_FWI_Module: fwi_mapping.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class FWITiledFile;
+
+
+/*
+ * A memory mapped range of an open FWITiledFile.  The range needn't be page aligned, map() aligns it down and data()
+ * points at the first byte asked for.  Mappings are unmapped on destruction, and should be released before the file
+ * is closed.
+ */
+class fwi_mapping {
+public:
+	fwi_mapping() : m_base(nullptr), m_data(nullptr), m_bytes(0), m_writable(false) { }
+	~fwi_mapping() { unmap(); }
+	fwi_mapping(const fwi_mapping &) = delete;
+	fwi_mapping &operator=(const fwi_mapping &) = delete;
+
+	bool map(const FWITiledFile &file, std::uint64_t offset, std::size_t bytes, bool writable);
+	void unmap();
+
+	void *data() const { return m_data; }
+	std::size_t bytes() const { return m_bytes; }
+
+	// asks the OS to start reading the range in now, rather than a page fault at a time
+	void prefetch();
+	// starts writing modified pages back without waiting for them
+	void flush();
+
+private:
+	void *m_base;					// start of the mapping, aligned down from the offset asked for
+	void *m_data;
+	std::size_t m_bytes;				// bytes mapped from m_base
+	bool m_writable;
+};
+
+
+/*
+ * Named shared memory, mapped whole and read/write, for small control structures shared between processes.
+ */
+class fwi_shared_region {
+public:
+	fwi_shared_region() : m_handle(-1), m_data(nullptr), m_bytes(0) { }
+	~fwi_shared_region() { close(); }
+	fwi_shared_region(const fwi_shared_region &) = delete;
+	fwi_shared_region &operator=(const fwi_shared_region &) = delete;
+
+	// creates (or replaces) zero filled memory
+	bool create(const char *name, std::size_t bytes);
+	bool open(const char *name);
+	void close();
+	static bool unlink(const char *name);
+
+	void *data() const { return m_data; }
+	std::size_t bytes() const { return m_bytes; }
+
+private:
+	std::intptr_t m_handle;
+	void *m_data;
+	std::size_t m_bytes;
+};
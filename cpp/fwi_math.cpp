@@ -0,0 +1,332 @@
+/**
+ * WISE_FWI_Module: fwi_math.cpp
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Ported from fdlibm (Sun Microsystems, freely distributable), keeping its constants and order of operations.  Only
+ * std::frexp(), std::ldexp() (for subnormals), std::floor() and std::sqrt() are taken from the C library, all of which
+ * IEEE 754 defines exactly.
+ */
+
+#include "fwi_math.h"
+#include "fwi_kernels.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+
+namespace {
+
+const double LN2_HI = 6.93147180369123816490e-01;		// the top 32 bits of ln(2), so k * LN2_HI is exact
+const double LN2_LO = 1.90821492927058770002e-10;
+const double INV_LN2 = 1.44269504088896338700e+00;
+
+const double EXP_OVERFLOW = 7.09782712893383973096e+02;
+const double EXP_UNDERFLOW = -7.45133219101941108420e+02;
+const double P1 = 1.66666666666666019037e-01;
+const double P2 = -2.77777777770155933842e-03;
+const double P3 = 6.61375632143793436117e-05;
+const double P4 = -1.65339022054652515390e-06;
+const double P5 = 4.13813679705723846039e-08;
+
+const double LG1 = 6.666666666666735130e-01;
+const double LG2 = 3.999999999940941908e-01;
+const double LG3 = 2.857142874366239149e-01;
+const double LG4 = 2.222219843214978396e-01;
+const double LG5 = 1.818357216161805012e-01;
+const double LG6 = 1.531383769920937332e-01;
+const double LG7 = 1.479819860511658591e-01;
+const double SQRT_HALF = 7.07106781186547524401e-01;
+
+const double S1 = -1.66666666666666324348e-01;
+const double S2 = 8.33333333332248946124e-03;
+const double S3 = -1.98412698298579493134e-04;
+const double S4 = 2.75573137070700676789e-06;
+const double S5 = -2.50507602534068634195e-08;
+const double S6 = 1.58969099521155010221e-10;
+
+const double C1 = 4.16666666666666019037e-02;
+const double C2 = -1.38888888888741095749e-03;
+const double C3 = 2.48015872894767294178e-05;
+const double C4 = -2.75573143513906633035e-07;
+const double C5 = 2.08757232129817482790e-09;
+const double C6 = -1.13596475577881948265e-11;
+
+const double INV_PIO2 = 6.36619772367581382433e-01;
+const double PIO2_1 = 1.57079632673412561417e+00;		// the first 33 bits of pi/2
+const double PIO2_2 = 6.07710050630396597660e-11;		// the next 33
+const double PIO2_2T = 2.02226624879595063154e-21;		// pi/2 - PIO2_1 - PIO2_2
+
+const double PIO2_HI = 1.57079632679489655800e+00;
+const double PIO2_LO = 6.12323399573676603587e-17;
+const double PS0 = 1.66666666666666657415e-01;
+const double PS1 = -3.25565818622400915405e-01;
+const double PS2 = 2.01212532134862925881e-01;
+const double PS3 = -4.00555345006794114027e-02;
+const double PS4 = 7.91534994289814532176e-04;
+const double PS5 = 3.47933107596021167570e-05;
+const double QS1 = -2.40339491173441421878e+00;
+const double QS2 = 2.02094576023350569471e+00;
+const double QS3 = -6.88283971605453293030e-01;
+const double QS4 = 7.70381505559019352791e-02;
+
+
+inline double quiet_nan() {
+	return std::numeric_limits<double>::quiet_NaN();
+}
+
+
+inline double infinity() {
+	return std::numeric_limits<double>::infinity();
+}
+
+
+// sin(x + y) for |x + y| <= pi/4, y the tail of x
+inline double kernel_sin(double x, double y) {
+	const double z = x * x, w = z * z;
+	const double r = S2 + z * (S3 + z * S4) + z * w * (S5 + z * S6);
+	const double v = z * x;
+	return x - ((z * (0.5 * y - v * r) - y) - v * S1);
+}
+
+
+// cos(x + y) for |x + y| <= pi/4
+inline double kernel_cos(double x, double y) {
+	const double z = x * x, w = z * z;
+	const double r = z * (C1 + z * (C2 + z * C3)) + w * w * (C4 + z * (C5 + z * C6));
+	const double hz = 0.5 * z;
+	const double v = 1.0 - hz;
+	return v + (((1.0 - v) - hz) + (z * r - x * y));
+}
+
+
+// x - n * pi/2 as y + *tail, |y| <= pi/4, with pi/2 to 118 bits.  Exact enough for |x| up to 2^20 * pi/2, larger
+// arguments lose accuracy (but not reproducibility).
+inline double reduce(double x, double *tail, int *n) {
+	const double fn = std::floor(x * INV_PIO2 + 0.5);
+	double r = x - fn * PIO2_1;
+	double w = fn * PIO2_2;
+	const double t = r;
+	r = t - w;
+	w = fn * PIO2_2T - ((t - r) - w);
+	const double y = r - w;
+	*tail = (r - y) - w;
+	*n = (int)((std::int64_t)fn & 3);
+	return y;
+}
+
+
+inline std::uint64_t to_bits(double x) {
+	std::uint64_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return bits;
+}
+
+
+inline double from_bits(std::uint64_t bits) {
+	double x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+
+inline double clear_low_word(double x) {
+	return from_bits(to_bits(x) & 0xffffffff00000000ULL);
+}
+
+
+inline double acos_rational(double z) {
+	const double p = z * (PS0 + z * (PS1 + z * (PS2 + z * (PS3 + z * (PS4 + z * PS5)))));
+	const double q = 1.0 + z * (QS1 + z * (QS2 + z * (QS3 + z * QS4)));
+	return p / q;
+}
+
+
+double libm_exp(double x)		{ return std::exp(x); }
+double libm_log(double x)		{ return std::log(x); }
+double libm_pow(double x, double y)	{ return std::pow(x, y); }
+double libm_sin(double x)		{ return std::sin(x); }
+double libm_cos(double x)		{ return std::cos(x); }
+double libm_tan(double x)		{ return std::tan(x); }
+double libm_acos(double x)		{ return std::acos(x); }
+
+const fwi_math_table libm_table = { libm_exp, libm_log, libm_pow, libm_sin, libm_cos, libm_tan, libm_acos };
+const fwi_math_table pinned_table = { fwi_math::exp, fwi_math::log, fwi_math::pow, fwi_math::sin, fwi_math::cos, fwi_math::tan, fwi_math::acos };
+
+}
+
+
+double fwi_math::exp(double x) {
+	if (x != x)
+		return x;
+	if (x > EXP_OVERFLOW)
+		return infinity();
+	if (x < EXP_UNDERFLOW)
+		return 0.0;
+
+	// x = k * ln(2) + r, |r| <= ln(2) / 2, with r carried as hi - lo
+	const int k = (int)(x * INV_LN2 + ((x < 0.0) ? -0.5 : 0.5));
+	const double hi = x - k * LN2_HI, lo = k * LN2_LO;
+	const double r = hi - lo;
+	const double t = r * r;
+	const double c = r - t * (P1 + t * (P2 + t * (P3 + t * (P4 + t * P5))));
+	const double y = 1.0 - ((lo - (r * c) / (2.0 - c)) - hi);
+	// 2^k directly where it's a normal number, so the product is exact
+	if ((k >= -1022) && (k <= 1023))
+		return y * from_bits((std::uint64_t)(k + 1023) << 52);
+	return std::ldexp(y, k);
+}
+
+
+double fwi_math::log(double x) {
+	if (x != x)
+		return x;
+	if (x < 0.0)
+		return quiet_nan();
+	if (x == 0.0)
+		return -infinity();
+	if (x == infinity())
+		return x;
+
+	// x = 2^k * (1 + f), sqrt(2) / 2 <= 1 + f < sqrt(2), the exponent read straight from the bits of normal numbers
+	int k;
+	double m;
+	const std::uint64_t bits = to_bits(x);
+	if (bits >= 0x0010000000000000ULL) {
+		k = (int)(bits >> 52) - 1022;
+		m = from_bits((bits & 0x000fffffffffffffULL) | 0x3fe0000000000000ULL);
+	}
+	else
+		m = std::frexp(x, &k);
+	if (m < SQRT_HALF) {
+		m *= 2.0;
+		k--;
+	}
+	const double f = m - 1.0, dk = (double)k;
+	const double s = f / (2.0 + f);
+	const double z = s * s, w = z * z;
+	const double t1 = w * (LG2 + w * (LG4 + w * LG6));
+	const double t2 = z * (LG1 + w * (LG3 + w * (LG5 + w * LG7)));
+	const double r = t2 + t1;
+	const double hfsq = 0.5 * f * f;
+	return dk * LN2_HI - ((hfsq - (s * (hfsq + r) + dk * LN2_LO)) - f);
+}
+
+
+double fwi_math::pow(double x, double y) {
+	if ((y == 0.0) || (x == 1.0))
+		return 1.0;
+	if ((x != x) || (y != y))
+		return quiet_nan();
+	if (x < 0.0) {
+		if (std::floor(y) != y)
+			return quiet_nan();
+		const double r = pow(-x, y);
+		return (std::floor(y * 0.5) != y * 0.5) ? -r : r;
+	}
+	if (x == 0.0)
+		return (y > 0.0) ? 0.0 : infinity();
+	if (x == infinity())
+		return (y > 0.0) ? infinity() : 0.0;
+	// small whole powers (the codes' x^8) by squaring, which is faster and no less accurate
+	if ((y >= -64.0) && (y <= 64.0) && (std::floor(y) == y)) {
+		unsigned n = (unsigned)((y < 0.0) ? -y : y);
+		double r = 1.0, b = x;
+		for (; n; n >>= 1) {
+			if (n & 1)
+				r *= b;
+			b *= b;
+		}
+		return (y < 0.0) ? (1.0 / r) : r;
+	}
+	return exp(y * log(x));
+}
+
+
+double fwi_math::sin(double x) {
+	if ((x != x) || (x == infinity()) || (x == -infinity()))
+		return quiet_nan();
+	double tail;
+	int n;
+	const double y = reduce(x, &tail, &n);
+	switch (n) {
+	case 0:		return kernel_sin(y, tail);
+	case 1:		return kernel_cos(y, tail);
+	case 2:		return -kernel_sin(y, tail);
+	default:	return -kernel_cos(y, tail);
+	}
+}
+
+
+double fwi_math::cos(double x) {
+	if ((x != x) || (x == infinity()) || (x == -infinity()))
+		return quiet_nan();
+	double tail;
+	int n;
+	const double y = reduce(x, &tail, &n);
+	switch (n) {
+	case 0:		return kernel_cos(y, tail);
+	case 1:		return -kernel_sin(y, tail);
+	case 2:		return -kernel_cos(y, tail);
+	default:	return kernel_sin(y, tail);
+	}
+}
+
+
+double fwi_math::tan(double x) {
+	if ((x != x) || (x == infinity()) || (x == -infinity()))
+		return quiet_nan();
+	double tail;
+	int n;
+	const double y = reduce(x, &tail, &n);
+	const double s = kernel_sin(y, tail), c = kernel_cos(y, tail);
+	return (n & 1) ? (-c / s) : (s / c);
+}
+
+
+double fwi_math::acos(double x) {
+	if (x != x)
+		return x;
+	if (x >= 1.0)
+		return (x == 1.0) ? 0.0 : quiet_nan();
+	if (x <= -1.0)
+		return (x == -1.0) ? (2.0 * PIO2_HI + 2.0 * PIO2_LO) : quiet_nan();
+
+	if ((x < 0.5) && (x > -0.5)) {
+		const double r = acos_rational(x * x);
+		return PIO2_HI - (x - (PIO2_LO - x * r));
+	}
+	if (x < 0.0) {
+		const double z = (1.0 + x) * 0.5;
+		const double s = std::sqrt(z);
+		const double w = acos_rational(z) * s - PIO2_LO;
+		return 2.0 * PIO2_HI - 2.0 * (s + w);
+	}
+	const double z = (1.0 - x) * 0.5;
+	const double s = std::sqrt(z);
+	const double df = clear_low_word(s);
+	const double c = (z - df * df) / (s + df);
+	const double w = acos_rational(z) * s + c;
+	return 2.0 * (df + w);
+}
+
+
+const fwi_math_table &fwi_math_functions() {
+	return fwi_reproducible() ? pinned_table : libm_table;
+}
@@ -0,0 +1,58 @@
+/**
+ * WISE_FWI_Module: fwi_math.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+
+/*
+ * The elementary functions used by the reproducible kernel mode (see CCWFGM_FWI::SetKernelMode()), written out with
+ * nothing but IEEE additions, multiplications, divisions and square roots so that they give the same bits on every
+ * CPU and every C library.  The system's libm is free to pick an FMA or vector implementation depending on the CPU
+ * it finds itself on, and isn't correctly rounded, so it can't promise that.
+ *
+ * The algorithms are fdlibm's: exp, log, sin, cos and acos are within an ulp of the exact result and tan within two.
+ * pow is exp(y * log(x)) (or repeated squaring for small whole powers), so its error grows with |y * log(x)|: up to
+ * about 50 ulps (1e-14 relative) for the largest the codes use, ISI's fm^5.31.  fwi_math.cpp must be compiled without
+ * floating point contraction (-ffp-contract=off), as must anything calling these that has to reproduce.
+ */
+namespace fwi_math {
+	double exp(double x);
+	double log(double x);
+	double pow(double x, double y);
+	double sin(double x);
+	double cos(double x);
+	double tan(double x);
+	double acos(double x);
+}
+
+
+/*
+ * The same functions, either the ones above or the system's, for the code outside the kernels to call: the
+ * reproducible set while that kernel mode is selected, the system's otherwise.
+ */
+struct fwi_math_table {
+	double (*exp)(double x);
+	double (*log)(double x);
+	double (*pow)(double x, double y);
+	double (*sin)(double x);
+	double (*cos)(double x);
+	double (*tan)(double x);
+	double (*acos)(double x);
+};
+
+const fwi_math_table &fwi_math_functions();
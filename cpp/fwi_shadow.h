@@ -0,0 +1,107 @@
+/**
+ * WISE_FWI_Module: fwi_shadow.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "FWIShadow.h"
+#include "fwi_kernels.h"
+
+#include <algorithm>
+#include <atomic>
+
+
+/*
+ * The batch paths' side of FWIShadow: after a batch is calculated, fwi_shadow() picks out the elements to sample and
+ * has 'fill' copy each one's inputs and outputs into a fwi_shadow_sample, which are queued for the background thread.
+ */
+
+enum class fwi_shadow_kernel : std::uint8_t {
+	HOURLY_FFMC_VANWAGNER,		// in: in_ffmc, rain, temperature, rh, ws
+	HOURLY_FFMC_VANWAGNER_EQUILIBRIUM,	// in: as above, tolerance
+	HOURLY_FFMC_VANWAGNER_QUANTIZED,	// in: as above, the FFMC dequantized, out: dequantized
+	HOURLY_FFMC_VANWAGNER_PREVIOUS,	// in: current_ffmc, rain, temperature, rh, ws
+	HOURLY_FFMC_LAWSON,		// in: prev, curr, rh_0, rh_t, rh_1, flag is contiguous
+	ISI,				// in: ffmc, ws
+	BUI,				// in: dc, dmc
+	FWI,				// in: isi, bui
+	DAILY,				// in: fwi_daily_inputs, out: ffmc, dmc, dc, bui, isi, fwi, dsr, flag is whether dsr was calculated
+	QUANTIZED_DAILY			// as DAILY, dequantized
+};
+
+struct fwi_shadow_sample {
+	fwi_shadow_kernel kernel;
+	bool flag;
+	std::int64_t seconds;
+	double in[FWIShadowSample::INPUTS];
+	double out[7];
+};
+
+
+// read with a relaxed load by every batch, see FWIShadow.cpp
+extern std::atomic<bool> fwi_shadow_active;
+// looks at the environment the first time, then whether a session is running
+bool fwi_shadow_begin();
+// the number of elements to skip before the next sample, on the calling thread's generator, or UINT64_MAX once the session has ended
+std::uint64_t fwi_shadow_skip();
+// the calling thread's elements still to skip, carried from one batch to the next
+std::uint64_t &fwi_shadow_pending();
+void fwi_shadow_submit(const fwi_shadow_sample *samples, std::uint32_t count);
+
+
+template <typename F>
+inline void fwi_shadow(std::uint32_t count, F fill) {
+	if ((!fwi_shadow_active.load(std::memory_order_relaxed)) || (!fwi_shadow_begin()))
+		return;
+
+	const std::uint32_t block = 32;
+	fwi_shadow_sample samples[block];
+	std::uint32_t n = 0;
+	std::uint64_t &pending = fwi_shadow_pending();
+	std::uint64_t i = pending;
+	while (i < count) {
+		fill((std::uint32_t)i, samples[n]);
+		if (++n == block) {
+			fwi_shadow_submit(samples, n);
+			n = 0;
+		}
+		const std::uint64_t skip = fwi_shadow_skip();
+		if (skip == UINT64_MAX) {
+			n = 0;
+			i = count;
+			break;
+		}
+		i += skip + 1;
+	}
+	pending = i - count;
+	if (n)
+		fwi_shadow_submit(samples, n);
+}
+
+
+// the daily chain, as fwi_kernels().daily_chain() was just handed it
+inline void fwi_shadow_daily(std::uint32_t count, const fwi_daily_inputs &in, const fwi_daily_outputs &out) {
+	fwi_shadow(count, [&](std::uint32_t i, fwi_shadow_sample &s) {
+		s.kernel = fwi_shadow_kernel::DAILY;
+		s.flag = (out.dsr != nullptr);
+		s.seconds = 24 * 60 * 60;
+		const double in_values[FWIShadowSample::INPUTS] = { in.in_ffmc[i], in.in_dmc[i], in.in_dc[i], in.rain[i], in.temperature[i], in.rh[i], in.ws[i], in.el[i], in.fl[i] };
+		std::copy(in_values, in_values + FWIShadowSample::INPUTS, s.in);
+		const double out_values[7] = { out.ffmc[i], out.dmc[i], out.dc[i], out.bui[i], out.isi[i], out.fwi[i], out.dsr ? out.dsr[i] : 0.0 };
+		std::copy(out_values, out_values + 7, s.out);
+	});
+}
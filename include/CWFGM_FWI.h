@@ -53,6 +53,28 @@
 
 #include "hresult.h"
 
+class FWICellFactors;
+class FWIWeatherIntermediates;
+
+
+/**
+ * Identifies one of the daily codes, e.g. in FWIClimatology and FWIQuantized.
+ */
+enum class FWICode : std::uint8_t {
+	FFMC, DMC, DC, ISI, BUI, FWI, DSR
+};
+static const std::uint8_t FWI_CODE_COUNT = 7;
+
+
+/**
+ * Selects how the batch kernels, and the grid, downscaling and Monte Carlo paths built on them, trade speed for
+ * reproducibility (see CCWFGM_FWI::SetKernelMode()).
+ */
+enum class FWIKernelMode : std::uint8_t {
+	FASTEST,				///< The best instruction set variant the CPU runs, fused multiply-adds and the system's libm
+	REPRODUCIBLE				///< Bit for bit the same results on every CPU, instruction set, thread count and tile size
+};
+
 
 /**	CFFDRS FWI Implementation
  * 
@@ -152,7 +174,7 @@ public:
 	 * \param rain Precipitation in the prior 24 hours (noon to noon, LST), mm
 	 * \param temperature Noon (LST) temperature, Celsius
 	 * \param latitude Radians, used to determine the appropriate table as defined in "Latitude Considerations in Adapting the Canadian Forest Fire Weather Index System To Other Countries", M.E. Alexander, in prep as Index X in Weather Guide for the Canadian Forest Fire Danger Rating System by B.D. Lawson, O.B. Armitage.
-	 * \param longitude Radians, reserved for future use, currently unused (may be if/as/when more regional constants are defined)
+	 * \param longitude Radians, currently unused by the built-in tables (regional tables are available through FWIRegionalFactors and the batch methods)
 	 * \param month Origin 0 (January = 0, December = 11)
 	 * \param rh Relative humidity expressed as a fraction ([0..1]) at noon LST
 	 * \param dmc Calculated DMC value
@@ -168,7 +190,7 @@ public:
 	 * \param rain Precipitation in the prior 24 hours (noon to noon, LST), mm
 	 * \param temperature Noon (LST) temperature, Celsius
 	 * \param latitude Radians, used to determine the appropriate table as defined in "Latitude Considerations in Adapting the Canadian Forest Fire Weather Index System To Other Countries", M.E. Alexander, in prep as Index X in Weather Guide for the Canadian Forest Fire Danger Rating System by B.D. Lawson, O.B. Armitage.
-	 * \param longitude Radians, reserved for future use, currently unused (may be if/as/when more regional constants are defined)
+	 * \param longitude Radians, currently unused by the built-in tables (regional tables are available through FWIRegionalFactors and the batch methods)
 	 * \param month Origin 0 (January = 0, December = 11)
 	 * \param dc Calculated DC value
    *
@@ -244,4 +266,273 @@ public:
 	 * \retval E_INVALIDARG Failure during calculation
 	 */
 	virtual NO_THROW HRESULT DSR(double fwi, double *dsr);
+
+	/**
+	 * Batch form of DailyFFMC_VanWagner, DMC, DC, BUI, ISI_FWI (with 24 hours since the FFMC), FWI and DSR: calculates all daily codes for 'count' independent cells or stations in one call.  All arrays are of length count.  The work is done by the kernel variant reported by KernelVariant().
+	 * \param count Number of elements
+	 * \param in_ffmc The previous day's Van Wagner FFMC values
+	 * \param in_dmc The previous day's DMC values
+	 * \param in_dc The previous day's DC values
+	 * \param rain Precipitation in the prior 24 hours (noon to noon, LST), mm
+	 * \param temperature Noon (LST) temperature, Celsius
+	 * \param rh Noon (LST) relative humidity expressed as a fraction ([0..1])
+	 * \param ws Noon (LST) wind speed (kph)
+	 * \param latitude Radians, selects the built-in day length factors as DMC() and DC() do
+	 * \param longitude Radians, currently unused
+	 * \param month Origin 0 (January = 0, December = 11)
+	 * \param ffmc, dmc, dc, bui, isi, fwi Calculated values
+	 * \param dsr Calculated DSR values, may be NULL if not wanted
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG month is greater than 11, or one or more elements failed their range checks (those elements are set to -98, the remainder are calculated)
+	 */
+	virtual NO_THROW HRESULT DailyCodes_Batch(std::uint32_t count, const double *in_ffmc, const double *in_dmc, const double *in_dc, const double *rain, const double *temperature, const double *rh, const double *ws,
+		const double *latitude, const double *longitude, unsigned short month, double *ffmc, double *dmc, double *dc, double *bui, double *isi, double *fwi, double *dsr) const;
+	/**
+	 * As the DailyCodes_Batch() above, with the DMC and DC day length factors taken from factors resolved once for a fixed set of cells or stations (see FWIRegionalFactors), rather than looked up from latitude on every call.
+	 * \param count Number of elements
+	 * \param in_ffmc, in_dmc, in_dc, rain, temperature, rh, ws Arrays of length count, as above
+	 * \param factors Resolved day length factors
+	 * \param first_cell Index into factors of the cell corresponding to the first element of the arrays
+	 * \param month Origin 0 (January = 0, December = 11)
+	 * \param ffmc, dmc, dc, bui, isi, fwi Calculated values
+	 * \param dsr Calculated DSR values, may be NULL if not wanted
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG month is greater than 11, factors doesn't cover the requested cells, or one or more elements failed their range checks (those elements are set to -98, the remainder are calculated)
+	 */
+	virtual NO_THROW HRESULT DailyCodes_Batch(std::uint32_t count, const double *in_ffmc, const double *in_dmc, const double *in_dc, const double *rain, const double *temperature, const double *rh, const double *ws,
+		const FWICellFactors &factors, std::uint32_t first_cell, unsigned short month, double *ffmc, double *dmc, double *dc, double *bui, double *isi, double *fwi, double *dsr) const;
+	/**
+	 * As the DailyCodes_Batch() above, with the previous day's codes read from, and the calculated codes written in, the fixed point forms described by FWIQuantized: the DMC and DC as 32 bit state, everything else in 16 bits.  The codes are calculated in doubles, so only the storage is rounded.
+	 * \param count Number of elements
+	 * \param in_ffmc The previous day's FFMC, 16 bit
+	 * \param in_dmc, in_dc The previous day's DMC and DC, 32 bit state
+	 * \param rain, temperature, rh, ws Arrays of length count, as above
+	 * \param factors Resolved day length factors
+	 * \param first_cell Index into factors of the cell corresponding to the first element of the arrays
+	 * \param month Origin 0 (January = 0, December = 11)
+	 * \param ffmc, bui, isi, fwi Calculated values, 16 bit
+	 * \param dmc, dc Calculated values, 32 bit state
+	 * \param dsr Calculated DSR values, 16 bit, may be NULL if not wanted
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG month is greater than 11, factors doesn't cover the requested cells, or one or more elements failed their range checks or were missing (those elements are set to FWIQuantized::MISSING, the remainder are calculated)
+	 */
+	virtual NO_THROW HRESULT DailyCodes_Quantized_Batch(std::uint32_t count, const std::uint16_t *in_ffmc, const std::uint32_t *in_dmc, const std::uint32_t *in_dc, const double *rain, const double *temperature, const double *rh, const double *ws,
+		const FWICellFactors &factors, std::uint32_t first_cell, unsigned short month, std::uint16_t *ffmc, std::uint32_t *dmc, std::uint32_t *dc, std::uint16_t *bui, std::uint16_t *isi, std::uint16_t *fwi, std::uint16_t *dsr) const;
+	/**
+	 * Batch form of HourlyFFMC_VanWagner, for 'count' independent cells or stations sharing the same time step.
+	 * \param count Number of elements
+	 * \param in_ffmc, rain, temperature, rh, ws Arrays of length count, as HourlyFFMC_VanWagner()
+	 * \param seconds_since_ffmc Seconds since observed FFMC
+	 * \param ffmc Calculated FFMC values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG seconds_since_ffmc is greater than 7200 seconds, or one or more elements failed their range checks (those elements are set to -98)
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_VanWagner_Batch(std::uint32_t count, const double *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, std::uint32_t seconds_since_ffmc, double *ffmc) const;
+	/**
+	 * As HourlyFFMC_VanWagner_Batch(), with a fast path for elements whose fuel moisture has converged.  An element without rain whose moisture content
+	 * is already within 'tolerance' of the equilibrium moisture content it is drying or wetting towards keeps its moisture content, and the drying
+	 * rate and decay aren't calculated.  The full model never moves the moisture content past that equilibrium, so each fast path result is within
+	 * 'tolerance' of the full model's in moisture content, and within 1.091 * tolerance in FFMC.  Errors from earlier steps aren't amplified by later
+	 * ones, since the full model only contracts differences in moisture content.  A tolerance of 0 gives exactly the results of HourlyFFMC_VanWagner_Batch().
+	 * \param count Number of elements
+	 * \param in_ffmc, rain, temperature, rh, ws Arrays of length count, as HourlyFFMC_VanWagner()
+	 * \param seconds_since_ffmc Seconds since observed FFMC
+	 * \param tolerance Moisture content, percent
+	 * \param ffmc Calculated FFMC values
+	 * \param converged If not NULL, receives the number of elements that took the fast path
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG seconds_since_ffmc is greater than 7200 seconds, tolerance is negative, or one or more elements failed their range checks (those elements are set to -98)
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_VanWagner_Equilibrium_Batch(std::uint32_t count, const double *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, std::uint32_t seconds_since_ffmc,
+		double tolerance, double *ffmc, std::uint32_t *converged) const;
+	/**
+	 * As HourlyFFMC_VanWagner_Batch(), with the FFMC read and written in the 16 bit fixed point form described by FWIQuantized.
+	 * \param count Number of elements
+	 * \param in_ffmc Previous FFMC values, fixed point
+	 * \param rain, temperature, rh, ws Arrays of length count, as HourlyFFMC_VanWagner()
+	 * \param seconds_since_ffmc Seconds since observed FFMC
+	 * \param ffmc Calculated FFMC values, fixed point
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG seconds_since_ffmc is greater than 7200 seconds, or one or more elements failed their range checks or were missing (those elements are set to FWIQuantized::MISSING)
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_VanWagner_Quantized_Batch(std::uint32_t count, const std::uint16_t *in_ffmc, const double *rain, const double *temperature, const double *rh, const double *ws, std::uint32_t seconds_since_ffmc, std::uint16_t *ffmc) const;
+	/**
+	 * As HourlyFFMC_VanWagner_Batch(), with the weather taken from intermediates calculated once for a set of weather records (see FWIWeatherIntermediates).
+	 * \param count Number of elements
+	 * \param in_ffmc, rain Arrays of length count, as HourlyFFMC_VanWagner()
+	 * \param wx Weather intermediates
+	 * \param first_record Index into wx of the record corresponding to the first element of the arrays
+	 * \param seconds_since_ffmc Seconds since observed FFMC
+	 * \param ffmc Calculated FFMC values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG seconds_since_ffmc is greater than 7200 seconds, wx doesn't cover the requested records, or one or more elements failed their range checks (those elements are set to -98)
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_VanWagner_Batch(std::uint32_t count, const double *in_ffmc, const double *rain, const FWIWeatherIntermediates &wx, std::uint32_t first_record, std::uint32_t seconds_since_ffmc, double *ffmc) const;
+	/**
+	 * Batch form of HourlyFFMC_VanWagner_Previous, with the weather taken from intermediates calculated once for a set of weather records (see FWIWeatherIntermediates).
+	 * \param count Number of elements
+	 * \param in_ffmc Current FFMC values
+	 * \param rain Precipitation in the preceding hour, mm
+	 * \param wx Weather intermediates
+	 * \param first_record Index into wx of the record corresponding to the first element of the arrays
+	 * \param ffmc Calculated previous hour's FFMC values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG wx doesn't cover the requested records, or one or more elements failed their range checks (those elements are set to -98)
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_VanWagner_Previous_Batch(std::uint32_t count, const double *in_ffmc, const double *rain, const FWIWeatherIntermediates &wx, std::uint32_t first_record, double *ffmc) const;
+	/**
+	 * Batch form of DailyFFMC_VanWagner, with the noon weather taken from intermediates calculated once for a set of weather records (see FWIWeatherIntermediates).
+	 * \param count Number of elements
+	 * \param in_ffmc The previous day's Van Wagner FFMC values
+	 * \param rain Precipitation in the prior 24 hours (noon to noon, LST), mm
+	 * \param wx Weather intermediates
+	 * \param first_record Index into wx of the record corresponding to the first element of the arrays
+	 * \param ffmc Calculated FFMC values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG wx doesn't cover the requested records, or one or more elements failed their range checks (those elements are set to -98)
+	 */
+	virtual NO_THROW HRESULT DailyFFMC_VanWagner_Batch(std::uint32_t count, const double *in_ffmc, const double *rain, const FWIWeatherIntermediates &wx, std::uint32_t first_record, double *ffmc) const;
+	/**
+	 * Batch form of HourlyFFMC_Lawson, for 'count' independent cells or stations sharing the same time of day.  Where the daily FFMC the hour uses (in_ffmc_prevday or in_ffmc_currday) is exactly 101, the kernel takes the last column of the Lawson tables, whose column search in HourlyFFMC_Lawson() runs past the end of the table row, so the two can differ there.
+	 * \param count Number of elements
+	 * \param in_ffmc_prevday, in_ffmc_currday, rh Arrays of length count, as HourlyFFMC_Lawson()
+	 * \param seconds_into_day Local standard time
+	 * \param ffmc Calculated FFMC values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG One or more elements failed their range checks (those elements are set to -98)
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_Lawson_Batch(std::uint32_t count, const double *in_ffmc_prevday, const double *in_ffmc_currday, const double *rh, unsigned long seconds_into_day, double *ffmc) const;
+	/**
+	 * Batch form of HourlyFFMC_Lawson_Contiguous, for 'count' independent cells or stations sharing the same time of day.  As HourlyFFMC_Lawson_Batch(), an FFMC of exactly 101 takes the last column of the Lawson tables, and can differ from HourlyFFMC_Lawson_Contiguous() there.
+	 * \param count Number of elements
+	 * \param in_ffmc_prevday, in_ffmc_currday, rh_0, rh, rh_1 Arrays of length count, as HourlyFFMC_Lawson_Contiguous()
+	 * \param seconds_into_day Local standard time
+	 * \param ffmc Calculated FFMC values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG One or more elements failed their range checks (those elements are set to -98)
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_Lawson_Contiguous_Batch(std::uint32_t count, const double *in_ffmc_prevday, const double *in_ffmc_currday, const double *rh_0, const double *rh, const double *rh_1, unsigned long seconds_into_day, double *ffmc) const;
+	/**
+	 * HourlyFFMC_Lawson_Batch() for cells or stations spread over time zones, at one instant: each element's LST, and
+	 * so its table row and side of the noon switch, is resolved from utc and its own offset inside the kernel, so a
+	 * grid spanning several time zones runs as a single batch.
+	 * \param count Number of elements
+	 * \param in_ffmc_prevday, in_ffmc_currday, rh Arrays of length count, as HourlyFFMC_Lawson(), the codes being those of each element's own LST date
+	 * \param utc Seconds since 1970-01-01 00:00 UTC
+	 * \param utc_offset Each element's standard time offset from UTC, seconds (e.g. -25200 for MST), array of length count, with no daylight savings.  A raster of these can be built once and reused for every hour.
+	 * \param ffmc Calculated FFMC values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG One or more elements failed their range checks (those elements are set to -98)
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_Lawson_UTC_Batch(std::uint32_t count, const double *in_ffmc_prevday, const double *in_ffmc_currday, const double *rh, std::int64_t utc, const std::int32_t *utc_offset, double *ffmc) const;
+	/**
+	 * HourlyFFMC_Lawson_Contiguous_Batch() for cells or stations spread over time zones, see HourlyFFMC_Lawson_UTC_Batch().
+	 * \param count Number of elements
+	 * \param in_ffmc_prevday, in_ffmc_currday, rh_0, rh, rh_1 Arrays of length count, as HourlyFFMC_Lawson_Contiguous(), rh_0 and rh_1 being the observations on each element's LST hours
+	 * \param utc Seconds since 1970-01-01 00:00 UTC
+	 * \param utc_offset Each element's standard time offset from UTC, seconds, array of length count
+	 * \param ffmc Calculated FFMC values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 * \retval E_INVALIDARG One or more elements failed their range checks (those elements are set to -98)
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_Lawson_Contiguous_UTC_Batch(std::uint32_t count, const double *in_ffmc_prevday, const double *in_ffmc_currday, const double *rh_0, const double *rh, const double *rh_1, std::int64_t utc, const std::int32_t *utc_offset, double *ffmc) const;
+	/**
+	 * Batch form of ISI_FWI.
+	 * \param count Number of elements
+	 * \param ffmc FFMC values
+	 * \param ws Wind speeds (kph)
+	 * \param seconds_since_ffmc Seconds since observed ffmc, shared by all elements
+	 * \param isi Calculated ISI values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT ISI_FWI_Batch(std::uint32_t count, const double *ffmc, const double *ws, std::uint32_t seconds_since_ffmc, double *isi) const;
+	/**
+	 * Batch form of BUI.
+	 * \param count Number of elements
+	 * \param dc DC values
+	 * \param dmc DMC values
+	 * \param bui Calculated BUI values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT BUI_Batch(std::uint32_t count, const double *dc, const double *dmc, double *bui) const;
+	/**
+	 * Batch form of FWI.
+	 * \param count Number of elements
+	 * \param isi ISI values
+	 * \param bui BUI values
+	 * \param fwi Calculated FWI values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT FWI_Batch(std::uint32_t count, const double *isi, const double *bui, double *fwi) const;
+	/**
+	 * Hourly FWI for cells or stations spread over time zones, at one instant: each element uses the previous day's BUI
+	 * before noon in its own LST and the current day's from noon on, switching inside the batch rather than splitting
+	 * it by time zone.
+	 * \param count Number of elements
+	 * \param isi Hourly ISI values
+	 * \param prev_bui, curr_bui The BUI of the day before and of each element's LST date
+	 * \param utc Seconds since 1970-01-01 00:00 UTC
+	 * \param utc_offset Each element's standard time offset from UTC, seconds, array of length count
+	 * \param fwi Calculated FWI values
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT HourlyFWI_UTC_Batch(std::uint32_t count, const double *isi, const double *prev_bui, const double *curr_bui, std::int64_t utc, const std::int32_t *utc_offset, double *fwi) const;
+	/**
+	 * Reports which instruction set variant of the batch kernels was selected for this process ("generic", "sse4.2", "avx2", "avx512"), or "reproducible" while that mode is selected.  The choice is made once, at first use, from the CPU's capabilities, and can be lowered for testing by setting the FWI_ISA environment variable to one of those names before the first call.
+	 * The variants are currently the same scalar code built for each instruction set, a dispatch scaffold for vectorized kernels rather than a speedup: the generic variant runs within a few percent of the AVX-512 one.
+	 * \param name Receives a pointer to a static string
+	 *
+	 * \retval E_POINTER The address provided is invalid
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT KernelVariant(const char **name) const;
+	/**
+	 * Selects the kernel mode for the whole process.  FWIKernelMode::FASTEST, the default, runs the best instruction set variant and lets the compiler fuse multiplies and adds, and the C library pick its own exp(), log() and pow(), so results can differ in the last bits between CPUs (or with FWI_ISA).
+	 * FWIKernelMode::REPRODUCIBLE runs one variant everywhere, built without contraction on the library's own elementary functions (ports of fdlibm), so that the batch methods, FWICalculations, FWIDownscaler, FWIMonteCarlo, FWIClimatology and FWIGridEngine give the same bits on any x86-64 CPU, with any number of threads or processes and any tile size, e.g. for re-running a day that was reported.  The per-value methods above always use the reference routines, and aren't affected.
+	 * The cost is in the elementary functions, which are slower than a tuned libm's: the FWI stages of fwi_season_benchmark run at about 55% of the fastest mode's throughput (an AVX-512 Xeon with glibc 2.36, with or without --downscale), and the generic variant on its own runs within a few percent of the AVX-512 one.  Time fwi_season_benchmark with and without --reproducible for a given machine.
+	 * The mode can also be selected by setting the FWI_REPRODUCIBLE environment variable to "1".  Change it between runs, not while one is under way.
+	 * \param mode The mode
+	 *
+	 * \retval E_INVALIDARG Unknown mode
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT SetKernelMode(FWIKernelMode mode);
+	/**
+	 * Returns the kernel mode selected for the process.
+	 */
+	static FWIKernelMode KernelMode();
 };
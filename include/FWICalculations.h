@@ -0,0 +1,116 @@
+/**
+ * WISE_FWI_Module: FWICalculations.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+
+/**
+ * Options and time of day shared by every station in a call to FWICalculations.
+ */
+struct FWICalculationSettings {
+	std::uint16_t month;				///< Origin 0 (January = 0, December = 11)
+	std::uint16_t hour, minute, second;		///< Local clock time of the hourly observation, including any daylight savings, or UTC if utc is set
+	std::int32_t dst;				///< Daylight savings in effect, seconds (0 for standard time), ignored if utc is set
+	bool hourly;					///< Calculate the hourly codes as well as the daily codes
+	bool van_wagner;				///< Use the Van Wagner hourly FFMC rather than Lawson's
+	bool lawson_previous_hour;			///< Calculate the previous hour's FFMC with Lawson's method and use it as the starting point of the Van Wagner hourly FFMC (only has an effect if van_wagner is set)
+	bool utc;					///< The time of day is UTC, and each station's LST is found from its utc_offset
+
+	FWICalculationSettings() : month(0), hour(12), minute(0), second(0), dst(0), hourly(false), van_wagner(false), lawson_previous_hour(false), utc(false) { }
+};
+
+
+/**
+ * One station's observations.
+ */
+struct FWIStationInputs {
+	double yesterday_ffmc, yesterday_dmc, yesterday_dc;	///< The previous day's daily codes
+	double noon_temperature;			///< Celsius
+	double noon_rh;					///< Fraction ([0..1])
+	double noon_rain;				///< Noon to noon LST, mm
+	double noon_ws;					///< kph
+	double hourly_temperature;			///< Celsius, only used for the hourly codes
+	double hourly_rh;				///< Fraction ([0..1])
+	double hourly_rain;				///< Rain in the preceding hour, mm
+	double hourly_ws;				///< kph
+	double previous_hourly_ffmc;			///< The previous hour's FFMC, the starting point of the Van Wagner hourly FFMC (unless lawson_previous_hour is set)
+	double latitude, longitude;			///< Radians
+	std::int32_t utc_offset;			///< Standard time offset from UTC, seconds (e.g. -25200 for MST), only used if the settings' utc is set
+};
+
+
+/**
+ * One station's daily and (if requested) hourly codes.
+ */
+struct FWIStationOutputs {
+	double ffmc, dmc, dc, bui, isi, fwi, dsr;	///< Daily codes
+	double hourly_ffmc, hourly_isi, hourly_fwi;	///< Hourly codes, unchanged if hourly codes weren't requested
+	double previous_hourly_ffmc;			///< The previous hour's Lawson FFMC, unchanged if hourly codes weren't requested
+};
+
+
+class FWICellFactors;
+
+
+/**
+ * Calculates every daily and hourly code for one or more stations in a single call: the C++ equivalent of
+ * FWICalculations.FWICalculateDailyStatisticsCOM() in the Java library.  The daily FFMC, DMC, DC, BUI, ISI, FWI and
+ * DSR are calculated from the noon observations and, if requested, the hourly FFMC, ISI and FWI for the hourly
+ * observation.  The hourly FWI uses the previous day's BUI before noon LST (13:00 local clock time when daylight
+ * savings is in effect) and the current day's BUI after.
+ *
+ * With FWICalculationSettings::utc set, the stations of a batch may be in any number of time zones: the time of day
+ * is UTC, and each station's LST (its Lawson table row, whether it's past noon, and the ISI's time step) is resolved
+ * from its own utc_offset inside the kernels.  Each station's daily observations are then those of its own LST date,
+ * which may be a day either side of the UTC date.
+ *
+ * Inputs are range checked once, by the kernels, and the BUI and f(F) are calculated once per station, rather than
+ * repeated in each of a dozen CCWFGM_FWI calls.
+ */
+class FWI_API FWICalculations {
+public:
+	FWICalculations() = default;
+	virtual ~FWICalculations() = default;
+
+	/**
+	 * Calculates the codes for a single station.
+	 * \param settings Options and time of day
+	 * \param in The station's observations
+	 * \param out Receives the calculated codes
+	 *
+	 * \retval E_POINTER out is invalid
+	 * \retval E_INVALIDARG The month or time of day is invalid, or the inputs failed their range checks (the codes that couldn't be calculated are set to -98)
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Calculate(const FWICalculationSettings &settings, const FWIStationInputs &in, FWIStationOutputs *out) const;
+	/**
+	 * Calculates the codes for 'count' stations sharing the same date and time of day.
+	 * \param settings Options and time of day
+	 * \param count Number of stations
+	 * \param in Array of length count
+	 * \param factors Day length factors resolved for the stations (see FWIRegionalFactors), may be NULL to select the built-in tables from each station's latitude
+	 * \param out Array of length count
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG The month or time of day is invalid, factors doesn't cover count stations, or one or more stations failed their range checks (the codes that couldn't be calculated are set to -98, the remainder are calculated)
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Calculate_Batch(const FWICalculationSettings &settings, std::uint32_t count, const FWIStationInputs *in, const FWICellFactors *factors, FWIStationOutputs *out) const;
+};
@@ -0,0 +1,187 @@
+/**
+ * WISE_FWI_Module: FWIClassRaster.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+#include "FWIScratchArena.h"
+
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+
+static const std::uint8_t FWI_DANGER_CLASS_COUNT = 5;	///< Low, moderate, high, very high, extreme
+
+
+/**
+ * Breakpoints between the fire danger classes.  A cell's class is the number of FWI breakpoints its FWI is at or above
+ * and, if bui_classes is set, the higher of that and the class from its BUI.
+ */
+struct FWIDangerClasses {
+	double fwi[FWI_DANGER_CLASS_COUNT - 1];		///< Ascending
+	double bui[FWI_DANGER_CLASS_COUNT - 1];		///< Ascending
+	bool bui_classes;				///< Also classify on the BUI
+
+	FWIDangerClasses() : fwi{ 5.0, 10.0, 20.0, 30.0 }, bui{ 20.0, 40.0, 60.0, 90.0 }, bui_classes(false) { }
+};
+
+
+/**
+ * A run of cells of the same class, in cell order within a tile.
+ */
+struct FWIClassRun {
+	std::uint32_t length;
+	std::uint8_t danger_class;			///< [0..FWI_DANGER_CLASS_COUNT), or FWIClassRaster::NO_DATA
+};
+
+
+/**
+ * Daily fire danger class maps, stored run length encoded a tile at a time, using the same tiles as FWITiledFile.
+ * Class maps are mostly large uniform areas, so a tile is usually a handful of runs rather than a value per cell,
+ * and map tiles can be generated straight from the runs.
+ *
+ *	header | runs of each (day, tile) in the order they were written | index: offset and run count of each (day, tile)
+ *
+ * Each run is 4 bytes: the length in the upper 24 bits and the class in the lower 8, in the native byte order.  The
+ * index is written by Close(), so a file that wasn't closed can't be opened.  Write() may be called from several
+ * threads at once.
+ */
+class FWI_API FWIClassRaster {
+public:
+	static const std::uint8_t NO_DATA = 0xff;	///< Cells without a class: masked, out of season, or failing their range checks
+
+	FWIClassRaster();
+	virtual ~FWIClassRaster();
+	FWIClassRaster(const FWIClassRaster &) = delete;
+	FWIClassRaster &operator=(const FWIClassRaster &) = delete;
+
+	bool IsOpen() const { return m_file.is_open(); }
+	bool Writable() const { return m_writable; }
+	std::uint32_t Cells() const { return m_cells; }
+	std::uint32_t TileCells() const { return m_tile_cells; }
+	std::uint32_t Tiles() const { return m_tile_cells ? (std::uint32_t)(((std::uint64_t)m_cells + m_tile_cells - 1) / m_tile_cells) : 0; }
+	std::uint16_t Days() const { return m_days; }
+	/**
+	 * Returns the number of cells in a tile: TileCells(), except for the last tile.
+	 */
+	std::uint32_t TileCount(std::uint32_t tile) const;
+	/**
+	 * Returns the bytes of runs written so far (or in the file, if opened).
+	 */
+	std::uint64_t RunBytes() const;
+
+	/**
+	 * Classifies an array of FWI and BUI values, in the 16 bit form of FWIQuantized.  Missing values are NO_DATA.
+	 * \param classes Class breakpoints
+	 * \param count Number of cells
+	 * \param fwi, bui Arrays of length count (bui may be NULL unless classes.bui_classes is set)
+	 * \param danger_class Receives the classes, array of length count
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT Classify(const FWIDangerClasses &classes, std::uint32_t count, const std::uint16_t *fwi, const std::uint16_t *bui, std::uint8_t *danger_class);
+
+	/**
+	 * Creates (or replaces) a file, opened for writing.
+	 * \param filename Path of the file
+	 * \param cells Number of cells
+	 * \param tile_cells Number of cells per tile, less than 2^24
+	 * \param days Number of days
+	 *
+	 * \retval E_POINTER filename is invalid
+	 * \retval E_INVALIDARG cells, tile_cells or days is 0, or tile_cells is too large
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL The file can't be created
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Create(const char *filename, std::uint32_t cells, std::uint32_t tile_cells, std::uint16_t days);
+	/**
+	 * Opens an existing, closed, file for reading.
+	 * \param filename Path of the file
+	 *
+	 * \retval E_POINTER filename is invalid
+	 * \retval E_INVALIDARG The file isn't a class raster
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL The file can't be opened or read
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Open(const char *filename);
+	/**
+	 * Closes the file, first writing the index if it was created.
+	 *
+	 * \retval E_FAIL The index couldn't be written
+	 * \retval S_OK Successful, or the file wasn't open
+	 */
+	virtual NO_THROW HRESULT Close();
+	/**
+	 * Encodes and writes one day of one tile.  Writing a (day, tile) again replaces it.
+	 * \param day Origin 0
+	 * \param tile Tile index
+	 * \param danger_class Classes of the tile's cells, array of length TileCount(tile)
+	 * \param scratch Where the runs are encoded, NULL for the calling thread's FWIScratchArena::ThreadLocal()
+	 *
+	 * \retval E_POINTER danger_class is invalid
+	 * \retval E_UNEXPECTED The file isn't open for writing
+	 * \retval E_INVALIDARG day or tile is out of range
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL The runs couldn't be written
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Write(std::uint16_t day, std::uint32_t tile, const std::uint8_t *danger_class, FWIScratchArena *scratch = nullptr);
+	/**
+	 * Reads the runs of one day of one tile.
+	 * \param day Origin 0
+	 * \param tile Tile index
+	 * \param runs Receives the runs, covering TileCount(tile) cells, or none if the (day, tile) was never written
+	 *
+	 * \retval E_POINTER runs is invalid
+	 * \retval E_UNEXPECTED The file isn't open
+	 * \retval E_INVALIDARG day or tile is out of range
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL The runs couldn't be read
+	 * \retval S_FALSE The (day, tile) was never written
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Runs(std::uint16_t day, std::uint32_t tile, std::vector<FWIClassRun> *runs) const;
+	/**
+	 * As Runs(), decoded to a class per cell.
+	 * \param day Origin 0
+	 * \param tile Tile index
+	 * \param danger_class Receives the classes, array of length TileCount(tile).  NO_DATA if the (day, tile) was never written.
+	 *
+	 * Returns the same values as Runs().
+	 */
+	virtual NO_THROW HRESULT Read(std::uint16_t day, std::uint32_t tile, std::uint8_t *danger_class) const;
+
+protected:
+	struct index_entry {
+		std::uint64_t offset;
+		std::uint32_t runs;
+		std::uint32_t reserved;
+	};
+
+	mutable std::mutex m_lock;			// the file position is shared
+	mutable std::fstream m_file;
+	bool m_writable;
+	std::uint32_t m_cells, m_tile_cells;
+	std::uint16_t m_days;
+	std::uint64_t m_end;				// where the next runs go
+	std::vector<index_entry> m_index;		// [day][tile]
+};
@@ -0,0 +1,158 @@
+/**
+ * WISE_FWI_Module: FWIClimatology.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "FWIQuantileSketch.h"
+
+#include <vector>
+
+
+class FWIRegionalFactors;
+
+
+/**
+ * One day of a station's historical record.
+ */
+struct FWIClimatologyDay {
+	std::uint16_t year;				///< Calendar year, used to restart the codes each season
+	std::uint16_t month;				///< Origin 0 (January = 0, December = 11)
+	double temperature;				///< Noon LST, Celsius
+	double rh;					///< Noon LST, fraction ([0..1])
+	double ws;					///< Noon LST, kph
+	double rain;					///< Noon to noon LST, mm
+};
+
+
+/**
+ * Supplies historical daily weather to FWIClimatology, a station at a time, so that archives can be streamed from
+ * disk rather than loaded.  Read() is called from several threads at once, but never concurrently for the same
+ * station, and each station's days are requested in order.
+ */
+class FWI_API FWIClimatologySource {
+public:
+	virtual ~FWIClimatologySource() = default;
+
+	virtual std::uint32_t Stations() const = 0;
+	/**
+	 * Retrieves a station's location, used to select its DMC and DC day length factors.
+	 * \param station Station index
+	 * \param latitude, longitude Receive the location, radians
+	 */
+	virtual NO_THROW HRESULT Location(std::uint32_t station, double *latitude, double *longitude) const = 0;
+	/**
+	 * Reads the next days of a station's record, which must be consecutive and in date order.
+	 * \param station Station index
+	 * \param first_day Index into the station's record of the first day wanted (the total returned so far)
+	 * \param max_days Capacity of days
+	 * \param days Receives the days
+	 * \param count Receives the number of days read, 0 at the end of the record
+	 */
+	virtual NO_THROW HRESULT Read(std::uint32_t station, std::uint64_t first_day, std::uint32_t max_days, FWIClimatologyDay *days, std::uint32_t *count) const = 0;
+};
+
+
+/**
+ * Options for FWIClimatology.
+ */
+struct FWIClimatologySettings {
+	double start_ffmc, start_dmc, start_dc;		///< Startup codes, at the start of the record, each year and after missing or invalid days
+	bool restart_each_year;				///< Restart the codes when the year changes, rather than carrying them across the winter
+	double relative_accuracy;			///< Relative error of the percentiles, see FWIQuantileSketch
+	std::uint32_t threads;				///< Worker threads, 0 to use one per hardware thread
+	bool numa;					///< Spread the worker threads evenly over the NUMA nodes, bound to them (see FWINumaTopology)
+
+	FWIClimatologySettings() : start_ffmc(85.0), start_dmc(6.0), start_dc(15.0), restart_each_year(true), relative_accuracy(0.005), threads(0), numa(false) { }
+};
+
+
+/**
+ * Builds fire danger climatologies (e.g. the 90th and 97th percentile FWI, BUI and ISI by month, for danger class
+ * thresholds) from historical weather.  Each station's record is run through the daily FWI chain and every code is
+ * added to a quantile sketch for its station, month and code, so that the full history is never stored.  Stations are
+ * processed in parallel, each by a single thread, so the results don't depend on the number of threads.
+ *
+ * Days failing a code's range checks (e.g. missing observations) aren't added for that code, or for the codes that
+ * depend on it, and it restarts from its startup value on the following day.
+ */
+class FWI_API FWIClimatology {
+public:
+	FWIClimatology(const FWIClimatologySettings &settings = FWIClimatologySettings());
+	virtual ~FWIClimatology() = default;
+
+	std::uint32_t Stations() const { return m_stations; }
+	/**
+	 * Returns the sketch for a station, month (origin 0) and code.
+	 */
+	const FWIQuantileSketch &Sketch(std::uint32_t station, std::uint16_t month, FWICode code) const { return m_sketches[index(station, month, code)]; }
+
+	/**
+	 * Runs every station's record through the daily codes, replacing any previous results.
+	 * \param source Historical weather
+	 * \param factors Day length factors to resolve the stations against, may be NULL for the built-in tables
+	 *
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_INVALIDARG A station isn't contained by any region in factors, or a day's month is invalid
+	 * \retval S_OK Successful
+	 * Any other failure returned by the source is passed back, and the results are cleared.
+	 */
+	virtual NO_THROW HRESULT Run(const FWIClimatologySource &source, const FWIRegionalFactors *factors);
+	/**
+	 * Adds another climatology for the same stations (e.g. a different period of record) to this one.
+	 * \param other Climatology to merge
+	 *
+	 * \retval E_INVALIDARG other has a different number of stations or relative accuracy
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Merge(const FWIClimatology &other);
+	/**
+	 * Estimates a percentile.
+	 * \param station Station index
+	 * \param month Origin 0
+	 * \param code The code
+	 * \param q Quantile, [0..1]
+	 * \param value Receives the estimate
+	 *
+	 * \retval E_POINTER value is invalid
+	 * \retval E_INVALIDARG station, month or q is out of range
+	 * \retval E_UNEXPECTED There are no values for that station, month and code
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Percentile(std::uint32_t station, std::uint16_t month, FWICode code, double q, double *value) const;
+	/**
+	 * Writes a percentile table as comma separated values, one row per station, month (origin 1) and code with the
+	 * number of days and each of the quantiles requested.  Rows with no values are omitted.
+	 * \param filename Path of the table
+	 * \param count Number of quantiles
+	 * \param q Array of length count, [0..1]
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG A quantile is out of range
+	 * \retval E_FAIL The file can't be written
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT WriteTable(const char *filename, std::uint32_t count, const double *q) const;
+
+protected:
+	std::size_t index(std::uint32_t station, std::uint16_t month, FWICode code) const { return ((std::size_t)station * 12 + month) * FWI_CODE_COUNT + (std::size_t)code; }
+
+	FWIClimatologySettings m_settings;
+	std::uint32_t m_stations;
+	std::vector<FWIQuantileSketch> m_sketches;	// [m_stations][12][FWI_CODE_COUNT]
+};
@@ -0,0 +1,154 @@
+/**
+ * WISE_FWI_Module: FWIDailyAggregator.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <vector>
+
+
+class FWICellFactors;
+
+
+/**
+ * One hourly observation from a station's feed.
+ */
+struct FWIHourlyRecord {
+	std::uint32_t station;				///< Station index
+	std::int64_t utc;				///< End of the hour observed, seconds since 1970-01-01 00:00 UTC
+	double temperature;				///< Celsius
+	double rh;					///< Fraction ([0..1])
+	double ws;					///< kph
+	double rain;					///< Rain in the hour, mm
+};
+
+
+/**
+ * One station's day, completed by FWIDailyAggregator: the noon to noon LST aggregate of its hourly records and the
+ * daily codes calculated from it.
+ */
+struct FWIStationDay {
+	std::uint32_t station;				///< Station index
+	std::int32_t day;				///< The LST date of the noon ending the day, see FWIStationHistory::DayNumber()
+	std::uint16_t month;				///< Of day, origin 0
+	std::uint16_t hours;				///< Hourly records in the day
+	bool calculated;				///< The day had a noon observation and its codes were calculated
+	double noon_temperature, noon_rh, noon_ws;	///< The noon observation
+	double rain;					///< Noon to noon LST, mm
+	double ffmc, dmc, dc, bui, isi, fwi, dsr;	///< Daily codes, -98 if not calculated or the inputs failed their range checks
+};
+
+
+/**
+ * Turns hourly station feeds into the daily codes in a single pass, with constant work per record: each station's
+ * records are summed into a rolling noon to noon LST window, the noon observation is picked out as the window closes,
+ * and completed days go straight through the daily chain (the FFMC, DMC, DC, BUI, ISI, FWI and DSR kernels), carrying
+ * each station's codes on to its next day.
+ *
+ * Feeds are in UTC and each station is given its standard time offset.  LST is standard time, the convention of the
+ * Lawson hourly FFMC and FWICalculations (which subtract any daylight savings from the local clock), so daylight
+ * savings never enters: noon LST is 13:00 on the local clock while it's in effect, and every day is 24 hours long.
+ *
+ * A day runs from just after noon LST to noon, inclusive, and a record belongs to the day its hour ends in.  The day's
+ * noon observation is the record ending exactly at noon, which closes the day as soon as it's added, or failing that
+ * the day's last record, if it ends after 11:00 LST, once a record of a later day arrives (or Flush() is called).  A
+ * day without one isn't calculated and leaves the station's codes as they were.  Hours missing from the window only
+ * lose their rain, and are counted in FWIStationDay::hours so the caller can decide whether to trust the day.
+ *
+ * Each station's records must be added in time order.  The stations may be interleaved in any way.
+ */
+class FWI_API FWIDailyAggregator {
+public:
+	FWIDailyAggregator();
+	virtual ~FWIDailyAggregator() = default;
+
+	/**
+	 * Sets up the stations, each starting with the standard startup codes (FFMC 85, DMC 6, DC 15) and no open day.
+	 * \param stations Number of stations
+	 * \param latitude Radians, array of length stations, used to select the built-in day length factors.  May be NULL if factors is given.
+	 * \param utc_offset Each station's standard time offset from UTC, seconds (e.g. -25200 for MST), array of length stations, with no daylight savings
+	 * \param factors Day length factors resolved for the stations (see FWIRegionalFactors), may be NULL
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG factors doesn't cover the stations, or an offset is more than 14 hours
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Reset(std::uint32_t stations, const double *latitude, const std::int32_t *utc_offset, const FWICellFactors *factors = nullptr);
+	/**
+	 * Sets the codes a station's next day starts from, e.g. the previous day's codes when resuming a season.
+	 *
+	 * \retval E_INVALIDARG station is out of range
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT SetCodes(std::uint32_t station, double ffmc, double dmc, double dc);
+
+	/**
+	 * Adds hourly records, then calculates every day they completed, appending them to Days() in the order they
+	 * completed.
+	 * \param count Number of records
+	 * \param records Array of length count
+	 *
+	 * \retval E_POINTER records is invalid
+	 * \retval E_INVALIDARG One or more records were for a station out of range, or weren't after the station's last record, and were skipped (the rest were added)
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Add(std::uint32_t count, const FWIHourlyRecord *records);
+	/**
+	 * At the end of the feeds, completes every open day whose last record ends after 11:00 LST and calculates it.
+	 * Records for those days can't be added afterwards.
+	 *
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Flush();
+
+	std::uint32_t Stations() const { return (std::uint32_t)m_stations.size(); }
+	/**
+	 * The days completed since the last ClearDays().
+	 */
+	const std::vector<FWIStationDay> &Days() const { return m_days; }
+	void ClearDays() { m_days.clear(); }
+	/// Records added since Reset()
+	std::uint64_t Records() const { return m_records; }
+	/// Records skipped since Reset()
+	std::uint64_t Rejected() const { return m_rejected; }
+
+protected:
+	struct station_state {
+		std::int64_t last;			// LST of the last record, seconds
+		std::int32_t window;			// the day the open window ends on
+		std::uint16_t hours;
+		bool open, noon, pending;		// a window is open, it has a noon observation, a day awaits calculation
+		std::int32_t utc_offset;
+		double rain;
+		double temperature, rh, ws;		// the noon observation
+		double ffmc, dmc, dc;			// what the next day starts from
+	};
+
+	bool close(std::uint32_t station);
+	bool calculate();
+
+	std::vector<station_state> m_stations;
+	std::vector<double> m_el, m_fl;			// [station][12]
+	std::vector<FWIStationDay> m_pending;		// completed, not yet calculated, at most one per station
+	std::vector<FWIStationDay> m_days;
+	std::uint64_t m_records, m_rejected;
+};
@@ -0,0 +1,152 @@
+/**
+ * WISE_FWI_Module: FWIDownscaler.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <vector>
+
+struct fwi_diurnal_day;
+
+/**
+ * One day of daily weather for every cell, the input to FWIDownscaler::SetDay().  All arrays are of length Cells().
+ */
+struct FWIDailyWeather {
+	std::uint16_t day_of_year;			///< Origin 0, used for sunrise and sunset
+	const double *min_temperature;			///< Celsius
+	const double *max_temperature;			///< Celsius
+	const double *rh;				///< Noon LST, fraction ([0..1])
+	const double *min_ws;				///< Early morning wind speed, kph
+	const double *max_ws;				///< Mid afternoon wind speed, kph.  May be the same array as min_ws for a constant wind.
+	const double *rain;				///< Noon to noon LST, mm
+};
+
+
+/**
+ * Generates hourly weather from daily observations or forecasts, and feeds it straight into the hourly FFMC, ISI and
+ * FWI kernels a block of cells at a time, so that hourly weather grids never need to be stored.
+ *
+ * Sunrise and sunset come from each cell's latitude and the day of year (solar noon is taken to be 12:00 LST).
+ * Temperature follows the Parton and Logan (1981) diurnal curve between the daily minimum and maximum, wind follows
+ * the same shape between the minimum and maximum wind speeds, and RH is calculated from the temperature holding the
+ * vapour pressure at its noon value, so that the noon RH is reproduced.  The daily rain is spread evenly over the 24
+ * hours.
+ */
+class FWI_API FWIDownscaler {
+public:
+	/**
+	 * \param cells Number of cells or stations
+	 * \param latitude Radians, array of length cells.  If NULL, every cell is placed on the equator.
+	 */
+	FWIDownscaler(std::uint32_t cells, const double *latitude);
+	virtual ~FWIDownscaler() = default;
+
+	/**
+	 * Returns the downscaler to the state of a newly constructed one, for a new set of cells, reusing its memory: with
+	 * no more cells than it has held before, it doesn't allocate.
+	 * \param cells Number of cells or stations
+	 * \param latitude Radians, array of length cells.  If NULL, every cell is placed on the equator.
+	 *
+	 * \retval E_OUTOFMEMORY Insufficient memory, the downscaler is left with no cells
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Reset(std::uint32_t cells, const double *latitude);
+
+	std::uint32_t Cells() const { return m_cells; }
+	/// Equilibrium tolerance used by HourlyFFMC_VanWagner(), moisture content percent
+	double EquilibriumTolerance() const { return m_equilibrium_tolerance; }
+	/// Number of cell-hours that HourlyFFMC_VanWagner() has advanced on the fast path since the tolerance was last set
+	std::uint64_t EquilibriumCellHours() const { return m_equilibrium_cell_hours; }
+
+	/**
+	 * Lets HourlyFFMC_VanWagner() skip cells whose fuel moisture has converged, see CCWFGM_FWI::HourlyFFMC_VanWagner_Equilibrium_Batch() for the
+	 * bound on the error.  The default of 0 always runs the full model.  Resets EquilibriumCellHours().
+	 * \param tolerance Moisture content, percent
+	 *
+	 * \retval E_INVALIDARG tolerance is negative
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT SetEquilibriumTolerance(double tolerance);
+
+	/**
+	 * Sets the daily weather that the following calls generate hours for.
+	 * \param day Daily weather for every cell
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG day_of_year is greater than 365, or a cell's minimum temperature or wind speed is greater than its maximum (the previous day is kept)
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT SetDay(const FWIDailyWeather &day);
+	/**
+	 * Generates the weather for a range of cells at a time of day.  Temperature, RH and wind are instantaneous values, rain is the amount that fell in the preceding hour.
+	 * \param hour LST, hours ([0..24))
+	 * \param first_cell First cell to generate
+	 * \param count Number of cells to generate
+	 * \param temperature, rh, ws, rain Arrays of length count
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG hour or the range of cells is invalid
+	 * \retval E_UNEXPECTED SetDay() hasn't been called
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Weather(double hour, std::uint32_t first_cell, std::uint32_t count, double *temperature, double *rh, double *ws, double *rain) const;
+	/**
+	 * Advances the hourly Van Wagner FFMC of every cell by one hour, to hour:00 LST, with the weather generated for that hour, and optionally calculates the ISI and FWI.
+	 * Cells within EquilibriumTolerance() of equilibrium take the fast path.
+	 * \param hour 0..23
+	 * \param ffmc On entry the FFMC for the previous hour, on return the FFMC at hour:00.  Array of length Cells().
+	 * \param isi Calculated ISI values, may be NULL
+	 * \param bui BUI values used for the FWI, may be NULL if fwi is NULL
+	 * \param fwi Calculated FWI values, may be NULL
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG hour is greater than 23, or one or more cells failed their range checks (set to -98)
+	 * \retval E_UNEXPECTED SetDay() hasn't been called
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_VanWagner(std::uint16_t hour, double *ffmc, double *isi, const double *bui, double *fwi) const;
+	/**
+	 * Calculates the hourly Lawson (contiguous) FFMC of every cell at hour:00 LST with the RH generated for that hour, and optionally the ISI and FWI.
+	 * \param hour 0..23
+	 * \param in_ffmc_prevday The previous day's daily FFMC values
+	 * \param in_ffmc_currday The current day's daily FFMC values
+	 * \param ffmc Calculated FFMC values
+	 * \param isi Calculated ISI values, may be NULL
+	 * \param bui BUI values used for the FWI, may be NULL if fwi is NULL
+	 * \param fwi Calculated FWI values, may be NULL
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG hour is greater than 23, or one or more cells failed their range checks (set to -98)
+	 * \retval E_UNEXPECTED SetDay() hasn't been called
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT HourlyFFMC_Lawson(std::uint16_t hour, const double *in_ffmc_prevday, const double *in_ffmc_currday, double *ffmc, double *isi, const double *bui, double *fwi) const;
+
+protected:
+	fwi_diurnal_day curves(std::uint32_t first_cell) const;
+
+	std::uint32_t m_cells;
+	bool m_have_day;
+	double m_equilibrium_tolerance;
+	mutable std::uint64_t m_equilibrium_cell_hours;
+	std::vector<double> m_tan_latitude;
+
+	// the day's curve parameters, per cell, see fwi_diurnal_day
+	std::vector<double> m_sunrise, m_day_length, m_sunset_shape, m_min_temp, m_temp_range, m_vapour_pressure, m_min_ws, m_ws_range, m_rain;
+};
@@ -0,0 +1,196 @@
+/**
+ * WISE_FWI_Module: FWIGridEngine.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "FWIClassRaster.h"
+#include "FWITiledFile.h"
+#include "FWIZonalSummary.h"
+
+#include <vector>
+
+
+class FWIRegionalFactors;
+class FWIShardQueue;
+
+
+/**
+ * The files making up a grid for FWIGridEngine, all with the same number of cells and cells per tile.  Layers are
+ * numbered from 0 within each day, days following one after another.
+ */
+struct FWIGridFiles {
+	const FWITiledFile *location;			///< 2 layers of double: latitude, longitude (radians)
+	const FWITiledFile *weather;			///< 6 layers of double per day: minimum temperature, maximum temperature (Celsius), noon LST RH (fraction), minimum and maximum wind speed (kph), noon to noon rain (mm), see FWIDailyWeather
+	FWITiledFile *state;				///< 4 layers of double: FFMC, DMC, DC and hourly FFMC, and with season rules 3 more: in season (1) or dormant (0), the count of days towards the season's start or end, and the precipitation since it ended (mm).  Read before the first day and updated in place to the state after the last.
+	FWITiledFile *daily;				///< FWI_CODE_COUNT layers of FWIQuantized 16 bit values per day, in FWICode order
+	FWITiledFile *hourly;				///< 72 layers of FWIQuantized 16 bit values per day: the hourly FFMC, ISI and FWI at each hour 0:00 .. 23:00 LST.  May be NULL if hourly codes aren't wanted.
+	const FWITiledFile *mask;			///< 1 layer of 8 bit flags, cells with 0 (e.g. water or non-fuel) are never run.  May be NULL to run every cell.
+	const FWITiledFile *zones;			///< 1 layer of 32 bit zone ids per zoning (fire zones, regions, districts...), for the zonal summaries.  May be NULL if they aren't wanted.
+	FWIClassRaster *classes;			///< Daily fire danger classes, run length encoded.  May be NULL if they aren't wanted.
+};
+
+
+/**
+ * Rules for the start and end of each cell's fire season, after Lawson and Armitage (2008).  A dormant cell starts its
+ * season on the start_days'th consecutive day with a maximum temperature of at least start_temperature (a proxy for
+ * the snow being gone), from the startup FFMC and DMC and a DC carried over the winter.  An active cell ends its
+ * season after stop_days consecutive days below stop_temperature, keeping its DC for the following spring.
+ *
+ * The overwintered DC is 400 ln(800 / Qs), Qs = carry_over 800 exp(-DCf / 400) + effectiveness 3.94 Rw, from the DC
+ * at the end of the previous season (DCf) and the precipitation while dormant (Rw, mm), and is at least start_dc.
+ */
+struct FWISeasonRules {
+	bool enabled;					///< Apply the rules; otherwise every unmasked cell runs every day
+	double start_temperature;			///< Celsius
+	std::uint16_t start_days;
+	double stop_temperature;			///< Celsius
+	std::uint16_t stop_days;
+	bool overwinter_dc;				///< Carry the DC over the winter; otherwise seasons start from start_dc
+	double carry_over;				///< Fraction of the previous fall's moisture carried over, [0..1]
+	double effectiveness;				///< Fraction of the winter precipitation that recharges the soil, [0..1]
+
+	FWISeasonRules() : enabled(false), start_temperature(12.0), start_days(3), stop_temperature(5.0), stop_days(3), overwinter_dc(true), carry_over(0.75), effectiveness(0.75) { }
+};
+
+
+/**
+ * Options for FWIGridEngine.
+ */
+struct FWIGridSettings {
+	std::uint16_t first_day_of_year;		///< Origin 0, the day of year of the first day in the weather file
+	std::uint16_t days;				///< Number of days to run
+	double start_ffmc, start_dmc, start_dc;		///< Codes restarted from after a cell fails its range checks
+	std::uint32_t threads;				///< Compute threads, 0 to use one per hardware thread
+	std::uint64_t memory_budget;			///< Bytes of the files that may be mapped at once, see FWIGridEngine
+	bool numa;					///< Split the tiles, threads and memory budget between the NUMA nodes, see FWIGridEngine
+	FWISeasonRules season;				///< When each cell is in its fire season
+	FWIZonalSettings zonal;				///< What to summarize over the zones, if there's a zones file
+	FWIDangerClasses danger;			///< Breakpoints of the danger classes, if there's a classes file
+	double equilibrium_tolerance;			///< Lets the hourly FFMC skip cells this close to equilibrium (moisture content, percent), see FWIDownscaler::SetEquilibriumTolerance().  0 always runs the full model.
+
+	FWIGridSettings() : first_day_of_year(0), days(1), start_ffmc(85.0), start_dmc(6.0), start_dc(15.0), threads(0), memory_budget((std::uint64_t)1 << 30), numa(false), equilibrium_tolerance(0.0) { }
+};
+
+
+/**
+ * What one NUMA node (or the whole machine, when not running NUMA aware) did in the last FWIGridEngine::Run().
+ */
+struct FWIGridNodeStatistics {
+	std::uint32_t node;				///< See FWINumaTopology
+	std::uint32_t threads;				///< Compute threads on the node
+	std::uint32_t tiles;				///< Tiles run
+	std::uint64_t bytes;				///< Bytes of the files mapped for those tiles
+	double seconds;					///< Time the node's compute threads spent running tiles, summed over the threads
+	std::uint64_t cell_days;			///< Cells times days in those tiles
+	std::uint64_t active_cell_days;			///< Of cell_days, those unmasked and in season, which were run
+	std::uint64_t equilibrium_cell_hours;		///< Hourly FFMC steps that took the equilibrium fast path
+
+	FWIGridNodeStatistics() : node(0), threads(0), tiles(0), bytes(0), seconds(0.0), cell_days(0), active_cell_days(0), equilibrium_cell_hours(0) { }
+
+	/**
+	 * Returns the bytes per second the node's threads streamed through while running tiles.
+	 */
+	double Bandwidth() const { return (seconds > 0.0) ? (double)bytes * threads / seconds : 0.0; }
+};
+
+
+/**
+ * Runs the daily codes and, optionally, the downscaled hourly codes (see FWIDownscaler) over grids too large to hold
+ * in memory, a tile at a time.  Each tile of every file is memory mapped and run through every day before moving on,
+ * so the state never leaves the tile and each byte of the files is read or written once.
+ *
+ * Three stages overlap: a prefetch stage maps the tiles ahead of the compute threads and asks the OS to start
+ * reading them in, the compute threads run the tiles, and a write-back stage starts writing each finished tile's
+ * outputs and unmaps it.  The number of tiles mapped at once is limited to what fits in memory_budget (each tile
+ * needing the tile's share of every file), so the resident set stays bounded however large the grid is; the compute
+ * threads also need around 20 doubles of working space per cell of a tile.  Each compute thread sets up everything a
+ * tile-day needs when it starts, so running a tile-day doesn't touch the heap, apart from the zonal summaries' sketches
+ * growing to cover new values.
+ *
+ * With numa set, each NUMA node gets its own prefetch and compute threads, bound to the node, and a fixed block of
+ * tiles (the same block every run, so that a tile's state pages stay on the node that last wrote them).  Pages of the
+ * files are read in by the node's prefetch thread and the working space is first touched by its compute threads, so
+ * everything a tile needs is local.  Statistics() reports each node's share of the work and bandwidth.  When running
+ * from an FWIShardQueue the tiles are claimed as each node is ready for them instead.
+ *
+ * Masked cells, and with season rules cells outside their fire season, aren't run: their codes are written as
+ * FWIQuantized::MISSING and their state is left alone.  The cells that do run on a day are gathered into dense arrays
+ * for the batch kernels (unless that's every cell of the tile), so the work done follows the number of active cells.
+ *
+ * With a zones file, the ISI, BUI and FWI are summarized over each zone for each day as the tiles are run (see
+ * FWIZonalSummary), each compute thread collecting its own summary, merged once the run is done.  The summaries are
+ * exact, so they're the same whatever the number of threads or the order the tiles ran in, and the outputs don't
+ * need to be read again.  When running from an FWIShardQueue, each process summarizes the tiles it ran, and the
+ * processes' summaries merge to the whole grid's.
+ *
+ * With a classes file, each day's FWI (and optionally BUI) is classified against the danger class breakpoints as it's
+ * produced and written run length encoded, a tile at a time (see FWIClassRaster).  The classes file is written
+ * through this process, so isn't supported when running from an FWIShardQueue.
+ *
+ * The daily codes use the noon LST temperature and wind from the downscaled curves and the noon RH and rain from the
+ * weather file.  The hourly FWI uses the previous day's BUI before noon LST and the current day's after.  Codes that
+ * fail their range checks are written as FWIQuantized::MISSING and the cell restarts from the startup codes the next
+ * day.  Every cell's days and hours are its own LST, so a grid spanning time zones runs as one, with no splitting by
+ * zone; to combine it with data on UTC hours, see CCWFGM_FWI::HourlyFFMC_Lawson_UTC_Batch().
+ */
+class FWI_API FWIGridEngine {
+public:
+	FWIGridEngine(const FWIGridSettings &settings = FWIGridSettings());
+	virtual ~FWIGridEngine() = default;
+
+	/**
+	 * Runs every tile of a grid.
+	 * \param files The grid's files
+	 * \param factors Day length factors to resolve the cells against, may be NULL for the built-in tables
+	 *
+	 * \retval E_POINTER A required file is NULL
+	 * \retval E_UNEXPECTED A file isn't open, or an output file isn't open for writing
+	 * \retval E_INVALIDARG The files don't match each other or have too few layers for the days requested (or the state for the season rules), a single tile doesn't fit in memory_budget, equilibrium_tolerance is negative, the zonal thresholds or danger class breakpoints aren't ascending, classes is used with a queue, or one or more cells failed their range checks or weren't contained by any region in factors (the remaining cells are calculated)
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL A tile couldn't be mapped, or the danger classes couldn't be written
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Run(const FWIGridFiles &files, const FWIRegionalFactors *factors);
+	/**
+	 * As the Run() above, running only the tiles claimed from a queue shared with other processes, until it's empty.
+	 * \param files The grid's files, normally shared memory (see FWITiledFile::CreateShared()) or files every process has open
+	 * \param factors Day length factors to resolve the cells against, may be NULL for the built-in tables
+	 * \param queue The tiles to run, opened as one of its workers.  Must have the same number of tiles as the files.
+	 *
+	 * Returns the same values as the Run() above.
+	 */
+	virtual NO_THROW HRESULT Run(const FWIGridFiles &files, const FWIRegionalFactors *factors, FWIShardQueue *queue);
+
+	/**
+	 * Returns the bytes of the files needed to map one tile, for sizing memory_budget.
+	 */
+	static std::uint64_t TileBytes(const FWIGridFiles &files, const FWIGridSettings &settings);
+	/**
+	 * Returns the work done by each node in the last Run(), a single entry unless numa is set.
+	 */
+	const std::vector<FWIGridNodeStatistics> &Statistics() const { return m_statistics; }
+	/**
+	 * Returns the zonal summaries from the last Run(), empty if there was no zones file.
+	 */
+	const FWIZonalSummary &Zonal() const { return m_zonal; }
+
+protected:
+	FWIGridSettings m_settings;
+	std::vector<FWIGridNodeStatistics> m_statistics;
+	FWIZonalSummary m_zonal;
+};
@@ -0,0 +1,108 @@
+/**
+ * WISE_FWI_Module: FWIHistoryReplay.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "FWIClimatology.h"
+
+
+class FWICellFactors;
+
+
+/**
+ * Options for FWIHistoryReplay.
+ */
+struct FWIReplaySettings {
+	double start_ffmc, start_dmc, start_dc;		///< Startup codes, at the start of the record, each year and after invalid days, as FWIClimatologySettings
+	bool restart_each_year;				///< Restart the codes when the year changes, rather than carrying them across the winter
+	std::uint32_t chunk_days;			///< Days per chunk, 0 to split the record evenly over the threads
+	std::uint32_t spin_up_days;			///< Days run ahead of each chunk, from the startup codes, to settle its starting FFMC and DMC
+	double tolerance;				///< Largest difference in FFMC, DMC or DC accepted where one chunk hands over to the next, 0 for the sequential results exactly
+	std::uint32_t threads;				///< Worker threads, 0 to use one per hardware thread
+
+	FWIReplaySettings() : start_ffmc(85.0), start_dmc(6.0), start_dc(15.0), restart_each_year(false), chunk_days(0), spin_up_days(365), tolerance(0.01), threads(0) { }
+};
+
+
+/**
+ * What the last FWIHistoryReplay::Run() did.
+ */
+struct FWIReplayStatistics {
+	std::uint32_t chunks;				///< Chunks the record was split into
+	std::uint32_t exact_chunks;			///< Chunks whose spin-up reached back to a restart of the codes, so needed no checking
+	std::uint32_t repaired_chunks;			///< Chunks that hadn't converged on their predecessor and were rerun (in part) from its codes
+	std::uint64_t spin_up_days;			///< Days run ahead of the chunks and discarded
+	std::uint64_t repaired_days;			///< Days rerun by the repairs
+	double max_difference;				///< Largest difference in FFMC, DMC or DC accepted at a hand over
+
+	FWIReplayStatistics() : chunks(0), exact_chunks(0), repaired_chunks(0), spin_up_days(0), repaired_days(0), max_difference(0.0) { }
+};
+
+
+/**
+ * Replays one station's long historical record (e.g. a reanalysis over decades, or recalculating a history after a
+ * change to the model) through the daily codes on several threads, where the day to day recurrence would otherwise
+ * keep it on one.
+ *
+ * The record is split into chunks of consecutive days that are run concurrently.  A chunk can't know the codes its
+ * predecessor ends with, so it starts its spin-up days earlier from the startup codes and relies on FFMC and DMC
+ * forgetting where they started, within days and weeks.  DC only forgets as heavy rain falls, which can take years,
+ * but its moisture equivalent is scaled and shifted from day to day, so each chunk's days compose into a simple
+ * transfer function that's found in parallel, and chained from the start of the record to give the DC each chunk
+ * starts from.  A spin-up that reaches back to the start of the record, or to a restart when restart_each_year is
+ * set, starts from the true codes and the chunk is exact (chunks are moved to start on a restart where one is near).
+ *
+ * Once every chunk is done, a sequential pass walks the hand overs in order, comparing the FFMC, DMC and DC each chunk
+ * started from with those its predecessor (as finally accepted) ended on.  A chunk within tolerance is kept; one that
+ * isn't is rerun from its predecessor's codes, a day at a time, until its codes come back within tolerance of what it
+ * had calculated (from where on its days are kept) or it ends.  The codes draw together rather than apart, so the days
+ * kept stay within about the tolerance of the sequential run's, and a tolerance of 0 gives the sequential results bit
+ * for bit, though often only by rerunning much of the record, as the last bits of the predicted DC can take years of
+ * rain to wash out.  A dry spell that outlasts a spin-up only costs rerunning the days until the next good rain.
+ *
+ * Days failing a code's range checks get -98 for it and the codes that depend on it, and it restarts from its
+ * startup value on the following day, as in FWIClimatology.
+ */
+class FWI_API FWIHistoryReplay {
+public:
+	FWIHistoryReplay(const FWIReplaySettings &settings = FWIReplaySettings());
+	virtual ~FWIHistoryReplay() = default;
+
+	const FWIReplaySettings &Settings() const { return m_settings; }
+	const FWIReplayStatistics &Statistics() const { return m_statistics; }
+
+	/**
+	 * Calculates the daily codes for every day of a station's record.
+	 * \param count Number of days
+	 * \param days The record, consecutive and in date order, array of length count
+	 * \param latitude Radians, used to select the built-in day length factors if factors is NULL
+	 * \param factors Day length factors resolved for the station's cell (see FWIRegionalFactors), may be NULL
+	 * \param cell The station's cell in factors
+	 * \param codes Receives the codes, FWI_CODE_COUNT arrays of length count one after another, in FWICode order
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG A day's month is invalid, or cell is out of range
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Run(std::uint32_t count, const FWIClimatologyDay *days, double latitude, const FWICellFactors *factors, std::uint32_t cell, double *codes);
+
+protected:
+	FWIReplaySettings m_settings;
+	FWIReplayStatistics m_statistics;
+};
@@ -0,0 +1,153 @@
+/**
+ * WISE_FWI_Module: FWIMonteCarlo.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "FWIQuantileSketch.h"
+
+#include <vector>
+
+
+class FWIRegionalFactors;
+
+
+static const std::uint8_t FWI_MONTE_CARLO_THRESHOLD_COUNT = 4;
+
+
+/**
+ * Forecast noon weather for a set of stations over consecutive days.  The weather arrays are [day][station], of
+ * length days * stations.
+ */
+struct FWIForecastWeather {
+	std::uint16_t days;
+	const std::uint16_t *month;			///< Of each day, origin 0 (January = 0, December = 11)
+	const double *temperature;			///< Noon LST, Celsius
+	const double *rh;				///< Noon LST, fraction ([0..1])
+	const double *ws;				///< Noon LST, kph
+	const double *rain;				///< Noon to noon LST, mm
+};
+
+
+/**
+ * The forecast errors sampled, and what to collect.  Each sample perturbs every station's weather independently on
+ * every day: the temperature and RH by adding normal errors, the wind speed and rain by multiplying by lognormal
+ * errors with a mean of 1 (so calm, dry days stay calm and dry).
+ */
+struct FWIMonteCarloSettings {
+	std::uint32_t samples;				///< Per station
+	std::uint64_t seed;
+	double temperature_sd;				///< Celsius
+	double rh_sd;					///< Fraction, the perturbed RH is clamped to [0..1]
+	double ws_sd;					///< Of the log of the wind speed
+	double rain_sd;					///< Of the log of the rain
+	double relative_accuracy;			///< Of the quantiles, see FWIQuantileSketch
+	double thresholds[FWI_CODE_COUNT][FWI_MONTE_CARLO_THRESHOLD_COUNT];	///< Ascending, per code in FWICode order; the samples at or above each are counted
+	std::uint32_t threads;				///< Worker threads, 0 to use one per hardware thread
+
+	FWIMonteCarloSettings() : samples(1000), seed(20230401), temperature_sd(1.5), rh_sd(0.08), ws_sd(0.3), rain_sd(0.6), relative_accuracy(0.005),
+		thresholds{ { 80.0, 85.0, 88.0, 91.0 }, { 20.0, 30.0, 40.0, 60.0 }, { 200.0, 300.0, 400.0, 500.0 }, { 2.0, 5.0, 10.0, 15.0 },
+			{ 20.0, 40.0, 60.0, 90.0 }, { 5.0, 10.0, 20.0, 30.0 }, { 1.0, 5.0, 10.0, 20.0 } },
+		threads(0) { }
+};
+
+
+/**
+ * The distribution of one code over the samples for one station and day.
+ */
+struct FWIMonteCarloStatistics {
+	std::uint32_t samples;				///< Samples with a value
+	std::uint32_t missing;				///< Samples failing the code's range checks
+	double sum, sum_squares;
+	std::uint32_t above[FWI_MONTE_CARLO_THRESHOLD_COUNT];	///< Samples at or above each threshold
+	FWIQuantileSketch sketch;			///< Every sample's value
+
+	explicit FWIMonteCarloStatistics(double relative_accuracy = 0.005) : samples(0), missing(0), sum(0.0), sum_squares(0.0), above{ 0, 0, 0, 0 }, sketch(relative_accuracy) { }
+
+	double Mean() const { return samples ? sum / samples : 0.0; }
+	double StandardDeviation() const;
+	/**
+	 * Returns the probability of the code being at or above one of the thresholds.
+	 */
+	double Exceedance(std::uint8_t threshold) const { return (samples + missing) ? (double)above[threshold] / (double)(samples + missing) : 0.0; }
+};
+
+
+/**
+ * Propagates forecast weather uncertainty through the daily codes.  For each station, every sample's weather is
+ * perturbed (see FWIMonteCarloSettings) and the samples are run through the daily chain together, as the elements of
+ * one batch, carrying each sample's FFMC, DMC and DC from day to day.  The codes are folded into per station, day and
+ * code statistics (mean, standard deviation, exceedance counts and a quantile sketch) as they're produced, so the
+ * individual samples are never stored.
+ *
+ * The perturbations come from a counter based generator keyed by the seed, station, day and weather variable, with
+ * the sample as the counter, and each station is run by a single thread, so the results depend only on the settings
+ * and inputs and not on the number of threads.
+ */
+class FWI_API FWIMonteCarlo {
+public:
+	FWIMonteCarlo(const FWIMonteCarloSettings &settings = FWIMonteCarloSettings());
+	virtual ~FWIMonteCarlo() = default;
+
+	const FWIMonteCarloSettings &Settings() const { return m_settings; }
+	std::uint32_t Stations() const { return m_stations; }
+	std::uint16_t Days() const { return m_days; }
+
+	/**
+	 * Runs the samples for every station, replacing any previous results.
+	 * \param stations Number of stations
+	 * \param latitude, longitude Station locations, radians, arrays of length stations
+	 * \param in_ffmc, in_dmc, in_dc The codes on the day before the forecast, arrays of length stations
+	 * \param forecast The forecast weather
+	 * \param factors Day length factors to resolve the stations against, may be NULL for the built-in tables
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG There are no samples, a standard deviation is negative, a set of thresholds isn't ascending,
+	 *		a month is invalid, or a station isn't contained by any region in factors
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Run(std::uint32_t stations, const double *latitude, const double *longitude, const double *in_ffmc, const double *in_dmc, const double *in_dc,
+		const FWIForecastWeather &forecast, const FWIRegionalFactors *factors);
+	/**
+	 * Returns the statistics of a code for one station and day (origin 0, into the forecast), or NULL if any argument
+	 * is out of range.
+	 */
+	const FWIMonteCarloStatistics *Statistics(std::uint32_t station, std::uint16_t day, FWICode code) const;
+	/**
+	 * Estimates a quantile of a code over the samples.
+	 * \param station Station index
+	 * \param day Origin 0, into the forecast
+	 * \param code The code
+	 * \param q Quantile, [0..1]
+	 * \param value Receives the estimate
+	 *
+	 * \retval E_POINTER value is invalid
+	 * \retval E_INVALIDARG station, day, code or q is out of range
+	 * \retval E_UNEXPECTED No sample has a value
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Quantile(std::uint32_t station, std::uint16_t day, FWICode code, double q, double *value) const;
+
+protected:
+	std::size_t index(std::uint32_t station, std::uint16_t day, FWICode code) const { return ((std::size_t)station * m_days + day) * FWI_CODE_COUNT + (std::size_t)code; }
+
+	FWIMonteCarloSettings m_settings;
+	std::uint32_t m_stations;
+	std::uint16_t m_days;
+	std::vector<FWIMonteCarloStatistics> m_statistics;	// [m_stations][m_days][FWI_CODE_COUNT]
+};
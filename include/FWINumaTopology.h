@@ -0,0 +1,50 @@
+/**
+ * WISE_FWI_Module: FWINumaTopology.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+
+/**
+ * The NUMA nodes of the machine, read once from the OS (/sys/devices/system/node on Linux), used to keep threads next
+ * to the memory they work on.  Machines (or OSs) without NUMA information are treated as a single node, for which
+ * binding does nothing.
+ */
+class FWI_API FWINumaTopology {
+public:
+	/**
+	 * Returns the number of nodes with processors, at least 1.
+	 */
+	static std::uint32_t Nodes();
+	/**
+	 * Returns the number of processors on a node, 0 if node is out of range.
+	 */
+	static std::uint32_t Processors(std::uint32_t node);
+	/**
+	 * Restricts the calling thread to a node's processors.  Threads it starts afterwards inherit the restriction, and
+	 * memory it touches first is placed on the node by the OS's default (first touch) policy.
+	 * \param node Node index, [0..Nodes())
+	 *
+	 * \retval E_INVALIDARG node is out of range
+	 * \retval E_FAIL The OS refused the request
+	 * \retval S_FALSE There's only one node, so nothing was changed
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT BindThread(std::uint32_t node);
+};
@@ -0,0 +1,93 @@
+/**
+ * WISE_FWI_Module: FWIQuantileSketch.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <vector>
+
+
+/**
+ * Streaming quantile sketch with a relative error guarantee, for non-negative values such as the FWI codes.  Values
+ * are counted in logarithmically sized buckets, so any quantile is reported to within relative_accuracy of a value
+ * that actually occurs at that rank, using memory proportional to the log of the range of values seen rather than
+ * the number of values.  Values below 0.001 are counted as zero.
+ *
+ * Sketches with the same relative accuracy can be merged exactly: the merged sketch is identical to the one that
+ * would have been built from all of the values, regardless of the order they were added or merged in.
+ */
+class FWI_API FWIQuantileSketch {
+public:
+	/**
+	 * \param relative_accuracy Relative error of reported quantiles, (0..1).  Out of range values select the default of 0.5%.
+	 */
+	explicit FWIQuantileSketch(double relative_accuracy = 0.005);
+	virtual ~FWIQuantileSketch() = default;
+
+	double RelativeAccuracy() const { return m_accuracy; }
+	/**
+	 * Number of values added, including those merged in.
+	 */
+	std::uint64_t Count() const { return m_count; }
+	/**
+	 * Smallest and largest values added, only meaningful if Count() is non-zero.
+	 */
+	double Min() const { return m_min; }
+	double Max() const { return m_max; }
+
+	/**
+	 * Adds a value.  Negative values (e.g. the -98 error code) are ignored.
+	 */
+	void Add(double value);
+	/**
+	 * Removes every value.
+	 */
+	void Clear();
+	/**
+	 * Adds every value in another sketch to this one.
+	 * \param other Sketch to merge
+	 *
+	 * \retval E_INVALIDARG other has a different relative accuracy
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Merge(const FWIQuantileSketch &other);
+	/**
+	 * Estimates a quantile of the values added.
+	 * \param q Quantile, [0..1] (e.g. 0.9 for the 90th percentile)
+	 * \param value Receives the estimate
+	 *
+	 * \retval E_POINTER value is invalid
+	 * \retval E_INVALIDARG q is out of range
+	 * \retval E_UNEXPECTED No values have been added
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Quantile(double q, double *value) const;
+
+protected:
+	void grow(std::int32_t index);
+
+	double m_accuracy;
+	double m_gamma;					// (1 + accuracy) / (1 - accuracy), the ratio between bucket bounds
+	double m_inv_log_gamma;
+	std::uint64_t m_count, m_zero;			// total values, values counted as zero
+	double m_min, m_max;
+	std::int32_t m_offset;				// bucket index of m_buckets[0]
+	std::vector<std::uint32_t> m_buckets;		// bucket i counts values in (gamma^(i-1), gamma^i]
+};
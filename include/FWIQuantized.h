@@ -0,0 +1,142 @@
+/**
+ * WISE_FWI_Module: FWIQuantized.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+
+/**
+ * Fixed point storage for the daily codes, for state rasters, checkpoints and outputs.
+ *
+ * Reported codes are stored in 16 bits, a quarter of the size of a double.  Each code has its own resolution, well
+ * inside the 0.1 reporting precision, chosen so that the range of values that occur in practice fits:
+ *
+ *	Code	Resolution	Largest value
+ *	FFMC	0.002		131.068
+ *	DMC	0.01		655.34
+ *	DC	0.025		1638.35
+ *	ISI	0.01		655.34
+ *	BUI	0.02		1310.68
+ *	FWI	0.01		655.34
+ *	DSR	0.01		655.34
+ *
+ * Larger values saturate at the largest value.  MISSING holds the -98 error code (any negative value) and reads back
+ * as -98, so that invalid cells propagate through the quantized batch kernels just as they do through the others.
+ *
+ * Daily state that is carried from day to day must not drift from the same season calculated in doubles.  The FFMC
+ * converges towards its equilibrium moisture content, so its rounding errors die away and the 16 bit form is used for
+ * its state too.  The DMC and DC accumulate, so their rounding errors random walk through the season (with 16 bits,
+ * by over 0.2 in a few seasons of the synthetic regimes), and their state is kept in 32 bit fixed point with a
+ * resolution of 0.0001 instead - still half the size of a double.  fwi_season_benchmark --quantized measures the
+ * drift.
+ */
+class FWI_API FWIQuantized {
+public:
+	static constexpr std::uint16_t MISSING = 0xffff;
+	static constexpr std::uint16_t MAXIMUM = 0xfffe;
+	static constexpr std::uint32_t STATE_MISSING = 0xffffffff;
+	static constexpr std::uint32_t STATE_MAXIMUM = 0xfffffffe;
+
+	/**
+	 * Returns the number of steps per unit of a code in the 16 bit form, the reciprocal of its resolution.
+	 */
+	static constexpr double Units(FWICode code) {
+		return (code == FWICode::FFMC) ? 500.0 :
+		       (code == FWICode::DC) ? 40.0 :
+		       (code == FWICode::BUI) ? 50.0 : 100.0;
+	}
+	/**
+	 * The number of steps per unit of the 32 bit DMC and DC state.
+	 */
+	static constexpr double StateUnits() { return 10000.0; }
+
+	static std::uint16_t Quantize(FWICode code, double value) {
+		if (!(value >= 0.0))
+			return MISSING;
+		const double q = value * Units(code) + 0.5;
+		return (q >= (double)MAXIMUM) ? MAXIMUM : (std::uint16_t)q;
+	}
+
+	static double Dequantize(FWICode code, std::uint16_t value) {
+		return (value == MISSING) ? -98.0 : ((double)value / Units(code));
+	}
+
+	/**
+	 * Converts a DMC or DC value to 32 bit state.  The DMC's rain equations change form, discontinuously, above 33 and
+	 * 65, so DMC values just above those breakpoints are rounded up rather than down, to take the same branch the next
+	 * day as they would in doubles.
+	 */
+	static std::uint32_t QuantizeState(FWICode code, double value) {
+		if (!(value >= 0.0))
+			return STATE_MISSING;
+		const double q = value * StateUnits() + 0.5;
+		if (q >= (double)STATE_MAXIMUM)
+			return STATE_MAXIMUM;
+		std::uint32_t s = (std::uint32_t)q;
+		if ((code == FWICode::DMC) && (((value > 33.0) && (s == 330000)) || ((value > 65.0) && (s == 650000))))
+			s++;
+		return s;
+	}
+
+	static double DequantizeState(std::uint32_t value) {
+		return (value == STATE_MISSING) ? -98.0 : ((double)value / StateUnits());
+	}
+
+	/**
+	 * Converts an array of a code's values to the 16 bit form.
+	 * \param code The code the values are of
+	 * \param count Number of values
+	 * \param values Array of length count
+	 * \param q Receives the fixed point values, array of length count
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT Quantize(FWICode code, std::uint32_t count, const double *values, std::uint16_t *q);
+	/**
+	 * Converts an array of a code's 16 bit values back to doubles.
+	 * \param code The code the values are of
+	 * \param count Number of values
+	 * \param q Array of length count
+	 * \param values Receives the values, array of length count
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT Dequantize(FWICode code, std::uint32_t count, const std::uint16_t *q, double *values);
+	/**
+	 * As Quantize(), to the 32 bit DMC or DC state.
+	 */
+	static NO_THROW HRESULT QuantizeState(FWICode code, std::uint32_t count, const double *values, std::uint32_t *q);
+	/**
+	 * As Dequantize(), from the 32 bit DMC or DC state.
+	 */
+	static NO_THROW HRESULT DequantizeState(std::uint32_t count, const std::uint32_t *q, double *values);
+	/**
+	 * Converts 32 bit DMC or DC state to the 16 bit form, e.g. for an output archive.
+	 * \param code FWICode::DMC or FWICode::DC
+	 * \param count Number of values
+	 * \param state Array of length count
+	 * \param q Receives the 16 bit values, array of length count
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT NarrowState(FWICode code, std::uint32_t count, const std::uint32_t *state, std::uint16_t *q);
+};
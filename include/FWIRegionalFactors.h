@@ -0,0 +1,161 @@
+/**
+ * WISE_FWI_Module: FWIRegionalFactors.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <string>
+#include <vector>
+
+
+/**
+ * A rectangular region with its own DMC (EL) and DC (FL) day length factors.
+ */
+struct FWIRegion {
+	std::string name;
+	double latitude_min, latitude_max;		///< Degrees, inclusive
+	double longitude_min, longitude_max;		///< Degrees, inclusive.  If longitude_min > longitude_max, the region crosses the antimeridian.
+	std::array<double, 12> el;			///< DMC day length adjustment factors, January first
+	std::array<double, 12> fl;			///< DC day length factors, January first
+};
+
+
+/**
+ * Day length factors resolved for a fixed set of cells or stations, stored month major so that one month's factors
+ * for every cell are contiguous and can be handed straight to the batch kernels.
+ */
+class FWI_API FWICellFactors {
+public:
+	FWICellFactors() : m_cells(0) { }
+
+	std::uint32_t Cells() const { return m_cells; }
+	/**
+	 * Makes room for factors for up to cells cells, so that resolving no more than that many doesn't allocate.
+	 *
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	NO_THROW HRESULT Reserve(std::uint32_t cells);
+	/**
+	 * Returns the DMC day length factors of every cell for a month (origin 0), Cells() values.
+	 */
+	const double *EL(std::uint16_t month) const { return m_el.data() + (std::size_t)month * m_cells; }
+	/**
+	 * Returns the DC day length factors of every cell for a month (origin 0), Cells() values.
+	 */
+	const double *FL(std::uint16_t month) const { return m_fl.data() + (std::size_t)month * m_cells; }
+
+protected:
+	friend class FWIRegionalFactors;
+
+	std::uint32_t m_cells;
+	std::vector<double> m_el, m_fl;			// [12][m_cells]
+};
+
+
+/**
+ * Registry of regional day length factors for the DMC and DC, keyed on location.  A newly constructed registry holds
+ * the built-in latitude bands used by CCWFGM_FWI::DMC() and CCWFGM_FWI::DC(), so resolving against it gives the same
+ * results as those methods.  Regions added later take precedence over those added earlier, so a configuration only
+ * needs to describe the areas where it differs from the built-in tables.
+ *
+ * Locations are resolved once, when a grid or set of stations is set up, rather than on every calculation.
+ *
+ * The configuration format is plain text, one keyword per line, '#' starting a comment:
+ *
+ *	region <name> <latitude_min> <latitude_max> <longitude_min> <longitude_max>
+ *	el <12 values, January first>
+ *	fl <12 values, January first>
+ *
+ * with each region's el and fl lines following its region line, and the name a single word.  A line containing only
+ * "clear" removes all regions defined before it, including the built-in ones.
+ */
+class FWI_API FWIRegionalFactors {
+public:
+	FWIRegionalFactors();
+	virtual ~FWIRegionalFactors() = default;
+
+	/**
+	 * Removes every region, including the built-in ones.
+	 */
+	void Clear() { m_regions.clear(); }
+	std::size_t Count() const { return m_regions.size(); }
+	const FWIRegion &Region(std::size_t index) const { return m_regions[index].region; }
+
+	/**
+	 * Adds a region, which takes precedence over all regions already defined.
+	 * \param region The region to add
+	 *
+	 * \retval E_INVALIDARG The latitude or longitude bounds are out of range or the latitude bounds are reversed
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Add(const FWIRegion &region);
+	/**
+	 * Adds the regions described by a configuration file, see the class description for the format.  If the file fails to parse, the registry is left unchanged.
+	 * \param filename Path to the configuration
+	 * \param error_line Receives the line number of the first error, may be NULL
+	 *
+	 * \retval E_POINTER filename is invalid
+	 * \retval E_FAIL The file can't be opened
+	 * \retval E_INVALIDARG The configuration failed to parse
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Load(const char *filename, std::uint32_t *error_line = nullptr);
+	/**
+	 * As Load(), from the text of a configuration.
+	 */
+	virtual NO_THROW HRESULT Parse(const char *text, std::uint32_t *error_line = nullptr);
+
+	/**
+	 * Resolves the factors for a single location.
+	 * \param latitude Radians
+	 * \param longitude Radians
+	 * \param el Receives the 12 monthly DMC day length factors
+	 * \param fl Receives the 12 monthly DC day length factors
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG No region contains the location
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Resolve(double latitude, double longitude, double *el, double *fl) const;
+	/**
+	 * Resolves the factors for a set of cells or stations.
+	 * \param count Number of locations
+	 * \param latitude Radians, array of length count
+	 * \param longitude Radians, array of length count.  May be NULL, in which case only regions spanning all longitudes are considered.
+	 * \param factors Receives the resolved factors
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_INVALIDARG One or more locations aren't contained by any region (their factors are set to 0)
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Resolve(std::uint32_t count, const double *latitude, const double *longitude, FWICellFactors *factors) const;
+
+protected:
+	struct entry {
+		FWIRegion region;
+		double lat_min, lat_max, lon_min, lon_max;	// radians
+		bool all_longitudes;
+	};
+
+	const entry *find(double latitude, const double *longitude) const;
+
+	std::vector<entry> m_regions;
+};
@@ -0,0 +1,107 @@
+/**
+ * WISE_FWI_Module: FWIResultCache.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <memory>
+
+
+struct fwi_cache_shard;
+struct fwi_cache_key;
+
+
+/**
+ * What an FWIResultCache has done since it was constructed or last cleared.
+ */
+struct FWIResultCacheStatistics {
+	std::uint64_t hits;				///< Calls answered from the cache
+	std::uint64_t misses;				///< Calls that were calculated
+	std::uint64_t evictions;			///< Results dropped, least recently used first, to make room for new ones
+	std::uint64_t entries;				///< Results held now
+	std::uint64_t capacity;				///< The most results it can hold
+	std::uint64_t bytes;				///< Memory reserved for the results and their index
+
+	FWIResultCacheStatistics() : hits(0), misses(0), evictions(0), entries(0), capacity(0), bytes(0) { }
+
+	double HitRate() const { return (hits + misses) ? (double)hits / (double)(hits + misses) : 0.0; }
+};
+
+
+/**
+ * A drop-in CCWFGM_FWI for services that are asked for the same point calculations over and over (the same station and
+ * date, or the same what-if weather and prior codes): results are kept, keyed on their inputs, so that repeated calls
+ * cost a hash lookup instead of a calculation.
+ *
+ * Only the methods that cost more than a lookup (about 50ns) are cached: HourlyFFMC_VanWagner_Previous(), whose
+ * iterative back-cast takes over a microsecond, HourlyFFMC_VanWagner(), DailyFFMC_VanWagner() and FWI().  The others,
+ * Lawson's interpolation included, take a few tens of nanoseconds and pass straight through, as do the batch methods.
+ *
+ * The floating point inputs are rounded to mantissa_bits bits of mantissa before both the lookup and the calculation,
+ * so inputs that differ only by representation noise (unit conversions, text round trips) share an entry, and every
+ * result is exactly what CCWFGM_FWI gives for the rounded inputs, whichever call first put it in the cache.  The
+ * default of 36 bits is a relative rounding of about 1e-11, far inside the precision the codes are reported to; 52
+ * keys on the exact values.  Only successful results are kept.
+ *
+ * The cache is split into shards, each with its own lock, least recently used list and share of the memory, chosen
+ * by the hash of the inputs; a lock is held only for the lookup or insertion itself, never for a calculation.  All
+ * memory is reserved at construction, so the cache never grows past bytes and a full one evicts rather than allocates.
+ *
+ * Safe to call from any number of threads at once.
+ */
+class FWI_API FWIResultCache : public CCWFGM_FWI {
+public:
+	static const std::uint32_t EXACT = 52;		///< mantissa_bits that keys on the exact input values
+
+	/**
+	 * \param bytes Memory for the results and their index, about 80 bytes per result.  0 (or too little for a single result) disables caching, and then the inputs aren't rounded either, so each method gives exactly what CCWFGM_FWI's does.
+	 * \param mantissa_bits Bits of mantissa kept of each floating point input, [1..52]
+	 * \param shards Number of independently locked shards, rounded up to a power of 2.  0 picks one from the number of hardware threads.
+	 */
+	explicit FWIResultCache(std::size_t bytes = 16 * 1024 * 1024, std::uint32_t mantissa_bits = 36, std::uint32_t shards = 0);
+	virtual ~FWIResultCache();
+	FWIResultCache(const FWIResultCache &) = delete;
+	FWIResultCache &operator=(const FWIResultCache &) = delete;
+
+	virtual NO_THROW HRESULT HourlyFFMC_VanWagner(double in_ffmc, double rain, double temperature, double rh, double ws, std::uint32_t seconds_since_ffmc, double *ffmc);
+	virtual NO_THROW HRESULT HourlyFFMC_VanWagner_Previous(double current_ffmc, double rain, double temperature, double rh, double ws, double *prev_ffmc);
+	virtual NO_THROW HRESULT DailyFFMC_VanWagner(double in_ffmc, double rain, double temperature, double rh, double ws, double *ffmc);
+	virtual NO_THROW HRESULT FWI(double isi, double bui, double *fwi) const;
+
+	/**
+	 * Drops every result and zeroes the counters, keeping the memory.
+	 */
+	void Clear();
+	FWIResultCacheStatistics Statistics() const;
+	std::uint32_t Shards() const { return m_shard_mask + 1; }
+	std::uint32_t MantissaBits() const { return m_mantissa_bits; }
+
+protected:
+	double quantize(double value) const;
+	fwi_cache_shard &shard(const fwi_cache_key &key) const;
+	bool find(const fwi_cache_key &key, double *value) const;
+	void insert(const fwi_cache_key &key, double value) const;
+	template <typename F>
+	HRESULT cached(const fwi_cache_key &key, double *result, F calculate) const;
+
+	std::unique_ptr<fwi_cache_shard[]> m_shards;
+	std::uint32_t m_shard_mask;
+	std::uint32_t m_mantissa_bits;
+	std::uint64_t m_drop_mask, m_drop_half;		// the mantissa bits rounded away, and half of their weight
+};
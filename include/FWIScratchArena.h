@@ -0,0 +1,117 @@
+/**
+ * WISE_FWI_Module: FWIScratchArena.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <vector>
+
+
+/**
+ * Temporary arrays for the batch, sequence and grid paths, handed out by bumping a pointer and given back a Frame at a
+ * time.  An arena either works within a buffer the caller provides, and never allocates, or owns its memory and grows
+ * it on demand: a few warm up calls allocate, and once it has grown to the most any call needs at once, it never
+ * allocates again.  ThreadLocal() is the calling thread's own owning arena, for calls that aren't given one.
+ *
+ * An arena is used by one thread at a time.
+ */
+class FWI_API FWIScratchArena {
+public:
+	static const std::size_t ALIGNMENT = 64;	///< Of every allocation, a cache line
+
+	/**
+	 * An owning arena, empty until first used.
+	 */
+	FWIScratchArena();
+	/**
+	 * An arena within a caller's buffer, which must outlive it.
+	 * \param buffer The memory handed out
+	 * \param bytes Size of buffer
+	 */
+	FWIScratchArena(void *buffer, std::size_t bytes);
+	virtual ~FWIScratchArena();
+	FWIScratchArena(const FWIScratchArena &) = delete;
+	FWIScratchArena &operator=(const FWIScratchArena &) = delete;
+
+	/**
+	 * Returns the calling thread's owning arena.
+	 */
+	static FWIScratchArena &ThreadLocal();
+
+	bool Owning() const { return m_owning; }
+	/// Bytes handed out and not yet given back
+	std::size_t Used() const { return m_used; }
+	/// The most bytes handed out at once
+	std::size_t HighWater() const { return m_high_water; }
+	/// Bytes of memory the arena holds
+	std::size_t Capacity() const;
+	/// Heap allocations the arena has made
+	std::uint64_t Growths() const { return m_growths; }
+
+	/**
+	 * Grows an owning arena so that allocations totalling bytes, each rounded up to a multiple of ALIGNMENT, can be
+	 * handed out at once without allocating.
+	 * \param bytes Size
+	 *
+	 * \retval E_UNEXPECTED Allocations are outstanding
+	 * \retval E_OUTOFMEMORY Insufficient memory, or a caller's buffer is too small
+	 * \retval S_FALSE The arena was already large enough
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Reserve(std::size_t bytes);
+
+	/**
+	 * Returns space for count values of T, aligned to ALIGNMENT and uninitialized, until the enclosing Frame ends.
+	 * Returns NULL if a caller's buffer is full or memory runs out.
+	 */
+	template <typename T>
+	T *Allocate(std::size_t count) { return static_cast<T *>(allocate(count * sizeof(T))); }
+
+	/**
+	 * Gives back everything allocated from the arena while it's in scope.  Frames nest.
+	 */
+	class Frame {
+	public:
+		explicit Frame(FWIScratchArena &arena) : m_arena(arena), m_chunk(arena.m_chunk), m_offset(arena.m_offset), m_used(arena.m_used) { arena.m_frames++; }
+		~Frame() { m_arena.release(m_chunk, m_offset, m_used); }
+		Frame(const Frame &) = delete;
+		Frame &operator=(const Frame &) = delete;
+
+	private:
+		FWIScratchArena &m_arena;
+		std::size_t m_chunk, m_offset, m_used;
+	};
+
+protected:
+	struct chunk {
+		std::uint8_t *memory;
+		std::size_t bytes;
+	};
+
+	void *allocate(std::size_t bytes);
+	void release(std::size_t chunk, std::size_t offset, std::size_t used);
+	void free_chunks();
+
+	bool m_owning;
+	std::vector<chunk> m_chunks;			// an owning arena moves on to a new chunk rather than move what it's handed out
+	std::size_t m_chunk, m_offset;			// where the next allocation comes from
+	std::size_t m_used, m_high_water;
+	std::uint32_t m_frames;
+	std::uint64_t m_growths;
+};
@@ -0,0 +1,165 @@
+/**
+ * WISE_FWI_Module: FWIShadow.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <vector>
+
+
+/**
+ * The outputs shadow execution compares, each with the inputs its samples record, in order.
+ */
+enum class FWIShadowChannel : std::uint32_t {
+	HOURLY_FFMC_VANWAGNER = 0,		///< HourlyFFMC_VanWagner_Batch(), either form: in_ffmc, rain, temperature, rh, ws
+	HOURLY_FFMC_VANWAGNER_EQUILIBRIUM,	///< HourlyFFMC_VanWagner_Equilibrium_Batch(): in_ffmc, rain, temperature, rh, ws, tolerance
+	HOURLY_FFMC_VANWAGNER_QUANTIZED,	///< HourlyFFMC_VanWagner_Quantized_Batch(): in_ffmc (dequantized), rain, temperature, rh, ws
+	HOURLY_FFMC_VANWAGNER_PREVIOUS,		///< HourlyFFMC_VanWagner_Previous_Batch(): in_ffmc, rain, temperature, rh, ws
+	HOURLY_FFMC_LAWSON,			///< The HourlyFFMC_Lawson batch forms: in_ffmc_prevday, in_ffmc_currday, rh_0, rh, rh_1, contiguous (0 or 1)
+	ISI,					///< ISI_FWI_Batch(): ffmc, ws
+	BUI,					///< BUI_Batch(): dc, dmc
+	FWI,					///< FWI_Batch(), HourlyFWI_UTC_Batch(): isi, bui
+	DAILY_FFMC,				///< DailyCodes_Batch() and FWICalculations: in_ffmc, in_dmc, in_dc, rain, temperature, rh, ws, el, fl
+	DAILY_DMC,
+	DAILY_DC,
+	DAILY_BUI,
+	DAILY_ISI,
+	DAILY_FWI,
+	DAILY_DSR,
+	QUANTIZED_DAILY_FFMC,			///< DailyCodes_Quantized_Batch(), as DAILY_FFMC with the codes dequantized
+	QUANTIZED_DAILY_DMC,
+	QUANTIZED_DAILY_DC,
+	QUANTIZED_DAILY_BUI,
+	QUANTIZED_DAILY_ISI,
+	QUANTIZED_DAILY_FWI,
+	QUANTIZED_DAILY_DSR,
+	COUNT
+};
+
+
+/**
+ * A sampled element, kept because its output was among the furthest from the reference.
+ */
+struct FWIShadowSample {
+	static const std::uint32_t INPUTS = 9;
+
+	FWIShadowChannel channel;
+	std::int64_t seconds;				///< The time step or time of day the element was calculated for, 0 if the channel has none
+	std::uint32_t inputs_count;
+	double inputs[INPUTS];				///< See FWIShadowChannel
+	double output;					///< What the batch path gave
+	double reference;				///< What the scalar calc_* routines give
+	double difference;				///< |output - reference|, infinite if only one of them failed its range checks
+};
+
+
+/**
+ * What shadow execution has found for one channel since it was started.
+ */
+struct FWIShadowStatistics {
+	static const std::uint32_t BUCKETS = 17;
+
+	std::uint64_t samples;				///< Elements recomputed
+	std::uint64_t exceeded;				///< Elements further from the reference than the tolerance, failures included
+	std::uint64_t failures;				///< Elements where only one of the batch path and the reference failed its range checks
+	double max_difference;				///< Largest |output - reference|, failures aside
+	double mean_difference;				///< Mean |output - reference|, failures aside
+	/**
+	 * Counts of |output - reference|, failures aside: bucket 0 is exact agreement, bucket i (1..15) is below 10^(i-15)
+	 * (and at least 10^(i-16), except for bucket 1), and bucket 16 is 1 or more.
+	 */
+	std::uint64_t histogram[BUCKETS];
+	std::vector<FWIShadowSample> worst;		///< The furthest samples, furthest first
+
+	FWIShadowStatistics() : samples(0), exceeded(0), failures(0), max_difference(0.0), mean_difference(0.0), histogram{ } { }
+};
+
+
+/**
+ * Shadow execution, to keep checking the batch paths (the SIMD kernel variants, the equilibrium fast path, the fixed
+ * point forms) against the reference scalar calc_* routines on production data: a fraction of the elements passing
+ * through the CCWFGM_FWI batch methods and FWICalculations is copied off, inputs and outputs, and recomputed on a
+ * background thread, and the differences are gathered per channel (see FWIShadowChannel) into a maximum, a histogram
+ * and the furthest samples with their inputs.
+ *
+ * The calling threads only pay for the elements sampled: which ones is decided by skipping a geometrically
+ * distributed number of elements at a time, so the cost is a few nanoseconds per sample rather than per element.
+ * Samples go through a queue of fixed size, and if the background thread falls behind they're dropped (and counted)
+ * rather than making the callers wait.  While it's off shadowing costs one relaxed load and a branch per batch.
+ *
+ * Shadowing is off unless started, either by Start() or by setting the FWI_SHADOW environment variable to the rate,
+ * which starts it the first time shadowing is touched (the first batch, Start() or Enabled(); FWI_SHADOW_TOLERANCE
+ * sets the tolerance) and, if FWI_SHADOW_REPORT names a file, writes the report there when the library unloads.  A
+ * session still running then is stopped.  While a trace is being recorded (see FWITrace) the background
+ * thread's work shows up in it.
+ */
+class FWI_API FWIShadow {
+public:
+	/// Whether a session is running
+	static bool Enabled();
+
+	/**
+	 * Starts shadowing, discarding the statistics of any previous session.
+	 * \param rate The fraction of elements to sample, (0..1]
+	 * \param tolerance Differences above this are counted as exceeding it
+	 * \param worst How many of the furthest samples to keep per channel
+	 * \param queue Samples that can wait for the background thread before more are dropped
+	 *
+	 * \retval E_INVALIDARG rate, tolerance or queue is out of range
+	 * \retval E_UNEXPECTED A session is already running
+	 * \retval E_OUTOFMEMORY Insufficient memory, or the background thread couldn't be started
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT Start(double rate, double tolerance = 1e-6, std::uint32_t worst = 16, std::uint32_t queue = 65536);
+	/**
+	 * Stops sampling, waits for the samples already taken to be recomputed and stops the background thread.  The
+	 * statistics stay available until the next Start().
+	 *
+	 * \retval S_FALSE No session was running
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT Stop();
+	/**
+	 * Waits until every sample taken so far has been recomputed, so that the statistics cover them.
+	 */
+	static void Drain();
+
+	/**
+	 * \param channel Channel to report
+	 * \param stats Receives the channel's statistics
+	 *
+	 * \retval E_POINTER stats is invalid
+	 * \retval E_INVALIDARG channel is out of range
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT Statistics(FWIShadowChannel channel, FWIShadowStatistics *stats);
+	/// Samples dropped because the queue was full
+	static std::uint64_t Dropped();
+	static const char *ChannelName(FWIShadowChannel channel);
+	/**
+	 * Writes every channel with samples, and their furthest samples, as JSON.
+	 *
+	 * \retval E_POINTER filename is invalid
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL The file couldn't be written
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT Write(const char *filename);
+};
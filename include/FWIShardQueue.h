@@ -0,0 +1,103 @@
+/**
+ * WISE_FWI_Module: FWIShardQueue.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <memory>
+
+
+class fwi_shared_region;
+struct fwi_shard_control;
+
+
+/**
+ * Hands out the tiles of a grid to several worker processes running FWIGridEngine over the same files, through named
+ * shared memory.  Tiles are given out one at a time to whichever worker asks next, rather than split up front, so a
+ * worker that draws slow tiles (e.g. rainy ones, which take the longer branches of the codes) simply runs fewer of
+ * them.  Each tile is written by exactly one worker, straight into the shared outputs, so there's nothing to merge.
+ *
+ * The launcher creates the queue and each worker opens it by name with its own worker index.
+ */
+class FWI_API FWIShardQueue {
+public:
+	FWIShardQueue();
+	virtual ~FWIShardQueue();
+	FWIShardQueue(const FWIShardQueue &) = delete;
+	FWIShardQueue &operator=(const FWIShardQueue &) = delete;
+
+	/**
+	 * Creates (or replaces) a queue.
+	 * \param name A POSIX shared memory name, starting with '/' (on Windows, a file mapping object name)
+	 * \param tiles Number of tiles in the grid
+	 * \param workers Number of worker processes
+	 *
+	 * \retval E_POINTER name is invalid
+	 * \retval E_INVALIDARG tiles or workers is 0
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL The shared memory can't be created
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Create(const char *name, std::uint32_t tiles, std::uint32_t workers);
+	/**
+	 * Opens a queue created by another process.
+	 * \param name The name given to Create()
+	 * \param worker This worker's index, [0..Workers())
+	 *
+	 * \retval E_POINTER name is invalid
+	 * \retval E_INVALIDARG The memory isn't a queue, or worker is out of range
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL The shared memory can't be opened
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Open(const char *name, std::uint32_t worker);
+	void Close();
+	/**
+	 * Removes the name of a queue, releasing the memory once every process has closed it.
+	 */
+	static NO_THROW HRESULT Unlink(const char *name);
+
+	bool IsOpen() const { return m_control != nullptr; }
+	std::uint32_t Tiles() const;
+	std::uint32_t Workers() const;
+
+	/**
+	 * Takes the next tile to run.
+	 * \param tile Receives the tile index
+	 * \retval false Every tile has been handed out
+	 */
+	bool Claim(std::uint32_t *tile);
+	/**
+	 * Records that a tile claimed by this process has been run and its outputs written.
+	 */
+	void Complete(std::uint32_t tile);
+	/**
+	 * Returns the number of tiles completed by all workers.
+	 */
+	std::uint32_t Completed() const;
+	/**
+	 * Returns the number of tiles a worker has claimed.
+	 */
+	std::uint32_t Claimed(std::uint32_t worker) const;
+
+protected:
+	std::unique_ptr<fwi_shared_region> m_region;
+	fwi_shard_control *m_control;
+	std::uint32_t m_worker;
+};
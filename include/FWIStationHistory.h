@@ -0,0 +1,198 @@
+/**
+ * WISE_FWI_Module: FWIStationHistory.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+
+static const std::uint8_t FWI_HISTORY_HOURLY_CODES = 3;	///< Hourly FFMC, ISI and FWI, as in FWIGridFiles::hourly
+static const std::uint8_t FWI_HISTORY_HOURLY_VALUES = 24 * FWI_HISTORY_HOURLY_CODES;
+
+
+/**
+ * A history of the daily (and optionally hourly) codes of a set of stations, for date range queries.
+ *
+ * Each station's days are appended in date order and encoded into blocks of consecutive days: every value in the 16
+ * bit form of FWIQuantized, stored as the zigzag varint of its difference from the previous day's value of the same
+ * code (for the hourly codes, the previous hour's).  Codes change slowly from day to day and hour to hour, so most
+ * values take one or two bytes.  A block ends when it reaches the file's block size or a station skips a day, and is
+ * written as soon as it ends, so a writer holds at most one block per station in memory.
+ *
+ *	header | blocks, in the order they were completed | index: each station's blocks in date order
+ *
+ * The index is written by Close() and held in memory, so finding the blocks covering a date range is a binary search
+ * and a query reads and decodes only those blocks.  Days are numbered as by DayNumber().  Read() may be called from
+ * several threads at once.
+ */
+class FWI_API FWIStationHistory {
+public:
+	static const std::uint32_t DEFAULT_BLOCK_BYTES = 4096;
+
+	FWIStationHistory();
+	virtual ~FWIStationHistory();
+	FWIStationHistory(const FWIStationHistory &) = delete;
+	FWIStationHistory &operator=(const FWIStationHistory &) = delete;
+
+	/**
+	 * Returns the number of days from 1970-01-01 to a date in the proleptic Gregorian calendar.
+	 * \param year Year
+	 * \param month Origin 1
+	 * \param day Origin 1
+	 */
+	static std::int32_t DayNumber(std::int32_t year, std::uint32_t month, std::uint32_t day);
+
+	bool IsOpen() const { return m_file.is_open(); }
+	bool Writable() const { return m_writable; }
+	bool Hourly() const { return m_hourly; }
+	std::uint32_t Stations() const { return m_stations; }
+	/**
+	 * Returns the bytes of blocks written so far (or in the file, if opened).
+	 */
+	std::uint64_t BlockBytes() const;
+	/**
+	 * Returns the number of station-days written so far (or in the file, if opened).
+	 */
+	std::uint64_t StationDays() const;
+	/**
+	 * Returns the first and last day stored for a station.
+	 * \param station Station index
+	 * \param first_day, last_day Receive the days
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_UNEXPECTED The file isn't open
+	 * \retval E_INVALIDARG station is out of range
+	 * \retval S_FALSE Nothing is stored for the station
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Span(std::uint32_t station, std::int32_t *first_day, std::int32_t *last_day) const;
+
+	/**
+	 * Creates (or replaces) a file, opened for writing.
+	 * \param filename Path of the file
+	 * \param stations Number of stations
+	 * \param hourly Whether the hourly codes are stored too
+	 * \param block_bytes Size a block is ended at
+	 *
+	 * \retval E_POINTER filename is invalid
+	 * \retval E_INVALIDARG stations or block_bytes is 0
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL The file can't be created
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Create(const char *filename, std::uint32_t stations, bool hourly, std::uint32_t block_bytes = DEFAULT_BLOCK_BYTES);
+	/**
+	 * Opens an existing, closed, file for reading.
+	 * \param filename Path of the file
+	 *
+	 * \retval E_POINTER filename is invalid
+	 * \retval E_INVALIDARG The file isn't a station history
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL The file can't be opened or read
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Open(const char *filename);
+	/**
+	 * Closes the file, first writing every station's last block and the index if it was created.
+	 *
+	 * \retval E_FAIL The blocks or index couldn't be written
+	 * \retval S_OK Successful, or the file wasn't open
+	 */
+	virtual NO_THROW HRESULT Close();
+	/**
+	 * Appends one day of codes for a set of stations.  Each station's days must be appended in increasing order.
+	 * \param day Day number, see DayNumber()
+	 * \param count Number of stations
+	 * \param stations Station index of each value, array of length count, or NULL for stations [0..count)
+	 * \param daily The daily codes in the 16 bit form of FWIQuantized, FWI_CODE_COUNT arrays of length count one after
+	 *		another, in FWICode order
+	 * \param hourly The hourly codes, FWI_HISTORY_HOURLY_VALUES arrays of length count one after another, hour by hour
+	 *		and within each hour the FFMC, ISI and FWI.  Ignored unless the file stores hourly codes.
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_UNEXPECTED The file isn't open for writing
+	 * \retval E_INVALIDARG A station is out of range or given twice, or day isn't after the station's last day
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL A block couldn't be written
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Append(std::int32_t day, std::uint32_t count, const std::uint32_t *stations, const std::uint16_t *daily, const std::uint16_t *hourly);
+	/**
+	 * Writes the block every station is part way through, so that Read() sees everything appended so far.
+	 *
+	 * \retval E_UNEXPECTED The file isn't open for writing
+	 * \retval E_FAIL A block couldn't be written
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Flush();
+	/**
+	 * Decodes a station's codes for a range of days.  Days that aren't stored are FWIQuantized::MISSING.
+	 * \param station Station index
+	 * \param first_day, last_day Inclusive range of day numbers
+	 * \param daily Receives the daily codes, FWI_CODE_COUNT values per day in FWICode order, array of length
+	 *		FWI_CODE_COUNT * (last_day - first_day + 1).  May be NULL.
+	 * \param hourly Receives the hourly codes, FWI_HISTORY_HOURLY_VALUES per day laid out as for Append(), array of
+	 *		length FWI_HISTORY_HOURLY_VALUES * (last_day - first_day + 1).  May be NULL, must be if the file doesn't
+	 *		store hourly codes.
+	 * \param days Receives the number of days in the range that are stored, may be NULL
+	 *
+	 * \retval E_UNEXPECTED The file isn't open
+	 * \retval E_INVALIDARG station is out of range, last_day is before first_day, or hourly codes were asked for and
+	 *		aren't stored
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL A block couldn't be read or is corrupt
+	 * \retval S_FALSE None of the days are stored
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Read(std::uint32_t station, std::int32_t first_day, std::int32_t last_day, std::uint16_t *daily, std::uint16_t *hourly, std::uint32_t *days = nullptr) const;
+
+protected:
+	struct block_entry {
+		std::int32_t first_day;
+		std::uint32_t days;
+		std::uint64_t offset;
+		std::uint32_t bytes;
+		std::uint32_t reserved;
+	};
+
+	// the block a station is part way through
+	struct station_block {
+		std::int32_t first_day;
+		std::uint32_t days;
+		std::uint32_t append;			// the Append() call that last listed the station, to find it listed twice
+		std::vector<std::uint8_t> bytes;
+	};
+
+	std::uint32_t values() const { return FWI_CODE_COUNT + (m_hourly ? FWI_HISTORY_HOURLY_VALUES : 0); }
+	bool write_block(std::uint32_t station);
+
+	mutable std::mutex m_lock;			// the file position is shared
+	mutable std::fstream m_file;
+	bool m_writable, m_hourly;
+	std::uint32_t m_stations, m_block_bytes;
+	std::uint64_t m_end;				// where the next block goes
+	std::uint64_t m_station_days;
+	std::uint32_t m_appends;			// Append() calls with a stations list
+	std::vector<std::vector<block_entry>> m_index;	// [station], in date order
+	std::vector<station_block> m_pending;		// [station], while writing
+	std::vector<std::uint16_t> m_previous;		// [station][value], what the next day is encoded against
+};
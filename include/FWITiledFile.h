@@ -0,0 +1,152 @@
+/**
+ * WISE_FWI_Module: FWITiledFile.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <cstddef>
+
+
+/**
+ * A grid of cells stored on disk a tile at a time, for grids too large to hold in memory.  The file holds a number of
+ * layers (e.g. a weather variable for one day, or one code) of fixed size elements for every cell.  Cells are grouped
+ * into tiles of tile_cells consecutive cells, and all of a tile's layers are stored together, layer by layer:
+ *
+ *	header (4096 bytes) | tile 0: layer 0 [tile_cells], layer 1 [tile_cells], ... | tile 1: ... |
+ *
+ * so that everything needed to process one tile is one contiguous range of the file, which FWIGridEngine memory maps.
+ * The last tile is padded to a full tile.  Values are stored in the native byte order.
+ */
+class FWI_API FWITiledFile {
+public:
+	FWITiledFile();
+	virtual ~FWITiledFile();
+	FWITiledFile(const FWITiledFile &) = delete;
+	FWITiledFile &operator=(const FWITiledFile &) = delete;
+
+	bool IsOpen() const;
+	bool Writable() const { return m_writable; }
+	std::uint32_t Cells() const { return m_cells; }
+	std::uint32_t TileCells() const { return m_tile_cells; }
+	std::uint32_t Tiles() const { return m_tile_cells ? (std::uint32_t)(((std::uint64_t)m_cells + m_tile_cells - 1) / m_tile_cells) : 0; }
+	std::uint32_t Layers() const { return m_layers; }
+	std::uint32_t ElementSize() const { return m_element_size; }
+	/**
+	 * Returns the number of cells in a tile: TileCells(), except for the last tile.
+	 */
+	std::uint32_t TileCount(std::uint32_t tile) const;
+	/**
+	 * Returns the size of one layer of one tile, in bytes.
+	 */
+	std::uint64_t LayerBytes() const { return (std::uint64_t)m_tile_cells * m_element_size; }
+	/**
+	 * Returns the offset of a layer of a tile from the start of the file, in bytes.
+	 */
+	std::uint64_t Offset(std::uint32_t tile, std::uint32_t layer) const;
+
+	/**
+	 * Creates (or replaces) a file, opened for reading and writing, with every value zero.
+	 * \param filename Path of the file
+	 * \param cells Number of cells
+	 * \param tile_cells Number of cells per tile
+	 * \param layers Number of layers
+	 * \param element_size Size of each value, bytes (e.g. 8 for doubles, 2 for FWIQuantized values)
+	 *
+	 * \retval E_POINTER filename is invalid
+	 * \retval E_INVALIDARG cells, tile_cells, layers or element_size is 0
+	 * \retval E_FAIL The file can't be created
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Create(const char *filename, std::uint32_t cells, std::uint32_t tile_cells, std::uint32_t layers, std::uint32_t element_size);
+	/**
+	 * Opens an existing file.
+	 * \param filename Path of the file
+	 * \param writable Open for writing as well as reading
+	 *
+	 * \retval E_POINTER filename is invalid
+	 * \retval E_INVALIDARG The file isn't a tiled file, or is truncated
+	 * \retval E_FAIL The file can't be opened
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Open(const char *filename, bool writable);
+	/**
+	 * As Create(), in named shared memory rather than a file, so that several processes can map the same grid and
+	 * see each other's writes.  The memory persists until UnlinkShared() is called (on Windows, until the last process
+	 * with it open closes it).
+	 * \param name A POSIX shared memory name, starting with '/' (on Windows, a file mapping object name)
+	 *
+	 * \retval E_POINTER name is invalid
+	 * \retval E_INVALIDARG cells, tile_cells, layers or element_size is 0
+	 * \retval E_FAIL The shared memory can't be created
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT CreateShared(const char *name, std::uint32_t cells, std::uint32_t tile_cells, std::uint32_t layers, std::uint32_t element_size);
+	/**
+	 * As Open(), for a grid created by CreateShared().
+	 */
+	virtual NO_THROW HRESULT OpenShared(const char *name, bool writable);
+	/**
+	 * Removes the name of a grid created by CreateShared(), releasing the memory once every process has closed it.
+	 * \retval E_POINTER name is invalid
+	 * \retval E_FAIL There's no such shared memory
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT UnlinkShared(const char *name);
+	void Close();
+
+	/**
+	 * Reads one layer of one tile, TileCount(tile) values.
+	 * \param tile Tile index
+	 * \param layer Layer index
+	 * \param values Receives the values, TileCount(tile) * ElementSize() bytes
+	 *
+	 * \retval E_POINTER values is invalid
+	 * \retval E_INVALIDARG tile or layer is out of range
+	 * \retval E_UNEXPECTED The file isn't open
+	 * \retval E_FAIL The read failed
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Read(std::uint32_t tile, std::uint32_t layer, void *values) const;
+	/**
+	 * Writes one layer of one tile, TileCount(tile) values.
+	 * \param tile Tile index
+	 * \param layer Layer index
+	 * \param values The values, TileCount(tile) * ElementSize() bytes
+	 *
+	 * \retval E_POINTER values is invalid
+	 * \retval E_INVALIDARG tile or layer is out of range
+	 * \retval E_UNEXPECTED The file isn't open for writing
+	 * \retval E_FAIL The write failed
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Write(std::uint32_t tile, std::uint32_t layer, const void *values);
+
+protected:
+	friend class fwi_mapping;
+
+	HRESULT create(std::uint32_t cells, std::uint32_t tile_cells, std::uint32_t layers, std::uint32_t element_size);
+	bool read_header();
+	bool read_bytes(std::uint64_t offset, void *buffer, std::size_t bytes) const;
+	bool write_bytes(std::uint64_t offset, const void *buffer, std::size_t bytes);
+
+	std::intptr_t m_file;				// file (or shared memory) descriptor, or file HANDLE on Windows
+	std::intptr_t m_mapping;			// file mapping HANDLE on Windows (the only handle for shared memory), unused elsewhere
+	bool m_writable;
+	std::uint32_t m_cells, m_tile_cells, m_layers, m_element_size;
+};
@@ -0,0 +1,103 @@
+/**
+ * WISE_FWI_Module: FWITrace.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <atomic>
+
+
+struct trace_thread;
+
+
+/**
+ * Records where the batch and grid paths spend their time, as spans (see FWITraceSpan) per thread, written out as a
+ * Chrome trace-event JSON file for chrome://tracing or Perfetto.  On Linux each span can also carry the cycles,
+ * instructions and last level cache misses its thread spent in it, read from perf_event_open() counters; where the
+ * counters can't be opened (e.g. perf_event_paranoid forbids it) the spans are recorded without them.
+ *
+ * Tracing is off unless started, either by Start() or by setting the FWI_TRACE environment variable to the file to
+ * write, which starts it when the library loads and writes the file when it unloads (FWI_TRACE_COUNTERS=1 adds the
+ * counters).  While it's off a span costs one relaxed load and a branch.
+ */
+class FWI_API FWITrace {
+public:
+	static bool Enabled() { return s_enabled.load(std::memory_order_relaxed); }
+	/**
+	 * Returns whether the calling thread's spans in the current session carry hardware counters, which shows whether
+	 * perf allows them.
+	 */
+	static bool Counters();
+
+	/**
+	 * Starts recording, discarding anything recorded since the last Stop().
+	 * \param filename Path of the file Stop() writes
+	 * \param counters Whether to read the hardware counters at the ends of each span
+	 *
+	 * \retval E_POINTER filename is invalid
+	 * \retval E_UNEXPECTED A session is already running
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT Start(const char *filename, bool counters);
+	/**
+	 * Stops recording and writes the spans recorded.  Spans still open are dropped, so call it once the traced work is
+	 * done.
+	 *
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval E_FAIL The file couldn't be written
+	 * \retval S_FALSE No session was running
+	 * \retval S_OK Successful
+	 */
+	static NO_THROW HRESULT Stop();
+	/**
+	 * Names the calling thread in the trace, if a session is running.
+	 * \param name Must outlive the session, normally a string literal
+	 */
+	static void NameThread(const char *name);
+
+private:
+	static std::atomic<bool> s_enabled;
+};
+
+
+/**
+ * Records the time (and counters) from its construction to its destruction on the calling thread, under a name that
+ * must outlive the session, normally a string literal.  An optional argument (a tile, a day) is shown with the span.
+ */
+class FWI_API FWITraceSpan {
+public:
+	explicit FWITraceSpan(const char *name) : m_name(nullptr) { if (FWITrace::Enabled()) begin(name, nullptr, 0); }
+	FWITraceSpan(const char *name, const char *arg_name, std::int64_t arg) : m_name(nullptr) { if (FWITrace::Enabled()) begin(name, arg_name, arg); }
+	~FWITraceSpan() { if (m_name) end(); }
+	FWITraceSpan(const FWITraceSpan &) = delete;
+	FWITraceSpan &operator=(const FWITraceSpan &) = delete;
+
+private:
+	void begin(const char *name, const char *arg_name, std::int64_t arg);
+	void end();
+
+	const char *m_name;
+	trace_thread *m_thread;
+	const char *m_arg_name;
+	std::int64_t m_arg;
+	std::uint32_t m_session;
+	std::uint64_t m_start;
+	std::uint64_t m_counters[3];
+};
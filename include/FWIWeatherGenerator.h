@@ -0,0 +1,146 @@
+/**
+ * WISE_FWI_Module: FWIWeatherGenerator.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <vector>
+
+
+/**
+ * Named climate regimes with built-in parameter sets.
+ */
+enum class FWIClimate : std::uint8_t {
+	BOREAL,			///< Northern boreal forest, 54-62N.  Short season, frequent light rain.
+	PRAIRIE,		///< Northern grassland, 49-54N.  Long, dry, windy season with convective rain.
+	SOUTHERN_HEMISPHERE	///< Temperate southern hemisphere, 35-45S (exercises the EL_NZ/FL_NZ tables).  Season spans the new year.
+};
+
+
+/**
+ * Parameters of a synthetic climate.  Days of year are origin 0 and a 365 day year is assumed.
+ */
+struct FWIClimateRegime {
+	double latitude_min, latitude_max;		///< Degrees, cells are spread uniformly over this band
+	double longitude_min, longitude_max;		///< Degrees
+	std::uint16_t season_start;			///< Day of year the season starts on
+	std::uint16_t season_length;			///< Days, may run past the end of the year
+	double temp_mean;				///< Seasonal mean of the daily mean temperature, Celsius
+	double temp_amplitude;				///< Half the annual swing in the daily mean temperature, Celsius
+	std::uint16_t temp_peak;			///< Day of year of the warmest daily mean temperature
+	double temp_sd;					///< Standard deviation of the daily temperature anomaly, Celsius
+	double temp_persistence;			///< Lag 1 autocorrelation of the daily temperature anomaly
+	double diurnal_range;				///< Mean daily maximum minus minimum temperature, Celsius
+	double dewpoint_depression;			///< Mean afternoon dewpoint depression on dry days, Celsius
+	double dewpoint_sd;				///< Standard deviation of the dewpoint depression, Celsius
+	double wind_mean;				///< Mean noon wind speed, kph
+	double wind_sd;					///< Standard deviation of the noon wind speed, kph
+	double p_wet_after_dry;				///< Probability of a rain day following a dry day
+	double p_wet_after_wet;				///< Probability of a rain day following a rain day (rain clustering)
+	double rain_mean;				///< Mean rain amount on a rain day, mm
+
+	/**
+	 * Returns the built-in parameters for a named regime.
+	 */
+	static FWI_API FWIClimateRegime Regime(FWIClimate climate);
+};
+
+
+/**
+ * The current day's noon (LST) observations and daily extremes, one value per cell.
+ */
+struct FWIGeneratedDay {
+	std::uint16_t day_of_year;			///< Origin 0
+	std::uint16_t month;				///< Origin 0 (January = 0, December = 11)
+	const double *temperature;			///< Noon LST, Celsius
+	const double *rh;				///< Noon LST, fraction ([0..1])
+	const double *ws;				///< Noon LST, kph
+	const double *rain;				///< Noon to noon LST, mm
+	const double *min_temperature;			///< Celsius
+	const double *max_temperature;			///< Celsius
+};
+
+
+/**
+ * Reproducible synthetic weather for benchmarking and validation.  Each cell has its own random stream, derived from
+ * the seed and the cell index, so the weather for a given seed, regime and cell is identical regardless of how many
+ * cells are generated or in what order they are consumed.  All arithmetic uses its own generator rather than the
+ * std:: distributions, whose output is implementation defined, so the weather is the same across platforms; in the
+ * reproducible kernel mode its elementary functions are pinned as well, so it is bit for bit the same.
+ *
+ * Rain days follow a two state Markov chain (so wet spells cluster), amounts are exponentially distributed and fall
+ * in a single event of a few hours.  Temperature follows an annual cycle plus an AR(1) anomaly, RH is derived from a
+ * daily dewpoint so that it follows the diurnal temperature curve, and wind peaks in mid afternoon.
+ */
+class FWI_API FWIWeatherGenerator {
+public:
+	FWIWeatherGenerator(std::uint64_t seed, const FWIClimateRegime &regime, std::uint32_t cells);
+	virtual ~FWIWeatherGenerator() = default;
+
+	std::uint32_t Cells() const { return m_cells; }
+
+	/**
+	 * Retrieves the location of every cell, in radians.
+	 * \param latitude Array of length Cells()
+	 * \param longitude Array of length Cells(), may be NULL
+	 *
+	 * \retval E_POINTER latitude is invalid
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Location(double *latitude, double *longitude) const;
+	/**
+	 * Advances every cell to the next day of the season.  The first call generates the first day of the season.
+	 * \param day Receives the day's noon observations, the arrays remain valid until the next call to NextDay()
+	 *
+	 * \retval E_POINTER day is invalid
+	 * \retval S_OK Successful
+	 * \retval S_FALSE The day generated is past the end of the regime's season (the generator continues regardless)
+	 */
+	virtual NO_THROW HRESULT NextDay(FWIGeneratedDay *day);
+	/**
+	 * Calculates the weather for an hour of the current day (local standard time) for every cell.  Temperature, RH and wind are instantaneous values at hour:00, rain is the amount that fell in the hour ending at hour:00.
+	 * \param hour 0..23
+	 * \param temperature Celsius, array of length Cells()
+	 * \param rh Fraction ([0..1]), array of length Cells()
+	 * \param ws kph, array of length Cells()
+	 * \param rain mm in the hour, array of length Cells()
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG hour is greater than 23
+	 * \retval E_UNEXPECTED NextDay() hasn't been called
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Hourly(std::uint16_t hour, double *temperature, double *rh, double *ws, double *rain) const;
+
+protected:
+	FWIClimateRegime m_regime;
+	std::uint32_t m_cells;
+	std::int32_t m_day;				// days into the season, -1 before the first call to NextDay()
+
+	std::vector<std::uint64_t> m_rng;		// per-cell generator state
+	std::vector<double> m_latitude, m_longitude;
+	std::vector<double> m_temp_anomaly;
+	std::vector<std::uint8_t> m_wet;
+
+	// today's weather, per cell
+	std::vector<double> m_mean_temp, m_dewpoint, m_wind;
+	std::vector<std::uint8_t> m_rain_start, m_rain_hours;
+	std::vector<double> m_rain_rate, m_carry_rain;	// carry_rain is yesterday's rain after noon
+	std::vector<double> m_noon_temp, m_noon_rh, m_noon_ws, m_noon_rain, m_min_temp, m_max_temp;
+};
@@ -0,0 +1,77 @@
+/**
+ * WISE_FWI_Module: FWIWeatherIntermediates.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "CWFGM_FWI.h"
+
+#include <vector>
+
+
+/**
+ * The weather-derived parts of the Van Wagner FFMC for a set of weather records: the equilibrium moisture contents
+ * (ed, ew), the log drying and wetting rates and the temperature term exp(0.0365 * T).  These account for most of the
+ * transcendental math in the FFMC, and depend only on the temperature, RH and wind speed, so they can be calculated
+ * once per record and shared by every model run over the same weather - the hourly and daily FFMC, and in particular
+ * the previous hour back-cast, which otherwise recalculates them on every iteration.
+ *
+ * The results are identical to calculating each code directly from the weather.
+ */
+class FWI_API FWIWeatherIntermediates {
+public:
+	FWIWeatherIntermediates() : m_count(0) { }
+	virtual ~FWIWeatherIntermediates() = default;
+
+	/**
+	 * Number of weather records held.
+	 */
+	std::uint32_t Count() const { return m_count; }
+	/**
+	 * Drying equilibrium moisture content of every record, Count() values.
+	 */
+	const double *EquilibriumDrying() const { return m_values.data(); }
+	/**
+	 * Wetting equilibrium moisture content of every record, Count() values.
+	 */
+	const double *EquilibriumWetting() const { return m_values.data() + m_count; }
+	/**
+	 * The weather the intermediates were calculated from, Count() values each, kept so that shadow execution (see
+	 * FWIShadow) can check the FFMC calculated from them against the scalar routines.
+	 */
+	const double *Temperature() const { return m_values.data() + 6 * (std::size_t)m_count; }
+	const double *RH() const { return m_values.data() + 7 * (std::size_t)m_count; }
+	const double *WS() const { return m_values.data() + 8 * (std::size_t)m_count; }
+
+	/**
+	 * Calculates the intermediates for a set of weather records, replacing any held.
+	 * \param count Number of records
+	 * \param temperature Celsius, array of length count
+	 * \param rh Relative humidity expressed as a fraction ([0..1]), array of length count
+	 * \param ws Wind speed (kph), array of length count
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Calculate(std::uint32_t count, const double *temperature, const double *rh, const double *ws);
+
+protected:
+	std::uint32_t m_count;
+	std::vector<double> m_values;		// ed, ew, k_dry, k_wet, k_wet_daily, temp_factor (see fwi_ffmc_weather), then the
+						// temperature, rh and ws, each m_count long
+};
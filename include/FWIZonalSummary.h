@@ -0,0 +1,142 @@
+/**
+ * WISE_FWI_Module: FWIZonalSummary.h
+ * Copyright (C) 2023  WISE
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "FWIQuantileSketch.h"
+#include "FWIQuantized.h"
+
+#include <vector>
+
+
+static const std::uint8_t FWI_ZONAL_CODE_COUNT = 3;		///< ISI, BUI and FWI, see FWIZonalSummary::CodeIndex()
+static const std::uint8_t FWI_ZONAL_THRESHOLD_COUNT = 4;	///< Class breaks per code, giving five danger classes
+
+
+/**
+ * What to collect in an FWIZonalSummary.
+ */
+struct FWIZonalSettings {
+	std::uint32_t zones;				///< Zone ids are [0..zones), cells with any other id (e.g. 0xffffffff for no data) belong to no zone.  0 collects nothing.
+	bool percentiles;				///< Also collect a quantile sketch per zone, day and code, for the percentiles.  Takes memory in proportion to the spread of each zone's values.
+	double relative_accuracy;			///< Of the percentiles, see FWIQuantileSketch
+	double thresholds[FWI_ZONAL_CODE_COUNT][FWI_ZONAL_THRESHOLD_COUNT];	///< Ascending class breaks of the ISI, BUI and FWI; the cells at or above each are counted
+
+	FWIZonalSettings() : zones(0), percentiles(false), relative_accuracy(0.01),
+		thresholds{ { 2.0, 5.0, 10.0, 15.0 }, { 20.0, 40.0, 60.0, 90.0 }, { 5.0, 10.0, 20.0, 30.0 } } { }
+};
+
+
+/**
+ * One code's statistics over the cells of one zone on one day.  Sums and maximums are kept in the fixed point units of
+ * FWIQuantized, so that they're exact.
+ */
+struct FWIZoneStatistics {
+	std::uint64_t cells;				///< Cells with a value
+	std::uint64_t missing;				///< Cells without one: masked, out of season or failing their range checks
+	std::uint64_t sum;				///< Of the values, fixed point
+	std::uint16_t maximum;				///< Fixed point, 0 if there are no cells
+	std::uint64_t above[FWI_ZONAL_THRESHOLD_COUNT];	///< Cells at or above each threshold.  Multiply by the cell area for the area above the threshold.
+	FWIQuantileSketch sketch;			///< Every value, if percentiles are collected
+
+	explicit FWIZoneStatistics(double relative_accuracy = 0.01) : cells(0), missing(0), sum(0), maximum(0), above{ 0, 0, 0, 0 }, sketch(relative_accuracy) { }
+
+	double Mean(FWICode code) const { return cells ? (double)sum / (double)cells / FWIQuantized::Units(code) : 0.0; }
+	double Maximum(FWICode code) const { return (double)maximum / FWIQuantized::Units(code); }
+};
+
+
+/**
+ * Statistics of the ISI, BUI and FWI over zones (fire zones, regions, districts...) for each day of a gridded run,
+ * accumulated from the 16 bit codes as they're produced: the number of cells, mean, maximum, number of cells at or
+ * above each class break and, optionally, percentiles.  A grid can have several zonings at once, each assigning every
+ * cell to at most one of its zones.
+ *
+ * Everything is accumulated exactly: integer counts and sums of the fixed point codes, and quantile sketches that
+ * merge exactly.  So summaries collected separately, e.g. per thread or per process, and merged in any order are
+ * identical, bit for bit, to one collected in a single pass, and a run's summary doesn't depend on how many threads
+ * produced it.
+ */
+class FWI_API FWIZonalSummary {
+public:
+	FWIZonalSummary() : m_zonings(0), m_days(0) { }
+	virtual ~FWIZonalSummary() = default;
+
+	/**
+	 * Returns the summary's index of a code, or -1 if the code isn't summarized.
+	 */
+	static int CodeIndex(FWICode code) {
+		return (code == FWICode::ISI) ? 0 : (code == FWICode::BUI) ? 1 : (code == FWICode::FWI) ? 2 : -1;
+	}
+
+	const FWIZonalSettings &Settings() const { return m_settings; }
+	std::uint32_t Zonings() const { return m_zonings; }
+	std::uint32_t Zones() const { return m_settings.zones; }
+	std::uint16_t Days() const { return m_days; }
+
+	/**
+	 * Sets up an empty summary, discarding anything collected.
+	 * \param settings What to collect
+	 * \param zonings Number of zonings
+	 * \param days Number of days
+	 *
+	 * \retval E_INVALIDARG A set of thresholds isn't ascending
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Initialize(const FWIZonalSettings &settings, std::uint32_t zonings, std::uint16_t days);
+	/**
+	 * Adds one day of a code for a set of cells.
+	 * \param zoning Zoning the ids are from
+	 * \param day Origin 0, into the run
+	 * \param code FWICode::ISI, FWICode::BUI or FWICode::FWI
+	 * \param count Number of cells
+	 * \param zones Zone id of each cell, array of length count
+	 * \param values Each cell's code in the 16 bit form of FWIQuantized, array of length count
+	 *
+	 * \retval E_POINTER An address provided is invalid
+	 * \retval E_INVALIDARG zoning, day or code is out of range
+	 * \retval E_OUTOFMEMORY Insufficient memory (for the percentiles)
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Add(std::uint32_t zoning, std::uint16_t day, FWICode code, std::uint32_t count, const std::uint32_t *zones, const std::uint16_t *values);
+	/**
+	 * Adds everything collected in another summary of the same shape to this one.
+	 * \param other Summary to merge
+	 *
+	 * \retval E_INVALIDARG other has different settings, zonings or days
+	 * \retval E_OUTOFMEMORY Insufficient memory
+	 * \retval S_OK Successful
+	 */
+	virtual NO_THROW HRESULT Merge(const FWIZonalSummary &other);
+	/**
+	 * Returns the statistics of a code for one zone and day, or NULL if any argument is out of range.
+	 */
+	const FWIZoneStatistics *Statistics(std::uint32_t zoning, std::uint32_t zone, std::uint16_t day, FWICode code) const;
+
+protected:
+	std::size_t index(std::uint32_t zoning, std::uint32_t zone, std::uint16_t day, int code) const {
+		return (((std::size_t)zoning * m_days + day) * m_settings.zones + zone) * FWI_ZONAL_CODE_COUNT + code;
+	}
+
+	FWIZonalSettings m_settings;
+	std::uint32_t m_zonings;
+	std::uint16_t m_days;
+	std::uint16_t m_thresholds[FWI_ZONAL_CODE_COUNT][FWI_ZONAL_THRESHOLD_COUNT];	// fixed point
+	std::vector<FWIZoneStatistics> m_statistics;	// [zoning][day][zone][code]
+};